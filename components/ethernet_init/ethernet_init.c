@@ -60,6 +60,8 @@ static esp_eth_handle_t eth_init_internal(esp_eth_mac_t **mac_out, esp_eth_phy_t
     // Init common MAC and PHY configs to default
     eth_mac_config_t mac_config = ETH_MAC_DEFAULT_CONFIG();
     eth_phy_config_t phy_config = ETH_PHY_DEFAULT_CONFIG();
+    // Pin the MAC receive task to the core calling eth_init, the application calls it from the network core
+    mac_config.flags |= ETH_MAC_FLAG_PIN_TO_CORE;
 
     // Update PHY config based on board specific configuration
     phy_config.phy_addr = CONFIG_EXAMPLE_ETH_PHY_ADDR;
@@ -0,0 +1,19 @@
+/* Checks of the host tests, a failed check is reported and the test goes on */
+#pragma once
+#include <stdio.h>
+
+static int host_test_failures;
+
+#define CHECK(cond)     do { \
+                            if (!(cond)) { \
+                                printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+                                host_test_failures++; \
+                            } \
+                        } while (0)
+
+// Exit code of a test, 0 once every check passed
+static inline int host_test_result(const char *name)
+{
+    printf("%s: %s\n", name, host_test_failures ? "FAILED" : "passed");
+    return host_test_failures ? 1 : 0;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+typedef struct gptimer_t *gptimer_handle_t;
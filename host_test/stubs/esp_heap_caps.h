@@ -0,0 +1,10 @@
+#pragma once
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT             (1 << 2)
+#define MALLOC_CAP_INTERNAL         (1 << 11)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
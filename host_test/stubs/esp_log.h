@@ -0,0 +1,31 @@
+/* Logging of the host tests, the messages are checked for their format arguments and dropped */
+#pragma once
+#include <stdio.h>
+#include "esp_err.h"
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL             ESP_LOG_INFO
+#endif
+
+static inline void __attribute__((format(printf, 2, 3))) esp_log_host(const char *tag, const char *format, ...)
+{
+    (void)tag;
+    (void)format;
+}
+
+#define ESP_LOGE(tag, format, ...)          esp_log_host(tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)          esp_log_host(tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)          esp_log_host(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)          esp_log_host(tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...)          esp_log_host(tag, format, ##__VA_ARGS__)
+#define ESP_EARLY_LOGD(tag, format, ...)    esp_log_host(tag, format, ##__VA_ARGS__)
+#define ESP_LOG_LEVEL_LOCAL(level, tag, format, ...)    esp_log_host(tag, format, ##__VA_ARGS__)
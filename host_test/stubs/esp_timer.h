@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct esp_timer *esp_timer_handle_t;
+
+// Provided by each test, so it runs on its own clock
+int64_t esp_timer_get_time(void);
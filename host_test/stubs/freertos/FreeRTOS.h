@@ -0,0 +1,32 @@
+/* FreeRTOS types and critical sections of the host tests, mapped to pthreads */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <pthread.h>
+// As on the target, the port of FreeRTOS brings the heap capabilities
+#include "esp_heap_caps.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void *TaskHandle_t;
+
+#define pdTRUE                      (1)
+#define pdFALSE                     (0)
+#define pdPASS                      (1)
+#define portMAX_DELAY               (0xFFFFFFFFU)
+#define portTICK_PERIOD_MS          (1)
+#define pdMS_TO_TICKS(ms)           ((TickType_t)(ms))
+
+#define IRAM_ATTR
+#define portYIELD_FROM_ISR()
+
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED    PTHREAD_MUTEX_INITIALIZER
+#define portMUX_INITIALIZE(mux)         pthread_mutex_init((mux), NULL)
+#define portENTER_CRITICAL(mux)         pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux)          pthread_mutex_unlock(mux)
+#define portENTER_CRITICAL_ISR(mux)     pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL_ISR(mux)      pthread_mutex_unlock(mux)
@@ -0,0 +1,7 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef void *EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, const EventBits_t bits);
@@ -0,0 +1,10 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+#define errQUEUE_FULL               (0)
+
+typedef void *QueueHandle_t;
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+BaseType_t xQueueReset(QueueHandle_t queue);
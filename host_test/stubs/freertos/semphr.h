@@ -0,0 +1,25 @@
+/* Mutexes of the host tests, the semaphores of the application are only used as mutexes */
+#pragma once
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+
+typedef pthread_mutex_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t mutex = malloc(sizeof(pthread_mutex_t));
+    if (mutex) {
+        pthread_mutex_init(mutex, NULL);
+    }
+    return mutex;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t wait)
+{
+    return (pthread_mutex_lock(mutex) == 0) ? pdTRUE : pdFALSE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    return (pthread_mutex_unlock(mutex) == 0) ? pdTRUE : pdFALSE;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+// Notifications go to tasks the host tests do not run
+static inline BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+// Provided by the tests that run the tasks of the port
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name, uint32_t stack_depth,
+                                   void *param, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
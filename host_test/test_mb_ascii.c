@@ -0,0 +1,289 @@
+/* Host test of the ASCII master framing
+
+   The lookup tables of mbascii_m.c replaced the character conversions of mbascii.c, and the
+   receiver sums the LRC while decoding. Every byte value is checked against those reference
+   conversions: the encoded request, the decoded response and both LRC paths.
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "mb_m.h"
+#include "mbframe.h"
+#include "mbport.h"
+#include "mbascii.h"
+#include "host_test.h"
+
+volatile UCHAR ucMasterSndBuf[MB_SERIAL_BUF_SIZE];
+volatile UCHAR ucMasterRcvBuf[MB_SERIAL_BUF_SIZE];
+volatile eMBMasterTimerMode eMasterCurTimerMode;
+
+// Characters written by the transmitter and the ones the receiver reads next
+static UCHAR line_out[1 + 2 * MB_SER_PDU_SIZE_MAX + 2];
+static USHORT line_out_len;
+static const UCHAR *line_in;
+
+// Hand the receiver a copy of the frame, so it has to compute the LRC instead of using its sum
+static bool response_copy;
+static UCHAR response_buf[MB_SER_PDU_SIZE_MAX];
+
+/* ----------------------- Reference conversions of mbascii.c ---------------*/
+static UCHAR ref_char2bin(UCHAR character)
+{
+    if ((character >= '0') && (character <= '9')) {
+        return (UCHAR)(character - '0');
+    } else if ((character >= 'A') && (character <= 'F')) {
+        return (UCHAR)(character - 'A' + 0x0A);
+    }
+    return 0xFF;
+}
+
+static UCHAR ref_bin2char(UCHAR nibble)
+{
+    return (nibble <= 0x09) ? (UCHAR)('0' + nibble) : (UCHAR)(nibble - 0x0A + 'A');
+}
+
+static UCHAR ref_lrc(const UCHAR *frame, USHORT len)
+{
+    UCHAR lrc = 0;
+    while (len--) {
+        lrc += *frame++;
+    }
+    return (UCHAR)(-((CHAR)lrc));
+}
+
+// Encode a frame with the reference conversions, from the ':' to the LF
+static USHORT ref_encode(const UCHAR *frame, USHORT len, UCHAR *chars)
+{
+    USHORT count = 0;
+    chars[count++] = ':';
+    for (USHORT i = 0; i < len; i++) {
+        chars[count++] = ref_bin2char(frame[i] >> 4);
+        chars[count++] = ref_bin2char(frame[i] & 0x0F);
+    }
+    chars[count++] = MB_ASCII_DEFAULT_CR;
+    chars[count++] = MB_ASCII_DEFAULT_LF;
+    return count;
+}
+
+/* ----------------------- Port of the test ---------------------------------*/
+BOOL xMBMasterPortSerialInit(UCHAR ucPort, ULONG ulBaudRate, UCHAR ucDataBits, eMBParity eParity)
+{
+    return TRUE;
+}
+
+BOOL xMBMasterPortSerialSetConfig(ULONG ulBaudRate, eMBParity eParity)
+{
+    return TRUE;
+}
+
+void vMBMasterPortSerialEnable(BOOL xRxEnable, BOOL xTxEnable)
+{
+}
+
+BOOL xMBMasterPortSerialGetByte(CHAR *pucByte)
+{
+    *pucByte = (CHAR)*line_in++;
+    return FALSE;
+}
+
+BOOL xMBMasterPortSerialPutBuffer(const UCHAR *pucBuffer, USHORT usLength)
+{
+    CHECK(usLength <= sizeof(line_out));
+    memcpy(line_out, pucBuffer, usLength);
+    line_out_len = usLength;
+    return TRUE;
+}
+
+BOOL xMBMasterPortSerialGetResponse(UCHAR **ppucMBSerialFrame, USHORT *usSerialLength)
+{
+    if (response_copy) {
+        memcpy(response_buf, *ppucMBSerialFrame, *usSerialLength);
+        *ppucMBSerialFrame = response_buf;
+    }
+    return TRUE;
+}
+
+BOOL xMBMasterPortEventPost(eMBMasterEventEnum eEvent)
+{
+    return TRUE;
+}
+
+BOOL xMBMasterPortTimersInit(USHORT usTimeOut50us)
+{
+    return TRUE;
+}
+
+void vMBMasterPortTimersT35Enable(void)
+{
+}
+
+void vMBMasterPortTimersConvertDelayEnable(void)
+{
+}
+
+void vMBMasterPortTimersRespondTimeoutEnable(void)
+{
+}
+
+void vMBMasterPortTimersDisable(void)
+{
+}
+
+void vMBPortTimersDisable(void)
+{
+}
+
+void vMBMasterRequestSetType(BOOL xIsBroadcast)
+{
+}
+
+BOOL xMBMasterRequestIsBroadcast(void)
+{
+    return FALSE;
+}
+
+void vMBMasterSetErrorType(eMBMasterErrorEventType errorType)
+{
+}
+
+eMBMasterTimerMode xMBMasterGetCurTimerMode(void)
+{
+    return eMasterCurTimerMode;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    return pdFALSE;
+}
+
+esp_err_t uart_set_rx_timeout(uart_port_t uart_num, const uint8_t tout_thresh)
+{
+    return ESP_OK;
+}
+
+/* ----------------------- Tests --------------------------------------------*/
+// Send a request and check the characters written against the reference encoding
+static void check_send(UCHAR slave, const UCHAR *pdu, USHORT len)
+{
+    UCHAR *frame = (UCHAR *)&ucMasterSndBuf[MB_SER_PDU_PDU_OFF];
+    memcpy(frame, pdu, len);
+    CHECK(eMBMasterASCIISend(slave, frame, len) == MB_ENOERR);
+    // Start writes the frame, notify waits for the response
+    xMBMasterASCIITransmitFSM();
+    xMBMasterASCIITransmitFSM();
+
+    UCHAR expected[MB_SER_PDU_SIZE_MAX + 1];
+    expected[0] = slave;
+    memcpy(&expected[1], pdu, len);
+    expected[len + 1] = ref_lrc(expected, len + 1);
+    UCHAR chars[sizeof(line_out)];
+    USHORT count = ref_encode(expected, len + 2, chars);
+    CHECK(line_out_len == count);
+    CHECK(!memcmp(line_out, chars, count));
+}
+
+// Feed characters to the receiver until the LF ends the frame, then fetch the frame
+static eMBErrorCode receive(const UCHAR *chars, USHORT count, UCHAR *slave, UCHAR **pdu, USHORT *len)
+{
+    line_in = chars;
+    while (line_in < chars + count) {
+        xMBMasterASCIIReceiveFSM();
+    }
+    return eMBMasterASCIIReceive(slave, pdu, len);
+}
+
+// Receive a response encoded by the reference conversions, with its LRC and with a wrong one
+static void check_receive(const UCHAR *frame, USHORT len)
+{
+    UCHAR chars[sizeof(line_out)];
+    UCHAR serial[MB_SER_PDU_SIZE_MAX];
+    memcpy(serial, frame, len);
+    serial[len] = ref_lrc(frame, len);
+
+    for (int copy = 0; copy < 2; copy++) {
+        response_copy = copy;
+        UCHAR slave = 0;
+        UCHAR *pdu = NULL;
+        USHORT pdu_len = 0;
+        USHORT count = ref_encode(serial, len + 1, chars);
+        eMBErrorCode status = receive(chars, count, &slave, &pdu, &pdu_len);
+        CHECK(status == MB_ENOERR);
+        if (status == MB_ENOERR) {
+            CHECK(slave == frame[0]);
+            CHECK(pdu_len == len - 1);
+            CHECK(!memcmp(pdu, &frame[1], len - 1));
+        }
+
+        serial[len]++;
+        count = ref_encode(serial, len + 1, chars);
+        CHECK(receive(chars, count, &slave, &pdu, &pdu_len) == MB_EIO);
+        serial[len]--;
+    }
+    response_copy = false;
+}
+
+static void test_encode(void)
+{
+    // Every byte value in the PDU, and with the slave address each of the LRC values
+    UCHAR pdu[128];
+    for (int start = 0; start < 256; start += sizeof(pdu)) {
+        for (int i = 0; i < sizeof(pdu); i++) {
+            pdu[i] = (UCHAR)(start + i);
+        }
+        check_send(1, pdu, sizeof(pdu));
+    }
+    for (int value = 0; value < 256; value++) {
+        pdu[0] = 0x03;
+        pdu[1] = (UCHAR)value;
+        check_send((UCHAR)(value % MB_MASTER_TOTAL_SLAVE_NUM + 1), pdu, 2);
+    }
+}
+
+static void test_decode(void)
+{
+    // Every byte value in a response, once in the PDU and once as the LRC
+    UCHAR frame[3] = { 1, 0x03, 0 };
+    for (int value = 0; value < 256; value++) {
+        frame[2] = (UCHAR)value;
+        check_receive(frame, sizeof(frame));
+    }
+    UCHAR long_frame[MB_SER_PDU_SIZE_MAX - 2];
+    long_frame[0] = 1;
+    for (int i = 1; i < sizeof(long_frame); i++) {
+        long_frame[i] = (UCHAR)(255 - i);
+    }
+    check_receive(long_frame, sizeof(long_frame));
+}
+
+static void test_decode_chars(void)
+{
+    // Characters that are not upper case hex digits decode as 0xFF nibbles, as they did before
+    for (int character = 0; character < 256; character++) {
+        if ((character == ':') || (character == MB_ASCII_DEFAULT_CR)) {
+            continue;
+        }
+        UCHAR chars[] = { ':', (UCHAR)character, '0', '0', (UCHAR)character, MB_ASCII_DEFAULT_CR, MB_ASCII_DEFAULT_LF };
+        UCHAR slave = 0;
+        UCHAR *pdu = NULL;
+        USHORT len = 0;
+        receive(chars, sizeof(chars), &slave, &pdu, &len);
+        UCHAR nibble = ref_char2bin((UCHAR)character);
+        CHECK(ucMasterRcvBuf[0] == (UCHAR)((nibble << 4) | 0x0));
+        CHECK(ucMasterRcvBuf[1] == (UCHAR)((0x0 << 4) | nibble));
+    }
+}
+
+int main(void)
+{
+    CHECK(eMBMasterASCIIInit(0, 9600, MB_PAR_NONE) == MB_ENOERR);
+    eMBMasterASCIIStart();
+    test_encode();
+    test_decode();
+    test_decode_chars();
+    return host_test_result("mb_ascii");
+}
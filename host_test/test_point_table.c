@@ -0,0 +1,200 @@
+/* Host test of the scan schedule of the point table
+
+   Polls taken late must not shift the grid of a point: its due times stay multiples of the
+   period, and each cycle skipped by an overrun is counted once in missed.
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include "host_test.h"
+
+// The wall clock of the test, either not set or at a fixed offset from the time since boot
+static int64_t test_now;
+static int64_t test_wall_offset;
+
+static int test_gettimeofday(struct timeval *tv, void *tz)
+{
+    int64_t wall = test_wall_offset ? test_now + test_wall_offset : test_now;
+    tv->tv_sec = wall / 1000000;
+    tv->tv_usec = wall % 1000000;
+    return 0;
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+// The schedule state is private, the module is built into the test to read it
+#define gettimeofday test_gettimeofday
+#include "point_table.c"
+#undef gettimeofday
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size) {
+        size_t copy = (len < size) ? len : size - 1;
+        memcpy(dst, src, copy);
+        dst[copy] = '\0';
+    }
+    return len;
+}
+
+/* ----------------------- Modules the point table uses ---------------------*/
+int64_t esp_timer_get_time(void)
+{
+    return test_now;
+}
+
+int mb_worker_read_cid(int func_id)
+{
+    return ((func_id == 3) || (func_id == 4)) ? func_id : -1;
+}
+
+void mb_worker_wake(void)
+{
+}
+
+int mb_route_resolve(int unit_id, int *address)
+{
+    *address = unit_id;
+    return MB_ROUTE_LOCAL;
+}
+
+uint32_t bus_model_transaction_us(int slave_id, int func_id, uint16_t count)
+{
+    return 1000;
+}
+
+void alarm_evaluate(int point, double value, bool valid, uint64_t timestamp)
+{
+}
+
+void alarm_tick(int64_t now)
+{
+}
+
+void concentrator_update(int point, double value, bool valid)
+{
+}
+
+/* ----------------------- Tests --------------------------------------------*/
+#define TEST_PERIODS            (10000)
+
+// Small deterministic generator, so a failure repeats
+static uint32_t test_random(void)
+{
+    static uint32_t state = 12345;
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+static void reset_points(void)
+{
+    point_count = 0;
+    valid_mask = 0;
+    changed_mask = 0;
+}
+
+// Take the due point at now, -1 if none
+static int take_at(int64_t now)
+{
+    mb_job_t job;
+    test_now = now;
+    return point_table_take_due(now, &job);
+}
+
+// Phase of a due time on the grid of the period, 0 once it is on the grid
+static int64_t grid_phase(int64_t due, uint32_t period_ms)
+{
+    return (due + test_wall_offset) % ((int64_t)period_ms * 1000);
+}
+
+// Poll one point many periods with late starts, some of them past the next cycles
+static void check_schedule(uint32_t period_ms, int64_t start)
+{
+    int64_t period_us = (int64_t)period_ms * 1000;
+    reset_points();
+    CHECK(point_table_add_register("p", 1, 3, 0, period_ms) == ESP_OK);
+    // A new point is polled at once, whatever the phase of the start, then joins the grid
+    CHECK(take_at(start) == 0);
+    int64_t due = point_table_next_due();
+    CHECK(due > start);
+    CHECK(due - start <= period_us);
+    CHECK(grid_phase(due, period_ms) == 0);
+
+    uint32_t missed = 0;
+    for (int cycle = 0; cycle < TEST_PERIODS; cycle++) {
+        CHECK(take_at(due - 1) == -1);
+        uint32_t skipped = (test_random() % 10 == 0) ? test_random() % 4 + 1 : 0;
+        int64_t late = (int64_t)skipped * period_us + test_random() % period_us;
+        CHECK(take_at(due + late) == 0);
+        missed += skipped;
+        int64_t next = point_table_next_due();
+        // No drift: the next due time is the following cycle the poll did not overrun
+        CHECK(next == due + (int64_t)(skipped + 1) * period_us);
+        CHECK(grid_phase(next, period_ms) == 0);
+        CHECK(points[0].missed == missed);
+        due = next;
+    }
+    // Polls exactly on time keep the grid as well
+    for (int cycle = 0; cycle < 100; cycle++) {
+        CHECK(take_at(due) == 0);
+        CHECK(point_table_next_due() == due + period_us);
+        due += period_us;
+    }
+    CHECK(points[0].missed == missed);
+}
+
+// Points of different periods polled by one scan loop, each on its own grid
+static void check_interleaved(void)
+{
+    static const uint32_t periods_ms[] = { 100, 250, 1000 };
+    const int count = sizeof(periods_ms) / sizeof(periods_ms[0]);
+    reset_points();
+    for (int i = 0; i < count; i++) {
+        char name[] = { 'p', (char)('a' + i), '\0' };
+        CHECK(point_table_add_register(name, i + 1, 3, 0, periods_ms[i]) == ESP_OK);
+    }
+    int64_t now = 7654321;
+    int polls[3] = { 0 };
+    while (now < 60 * 1000000LL) {
+        int due = take_at(now);
+        if (due < 0) {
+            now = point_table_next_due();
+            continue;
+        }
+        CHECK(due < count);
+        polls[due]++;
+        // Each poll takes the bus for 3 ms, never enough to overrun the shortest period
+        now += 3000;
+    }
+    for (int i = 0; i < count; i++) {
+        CHECK(points[i].missed == 0);
+        CHECK(grid_phase(points[i].next_due, periods_ms[i]) == 0);
+        // The first poll is at once, then one per period until the end of the run
+        int64_t expected = (60 * 1000000LL - 7654321) / ((int64_t)periods_ms[i] * 1000);
+        CHECK((polls[i] >= expected) && (polls[i] <= expected + 2));
+    }
+}
+
+int main(void)
+{
+    CHECK(point_table_init() == ESP_OK);
+    // Clock counting from boot, grid on the time since boot
+    test_wall_offset = 0;
+    check_schedule(100, 1234567);
+    check_schedule(1000, 999999);
+    check_schedule(30, 30000);
+    check_interleaved();
+    // Wall clock set, grid on the wall clock so gateways sample together
+    test_wall_offset = 1700000000LL * 1000000 + 123457;
+    check_schedule(100, 1234567);
+    check_schedule(250, 42);
+    check_interleaved();
+    return host_test_result("point_table");
+}
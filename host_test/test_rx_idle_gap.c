@@ -0,0 +1,115 @@
+/* Host test of the frame gap of the serial port
+
+   xMBPortSerialSetRxIdleGap() converts the gap in bit times, or in microseconds above
+   19200 baud, into the TOUT threshold of the UART in symbols. The threshold is rounded up so
+   the gap is never shorter than configured, and clamped to what the driver accepts.
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdint.h>
+#include "port.h"
+#include "host_test.h"
+
+// Threshold the port set last, 0 if it did not set one
+static uint8_t tout_set;
+static esp_err_t tout_result = ESP_OK;
+
+esp_err_t uart_set_rx_timeout(uart_port_t uart_num, const uint8_t tout_thresh)
+{
+    tout_set = tout_thresh;
+    return tout_result;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    return pdFALSE;
+}
+
+// Set the gap and return the threshold, with the gap the port reports in us
+static uint8_t set_gap(ULONG baud, UCHAR data_bits, BOOL parity, ULONG *gap_us)
+{
+    tout_set = 0;
+    CHECK(xMBPortSerialSetRxIdleGap(1, baud, data_bits, parity, gap_us) == TRUE);
+    return tout_set;
+}
+
+static void test_conversion(void)
+{
+    static const ULONG bauds[] = { 1200, 2400, 4800, 9600, 14400, 19200, 19201, 38400, 57600,
+                                   115200, 230400, 460800, 921600, 1000000, 2000000, 5000000 };
+    for (int i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++) {
+        for (UCHAR data_bits = 5; data_bits <= 8; data_bits++) {
+            for (BOOL parity = FALSE; parity <= TRUE; parity++) {
+                ULONG baud = bauds[i];
+                ULONG symbol_bits = 1 + data_bits + (parity ? 1 : 0) + 1;
+                // Fixed number of bit times up to 19200 baud, fixed time above
+                uint64_t gap_bits = (baud > MB_SERIAL_RX_IDLE_BAUD_FIXED)
+                                    ? ((uint64_t)MB_SERIAL_RX_IDLE_GAP_US * baud + 999999) / 1000000
+                                    : MB_SERIAL_RX_IDLE_BITS;
+                ULONG gap_us = 0;
+                uint8_t tout = set_gap(baud, data_bits, parity, &gap_us);
+                CHECK((tout >= 1) && (tout <= MB_SERIAL_RX_IDLE_TOUT_MAX));
+                if (tout < MB_SERIAL_RX_IDLE_TOUT_MAX) {
+                    // Shortest threshold covering the gap
+                    CHECK((uint64_t)tout * symbol_bits >= gap_bits);
+                    CHECK((tout == 1) || ((uint64_t)(tout - 1) * symbol_bits < gap_bits));
+                } else {
+                    CHECK((uint64_t)(tout - 1) * symbol_bits < gap_bits);
+                }
+                CHECK(gap_us == (ULONG)((uint64_t)tout * symbol_bits * 1000000 / baud));
+            }
+        }
+    }
+}
+
+static void test_values(void)
+{
+    ULONG gap_us = 0;
+    // 8N1 symbols of 10 bits cover the configured bit times rounded up
+    CHECK(set_gap(9600, 8, FALSE, &gap_us) == (MB_SERIAL_RX_IDLE_BITS + 9) / 10);
+    // 8E1 symbols of 11 bits
+    CHECK(set_gap(9600, 8, TRUE, NULL) == (MB_SERIAL_RX_IDLE_BITS + 10) / 11);
+    // Above 19200 baud the gap is a time, the same at any higher speed
+    ULONG gap_115200 = 0;
+    ULONG gap_230400 = 0;
+    set_gap(115200, 8, FALSE, &gap_115200);
+    set_gap(230400, 8, FALSE, &gap_230400);
+    CHECK(gap_115200 >= MB_SERIAL_RX_IDLE_GAP_US);
+    CHECK(gap_230400 >= MB_SERIAL_RX_IDLE_GAP_US);
+    CHECK(gap_115200 < MB_SERIAL_RX_IDLE_GAP_US + 10 * 1000000 / 115200);
+    CHECK(gap_230400 < MB_SERIAL_RX_IDLE_GAP_US + 10 * 1000000 / 230400);
+}
+
+static void test_clamp(void)
+{
+    // The gap in symbols passes the TOUT range of the driver at high baud rates
+    ULONG baud = 5000000;
+    uint64_t symbols = (((uint64_t)MB_SERIAL_RX_IDLE_GAP_US * baud + 999999) / 1000000 + 9) / 10;
+    CHECK(symbols > MB_SERIAL_RX_IDLE_TOUT_MAX);
+    ULONG gap_us = 0;
+    CHECK(set_gap(baud, 8, FALSE, &gap_us) == MB_SERIAL_RX_IDLE_TOUT_MAX);
+    // The reported gap is the clamped one, shorter than configured
+    CHECK(gap_us == (ULONG)((uint64_t)MB_SERIAL_RX_IDLE_TOUT_MAX * 10 * 1000000 / baud));
+    CHECK(gap_us < MB_SERIAL_RX_IDLE_GAP_US);
+}
+
+static void test_driver_error(void)
+{
+    ULONG gap_us = 0;
+    tout_result = ESP_ERR_INVALID_ARG;
+    CHECK(xMBPortSerialSetRxIdleGap(1, 9600, 8, FALSE, &gap_us) == FALSE);
+    tout_result = ESP_OK;
+}
+
+int main(void)
+{
+    test_conversion();
+    test_values();
+    test_clamp();
+    test_driver_error();
+    return host_test_result("rx_idle_gap");
+}
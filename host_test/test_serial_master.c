@@ -0,0 +1,406 @@
+/* Host test of the receive path of the master serial port
+
+   The UART task of the port keeps running and takes a one-shot permit for the first frame
+   after a request, data arriving without the permit is dropped. The stack runs transactions
+   back to back against the real UART task of portserial_m.c, with late duplicates of the
+   responses and characters left on the line in between: every response must arrive once,
+   none of the stale data may be handed to the stack, and the driver is only flushed when
+   there is something to drop.
+
+   Each response is stamped when the TOUT event wakes the UART task, before any character is
+   read, and corrected by the frame gap of the line settings: the stamp is the end of the last
+   character plus the wake up latency of the task, whatever the length of the frame.
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "mb_m.h"
+#include "mbport.h"
+#include "port.h"
+#include "host_test.h"
+
+// Called by the task of the serial master controller after each request
+extern BOOL xMBMasterPortSerialTxPoll(void);
+
+#define TEST_TRANSACTIONS       (100000)
+#define TEST_EVENTS             (8)
+// Frame of the test: kind, then the number of the transaction
+#define TEST_FRAME_LEN          (5)
+#define TEST_RESPONSE           (0xA5)
+#define TEST_STALE              (0x5A)
+
+// Line and event queue of the UART driver, shared by the UART task and the test
+static pthread_mutex_t line_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t line_cond = PTHREAD_COND_INITIALIZER;
+static UCHAR line_buf[4 * TEST_FRAME_LEN];
+static size_t line_len;
+static size_t line_pos;
+static uart_event_t events[TEST_EVENTS];
+static int event_count;
+// The UART task waits for the next event, so it is done with the previous one
+static bool task_idle;
+static int queue_resets;
+
+// Frames the port handed to the stack
+static UCHAR frame_buf[4 * TEST_FRAME_LEN];
+static size_t frame_len;
+static UCHAR delivered_buf[sizeof(frame_buf)];
+static size_t delivered_len;
+static uint32_t delivered_count;
+
+// Clock of the test, reading a character from the driver takes read_cost_us
+static int64_t clock_us;
+static int64_t read_cost_us;
+static uint64_t rx_timestamp;
+
+/* ----------------------- UART driver --------------------------------------*/
+esp_err_t uart_set_rx_timeout(uart_port_t uart_num, const uint8_t tout_thresh)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t *uart_config)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size,
+                              int queue_size, QueueHandle_t *uart_queue, int intr_alloc_flags)
+{
+    *uart_queue = (QueueHandle_t)events;
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t uart_num)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_set_always_rx_timeout(uart_port_t uart_num, bool always_rx_timeout)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_set_baudrate(uart_port_t uart_num, uint32_t baudrate)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_set_parity(uart_port_t uart_num, uart_parity_t parity_mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t *size)
+{
+    pthread_mutex_lock(&line_lock);
+    *size = line_len - line_pos;
+    pthread_mutex_unlock(&line_lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t uart_num)
+{
+    pthread_mutex_lock(&line_lock);
+    line_len = 0;
+    line_pos = 0;
+    pthread_cond_broadcast(&line_cond);
+    pthread_mutex_unlock(&line_lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t uart_num, TickType_t ticks_to_wait)
+{
+    return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size)
+{
+    return (int)size;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    pthread_mutex_lock(&line_lock);
+    size_t count = line_len - line_pos;
+    count = (count < length) ? count : length;
+    memcpy(buf, &line_buf[line_pos], count);
+    line_pos += count;
+    clock_us += (int64_t)count * read_cost_us;
+    pthread_mutex_unlock(&line_lock);
+    return (int)count;
+}
+
+/* ----------------------- FreeRTOS -----------------------------------------*/
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    pthread_mutex_lock(&line_lock);
+    task_idle = true;
+    pthread_cond_broadcast(&line_cond);
+    while (!event_count) {
+        pthread_cond_wait(&line_cond, &line_lock);
+    }
+    task_idle = false;
+    *(uart_event_t *)item = events[0];
+    memmove(&events[0], &events[1], --event_count * sizeof(events[0]));
+    pthread_mutex_unlock(&line_lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&line_lock);
+    event_count = 0;
+    queue_resets++;
+    pthread_mutex_unlock(&line_lock);
+    return pdPASS;
+}
+
+static void *task_thread(void *arg)
+{
+    void (**task)(void *) = arg;
+    (*task)(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name, uint32_t stack_depth,
+                                   void *param, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    static void (*uart_task)(void *);
+    static pthread_t thread;
+    uart_task = task;
+    *handle = &thread;
+    return (pthread_create(&thread, NULL, task_thread, &uart_task) == 0) ? pdPASS : pdFALSE;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+int64_t esp_timer_get_time(void)
+{
+    pthread_mutex_lock(&line_lock);
+    int64_t now = clock_us;
+    pthread_mutex_unlock(&line_lock);
+    return now;
+}
+
+/* ----------------------- Modbus stack -------------------------------------*/
+static BOOL frame_byte_received(void)
+{
+    CHAR byte;
+    BOOL status = xMBMasterPortSerialGetByte(&byte);
+    if (status && (frame_len < sizeof(frame_buf))) {
+        frame_buf[frame_len++] = (UCHAR)byte;
+    }
+    return status;
+}
+
+static BOOL frame_transmitter_empty(void)
+{
+    return FALSE;
+}
+
+// The frame gap passed, hand the frame to the stack
+static BOOL frame_timer_expired(void)
+{
+    pthread_mutex_lock(&line_lock);
+    memcpy(delivered_buf, frame_buf, frame_len);
+    delivered_len = frame_len;
+    delivered_count++;
+    frame_len = 0;
+    pthread_cond_broadcast(&line_cond);
+    pthread_mutex_unlock(&line_lock);
+    return TRUE;
+}
+
+BOOL (*pxMBMasterFrameCBByteReceived)(void) = frame_byte_received;
+BOOL (*pxMBMasterFrameCBTransmitterEmpty)(void) = frame_transmitter_empty;
+BOOL (*pxMBMasterPortCBTimerExpired)(void) = frame_timer_expired;
+
+void vMBMasterSetCurTimerMode(eMBMasterTimerMode eMBTimerMode)
+{
+}
+
+BOOL xMBMasterPortEventPost(eMBMasterEventEnum eEvent)
+{
+    return TRUE;
+}
+
+void vMBMasterPortSetRxTimestamp(uint64_t xTimestamp)
+{
+    pthread_mutex_lock(&line_lock);
+    rx_timestamp = xTimestamp;
+    pthread_mutex_unlock(&line_lock);
+}
+
+/* ----------------------- Tests --------------------------------------------*/
+// Small deterministic generator, so a failure repeats
+static uint32_t test_random(void)
+{
+    static uint32_t state = 12345;
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+// Characters of a frame arrive on the line, with the TOUT event of the driver if the gap passed
+static void line_receive(UCHAR kind, uint32_t number, bool gap)
+{
+    UCHAR frame[TEST_FRAME_LEN] = { kind, (UCHAR)(number >> 24), (UCHAR)(number >> 16),
+                                    (UCHAR)(number >> 8), (UCHAR)number };
+    pthread_mutex_lock(&line_lock);
+    CHECK(line_len + sizeof(frame) <= sizeof(line_buf));
+    memcpy(&line_buf[line_len], frame, sizeof(frame));
+    line_len += sizeof(frame);
+    if (gap) {
+        CHECK(event_count < TEST_EVENTS);
+        events[event_count++] = (uart_event_t) {
+            .type = UART_DATA,
+            .size = line_len - line_pos,
+            .timeout_flag = true
+        };
+        pthread_cond_broadcast(&line_cond);
+    }
+    pthread_mutex_unlock(&line_lock);
+}
+
+// Wait for the UART task to take the events queued so far, false after a second
+static bool wait_idle(void)
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec++;
+    int err = 0;
+    pthread_mutex_lock(&line_lock);
+    while ((event_count || !task_idle) && (err != ETIMEDOUT)) {
+        err = pthread_cond_timedwait(&line_cond, &line_lock, &until);
+    }
+    bool idle = !event_count && task_idle;
+    pthread_mutex_unlock(&line_lock);
+    return idle;
+}
+
+// Wait for the response of a transaction, false if it got lost
+static bool wait_response(uint32_t count)
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec++;
+    int err = 0;
+    pthread_mutex_lock(&line_lock);
+    while ((delivered_count != count) && (err != ETIMEDOUT)) {
+        err = pthread_cond_timedwait(&line_cond, &line_lock, &until);
+    }
+    bool received = (delivered_count == count);
+    pthread_mutex_unlock(&line_lock);
+    return received;
+}
+
+static void check_response(uint32_t number)
+{
+    UCHAR frame[TEST_FRAME_LEN] = { TEST_RESPONSE, (UCHAR)(number >> 24), (UCHAR)(number >> 16),
+                                    (UCHAR)(number >> 8), (UCHAR)number };
+    pthread_mutex_lock(&line_lock);
+    CHECK(delivered_len == sizeof(frame));
+    CHECK(!memcmp(delivered_buf, frame, sizeof(frame)));
+    pthread_mutex_unlock(&line_lock);
+}
+
+static void test_transactions(void)
+{
+    CHECK(xMBMasterPortSerialInit(1, 115200, 8, MB_PAR_NONE) == TRUE);
+    // Data before the first request finds no permit and is dropped
+    line_receive(TEST_STALE, 0, true);
+    CHECK(wait_idle());
+    CHECK(delivered_count == 0);
+
+    int stale_flushes = 1;
+    for (uint32_t number = 1; number <= TEST_TRANSACTIONS; number++) {
+        // The request drops what is left on the line, then the transmitter enables the receiver
+        vMBMasterPortSerialEnable(FALSE, TRUE);
+        CHECK(xMBMasterPortSerialTxPoll() == TRUE);
+        line_receive(TEST_RESPONSE, number, true);
+        CHECK(wait_response(number));
+        check_response(number);
+
+        switch (test_random() % 8) {
+            case 0:
+                // Late duplicate of the response after the stack got it, the permit is used up
+                line_receive(TEST_STALE, number, true);
+                CHECK(wait_idle());
+                CHECK(delivered_count == number);
+                stale_flushes++;
+                break;
+            case 1:
+                // Characters without a frame gap yet, the next request drops them
+                line_receive(TEST_STALE, number, false);
+                stale_flushes++;
+                break;
+            default:
+                break;
+        }
+        // The transactions after a failure are out of step, each would wait for its response
+        if (host_test_failures) {
+            break;
+        }
+    }
+    CHECK(wait_idle());
+    CHECK(delivered_count == TEST_TRANSACTIONS);
+    // Transactions without stale data do not touch the event queue
+    CHECK(queue_resets == stale_flushes);
+}
+
+// One transaction at the line settings, with the response ending at frame_end on the clock
+static void check_timestamp(ULONG baud, eMBParity parity, int64_t latency_us, int64_t cost_us)
+{
+    static uint32_t number = TEST_TRANSACTIONS;
+    ULONG gap_us = 0;
+    CHECK(xMBMasterPortSerialSetConfig(baud, parity) == TRUE);
+    CHECK(xMBPortSerialSetRxIdleGap(1, baud, 8, (parity != MB_PAR_NONE), &gap_us) == TRUE);
+    CHECK(wait_idle());
+    vMBMasterPortSerialEnable(FALSE, TRUE);
+    CHECK(xMBMasterPortSerialTxPoll() == TRUE);
+
+    int64_t frame_end = 1000000 + number * 10000LL;
+    pthread_mutex_lock(&line_lock);
+    // The TOUT event fires one frame gap after the last character, the task wakes up later
+    clock_us = frame_end + gap_us + latency_us;
+    read_cost_us = cost_us;
+    pthread_mutex_unlock(&line_lock);
+    line_receive(TEST_RESPONSE, ++number, true);
+    CHECK(wait_response(number));
+    check_response(number);
+    pthread_mutex_lock(&line_lock);
+    CHECK(rx_timestamp == (uint64_t)(frame_end + latency_us));
+    pthread_mutex_unlock(&line_lock);
+}
+
+static void test_rx_timestamp(void)
+{
+    static const ULONG bauds[] = { 1200, 9600, 19200, 38400, 115200, 921600 };
+    static const eMBParity parities[] = { MB_PAR_NONE, MB_PAR_EVEN, MB_PAR_ODD };
+    for (int i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++) {
+        for (int j = 0; j < sizeof(parities) / sizeof(parities[0]); j++) {
+            // The stamp does not depend on the time it takes to read the frame
+            check_timestamp(bauds[i], parities[j], 0, 0);
+            check_timestamp(bauds[i], parities[j], 0, 250);
+            // The wake up latency of the task is the error left in the stamp
+            check_timestamp(bauds[i], parities[j], 37, 250);
+            check_timestamp(bauds[i], parities[j], 1500, 0);
+        }
+    }
+}
+
+int main(void)
+{
+    test_transactions();
+    test_rx_timestamp();
+    return host_test_result("serial_master");
+}
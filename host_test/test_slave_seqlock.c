@@ -0,0 +1,179 @@
+/* Host test of the sequence lock of the slave register areas
+
+   The stack copies the registers of a request again when the application updated the area
+   meanwhile, so a response never mixes two halves of a 32 bit value. Readers run through the
+   register callbacks of the stack while writer threads update the same registers.
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_modbus_slave.h"
+#include "esp_modbus_callbacks.h"
+#include "mbc_slave.h"
+#include "host_test.h"
+
+#define TEST_UPDATES            (200000)
+#define TEST_REGS               (8)
+// Input registers of the update count, twice as high and low halves
+#define TEST_COUNT_REGS         (4)
+// Holding registers of the pair the application updates, the pair the stack writes and the masked one
+#define TEST_APP_PAIR           (2)
+#define TEST_STACK_PAIR         (4)
+#define TEST_MASK_REG           (6)
+// Bit of the masked register set and cleared by mask writes, the others count the updates
+#define TEST_MASK_BIT           (0x8000)
+
+static uint16_t input_regs[TEST_REGS];
+static uint16_t holding_regs[TEST_REGS];
+static mb_seqlock_t seqlock;
+static atomic_bool writers_done;
+
+/* ----------------------- Modules the slave controller uses ----------------*/
+int64_t esp_timer_get_time(void)
+{
+    return 0;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    return pdTRUE;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, const EventBits_t bits)
+{
+    return bits;
+}
+
+eMBErrorCode eMBSetSlaveID(UCHAR ucSlaveID, BOOL xIsRunning, UCHAR const *pucAdditional, USHORT usAdditionalLen)
+{
+    return MB_ENOERR;
+}
+
+/* ----------------------- Threads ------------------------------------------*/
+// Spin between the halves of an update, so an unprotected reader would catch one half
+static void widen(void)
+{
+    for (volatile int i = 0; i < 20; i++) {
+    }
+}
+
+// Application updating both register areas through the sequence lock
+static void *app_writer(void *arg)
+{
+    for (uint32_t update = 1; update <= TEST_UPDATES; update++) {
+        mbc_slave_area_begin(&seqlock);
+        for (int i = 0; i < TEST_COUNT_REGS; i += 2) {
+            input_regs[i] = (uint16_t)(update >> 16);
+            widen();
+            input_regs[i + 1] = (uint16_t)update;
+        }
+        holding_regs[TEST_APP_PAIR] = (uint16_t)update;
+        widen();
+        holding_regs[TEST_APP_PAIR + 1] = (uint16_t)update;
+        // Counter in the bits the mask writes keep
+        uint16_t masked = holding_regs[TEST_MASK_REG];
+        holding_regs[TEST_MASK_REG] = (uint16_t)((masked & TEST_MASK_BIT) | ((masked + 1) & ~TEST_MASK_BIT));
+        widen();
+        holding_regs[TEST_STACK_PAIR] = (uint16_t)~update;
+        widen();
+        holding_regs[TEST_STACK_PAIR + 1] = (uint16_t)~update;
+        mbc_slave_area_commit(&seqlock);
+    }
+    return NULL;
+}
+
+// Upstream client writing holding registers and masking a bit, the stack takes the same lock
+static void *stack_writer(void *arg)
+{
+    for (uint32_t update = 1; update <= TEST_UPDATES; update++) {
+        UCHAR frame[4] = { (UCHAR)(update >> 8), (UCHAR)update, (UCHAR)(update >> 8), (UCHAR)update };
+        CHECK(eMBRegHoldingCB(frame, TEST_STACK_PAIR + 1, 2, MB_REG_WRITE) == MB_ENOERR);
+        USHORT or_mask = (update & 1) ? TEST_MASK_BIT : 0;
+        CHECK(eMBRegHoldingMaskCB(TEST_MASK_REG + 1, (USHORT)~TEST_MASK_BIT, or_mask) == MB_ENOERR);
+    }
+    return NULL;
+}
+
+// Stack answering read requests, each response must hold the two halves of one update
+static void *reader(void *arg)
+{
+    uint32_t reads = 0;
+    uint32_t last = 0;
+    while (!atomic_load(&writers_done) || (reads < 1000)) {
+        UCHAR frame[2 * TEST_REGS];
+        CHECK(eMBRegInputCB(frame, 1, TEST_COUNT_REGS) == MB_ENOERR);
+        CHECK(!memcmp(&frame[0], &frame[4], 4));
+        uint32_t count = ((uint32_t)frame[0] << 24) | ((uint32_t)frame[1] << 16) | ((uint32_t)frame[2] << 8) | frame[3];
+        // Updates only move forward, a response never goes back to an older one
+        CHECK(count >= last);
+        last = count;
+
+        CHECK(eMBRegHoldingCB(frame, TEST_APP_PAIR + 1, TEST_REGS - TEST_APP_PAIR, MB_REG_READ) == MB_ENOERR);
+        CHECK(!memcmp(&frame[0], &frame[2], 2));
+        CHECK(!memcmp(&frame[4], &frame[6], 2));
+        reads++;
+    }
+    return NULL;
+}
+
+/* ----------------------- Tests --------------------------------------------*/
+static void setup_slave(void)
+{
+    mb_slave_interface_t *slave = calloc(1, sizeof(mb_slave_interface_t));
+    mbc_slave_init_iface(slave);
+    mb_register_area_descriptor_t area = {
+        .start_offset = 0,
+        .type = MB_PARAM_INPUT,
+        .address = (void *)input_regs,
+        .size = sizeof(input_regs)
+    };
+    CHECK(mbc_slave_set_descriptor(area) == ESP_OK);
+    area.type = MB_PARAM_HOLDING;
+    area.address = (void *)holding_regs;
+    CHECK(mbc_slave_set_descriptor(area) == ESP_OK);
+    mbc_slave_seqlock_init(&seqlock);
+    CHECK(mbc_slave_set_seqlock(MB_PARAM_INPUT, 0, &seqlock) == ESP_OK);
+    CHECK(mbc_slave_set_seqlock(MB_PARAM_HOLDING, 0, &seqlock) == ESP_OK);
+    // Areas other than registers and offsets without an area have no lock
+    CHECK(mbc_slave_set_seqlock(MB_PARAM_COIL, 0, &seqlock) == ESP_ERR_INVALID_ARG);
+    CHECK(mbc_slave_set_seqlock(MB_PARAM_INPUT, 1, &seqlock) == ESP_ERR_INVALID_ARG);
+}
+
+static void test_concurrent_access(void)
+{
+    pthread_t writers[2];
+    pthread_t readers[2];
+    atomic_store(&writers_done, false);
+    for (int i = 0; i < 2; i++) {
+        CHECK(pthread_create(&readers[i], NULL, reader, NULL) == 0);
+    }
+    CHECK(pthread_create(&writers[0], NULL, app_writer, NULL) == 0);
+    CHECK(pthread_create(&writers[1], NULL, stack_writer, NULL) == 0);
+    for (int i = 0; i < 2; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    atomic_store(&writers_done, true);
+    for (int i = 0; i < 2; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    // The mask writes and the updates of the application are one writer each, none got lost
+    CHECK((holding_regs[TEST_MASK_REG] & ~TEST_MASK_BIT) == (TEST_UPDATES & (uint16_t)~TEST_MASK_BIT));
+    CHECK(!(holding_regs[TEST_MASK_REG] & TEST_MASK_BIT) == !(TEST_UPDATES & 1));
+    // Both writers left the sequence even
+    CHECK(!(seqlock.seq & 1));
+    CHECK(seqlock.seq == 2 * 3 * TEST_UPDATES);
+}
+
+int main(void)
+{
+    setup_slave();
+    test_concurrent_access();
+    return host_test_result("slave_seqlock");
+}
@@ -0,0 +1,230 @@
+/* Alarm evaluation on polled points
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <math.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "point_table.h"
+#include "alarm.h"
+
+typedef struct {
+    char point_name[POINT_NAME_LEN];
+    int point;
+    alarm_type_t type;
+    double limit;
+    double hysteresis;
+    uint32_t on_delay_ms;
+    uint32_t off_delay_ms;
+    double value;                   // last evaluated value, the rate for ALARM_TYPE_ROC
+    bool violated;                  // limit violated, after hysteresis
+    uint64_t violated_since;        // time of the last change of violated
+    bool active;                    // violated for longer than the delay
+    uint64_t active_since;
+    double last_sample;             // previous sample for the rate of change
+    uint64_t last_time;
+    bool has_sample;
+} alarm_t;
+
+typedef struct {
+    uint32_t seq;
+    uint8_t alarm;
+    bool active;
+    double value;
+    uint64_t timestamp;
+} alarm_event_t;
+
+static const char *TAG = "ALARM";
+
+static const char *alarm_type_names[] = { "hi", "lo", "roc" };
+
+static alarm_t alarms[ALARM_MAX];
+static int alarm_count;
+static alarm_event_t journal[ALARM_JOURNAL_SIZE];
+static uint32_t journal_seq;                    // sequence number of the newest event
+static SemaphoreHandle_t alarm_lock;
+
+// Record an alarm state change in the journal, called with the lock taken
+static void alarm_journal(int id, uint64_t timestamp)
+{
+    const alarm_t *alarm = &alarms[id];
+    alarm_event_t *event = &journal[++journal_seq % ALARM_JOURNAL_SIZE];
+    event->seq = journal_seq;
+    event->alarm = (uint8_t)id;
+    event->active = alarm->active;
+    event->value = alarm->value;
+    event->timestamp = timestamp;
+    ESP_LOGI(TAG, "Alarm #%d %s %s %s, value = %f.", id, alarm->point_name, alarm_type_names[alarm->type],
+             alarm->active ? "raised" : "cleared", alarm->value);
+}
+
+// Change the alarm state once the violation changed for longer than its delay, called with the lock taken
+static void alarm_update(int id, uint64_t now)
+{
+    alarm_t *alarm = &alarms[id];
+    if (alarm->violated == alarm->active) {
+        return;
+    }
+    uint64_t delay_us = (uint64_t)(alarm->violated ? alarm->on_delay_ms : alarm->off_delay_ms) * 1000;
+    if (now - alarm->violated_since >= delay_us) {
+        // Stamp the change at the time the delay expired, not when it was noticed
+        alarm->active = alarm->violated;
+        alarm->active_since = alarm->violated_since + delay_us;
+        alarm_journal(id, alarm->active_since);
+    }
+}
+
+esp_err_t alarm_init(void)
+{
+    alarm_lock = xSemaphoreCreateMutex();
+    if (!alarm_lock) {
+        ESP_LOGE(TAG, "no memory for alarm lock.");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t alarm_type_from_name(const char *name, alarm_type_t *type)
+{
+    for (int i = 0; name && (i < sizeof(alarm_type_names) / sizeof(alarm_type_names[0])); i++) {
+        if (!strcmp(name, alarm_type_names[i])) {
+            *type = (alarm_type_t)i;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t alarm_add(const alarm_config_t *config, int *id)
+{
+    if (!config || (config->type > ALARM_TYPE_ROC) || !isfinite(config->limit)
+            || !isfinite(config->hysteresis) || (config->hysteresis < 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int index = point_table_index(config->point);
+    if (index < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = ESP_ERR_NO_MEM;
+    xSemaphoreTake(alarm_lock, portMAX_DELAY);
+    if (alarm_count < ALARM_MAX) {
+        alarm_t *alarm = &alarms[alarm_count];
+        memset(alarm, 0, sizeof(alarm_t));
+        strlcpy(alarm->point_name, config->point, POINT_NAME_LEN);
+        alarm->point = index;
+        alarm->type = config->type;
+        alarm->limit = config->limit;
+        alarm->hysteresis = config->hysteresis;
+        alarm->on_delay_ms = config->on_delay_ms;
+        alarm->off_delay_ms = config->off_delay_ms;
+        if (id) {
+            *id = alarm_count;
+        }
+        alarm_count++;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(alarm_lock);
+    return err;
+}
+
+void alarm_evaluate(int point, double value, bool valid, uint64_t timestamp)
+{
+    if (!valid) {
+        // Hold the state, a lost sample says nothing about the limit
+        return;
+    }
+    xSemaphoreTake(alarm_lock, portMAX_DELAY);
+    for (int i = 0; i < alarm_count; i++) {
+        alarm_t *alarm = &alarms[i];
+        if (alarm->point != point) {
+            continue;
+        }
+        double x = value;
+        if (alarm->type == ALARM_TYPE_ROC) {
+            if (alarm->has_sample && (timestamp <= alarm->last_time)) {
+                continue;
+            }
+            bool first = !alarm->has_sample;
+            x = first ? 0 : fabs(value - alarm->last_sample) * 1000000.0 / (double)(timestamp - alarm->last_time);
+            alarm->last_sample = value;
+            alarm->last_time = timestamp;
+            alarm->has_sample = true;
+            if (first) {
+                continue;
+            }
+        }
+        alarm->value = x;
+        bool violated;
+        if (alarm->type == ALARM_TYPE_LO) {
+            violated = alarm->violated ? (x < alarm->limit + alarm->hysteresis) : (x < alarm->limit);
+        } else {
+            violated = alarm->violated ? (x > alarm->limit - alarm->hysteresis) : (x > alarm->limit);
+        }
+        if (violated != alarm->violated) {
+            alarm->violated = violated;
+            alarm->violated_since = timestamp;
+        }
+        alarm_update(i, timestamp);
+    }
+    xSemaphoreGive(alarm_lock);
+}
+
+void alarm_tick(int64_t now)
+{
+    xSemaphoreTake(alarm_lock, portMAX_DELAY);
+    for (int i = 0; i < alarm_count; i++) {
+        alarm_update(i, (uint64_t)now);
+    }
+    xSemaphoreGive(alarm_lock);
+}
+
+void alarm_report(cJSON *root, uint32_t since)
+{
+    xSemaphoreTake(alarm_lock, portMAX_DELAY);
+    cJSON_AddNumberToObject(root, "seq", journal_seq);
+    cJSON *array = cJSON_AddArrayToObject(root, "alarms");
+    for (int i = 0; i < alarm_count; i++) {
+        const alarm_t *alarm = &alarms[i];
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "id", i);
+        cJSON_AddStringToObject(item, "point", alarm->point_name);
+        cJSON_AddStringToObject(item, "type", alarm_type_names[alarm->type]);
+        cJSON_AddNumberToObject(item, "limit", alarm->limit);
+        cJSON_AddNumberToObject(item, "hysteresis", alarm->hysteresis);
+        cJSON_AddNumberToObject(item, "onDelayMs", alarm->on_delay_ms);
+        cJSON_AddNumberToObject(item, "offDelayMs", alarm->off_delay_ms);
+        cJSON_AddBoolToObject(item, "active", alarm->active);
+        cJSON_AddNumberToObject(item, "value", alarm->value);
+        cJSON_AddNumberToObject(item, "sinceUs", (double)alarm->active_since);
+        cJSON_AddItemToArray(array, item);
+    }
+    // Only the last ALARM_JOURNAL_SIZE events are kept
+    uint32_t first = (journal_seq > ALARM_JOURNAL_SIZE) ? (journal_seq - ALARM_JOURNAL_SIZE + 1) : 1;
+    if (since > journal_seq) {
+        // The client saw a journal from before a restart
+        since = 0;
+    }
+    cJSON_AddBoolToObject(root, "lost", since + 1 < first);
+    if (since + 1 > first) {
+        first = since + 1;
+    }
+    array = cJSON_AddArrayToObject(root, "events");
+    for (uint32_t seq = first; seq <= journal_seq; seq++) {
+        const alarm_event_t *event = &journal[seq % ALARM_JOURNAL_SIZE];
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "seq", event->seq);
+        cJSON_AddNumberToObject(item, "id", event->alarm);
+        cJSON_AddStringToObject(item, "point", alarms[event->alarm].point_name);
+        cJSON_AddBoolToObject(item, "active", event->active);
+        cJSON_AddNumberToObject(item, "value", event->value);
+        cJSON_AddNumberToObject(item, "timestampUs", (double)event->timestamp);
+        cJSON_AddItemToArray(array, item);
+    }
+    xSemaphoreGive(alarm_lock);
+}
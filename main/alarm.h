@@ -0,0 +1,100 @@
+/* Alarm evaluation on polled points
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "cJSON.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ALARM_MAX               (CONFIG_GW_ALARMS_MAX)
+#define ALARM_JOURNAL_SIZE      (CONFIG_GW_ALARM_JOURNAL_SIZE)
+
+typedef enum {
+    ALARM_TYPE_HI,                  /*!< Value above the limit, clears below limit - hysteresis */
+    ALARM_TYPE_LO,                  /*!< Value below the limit, clears above limit + hysteresis */
+    ALARM_TYPE_ROC                  /*!< Absolute rate of change per second above the limit */
+} alarm_type_t;
+
+/**
+ * @brief Alarm configuration
+ */
+typedef struct {
+    const char *point;              /*!< Name of the monitored point */
+    alarm_type_t type;
+    double limit;
+    double hysteresis;              /*!< Dead band the value has to leave the limit by to clear the alarm */
+    uint32_t on_delay_ms;           /*!< Time the limit has to be violated before the alarm becomes active */
+    uint32_t off_delay_ms;          /*!< Time the limit has to be respected before the alarm clears */
+} alarm_config_t;
+
+/**
+ * @brief Create the alarm engine
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NO_MEM if the lock could not be created
+ */
+esp_err_t alarm_init(void);
+
+/**
+ * @brief Add an alarm on a point of the point table
+ *
+ * @param config alarm configuration
+ * @param[out] id alarm identifier, can be NULL
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG on wrong configuration
+ *     - ESP_ERR_NOT_FOUND if the point does not exist
+ *     - ESP_ERR_NO_MEM if all alarms are in use
+ */
+esp_err_t alarm_add(const alarm_config_t *config, int *id);
+
+/**
+ * @brief Get the alarm type from its name ("hi", "lo" or "roc")
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG if the name is unknown
+ */
+esp_err_t alarm_type_from_name(const char *name, alarm_type_t *type);
+
+/**
+ * @brief Evaluate the alarms of a point on a new sample, called by the point table
+ *
+ * @param point point index
+ * @param value sample value
+ * @param valid false if the sample could not be read, the alarm state is then held
+ * @param timestamp sample time in us since boot
+ */
+void alarm_evaluate(int point, double value, bool valid, uint64_t timestamp);
+
+/**
+ * @brief Apply the on and off delays that expired without a new sample
+ *
+ * @param now current time in us since boot
+ */
+void alarm_tick(int64_t now);
+
+/**
+ * @brief Add the alarm states and the journal entries newer than since to a JSON object
+ *
+ * @param root object to add "seq", "alarms", "events" and "lost" to
+ * @param since journal sequence number already known by the client, 0 for the whole journal
+ */
+void alarm_report(cJSON *root, uint32_t since);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,191 @@
+/* Bus time cost model of the RTU segment
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include "esp_log.h"
+#include "bus_model.h"
+
+// Addresses of the RTU segment
+#define BUS_MODEL_SLAVES            (248)
+// Smallest change of the silence a slave gets after its transactions
+#define BUS_MODEL_GAP_STEP_US       (500)
+// Back-to-back transactions without a failure before the silence is shortened again
+#define BUS_MODEL_GAP_SHRINK_OK     (64)
+
+static const char *TAG = "BUS_MODEL";
+
+static mb_mode_type_t line_mode = MB_MODE_RTU;
+static uint32_t line_baudrate = 9600;
+static uint32_t char_bits = 10;
+// Learned response time per slave, 0 until the slave answered once
+static uint32_t turnaround_us[BUS_MODEL_SLAVES];
+
+// Silence a slave needs after a transaction before it takes the next request
+typedef struct {
+    uint32_t gap_us;
+    uint16_t short_fails;           // failures of requests sent after the gap only
+    uint16_t long_fails;            // failures of requests sent after a longer silence
+    uint16_t short_ok;              // back-to-back transactions without failure since the gap changed
+} bus_gap_t;
+
+static bus_gap_t gaps[BUS_MODEL_SLAVES];
+
+// Bytes of the request and of the response in RTU framing: address, PDU and CRC
+static void bus_model_frame_bytes(int func_id, uint16_t count, uint32_t *request, uint32_t *response)
+{
+    uint32_t bits = (count + 7) / 8;
+    switch (func_id) {
+        case 1:
+        case 2:
+            *request = 8;
+            *response = 5 + bits;
+            break;
+        case 3:
+        case 4:
+            *request = 8;
+            *response = 5 + 2 * (uint32_t)count;
+            break;
+        case 15:
+            *request = 9 + bits;
+            *response = 8;
+            break;
+        case 16:
+            *request = 9 + 2 * (uint32_t)count;
+            *response = 8;
+            break;
+        case 22:
+            *request = 10;
+            *response = 10;
+            break;
+        default:
+            // Write single coil or register, and the functions without a fixed response
+            *request = 8;
+            *response = 8;
+            break;
+    }
+}
+
+// Time on the line of a frame of RTU bytes
+static uint32_t bus_model_frame_us(uint32_t bytes)
+{
+    // ASCII sends each byte as two characters, with ':' and CR LF around and a 1 byte LRC for the 2 byte CRC
+    uint32_t chars = (line_mode == MB_MODE_ASCII) ? (2 * bytes + 1) : bytes;
+    return (uint32_t)((uint64_t)chars * char_bits * 1000000 / line_baudrate);
+}
+
+// Silence closing a frame, as the T3.5 timer of the stack computes it
+static uint32_t bus_model_t35_us(void)
+{
+    if (line_mode == MB_MODE_ASCII) {
+        // The end of an ASCII frame is its CR LF
+        return 0;
+    }
+    return (line_baudrate > 19200) ? 1800 : (uint32_t)(35ULL * 11 * 100000 / line_baudrate);
+}
+
+void bus_model_init(const mb_communication_info_t *comm)
+{
+    line_mode = comm->mode;
+    line_baudrate = comm->baudrate ? comm->baudrate : 9600;
+    // Start bit, data bits, parity bit and one stop bit as the port configures the UART
+    char_bits = 1 + ((line_mode == MB_MODE_ASCII) ? 7 : 8) + ((comm->parity != UART_PARITY_DISABLE) ? 1 : 0) + 1;
+    ESP_LOGI(TAG, "%u baud, %u us per character, T3.5 %u us.", (unsigned)line_baudrate,
+             (unsigned)(char_bits * 1000000 / line_baudrate), (unsigned)bus_model_t35_us());
+}
+
+uint32_t bus_model_transaction_us(int slave_id, int func_id, uint16_t count)
+{
+    uint32_t request, response;
+    bus_model_frame_bytes(func_id, count, &request, &response);
+    uint32_t turnaround = CONFIG_GW_BUS_MODEL_TURNAROUND_US;
+    if ((slave_id > 0) && (slave_id < BUS_MODEL_SLAVES) && turnaround_us[slave_id]) {
+        turnaround = turnaround_us[slave_id];
+    }
+    uint32_t gap = ((slave_id > 0) && (slave_id < BUS_MODEL_SLAVES)) ? gaps[slave_id].gap_us : 0;
+    return bus_model_frame_us(request) + turnaround + bus_model_frame_us(response) + bus_model_t35_us() + gap;
+}
+
+void bus_model_learn(int slave_id, int func_id, uint16_t count, uint32_t bus_us)
+{
+    if ((slave_id < 1) || (slave_id >= BUS_MODEL_SLAVES)) {
+        return;
+    }
+    uint32_t request, response;
+    bus_model_frame_bytes(func_id, count, &request, &response);
+    uint32_t line_us = bus_model_frame_us(request) + bus_model_frame_us(response) + bus_model_t35_us();
+    // The rest is the slave thinking, plus the time the stack takes to start sending
+    uint32_t sample = (bus_us > line_us) ? (bus_us - line_us) : 1;
+    uint32_t average = turnaround_us[slave_id];
+    // Moving average over about 8 transactions, one slow answer does not move the plan much
+    turnaround_us[slave_id] = average ? (uint32_t)(average + ((int32_t)sample - (int32_t)average) / 8) : sample;
+}
+
+uint32_t bus_model_gap_us(int slave_id)
+{
+    return ((slave_id > 0) && (slave_id < BUS_MODEL_SLAVES)) ? gaps[slave_id].gap_us : 0;
+}
+
+void bus_model_learn_gap(int slave_id, bool back_to_back, bool failed)
+{
+    if ((slave_id < 1) || (slave_id >= BUS_MODEL_SLAVES)) {
+        return;
+    }
+    bus_gap_t *gap = &gaps[slave_id];
+    if (!failed) {
+        if (back_to_back && gap->gap_us && (++gap->short_ok >= BUS_MODEL_GAP_SHRINK_OK)) {
+            // The slave keeps up, try a shorter silence
+            uint32_t step = (gap->gap_us / 8 > BUS_MODEL_GAP_STEP_US) ? gap->gap_us / 8 : BUS_MODEL_GAP_STEP_US;
+            gap->gap_us = (gap->gap_us > step) ? gap->gap_us - step : 0;
+            gap->short_ok = 0;
+            gap->short_fails = 0;
+            gap->long_fails = 0;
+        }
+        return;
+    }
+    gap->short_ok = 0;
+    if (!back_to_back) {
+        if (gap->long_fails < UINT16_MAX) {
+            gap->long_fails++;
+        }
+        return;
+    }
+    // A noisy line fails after any silence, only failures that favour the short ones are the gap
+    if ((++gap->short_fails >= 2) && (gap->short_fails > gap->long_fails)) {
+        uint32_t gap_us = gap->gap_us ? gap->gap_us * 2 : BUS_MODEL_GAP_STEP_US;
+        gap->gap_us = (gap_us < CONFIG_GW_BUS_MODEL_GAP_MAX_US) ? gap_us : CONFIG_GW_BUS_MODEL_GAP_MAX_US;
+        gap->short_fails = 0;
+        gap->long_fails = 0;
+        ESP_LOGW(TAG, "Slave %d drops back-to-back requests, %u us of silence after its transactions.",
+                 slave_id, (unsigned)gap->gap_us);
+    }
+}
+
+void bus_model_report(cJSON *root)
+{
+    cJSON *line = cJSON_AddObjectToObject(root, "line");
+    cJSON_AddStringToObject(line, "mode", (line_mode == MB_MODE_ASCII) ? "ascii" : "rtu");
+    cJSON_AddNumberToObject(line, "baudrate", line_baudrate);
+    cJSON_AddNumberToObject(line, "charUs", (double)char_bits * 1000000 / line_baudrate);
+    cJSON_AddNumberToObject(line, "t35Us", bus_model_t35_us());
+    cJSON_AddNumberToObject(line, "defaultTurnaroundUs", CONFIG_GW_BUS_MODEL_TURNAROUND_US);
+    cJSON_AddNumberToObject(line, "limitPct", CONFIG_GW_BUS_MODEL_LIMIT_PCT);
+    cJSON *array = cJSON_AddArrayToObject(root, "slaves");
+    for (int slave = 1; slave < BUS_MODEL_SLAVES; slave++) {
+        if (!turnaround_us[slave] && !gaps[slave].gap_us) {
+            continue;
+        }
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "slaveId", slave);
+        if (turnaround_us[slave]) {
+            cJSON_AddNumberToObject(item, "turnaroundUs", turnaround_us[slave]);
+        } else {
+            cJSON_AddNullToObject(item, "turnaroundUs");
+        }
+        cJSON_AddNumberToObject(item, "gapUs", gaps[slave].gap_us);
+        cJSON_AddItemToArray(array, item);
+    }
+}
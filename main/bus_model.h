@@ -0,0 +1,87 @@
+/* Bus time cost model of the RTU segment
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cJSON.h"
+#include "sdkconfig.h"
+#include "mbcontroller.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Share of the bus time a scan plan should stay below
+#define BUS_MODEL_LIMIT             (CONFIG_GW_BUS_MODEL_LIMIT_PCT / 100.0)
+
+/**
+ * @brief Set the serial line the model computes the frame times for
+ *
+ * @param comm communication settings given to mbc_master_setup()
+ */
+void bus_model_init(const mb_communication_info_t *comm);
+
+/**
+ * @brief Predict the bus time of one transaction with a slave of the RTU segment
+ *
+ * The time runs from the start of the request to the end of the response detected by the stack:
+ * request and response frames, the response time of the slave and the T3.5 silence closing
+ * the response, plus the silence the slave needs after it, see bus_model_gap_us(). The response
+ * time is the one learned from the slave, or CONFIG_GW_BUS_MODEL_TURNAROUND_US until it answered once.
+ *
+ * @param slave_id address of the slave on the RTU segment
+ * @param func_id Modbus function
+ * @param count registers or coils of the request
+ * @return predicted time in us
+ */
+uint32_t bus_model_transaction_us(int slave_id, int func_id, uint16_t count);
+
+/**
+ * @brief Learn the response time of a slave from a measured transaction, bus engine side
+ *
+ * @param slave_id address of the slave on the RTU segment
+ * @param func_id Modbus function
+ * @param count registers or coils of the request
+ * @param bus_us measured time from the start of the request to the end of the response
+ */
+void bus_model_learn(int slave_id, int func_id, uint16_t count, uint32_t bus_us);
+
+/**
+ * @brief Get the silence a slave needs after a transaction before it takes the next request
+ *
+ * @param slave_id address of the slave on the RTU segment
+ * @return silence in us, 0 for slaves that take back-to-back requests
+ */
+uint32_t bus_model_gap_us(int slave_id);
+
+/**
+ * @brief Tune the silence of a slave from the result of a transaction, bus engine side
+ *
+ * Failures that come more often right after a transaction with the same slave than after a
+ * longer silence double the silence, up to CONFIG_GW_BUS_MODEL_GAP_MAX_US. A run of
+ * back-to-back transactions without failure shortens it again by an eighth, so each
+ * slave ends up close to the silence it needs.
+ *
+ * @param slave_id address of the slave on the RTU segment
+ * @param back_to_back the request followed a response of the same slave after the silence only
+ * @param failed no response or a corrupted one, an exception response is not a failure
+ */
+void bus_model_learn_gap(int slave_id, bool back_to_back, bool failed);
+
+/**
+ * @brief Add the line settings and the learned response times and silences to a JSON object
+ *
+ * @param root object to add "line" and "slaves" to
+ */
+void bus_model_report(cJSON *root);
+
+#ifdef __cplusplus
+}
+#endif
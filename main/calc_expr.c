@@ -0,0 +1,308 @@
+/* Calculated point expressions
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "calc_expr.h"
+
+typedef enum {
+    CALC_OP_CONST,                  // followed by the constant index
+    CALC_OP_POINT,                  // followed by the point index
+    CALC_OP_ADD,
+    CALC_OP_SUB,
+    CALC_OP_MUL,
+    CALC_OP_DIV,
+    CALC_OP_NEG,
+    CALC_OP_ABS,
+    CALC_OP_SQRT,
+    CALC_OP_MIN,
+    CALC_OP_MAX
+} calc_op_t;
+
+typedef struct {
+    const char *pos;
+    calc_expr_resolve_t resolve;
+    void *ctx;
+    calc_expr_t *expr;
+    int depth;                      // stack depth at the current point of the code
+    int nest;                       // unary minus, parentheses and function calls open at the current position
+    esp_err_t err;
+    const char *error;
+} calc_compiler_t;
+
+typedef struct {
+    const char *name;
+    calc_op_t op;
+    int args;
+} calc_func_t;
+
+static const calc_func_t calc_funcs[] = {
+    { "abs", CALC_OP_ABS, 1 },
+    { "sqrt", CALC_OP_SQRT, 1 },
+    { "min", CALC_OP_MIN, 2 },
+    { "max", CALC_OP_MAX, 2 },
+};
+
+static void calc_parse_sum(calc_compiler_t *c);
+
+static void calc_fail(calc_compiler_t *c, esp_err_t err, const char *error)
+{
+    if (c->err == ESP_OK) {
+        c->err = err;
+        c->error = error;
+    }
+}
+
+static void calc_skip_space(calc_compiler_t *c)
+{
+    while (isspace((unsigned char)*c->pos)) {
+        c->pos++;
+    }
+}
+
+static bool calc_accept(calc_compiler_t *c, char ch)
+{
+    calc_skip_space(c);
+    if (*c->pos == ch) {
+        c->pos++;
+        return true;
+    }
+    return false;
+}
+
+// Append one byte of code, pops stack values and pushes the result
+static void calc_emit(calc_compiler_t *c, uint8_t byte, int pops, int pushes)
+{
+    calc_expr_t *expr = c->expr;
+    if (expr->code_len >= CALC_EXPR_CODE_MAX) {
+        calc_fail(c, ESP_ERR_INVALID_SIZE, "expression is too long");
+        return;
+    }
+    expr->code[expr->code_len++] = byte;
+    c->depth += pushes - pops;
+    if (c->depth > CALC_EXPR_STACK_MAX) {
+        calc_fail(c, ESP_ERR_INVALID_SIZE, "expression is nested too deep");
+    }
+}
+
+static void calc_parse_number(calc_compiler_t *c)
+{
+    char *end = NULL;
+    double value = strtod(c->pos, &end);
+    c->pos = end;
+    calc_expr_t *expr = c->expr;
+    int index = 0;
+    // Reuse the slot of the same constant, scale factors are often repeated
+    while ((index < expr->const_count) && (expr->consts[index] != value)) {
+        index++;
+    }
+    if (index == expr->const_count) {
+        if (expr->const_count >= CALC_EXPR_CONST_MAX) {
+            calc_fail(c, ESP_ERR_INVALID_SIZE, "too many constants");
+            return;
+        }
+        expr->consts[expr->const_count++] = value;
+    }
+    calc_emit(c, CALC_OP_CONST, 0, 1);
+    calc_emit(c, (uint8_t)index, 0, 0);
+}
+
+static void calc_parse_name(calc_compiler_t *c)
+{
+    const char *name = c->pos;
+    while (isalnum((unsigned char)*c->pos) || (*c->pos == '_')) {
+        c->pos++;
+    }
+    size_t len = c->pos - name;
+    if (calc_accept(c, '(')) {
+        for (size_t i = 0; i < sizeof(calc_funcs) / sizeof(calc_funcs[0]); i++) {
+            const calc_func_t *func = &calc_funcs[i];
+            if ((strlen(func->name) != len) || strncmp(func->name, name, len)) {
+                continue;
+            }
+            for (int arg = 0; arg < func->args; arg++) {
+                if ((arg > 0) && !calc_accept(c, ',')) {
+                    calc_fail(c, ESP_ERR_INVALID_ARG, "missing function argument");
+                    return;
+                }
+                calc_parse_sum(c);
+            }
+            if (!calc_accept(c, ')')) {
+                calc_fail(c, ESP_ERR_INVALID_ARG, "missing ')' after function arguments");
+                return;
+            }
+            calc_emit(c, func->op, func->args, 1);
+            return;
+        }
+        calc_fail(c, ESP_ERR_INVALID_ARG, "unknown function");
+        return;
+    }
+    int index = c->resolve(name, len, c->ctx);
+    if ((index < 0) || (index >= 64)) {
+        calc_fail(c, ESP_ERR_INVALID_ARG, "unknown point");
+        return;
+    }
+    c->expr->inputs |= (1ULL << index);
+    calc_emit(c, CALC_OP_POINT, 0, 1);
+    calc_emit(c, (uint8_t)index, 0, 0);
+}
+
+static void calc_parse_unary(calc_compiler_t *c)
+{
+    calc_skip_space(c);
+    if (c->err != ESP_OK) {
+        return;
+    }
+    // Every recursion of the parser passes here, bound it before it runs out of task stack
+    if (c->nest >= CALC_EXPR_NEST_MAX) {
+        calc_fail(c, ESP_ERR_INVALID_SIZE, "expression nested too deep");
+        return;
+    }
+    c->nest++;
+    if (calc_accept(c, '-')) {
+        calc_parse_unary(c);
+        calc_emit(c, CALC_OP_NEG, 1, 1);
+    } else if (calc_accept(c, '(')) {
+        calc_parse_sum(c);
+        if (!calc_accept(c, ')')) {
+            calc_fail(c, ESP_ERR_INVALID_ARG, "missing ')'");
+        }
+    } else if (isdigit((unsigned char)*c->pos) || (*c->pos == '.')) {
+        calc_parse_number(c);
+    } else if (isalpha((unsigned char)*c->pos) || (*c->pos == '_')) {
+        calc_parse_name(c);
+    } else {
+        calc_fail(c, ESP_ERR_INVALID_ARG, "operand expected");
+    }
+    c->nest--;
+}
+
+static void calc_parse_product(calc_compiler_t *c)
+{
+    calc_parse_unary(c);
+    while (c->err == ESP_OK) {
+        if (calc_accept(c, '*')) {
+            calc_parse_unary(c);
+            calc_emit(c, CALC_OP_MUL, 2, 1);
+        } else if (calc_accept(c, '/')) {
+            calc_parse_unary(c);
+            calc_emit(c, CALC_OP_DIV, 2, 1);
+        } else {
+            break;
+        }
+    }
+}
+
+static void calc_parse_sum(calc_compiler_t *c)
+{
+    calc_parse_product(c);
+    while (c->err == ESP_OK) {
+        if (calc_accept(c, '+')) {
+            calc_parse_product(c);
+            calc_emit(c, CALC_OP_ADD, 2, 1);
+        } else if (calc_accept(c, '-')) {
+            calc_parse_product(c);
+            calc_emit(c, CALC_OP_SUB, 2, 1);
+        } else {
+            break;
+        }
+    }
+}
+
+esp_err_t calc_expr_compile(const char *text, calc_expr_resolve_t resolve, void *ctx,
+                            calc_expr_t *expr, const char **error)
+{
+    if (!text || !resolve || !expr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(expr, 0, sizeof(calc_expr_t));
+    if (strnlen(text, CALC_EXPR_TEXT_MAX + 1) > CALC_EXPR_TEXT_MAX) {
+        if (error) {
+            *error = "expression too long";
+        }
+        return ESP_ERR_INVALID_SIZE;
+    }
+    calc_compiler_t c = {
+        .pos = text,
+        .resolve = resolve,
+        .ctx = ctx,
+        .expr = expr,
+        .depth = 0,
+        .nest = 0,
+        .err = ESP_OK,
+        .error = NULL
+    };
+    calc_parse_sum(&c);
+    calc_skip_space(&c);
+    if ((c.err == ESP_OK) && (*c.pos != '\0')) {
+        calc_fail(&c, ESP_ERR_INVALID_ARG, "unexpected character");
+    }
+    if (error) {
+        *error = c.error;
+    }
+    return c.err;
+}
+
+bool calc_expr_eval(const calc_expr_t *expr, const double *values, double *result)
+{
+    double stack[CALC_EXPR_STACK_MAX];
+    int sp = 0;
+    // The compiler checked the stack depth and operands, so the code is trusted here
+    for (int pc = 0; pc < expr->code_len; pc++) {
+        switch (expr->code[pc]) {
+            case CALC_OP_CONST:
+                stack[sp++] = expr->consts[expr->code[++pc]];
+                break;
+            case CALC_OP_POINT:
+                stack[sp++] = values[expr->code[++pc]];
+                break;
+            case CALC_OP_ADD:
+                sp--;
+                stack[sp - 1] += stack[sp];
+                break;
+            case CALC_OP_SUB:
+                sp--;
+                stack[sp - 1] -= stack[sp];
+                break;
+            case CALC_OP_MUL:
+                sp--;
+                stack[sp - 1] *= stack[sp];
+                break;
+            case CALC_OP_DIV:
+                sp--;
+                stack[sp - 1] /= stack[sp];
+                break;
+            case CALC_OP_NEG:
+                stack[sp - 1] = -stack[sp - 1];
+                break;
+            case CALC_OP_ABS:
+                stack[sp - 1] = fabs(stack[sp - 1]);
+                break;
+            case CALC_OP_SQRT:
+                stack[sp - 1] = sqrt(stack[sp - 1]);
+                break;
+            case CALC_OP_MIN:
+                sp--;
+                stack[sp - 1] = fmin(stack[sp - 1], stack[sp]);
+                break;
+            case CALC_OP_MAX:
+                sp--;
+                stack[sp - 1] = fmax(stack[sp - 1], stack[sp]);
+                break;
+            default:
+                return false;
+        }
+    }
+    if (sp != 1) {
+        return false;
+    }
+    *result = stack[0];
+    return isfinite(*result);
+}
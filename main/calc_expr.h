@@ -0,0 +1,79 @@
+/* Calculated point expressions
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CALC_EXPR_CODE_MAX      (CONFIG_GW_CALC_CODE_SIZE)
+#define CALC_EXPR_CONST_MAX     (8)
+#define CALC_EXPR_STACK_MAX     (8)
+#define CALC_EXPR_TEXT_MAX      (256)
+#define CALC_EXPR_NEST_MAX      (32)
+
+/**
+ * @brief Expression compiled to the bytecode of a small stack machine
+ *
+ * Inputs are referenced by point index, so evaluation does no name lookup.
+ */
+typedef struct {
+    uint8_t code[CALC_EXPR_CODE_MAX];
+    uint8_t code_len;
+    uint8_t const_count;
+    double consts[CALC_EXPR_CONST_MAX];
+    uint64_t inputs;                /*!< Bit mask of the point indexes used by the expression */
+} calc_expr_t;
+
+/**
+ * @brief Resolve a point name to its index
+ *
+ * @return point index (0..63) or -1 if the name is unknown
+ */
+typedef int (*calc_expr_resolve_t)(const char *name, size_t len, void *ctx);
+
+/**
+ * @brief Compile an expression
+ *
+ * Syntax: numbers, point names, + - * /, unary minus, parentheses and
+ * the functions abs(x), sqrt(x), min(x, y), max(x, y).
+ *
+ * @param text expression text
+ * @param resolve point name resolver
+ * @param ctx resolver context
+ * @param[out] expr compiled expression
+ * @param[out] error static error description on failure, can be NULL
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG on syntax error or unknown point
+ *     - ESP_ERR_INVALID_SIZE if the expression does not fit CALC_EXPR_* limits, including
+ *       its length and the nesting of unary minus, parentheses and function calls
+ */
+esp_err_t calc_expr_compile(const char *text, calc_expr_resolve_t resolve, void *ctx,
+                            calc_expr_t *expr, const char **error);
+
+/**
+ * @brief Evaluate a compiled expression
+ *
+ * @param expr compiled expression
+ * @param values point values indexed by point index
+ * @param[out] result value of the expression
+ * @return false if the result is not a finite number (for example division by zero)
+ */
+bool calc_expr_eval(const calc_expr_t *expr, const double *values, double *result);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,182 @@
+/* CBOR (RFC 8949) encoder writing straight into a buffer
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <math.h>
+#include <string.h>
+#include "cbor_writer.h"
+
+// Major types
+#define CBOR_UINT                   (0)
+#define CBOR_NEGINT                 (1)
+#define CBOR_BYTES                  (2)
+#define CBOR_TEXT                   (3)
+#define CBOR_ARRAY                  (4)
+#define CBOR_MAP                    (5)
+#define CBOR_TAG                    (6)
+
+// Initial bytes of the simple values and floats
+#define CBOR_FALSE                  (0xF4)
+#define CBOR_TRUE                   (0xF5)
+#define CBOR_NULL                   (0xF6)
+#define CBOR_FLOAT32                (0xFA)
+#define CBOR_FLOAT64                (0xFB)
+
+static void cbor_write(cbor_writer_t *writer, const uint8_t *data, size_t len)
+{
+    // Keep counting past the end, so the caller learns the size it needs
+    if (writer->buf && (writer->len + len <= writer->size)) {
+        memcpy(&writer->buf[writer->len], data, len);
+    }
+    writer->len += len;
+}
+
+// Initial byte and argument, in the shortest form
+static void cbor_put_head(cbor_writer_t *writer, uint8_t major, uint64_t arg)
+{
+    uint8_t head[9];
+    size_t len;
+    if (arg < 24) {
+        head[0] = (uint8_t)((major << 5) | arg);
+        len = 1;
+    } else if (arg <= UINT8_MAX) {
+        head[0] = (uint8_t)((major << 5) | 24);
+        len = 2;
+    } else if (arg <= UINT16_MAX) {
+        head[0] = (uint8_t)((major << 5) | 25);
+        len = 3;
+    } else if (arg <= UINT32_MAX) {
+        head[0] = (uint8_t)((major << 5) | 26);
+        len = 5;
+    } else {
+        head[0] = (uint8_t)((major << 5) | 27);
+        len = 9;
+    }
+    // Big-endian argument after the initial byte
+    for (size_t i = len - 1; i > 0; i--) {
+        head[i] = (uint8_t)arg;
+        arg >>= 8;
+    }
+    cbor_write(writer, head, len);
+}
+
+void cbor_writer_init(cbor_writer_t *writer, uint8_t *buf, size_t size)
+{
+    writer->buf = buf;
+    writer->size = size;
+    writer->len = 0;
+}
+
+void cbor_put_uint(cbor_writer_t *writer, uint64_t value)
+{
+    cbor_put_head(writer, CBOR_UINT, value);
+}
+
+void cbor_put_int(cbor_writer_t *writer, int64_t value)
+{
+    if (value < 0) {
+        // -1 - n without overflowing on INT64_MIN
+        cbor_put_head(writer, CBOR_NEGINT, (uint64_t)(-(value + 1)));
+    } else {
+        cbor_put_head(writer, CBOR_UINT, (uint64_t)value);
+    }
+}
+
+void cbor_put_number(cbor_writer_t *writer, double value)
+{
+    if ((value == floor(value)) && (value >= -9007199254740992.0) && (value <= 9007199254740992.0)) {
+        // Integral and exact in a double, like most register values and time stamps
+        cbor_put_int(writer, (int64_t)value);
+        return;
+    }
+    uint8_t data[9];
+    uint64_t bits;
+    size_t len;
+    float single = (float)value;
+    if ((double)single == value) {
+        uint32_t word;
+        memcpy(&word, &single, sizeof(word));
+        data[0] = CBOR_FLOAT32;
+        bits = word;
+        len = 5;
+    } else {
+        // NaN never compares equal, it takes the float64 form
+        memcpy(&bits, &value, sizeof(bits));
+        data[0] = CBOR_FLOAT64;
+        len = 9;
+    }
+    for (size_t i = len - 1; i > 0; i--) {
+        data[i] = (uint8_t)bits;
+        bits >>= 8;
+    }
+    cbor_write(writer, data, len);
+}
+
+void cbor_put_bool(cbor_writer_t *writer, bool value)
+{
+    uint8_t data = value ? CBOR_TRUE : CBOR_FALSE;
+    cbor_write(writer, &data, 1);
+}
+
+void cbor_put_null(cbor_writer_t *writer)
+{
+    uint8_t data = CBOR_NULL;
+    cbor_write(writer, &data, 1);
+}
+
+void cbor_put_text(cbor_writer_t *writer, const char *text)
+{
+    size_t len = strlen(text);
+    cbor_put_head(writer, CBOR_TEXT, len);
+    cbor_write(writer, (const uint8_t *)text, len);
+}
+
+void cbor_put_bytes(cbor_writer_t *writer, const uint8_t *data, size_t len)
+{
+    cbor_put_head(writer, CBOR_BYTES, len);
+    cbor_write(writer, data, len);
+}
+
+void cbor_put_tag(cbor_writer_t *writer, uint64_t tag)
+{
+    cbor_put_head(writer, CBOR_TAG, tag);
+}
+
+void cbor_put_array(cbor_writer_t *writer, size_t count)
+{
+    cbor_put_head(writer, CBOR_ARRAY, count);
+}
+
+void cbor_put_map(cbor_writer_t *writer, size_t count)
+{
+    cbor_put_head(writer, CBOR_MAP, count);
+}
+
+void cbor_put_json(cbor_writer_t *writer, const cJSON *item)
+{
+    const cJSON *child;
+    if (cJSON_IsObject(item)) {
+        cbor_put_map(writer, cJSON_GetArraySize(item));
+        cJSON_ArrayForEach(child, item) {
+            cbor_put_text(writer, child->string ? child->string : "");
+            cbor_put_json(writer, child);
+        }
+    } else if (cJSON_IsArray(item)) {
+        cbor_put_array(writer, cJSON_GetArraySize(item));
+        cJSON_ArrayForEach(child, item) {
+            cbor_put_json(writer, child);
+        }
+    } else if (cJSON_IsNumber(item)) {
+        cbor_put_number(writer, item->valuedouble);
+    } else if (cJSON_IsString(item)) {
+        cbor_put_text(writer, item->valuestring);
+    } else if (cJSON_IsBool(item)) {
+        cbor_put_bool(writer, cJSON_IsTrue(item));
+    } else {
+        cbor_put_null(writer);
+    }
+}
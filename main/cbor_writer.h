@@ -0,0 +1,86 @@
+/* CBOR (RFC 8949) encoder writing straight into a buffer
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cJSON.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Typed array of big-endian uint16 (RFC 8746), the byte order of Modbus registers
+#define CBOR_TAG_UINT16_BE_ARRAY    (65)
+
+/**
+ * @brief Output of the encoder
+ *
+ * Without a buffer the writer only counts the bytes, so a first pass gives the size
+ * of the buffer to allocate for the second one.
+ */
+typedef struct {
+    uint8_t *buf;                   /*!< Output buffer, NULL to only count */
+    size_t size;                    /*!< Size of the buffer */
+    size_t len;                     /*!< Bytes written or counted */
+} cbor_writer_t;
+
+/**
+ * @brief Start writing into a buffer
+ *
+ * @param writer writer to initialize
+ * @param buf output buffer, NULL to only count the bytes
+ * @param size size of the buffer
+ */
+void cbor_writer_init(cbor_writer_t *writer, uint8_t *buf, size_t size);
+
+/**
+ * @brief Check if everything written fitted into the buffer
+ */
+static inline bool cbor_writer_ok(const cbor_writer_t *writer)
+{
+    return !writer->buf || (writer->len <= writer->size);
+}
+
+void cbor_put_uint(cbor_writer_t *writer, uint64_t value);
+void cbor_put_int(cbor_writer_t *writer, int64_t value);
+
+/**
+ * @brief Write a number, integral values are written as integers and the others in the
+ *        smallest float that keeps them exact
+ */
+void cbor_put_number(cbor_writer_t *writer, double value);
+void cbor_put_bool(cbor_writer_t *writer, bool value);
+void cbor_put_null(cbor_writer_t *writer);
+void cbor_put_text(cbor_writer_t *writer, const char *text);
+void cbor_put_bytes(cbor_writer_t *writer, const uint8_t *data, size_t len);
+void cbor_put_tag(cbor_writer_t *writer, uint64_t tag);
+
+/**
+ * @brief Start an array of count items, the items follow
+ */
+void cbor_put_array(cbor_writer_t *writer, size_t count);
+
+/**
+ * @brief Start a map of count pairs, the keys and values follow
+ */
+void cbor_put_map(cbor_writer_t *writer, size_t count);
+
+/**
+ * @brief Write a cJSON tree, objects become maps with text keys
+ *
+ * @param writer output
+ * @param item tree to write
+ */
+void cbor_put_json(cbor_writer_t *writer, const cJSON *item);
+
+#ifdef __cplusplus
+}
+#endif
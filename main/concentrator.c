@@ -0,0 +1,303 @@
+/* Data concentrator serving the point cache as a Modbus TCP slave
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <math.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "mbcontroller.h"
+#include "point_table.h"
+#include "concentrator.h"
+
+#define CONCENTRATOR_MAP_MAX            (POINT_TABLE_MAX)
+#define CONCENTRATOR_TASK_STACK_SIZE    (2048)
+#define CONCENTRATOR_TASK_PRIO          (4)
+// Wait for upstream access notifications, the queue is drained so the slave task never blocks on it
+#define CONCENTRATOR_NOTIFY_WAIT_MS     (1000)
+
+typedef struct {
+    char point_name[POINT_NAME_LEN];
+    int point;
+    uint16_t address;
+    uint16_t regs;
+    concentrator_format_t format;
+} concentrator_map_t;
+
+static const char *TAG = "CONCENTRATOR";
+
+static const char *concentrator_format_names[] = { "u16", "i16", "u32", "f32" };
+
+// Register map served upstream, written here and read by the Modbus slave task
+static uint16_t concentrator_regs[CONCENTRATOR_REGS];
+// Copy served to holding reads, upstream writes land here and are undone instead of changing the cache view
+static uint16_t concentrator_holding[CONCENTRATOR_REGS];
+static uint8_t concentrator_valid[(CONCENTRATOR_REGS + 7) / 8];
+// Keeps the two registers of 32 bit values consistent in upstream responses
+static mb_seqlock_t concentrator_seqlock;
+
+static concentrator_map_t maps[CONCENTRATOR_MAP_MAX];
+static int map_count;
+static SemaphoreHandle_t concentrator_lock;
+static uint32_t upstream_reads;
+static uint32_t upstream_writes;
+
+static uint16_t concentrator_format_regs(concentrator_format_t format)
+{
+    return (format >= CONCENTRATOR_FORMAT_U32) ? 2 : 1;
+}
+
+static void concentrator_set_valid(uint16_t address, uint16_t regs, bool valid)
+{
+    for (uint16_t reg = address; reg < address + regs; reg++) {
+        if (valid) {
+            concentrator_valid[reg >> 3] |= (uint8_t)(1 << (reg & 7));
+        } else {
+            concentrator_valid[reg >> 3] &= (uint8_t)~(1 << (reg & 7));
+        }
+    }
+}
+
+// Encode the value into the registers of a mapping, called with the lock taken
+static void concentrator_write(const concentrator_map_t *map, double value)
+{
+    uint16_t *regs = &concentrator_regs[map->address];
+    switch (map->format) {
+        case CONCENTRATOR_FORMAT_U16:
+            regs[0] = (uint16_t)fmin(fmax(round(value), 0), UINT16_MAX);
+            break;
+        case CONCENTRATOR_FORMAT_I16:
+            regs[0] = (uint16_t)(int16_t)fmin(fmax(round(value), INT16_MIN), INT16_MAX);
+            break;
+        case CONCENTRATOR_FORMAT_U32: {
+            uint32_t word = (uint32_t)fmin(fmax(round(value), 0), UINT32_MAX);
+            regs[0] = (uint16_t)(word >> 16);
+            regs[1] = (uint16_t)word;
+            break;
+        }
+        case CONCENTRATOR_FORMAT_F32: {
+            float real = (float)value;
+            uint32_t word;
+            memcpy(&word, &real, sizeof(word));
+            regs[0] = (uint16_t)(word >> 16);
+            regs[1] = (uint16_t)word;
+            break;
+        }
+        default:
+            break;
+    }
+    memcpy(&concentrator_holding[map->address], regs, map->regs * sizeof(uint16_t));
+}
+
+// Restore the holding registers written upstream from the cache view
+static void concentrator_undo_write(uint16_t address, uint16_t regs)
+{
+    if (address >= CONCENTRATOR_REGS) {
+        return;
+    }
+    regs = (regs < CONCENTRATOR_REGS - address) ? regs : (uint16_t)(CONCENTRATOR_REGS - address);
+    xSemaphoreTake(concentrator_lock, portMAX_DELAY);
+    mbc_slave_area_begin(&concentrator_seqlock);
+    memcpy(&concentrator_holding[address], &concentrator_regs[address], regs * sizeof(uint16_t));
+    mbc_slave_area_commit(&concentrator_seqlock);
+    xSemaphoreGive(concentrator_lock);
+}
+
+// Drain the access notifications of the slave controller and count them
+static void concentrator_task(void *arg)
+{
+    mb_param_info_t info;
+    for (;;) {
+        if (mbc_slave_get_param_info(&info, CONCENTRATOR_NOTIFY_WAIT_MS) != ESP_OK) {
+            continue;
+        }
+        if (info.type & MB_EVENT_HOLDING_REG_WR) {
+            upstream_writes++;
+            concentrator_undo_write(info.mb_offset, (uint16_t)info.size);
+            ESP_LOGW(TAG, "Upstream write of %u registers at %u is not forwarded.",
+                     (unsigned)info.size, (unsigned)info.mb_offset);
+        } else {
+            upstream_reads++;
+        }
+    }
+}
+
+esp_err_t concentrator_start(void *netif)
+{
+    concentrator_lock = xSemaphoreCreateMutex();
+    if (!concentrator_lock) {
+        ESP_LOGE(TAG, "no memory for concentrator lock.");
+        return ESP_ERR_NO_MEM;
+    }
+    void *slave_handler = NULL;
+    esp_err_t err = mbc_slave_init_tcp(&slave_handler);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mb slave initialization fail, returns(0x%x).", (int)err);
+        return err;
+    }
+
+    mb_communication_info_t comm_info = { 0 };
+    comm_info.ip_mode = MB_MODE_TCP;
+    comm_info.ip_port = CONFIG_GW_CONCENTRATOR_PORT;
+    comm_info.ip_addr_type = MB_IPV4;
+    comm_info.ip_addr = NULL;
+    comm_info.ip_netif_ptr = netif;
+    err = mbc_slave_setup((void *)&comm_info);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mb slave setup fail, returns(0x%x).", (int)err);
+        return err;
+    }
+
+    // The register map answers both read functions, PLCs differ in which one they use.
+    // Holding reads are served from a copy, so upstream writes never reach the cache view.
+    mb_register_area_descriptor_t reg_area = {
+        .start_offset = 0,
+        .type = MB_PARAM_INPUT,
+        .address = (void *)concentrator_regs,
+        .size = sizeof(concentrator_regs)
+    };
+    mbc_slave_seqlock_init(&concentrator_seqlock);
+    err = mbc_slave_set_descriptor(reg_area);
+    if (err == ESP_OK) {
+        reg_area.type = MB_PARAM_HOLDING;
+        reg_area.address = (void *)concentrator_holding;
+        err = mbc_slave_set_descriptor(reg_area);
+    }
+    // Both areas are updated together, so they share the lock
+    if (err == ESP_OK) {
+        err = mbc_slave_set_seqlock(MB_PARAM_INPUT, 0, &concentrator_seqlock);
+    }
+    if (err == ESP_OK) {
+        err = mbc_slave_set_seqlock(MB_PARAM_HOLDING, 0, &concentrator_seqlock);
+    }
+    if (err == ESP_OK) {
+        reg_area.type = MB_PARAM_DISCRETE;
+        reg_area.address = (void *)concentrator_valid;
+        reg_area.size = sizeof(concentrator_valid);
+        err = mbc_slave_set_descriptor(reg_area);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mb slave area descriptor fail, returns(0x%x).", (int)err);
+        return err;
+    }
+
+    BaseType_t status = xTaskCreatePinnedToCore(concentrator_task, "concentrator",
+                                                CONCENTRATOR_TASK_STACK_SIZE, NULL,
+                                                CONCENTRATOR_TASK_PRIO, NULL,
+                                                CONFIG_GW_NET_CORE);
+    if (status != pdPASS) {
+        ESP_LOGE(TAG, "concentrator task creation error.");
+        return ESP_ERR_NO_MEM;
+    }
+    err = mbc_slave_start();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mb slave start fail, returns(0x%x).", (int)err);
+        return err;
+    }
+    ESP_LOGI(TAG, "Concentrator serving %u registers on port %u.",
+             (unsigned)CONCENTRATOR_REGS, (unsigned)CONFIG_GW_CONCENTRATOR_PORT);
+    return ESP_OK;
+}
+
+esp_err_t concentrator_format_from_name(const char *name, concentrator_format_t *format)
+{
+    for (int i = 0; name && (i < sizeof(concentrator_format_names) / sizeof(concentrator_format_names[0])); i++) {
+        if (!strcmp(name, concentrator_format_names[i])) {
+            *format = (concentrator_format_t)i;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t concentrator_map(const char *point, uint16_t address, concentrator_format_t format)
+{
+    if (!concentrator_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (format > CONCENTRATOR_FORMAT_F32) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint16_t regs = concentrator_format_regs(format);
+    if ((uint32_t)address + regs > CONCENTRATOR_REGS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int index = point_table_index(point);
+    if (index < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(concentrator_lock, portMAX_DELAY);
+    for (int i = 0; i < map_count; i++) {
+        if ((address < maps[i].address + maps[i].regs) && (maps[i].address < address + regs)) {
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+    }
+    if ((err == ESP_OK) && (map_count >= CONCENTRATOR_MAP_MAX)) {
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err == ESP_OK) {
+        concentrator_map_t *map = &maps[map_count++];
+        strlcpy(map->point_name, point, POINT_NAME_LEN);
+        map->point = index;
+        map->address = address;
+        map->regs = regs;
+        map->format = format;
+    }
+    xSemaphoreGive(concentrator_lock);
+    if (err == ESP_OK) {
+        // Fill the registers with the cached value instead of waiting for the next change
+        point_table_refresh(index);
+    }
+    return err;
+}
+
+void concentrator_update(int point, double value, bool valid)
+{
+    if (!concentrator_lock) {
+        return;
+    }
+    xSemaphoreTake(concentrator_lock, portMAX_DELAY);
+    for (int i = 0; i < map_count; i++) {
+        const concentrator_map_t *map = &maps[i];
+        if (map->point != point) {
+            continue;
+        }
+        if (valid) {
+            mbc_slave_area_begin(&concentrator_seqlock);
+            concentrator_write(map, value);
+            mbc_slave_area_commit(&concentrator_seqlock);
+        }
+        concentrator_set_valid(map->address, map->regs, valid);
+    }
+    xSemaphoreGive(concentrator_lock);
+}
+
+void concentrator_report(cJSON *root)
+{
+    if (!concentrator_lock) {
+        return;
+    }
+    xSemaphoreTake(concentrator_lock, portMAX_DELAY);
+    cJSON_AddNumberToObject(root, "port", CONFIG_GW_CONCENTRATOR_PORT);
+    cJSON_AddNumberToObject(root, "registers", CONCENTRATOR_REGS);
+    cJSON_AddNumberToObject(root, "upstreamReads", upstream_reads);
+    cJSON_AddNumberToObject(root, "upstreamWrites", upstream_writes);
+    cJSON *array = cJSON_AddArrayToObject(root, "map");
+    for (int i = 0; i < map_count; i++) {
+        const concentrator_map_t *map = &maps[i];
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "point", map->point_name);
+        cJSON_AddNumberToObject(item, "address", map->address);
+        cJSON_AddStringToObject(item, "format", concentrator_format_names[map->format]);
+        cJSON_AddItemToArray(array, item);
+    }
+    xSemaphoreGive(concentrator_lock);
+}
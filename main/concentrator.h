@@ -0,0 +1,87 @@
+/* Data concentrator serving the point cache as a Modbus TCP slave
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "cJSON.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CONCENTRATOR_REGS       (CONFIG_GW_CONCENTRATOR_REGS)
+
+typedef enum {
+    CONCENTRATOR_FORMAT_U16,        /*!< One register, rounded and clamped to 0..65535 */
+    CONCENTRATOR_FORMAT_I16,        /*!< One register, rounded and clamped to -32768..32767 */
+    CONCENTRATOR_FORMAT_U32,        /*!< Two registers, high word first */
+    CONCENTRATOR_FORMAT_F32         /*!< Two registers, IEEE 754 single, high word first */
+} concentrator_format_t;
+
+/**
+ * @brief Start the Modbus TCP slave serving the concentrator register map
+ *
+ * The map is served both as input registers and holding registers, and discrete input N
+ * tells if register N holds a valid value. Upstream writes to holding registers are not
+ * forwarded and get overwritten by the next change of the point.
+ *
+ * @param netif network interface to listen on
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NO_MEM if the tasks or locks could not be created
+ *     - error of the slave controller
+ */
+esp_err_t concentrator_start(void *netif);
+
+/**
+ * @brief Map a point of the point table into the concentrator register map
+ *
+ * @param point point name
+ * @param address first register in the concentrator map
+ * @param format register encoding of the value
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NOT_FOUND if the point does not exist
+ *     - ESP_ERR_INVALID_ARG if the registers do not fit in the map
+ *     - ESP_ERR_INVALID_STATE if the registers overlap another mapping or the concentrator is not started
+ *     - ESP_ERR_NO_MEM if all mappings are in use
+ */
+esp_err_t concentrator_map(const char *point, uint16_t address, concentrator_format_t format);
+
+/**
+ * @brief Get the register format from its name ("u16", "i16", "u32" or "f32")
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG if the name is unknown
+ */
+esp_err_t concentrator_format_from_name(const char *name, concentrator_format_t *format);
+
+/**
+ * @brief Update the registers mapped to a point, called by the point table when the point changes
+ *
+ * @param point point index
+ * @param value new value
+ * @param valid false if the value could not be read, the registers then keep the last value
+ */
+void concentrator_update(int point, double value, bool valid);
+
+/**
+ * @brief Add the mappings and the upstream access counters to a JSON object
+ *
+ * @param root object to add to
+ */
+void concentrator_report(cJSON *root);
+
+#ifdef __cplusplus
+}
+#endif
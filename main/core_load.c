@@ -0,0 +1,106 @@
+/* Per-core load report
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "core_load.h"
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+// Number of tasks whose previous run time is remembered between two reports
+#define CORE_LOAD_MAX_TASKS     (48)
+
+typedef struct {
+    UBaseType_t task_number;
+    uint32_t run_time;
+} core_load_prev_t;
+
+static const char *TAG = "CORE_LOAD";
+
+static core_load_prev_t prev_tasks[CORE_LOAD_MAX_TASKS];
+static UBaseType_t prev_task_count;
+static uint32_t prev_total_time;
+
+static uint32_t core_load_prev_run_time(UBaseType_t task_number)
+{
+    for (UBaseType_t i = 0; i < prev_task_count; i++) {
+        if (prev_tasks[i].task_number == task_number) {
+            return prev_tasks[i].run_time;
+        }
+    }
+    return 0;
+}
+
+esp_err_t core_load_report(cJSON *root)
+{
+    UBaseType_t task_count = uxTaskGetNumberOfTasks();
+    TaskStatus_t *tasks = calloc(task_count, sizeof(TaskStatus_t));
+    if (!tasks) {
+        ESP_LOGE(TAG, "no memory for task snapshot.");
+        return ESP_ERR_NO_MEM;
+    }
+    configRUN_TIME_COUNTER_TYPE total_time = 0;
+    task_count = uxTaskGetSystemState(tasks, task_count, &total_time);
+    // Every core spends the whole window either in a task or in its idle task
+    uint32_t window = (uint32_t)total_time - prev_total_time;
+    if (window == 0) {
+        window = 1;
+    }
+
+    cJSON *cores = cJSON_AddArrayToObject(root, "cores");
+    cJSON *task_array = cJSON_AddArrayToObject(root, "tasks");
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        TaskHandle_t idle = xTaskGetIdleTaskHandleForCPU(core);
+        for (UBaseType_t i = 0; i < task_count; i++) {
+            if (tasks[i].xHandle == idle) {
+                uint32_t idle_time = (uint32_t)tasks[i].ulRunTimeCounter
+                                        - core_load_prev_run_time(tasks[i].xTaskNumber);
+                double load = 100.0 - (100.0 * idle_time / window);
+                cJSON *item = cJSON_CreateObject();
+                cJSON_AddNumberToObject(item, "core", core);
+                cJSON_AddNumberToObject(item, "load", (load < 0) ? 0 : load);
+                cJSON_AddItemToArray(cores, item);
+                break;
+            }
+        }
+    }
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        uint32_t run_time = (uint32_t)tasks[i].ulRunTimeCounter
+                                - core_load_prev_run_time(tasks[i].xTaskNumber);
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", tasks[i].pcTaskName);
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        cJSON_AddNumberToObject(item, "core", (tasks[i].xCoreID == tskNO_AFFINITY) ? -1 : tasks[i].xCoreID);
+#endif
+        cJSON_AddNumberToObject(item, "load", 100.0 * run_time / window);
+        cJSON_AddItemToArray(task_array, item);
+    }
+
+    // Remember this snapshot as the start of the next window
+    prev_task_count = (task_count < CORE_LOAD_MAX_TASKS) ? task_count : CORE_LOAD_MAX_TASKS;
+    for (UBaseType_t i = 0; i < prev_task_count; i++) {
+        prev_tasks[i].task_number = tasks[i].xTaskNumber;
+        prev_tasks[i].run_time = (uint32_t)tasks[i].ulRunTimeCounter;
+    }
+    prev_total_time = (uint32_t)total_time;
+    cJSON_AddNumberToObject(root, "windowUs", window);
+    free(tasks);
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t core_load_report(cJSON *root)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
@@ -0,0 +1,34 @@
+/* Per-core load report
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "cJSON.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Add the load of every core and task since the previous call to a JSON object
+ *
+ * Requires CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS.
+ *
+ * @param root object to add "cores" and "tasks" arrays to
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NO_MEM if the task snapshot could not be allocated
+ *     - ESP_ERR_NOT_SUPPORTED if run time statistics are disabled
+ */
+esp_err_t core_load_report(cJSON *root);
+
+#ifdef __cplusplus
+}
+#endif
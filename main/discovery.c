@@ -0,0 +1,354 @@
+/* Slave discovery on the RTU segment and on Modbus TCP hosts
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+#include "mb_worker.h"
+#include "discovery.h"
+
+#define DISCOVERY_DEVICES_MAX       (CONFIG_GW_DISCOVERY_DEVICES_MAX)
+#define DISCOVERY_PARALLEL          (CONFIG_GW_DISCOVERY_PARALLEL)
+#define DISCOVERY_TCP_TIMEOUT_MS    (CONFIG_GW_DISCOVERY_TCP_TIMEOUT_MS)
+#define DISCOVERY_TASK_STACK_SIZE   (4096)
+#define DISCOVERY_TASK_PRIO         (3)
+#define DISCOVERY_MBAP_LEN          (7)
+// MBAP header and the largest Report Slave ID response kept
+#define DISCOVERY_FRAME_LEN         (DISCOVERY_MBAP_LEN + 2 + DISCOVERY_IDENT_LEN)
+
+typedef struct {
+    uint32_t host;                  // IPv4 address in network byte order, 0 on the RTU segment
+    uint8_t address;
+    uint8_t function;               // function the device answered
+    uint8_t ident_len;
+    uint8_t ident[DISCOVERY_IDENT_LEN];
+    int64_t seen;
+} discovery_device_t;
+
+typedef struct {
+    int sock;
+    uint32_t host;
+    bool connected;
+} discovery_probe_t;
+
+static const char *TAG = "DISCOVERY";
+
+static SemaphoreHandle_t discovery_lock;
+static TaskHandle_t discovery_task_handle;
+static mb_channel_t *discovery_channel;
+static discovery_request_t request;
+static discovery_device_t devices[DISCOVERY_DEVICES_MAX];
+static int device_count;
+static bool running;
+static int probed;
+static int total;
+static int64_t started;
+static int64_t finished;
+
+// Add or refresh an inventory entry
+static void discovery_store(uint32_t host, uint8_t address, uint8_t function, const uint8_t *ident, size_t ident_len)
+{
+    xSemaphoreTake(discovery_lock, portMAX_DELAY);
+    discovery_device_t *device = NULL;
+    for (int i = 0; i < device_count; i++) {
+        if ((devices[i].host == host) && (devices[i].address == address)) {
+            device = &devices[i];
+            break;
+        }
+    }
+    if (!device && (device_count < DISCOVERY_DEVICES_MAX)) {
+        device = &devices[device_count++];
+    }
+    if (device) {
+        device->host = host;
+        device->address = address;
+        device->function = function;
+        device->ident_len = (uint8_t)((ident_len < DISCOVERY_IDENT_LEN) ? ident_len : DISCOVERY_IDENT_LEN);
+        if (device->ident_len) {
+            memcpy(device->ident, ident, device->ident_len);
+        }
+        device->seen = esp_timer_get_time();
+    } else {
+        ESP_LOGW(TAG, "Inventory full, address %u is not stored.", (unsigned)address);
+    }
+    xSemaphoreGive(discovery_lock);
+}
+
+static void discovery_progress(int count)
+{
+    xSemaphoreTake(discovery_lock, portMAX_DELAY);
+    probed += count;
+    xSemaphoreGive(discovery_lock);
+}
+
+static void discovery_scan_rtu(void)
+{
+    uint8_t ident[DISCOVERY_IDENT_LEN];
+    for (int address = request.first; address <= request.last; address++) {
+        mb_job_t job = { .op = MB_JOB_PROBE, .slave_id = address, .value = request.function,
+                         .data = ident, .data_size = sizeof(ident) };
+        if ((mb_worker_execute(discovery_channel, &job) == ESP_OK) && (job.value == 0)) {
+            ESP_LOGI(TAG, "Slave %d answered.", address);
+            discovery_store(0, (uint8_t)address, request.function, ident, job.data_size);
+        }
+        discovery_progress(1);
+    }
+}
+
+// Wait until one of the sockets is ready or the deadline passes, false on timeout
+static bool discovery_select(discovery_probe_t *probes, int count, bool write, int64_t deadline)
+{
+    int64_t left_us = deadline - esp_timer_get_time();
+    if (left_us <= 0) {
+        return false;
+    }
+    fd_set fds;
+    FD_ZERO(&fds);
+    int max_fd = -1;
+    for (int i = 0; i < count; i++) {
+        if ((probes[i].sock >= 0) && (probes[i].connected != write)) {
+            FD_SET(probes[i].sock, &fds);
+            max_fd = (probes[i].sock > max_fd) ? probes[i].sock : max_fd;
+        }
+    }
+    if (max_fd < 0) {
+        return false;
+    }
+    struct timeval timeout = { .tv_sec = left_us / 1000000, .tv_usec = left_us % 1000000 };
+    if (select(max_fd + 1, write ? NULL : &fds, write ? &fds : NULL, NULL, &timeout) <= 0) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        discovery_probe_t *probe = &probes[i];
+        if ((probe->sock < 0) || (probe->connected != write) || !FD_ISSET(probe->sock, &fds)) {
+            continue;
+        }
+        if (write) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (!getsockopt(probe->sock, SOL_SOCKET, SO_ERROR, &error, &len) && !error) {
+                probe->connected = true;
+            } else {
+                close(probe->sock);
+                probe->sock = -1;
+            }
+        } else {
+            // Connected sockets are only readable when the response arrived
+            probe->connected = false;
+        }
+    }
+    return true;
+}
+
+// Read the response of a host and store it if it is a Modbus answer
+static void discovery_receive(const discovery_probe_t *probe)
+{
+    uint8_t frame[DISCOVERY_FRAME_LEN];
+    ssize_t len = recv(probe->sock, frame, sizeof(frame), 0);
+    if ((len < DISCOVERY_MBAP_LEN + 2) || (frame[0] != 0) || (frame[1] != 1) || (frame[2] | frame[3])) {
+        return;
+    }
+    const uint8_t *pdu = &frame[DISCOVERY_MBAP_LEN];
+    if ((pdu[0] & 0x7F) != request.function) {
+        return;
+    }
+    // An exception also tells that a device is there, only a Report Slave ID response has data
+    size_t ident_len = 0;
+    if (pdu[0] == 17) {
+        // The data may be truncated to the frame buffer
+        ident_len = pdu[1];
+        if (ident_len > len - DISCOVERY_MBAP_LEN - 2) {
+            ident_len = len - DISCOVERY_MBAP_LEN - 2;
+        }
+    }
+    char host[16];
+    inet_ntop(AF_INET, &probe->host, host, sizeof(host));
+    ESP_LOGI(TAG, "Host %s unit %u answered.", host, (unsigned)request.unit_id);
+    discovery_store(probe->host, request.unit_id, request.function, &pdu[2], ident_len);
+}
+
+// Connect to a batch of hosts at once, then send the probe to all connected hosts and collect the answers
+static void discovery_scan_batch(const uint32_t *hosts, int count)
+{
+    discovery_probe_t probes[DISCOVERY_PARALLEL];
+    for (int i = 0; i < count; i++) {
+        discovery_probe_t *probe = &probes[i];
+        probe->host = hosts[i];
+        probe->connected = false;
+        probe->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (probe->sock < 0) {
+            continue;
+        }
+        struct sockaddr_in addr = { 0 };
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(request.port);
+        addr.sin_addr.s_addr = hosts[i];
+        fcntl(probe->sock, F_SETFL, O_NONBLOCK);
+        if ((connect(probe->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) && (errno != EINPROGRESS)) {
+            close(probe->sock);
+            probe->sock = -1;
+        }
+    }
+    int64_t deadline = esp_timer_get_time() + DISCOVERY_TCP_TIMEOUT_MS * 1000;
+    while (discovery_select(probes, count, true, deadline)) {
+    }
+    for (int i = 0; i < count; i++) {
+        if ((probes[i].sock >= 0) && !probes[i].connected) {
+            close(probes[i].sock);
+            probes[i].sock = -1;
+        }
+    }
+    uint8_t pdu[5] = { request.function, 0, 0, 0, 1 };
+    size_t pdu_len = (request.function == 17) ? 1 : 5;
+    uint8_t frame[DISCOVERY_MBAP_LEN + 5] = { 0, 1, 0, 0, 0, (uint8_t)(pdu_len + 1), request.unit_id };
+    memcpy(&frame[DISCOVERY_MBAP_LEN], pdu, pdu_len);
+    for (int i = 0; i < count; i++) {
+        if (probes[i].connected && (send(probes[i].sock, frame, DISCOVERY_MBAP_LEN + pdu_len, 0) < 0)) {
+            close(probes[i].sock);
+            probes[i].sock = -1;
+            probes[i].connected = false;
+        }
+    }
+    // Hosts that answered are marked not connected by the select, so they are read once
+    deadline = esp_timer_get_time() + DISCOVERY_TCP_TIMEOUT_MS * 1000;
+    while (discovery_select(probes, count, false, deadline)) {
+        for (int i = 0; i < count; i++) {
+            if ((probes[i].sock >= 0) && !probes[i].connected) {
+                discovery_receive(&probes[i]);
+                close(probes[i].sock);
+                probes[i].sock = -1;
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (probes[i].sock >= 0) {
+            close(probes[i].sock);
+        }
+    }
+    discovery_progress(count);
+}
+
+static void discovery_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // TCP hosts first, they take a fraction of the time of the serial segment
+        for (int i = 0; i < request.host_count; i += DISCOVERY_PARALLEL) {
+            int count = request.host_count - i;
+            discovery_scan_batch(&request.hosts[i], (count < DISCOVERY_PARALLEL) ? count : DISCOVERY_PARALLEL);
+        }
+        if (request.rtu) {
+            discovery_scan_rtu();
+        }
+        xSemaphoreTake(discovery_lock, portMAX_DELAY);
+        running = false;
+        finished = esp_timer_get_time();
+        xSemaphoreGive(discovery_lock);
+        ESP_LOGI(TAG, "Scan done in %lld ms, %d devices in the inventory.",
+                 (long long)((finished - started) / 1000), device_count);
+    }
+}
+
+esp_err_t discovery_init(void)
+{
+    discovery_lock = xSemaphoreCreateMutex();
+    discovery_channel = mb_worker_channel_open();
+    if (!discovery_lock || !discovery_channel) {
+        ESP_LOGE(TAG, "no memory for discovery.");
+        return ESP_ERR_NO_MEM;
+    }
+    BaseType_t status = xTaskCreatePinnedToCore(discovery_task, "discovery",
+                                                DISCOVERY_TASK_STACK_SIZE, NULL,
+                                                DISCOVERY_TASK_PRIO, &discovery_task_handle,
+                                                CONFIG_GW_NET_CORE);
+    if (status != pdPASS) {
+        ESP_LOGE(TAG, "discovery task creation error.");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t discovery_start(const discovery_request_t *scan)
+{
+    if (!scan || (scan->rtu && ((scan->first < 1) || (scan->last > 247) || (scan->first > scan->last)))
+            || ((scan->function != 3) && (scan->function != 17))
+            || (scan->host_count < 0) || (scan->host_count > DISCOVERY_HOSTS_MAX)
+            || (scan->host_count && !scan->port)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!discovery_task_handle) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(discovery_lock, portMAX_DELAY);
+    if (running) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        // The task only reads the request while running is set
+        memcpy(&request, scan, sizeof(request));
+        running = true;
+        probed = 0;
+        total = scan->host_count + (scan->rtu ? scan->last - scan->first + 1 : 0);
+        started = esp_timer_get_time();
+    }
+    xSemaphoreGive(discovery_lock);
+    if (err == ESP_OK) {
+        xTaskNotifyGive(discovery_task_handle);
+    }
+    return err;
+}
+
+void discovery_report(cJSON *root)
+{
+    if (!discovery_lock) {
+        return;
+    }
+    xSemaphoreTake(discovery_lock, portMAX_DELAY);
+    cJSON_AddBoolToObject(root, "running", running);
+    cJSON_AddNumberToObject(root, "probed", probed);
+    cJSON_AddNumberToObject(root, "total", total);
+    cJSON_AddNumberToObject(root, "elapsedMs", (double)(((running || !finished) ? esp_timer_get_time() : finished) - started) / 1000);
+    cJSON *array = cJSON_AddArrayToObject(root, "devices");
+    for (int i = 0; i < device_count; i++) {
+        const discovery_device_t *device = &devices[i];
+        cJSON *item = cJSON_CreateObject();
+        if (device->host) {
+            char host[16];
+            inet_ntop(AF_INET, &device->host, host, sizeof(host));
+            cJSON_AddStringToObject(item, "transport", "tcp");
+            cJSON_AddStringToObject(item, "host", host);
+        } else {
+            cJSON_AddStringToObject(item, "transport", "rtu");
+        }
+        cJSON_AddNumberToObject(item, "address", device->address);
+        cJSON_AddNumberToObject(item, "funcId", device->function);
+        if (device->ident_len) {
+            // Report Slave ID data: slave ID, run indicator, then device specific bytes
+            char ident[DISCOVERY_IDENT_LEN * 2 + 1];
+            for (int j = 0; j < device->ident_len; j++) {
+                snprintf(&ident[j * 2], 3, "%02x", device->ident[j]);
+            }
+            cJSON_AddStringToObject(item, "ident", ident);
+            cJSON_AddNumberToObject(item, "slaveId", device->ident[0]);
+            if (device->ident_len > 1) {
+                cJSON_AddBoolToObject(item, "running", device->ident[1] == 0xFF);
+            }
+        }
+        cJSON_AddNumberToObject(item, "ageMs", (double)(esp_timer_get_time() - device->seen) / 1000);
+        cJSON_AddItemToArray(array, item);
+    }
+    xSemaphoreGive(discovery_lock);
+}
@@ -0,0 +1,71 @@
+/* Slave discovery on the RTU segment and on Modbus TCP hosts
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "cJSON.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DISCOVERY_HOSTS_MAX         (254)
+// Bytes of the Report Slave ID data kept per device
+#define DISCOVERY_IDENT_LEN         (32)
+
+/**
+ * @brief Addresses and hosts to probe
+ */
+typedef struct {
+    bool rtu;                       /*!< Probe the addresses first..last of the RTU segment */
+    uint8_t first;                  /*!< First RTU address */
+    uint8_t last;                   /*!< Last RTU address */
+    uint8_t function;               /*!< Probe function: 17 (Report Slave ID) or 3 (read holding register 0) */
+    uint8_t unit_id;                /*!< Unit ID probed on the TCP hosts */
+    uint16_t port;                  /*!< TCP port of the hosts */
+    int host_count;                 /*!< Number of TCP hosts */
+    uint32_t hosts[DISCOVERY_HOSTS_MAX];    /*!< IPv4 addresses of the TCP hosts, network byte order */
+} discovery_request_t;
+
+/**
+ * @brief Start the discovery task
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NO_MEM if the task could not be created
+ */
+esp_err_t discovery_init(void);
+
+/**
+ * @brief Start a scan in the background, the devices that answer are added to the inventory
+ *
+ * RTU addresses are probed one by one through the bus engine with the short
+ * CONFIG_GW_DISCOVERY_TIMEOUT_MS response timeout, between the jobs of the other clients.
+ * TCP hosts are probed CONFIG_GW_DISCOVERY_PARALLEL at a time.
+ *
+ * @param request addresses and hosts to probe, copied
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG on wrong arguments
+ *     - ESP_ERR_INVALID_STATE if a scan is running
+ */
+esp_err_t discovery_start(const discovery_request_t *request);
+
+/**
+ * @brief Add the scan state and the inventory of discovered devices to a JSON object
+ *
+ * @param root object to add "running", "probed", "total", "elapsedMs" and "devices" to
+ */
+void discovery_report(cJSON *root);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,364 @@
+#!/usr/bin/env python
+# Device map generator
+#
+# Generates the typed register structs, the Modbus descriptor table, the block read
+# plans and their decode functions from a device schema (JSON).
+#
+# This code is in the Public Domain (or CC0 licensed, at your option.)
+#
+# Unless required by applicable law or agreed to in writing, this
+# software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+# CONDITIONS OF ANY KIND, either express or implied.
+
+import argparse
+import json
+import os
+import sys
+
+# Area name: (mb_param_type_t, struct type, instance, register area)
+AREAS = {
+    'holding': ('MB_PARAM_HOLDING', 'device_holding_regs_t', 'device_holding_regs', True),
+    'input': ('MB_PARAM_INPUT', 'device_input_regs_t', 'device_input_regs', True),
+    'coil': ('MB_PARAM_COIL', 'device_coil_regs_t', 'device_coil_regs', False),
+    'discrete': ('MB_PARAM_DISCRETE', 'device_discrete_regs_t', 'device_discrete_regs', False),
+}
+
+# Field type: (C type, registers, mb_descr_type_t, mb_descr_size_t, device_field_type_t, decoder)
+TYPES = {
+    'u16': ('uint16_t', 1, 'PARAM_TYPE_U16', 'PARAM_SIZE_U16', 'DEVICE_FIELD_U16', 'device_map_u16'),
+    'i16': ('int16_t', 1, 'PARAM_TYPE_U16', 'PARAM_SIZE_U16', 'DEVICE_FIELD_I16', '(int16_t)device_map_u16'),
+    'u32': ('uint32_t', 2, 'PARAM_TYPE_U32', 'PARAM_SIZE_U32', 'DEVICE_FIELD_U32', 'device_map_u32'),
+    'i32': ('int32_t', 2, 'PARAM_TYPE_U32', 'PARAM_SIZE_U32', 'DEVICE_FIELD_I32', '(int32_t)device_map_u32'),
+    'f32': ('float', 2, 'PARAM_TYPE_FLOAT', 'PARAM_SIZE_FLOAT', 'DEVICE_FIELD_F32', 'device_map_f32'),
+}
+
+ACCESS = {
+    'read': 'PAR_PERMS_READ',
+    'write': 'PAR_PERMS_WRITE',
+    'read_write': 'PAR_PERMS_READ_WRITE',
+    'read_trigger': 'PAR_PERMS_READ_TRIGGER',
+    'write_trigger': 'PAR_PERMS_WRITE_TRIGGER',
+    'read_write_trigger': 'PAR_PERMS_READ_WRITE_TRIGGER',
+}
+
+# Registers of one FC3/FC4 response
+MAX_BLOCK_REGS = 125
+
+HEADER = '''/* Device map generated by gen_device_map.py from {schema}, do not edit
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+'''
+
+
+def fail(message):
+    sys.exit('gen_device_map: error: ' + message)
+
+
+def c_string(text):
+    return json.dumps(text)
+
+
+def load_schema(path):
+    with open(path) as f:
+        schema = json.load(f)
+
+    fields = {}
+    for area, entries in schema.get('areas', {}).items():
+        if area not in AREAS:
+            fail('unknown area "{}"'.format(area))
+        offset = 0
+        for entry in entries:
+            name = entry.get('field', '')
+            if not name.isidentifier():
+                fail('invalid field name "{}" in area {}'.format(name, area))
+            if entry.get('type') not in TYPES:
+                fail('field {} has unknown type "{}"'.format(name, entry.get('type')))
+            if (area, name) in fields:
+                fail('duplicate field {} in area {}'.format(name, area))
+            # The structs are packed, read_mb() and the decoders store whole words into them
+            size = 2 * TYPES[entry['type']][1]
+            if offset % size:
+                fail('field {} is not aligned to its size in area {}'.format(name, area))
+            offset += size
+            fields[(area, name)] = entry['type']
+
+    params = schema.get('parameters', [])
+    for index, param in enumerate(params):
+        # read_mb() and set_mb() index the descriptor table by characteristic
+        if param.get('cid') != index:
+            fail('parameter #{} has cid {}, cids have to be 0..n-1 in order'.format(index, param.get('cid')))
+        area = param.get('area')
+        if (area, param.get('field')) not in fields:
+            fail('cid {} refers to unknown field {}.{}'.format(index, area, param.get('field')))
+        field_type = TYPES[fields[(area, param['field'])]]
+        if AREAS[area][3]:
+            param.setdefault('regs', field_type[1])
+            if param['regs'] != field_type[1]:
+                fail('cid {} reads {} registers into a {} field'.format(index, param['regs'], param['field']))
+        else:
+            param.setdefault('regs', 1)
+            if not 1 <= param['regs'] <= 8 * 2 * field_type[1]:
+                fail('cid {} reads {} bits into a {} field'.format(index, param['regs'], param['field']))
+        if not 1 <= param.get('slave', 0) <= 247:
+            fail('cid {} has invalid slave address'.format(index))
+        if not 0 <= param.get('reg', -1) <= 0xFFFF - param['regs'] + 1:
+            fail('cid {} has invalid register'.format(index))
+        if param.get('access', 'read_write_trigger') not in ACCESS:
+            fail('cid {} has unknown access "{}"'.format(index, param.get('access')))
+    return schema, fields, params
+
+
+def plan_blocks(params, fields, max_gap):
+    # Merge the register parameters of each slave and area into the fewest reads of up to 125 registers
+    ranges = {}
+    for param in params:
+        if AREAS[param['area']][3]:
+            ranges.setdefault((param['slave'], param['area']), []).append(param)
+    blocks = []
+    for (slave, area), members in sorted(ranges.items()):
+        members.sort(key=lambda p: p['reg'])
+        block = None
+        for param in members:
+            end = param['reg'] + param['regs']
+            if (block is not None and param['reg'] <= block['end'] + max_gap
+                    and max(block['end'], end) - block['start'] <= MAX_BLOCK_REGS):
+                block['end'] = max(block['end'], end)
+                block['params'].append(param)
+            else:
+                block = {'slave': slave, 'area': area, 'start': param['reg'], 'end': end, 'params': [param]}
+                blocks.append(block)
+    for block in blocks:
+        # Parameters sharing a field and register decode once
+        decodes = {}
+        for param in block['params']:
+            decodes.setdefault((param['field'], param['reg'] - block['start']), fields[(param['area'], param['field'])])
+        block['decodes'] = sorted(decodes.items(), key=lambda d: d[0][1])
+    return blocks
+
+
+def write_header(out, schema_name, fields, params, blocks):
+    out.write(HEADER.format(schema=schema_name))
+    out.write('''#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "mbcontroller.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+''')
+    out.write('#define DEVICE_MAP_PARAMS       ({})\n'.format(len(params)))
+    out.write('#define DEVICE_MAP_BLOCKS       ({})\n'.format(len(blocks)))
+    out.write('#define DEVICE_MAP_FIELDS       ({})\n\n'.format(len(fields)))
+    out.write('''typedef enum {
+    DEVICE_FIELD_U16,
+    DEVICE_FIELD_I16,
+    DEVICE_FIELD_U32,
+    DEVICE_FIELD_I32,
+    DEVICE_FIELD_F32
+} device_field_type_t;
+
+''')
+    for area, (_, struct_type, instance, _) in AREAS.items():
+        members = [(name, t) for (a, name), t in fields.items() if a == area]
+        if not members:
+            continue
+        out.write('typedef struct __attribute__((packed)) {\n')
+        for name, t in members:
+            out.write('    {} {};\n'.format(TYPES[t][0], name))
+        out.write('}} {};\n\n'.format(struct_type))
+        out.write('extern {} {};\n\n'.format(struct_type, instance))
+    out.write('''/**
+ * @brief Field of the register structs, for generic access
+ */
+typedef struct {
+    const char *name;
+    mb_param_type_t area;
+    device_field_type_t type;
+    const void *data;
+} device_map_field_t;
+
+/**
+ * @brief Block read plan, one FC3/FC4 request covering adjacent parameters of a slave
+ */
+typedef struct {
+    uint8_t slave_addr;
+    mb_param_type_t area;
+    uint16_t reg_start;
+    uint16_t reg_count;
+    void (*decode)(const uint8_t *data);    /*!< Decode the big-endian registers into the register structs */
+} device_map_block_t;
+
+extern const mb_parameter_descriptor_t device_map_descriptors[DEVICE_MAP_PARAMS];
+// Storage of each characteristic, indexed by cid
+extern void *const device_map_param_data[DEVICE_MAP_PARAMS];
+extern const device_map_block_t device_map_blocks[DEVICE_MAP_BLOCKS];
+extern const device_map_field_t device_map_fields[DEVICE_MAP_FIELDS];
+
+/**
+ * @brief Read a block and decode it into the register structs, from the bus engine task only
+ *
+ * A block the slave can not serve in one request, as learned by mb_caps_probe(), is read in
+ * several requests that skip its illegal addresses; the registers not read decode as 0.
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_RESPONSE if a response does not have the requested registers
+ *     - ESP_ERR_NOT_SUPPORTED if every address of the block is illegal on the slave
+ *     - error of mbc_master_read_view()
+ */
+esp_err_t device_map_read_block(const device_map_block_t *block);
+
+#ifdef __cplusplus
+}
+#endif
+''')
+
+
+def write_source(out, schema_name, fields, params, blocks):
+    out.write(HEADER.format(schema=schema_name))
+    out.write('''#include <stddef.h>
+#include <string.h>
+#include "device_map.h"
+#include "mb_caps.h"
+
+#define STR(fieldname) ((const char*)( fieldname ))
+// Options can be used as bit masks or parameter limits
+#define OPTS(min_val, max_val, step_val) { .opt1 = min_val, .opt2 = max_val, .opt3 = step_val }
+
+static inline uint16_t device_map_u16(const uint8_t *data)
+{
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+// 32 bit values are sent high word first
+static inline uint32_t device_map_u32(const uint8_t *data)
+{
+    return ((uint32_t)device_map_u16(data) << 16) | device_map_u16(data + 2);
+}
+
+static inline float device_map_f32(const uint8_t *data)
+{
+    uint32_t word = device_map_u32(data);
+    float value;
+    memcpy(&value, &word, sizeof(value));
+    return value;
+}
+
+''')
+    for area, (_, struct_type, instance, _) in AREAS.items():
+        if any(a == area for a, _ in fields):
+            out.write('{} {};\n'.format(struct_type, instance))
+    out.write('\nconst mb_parameter_descriptor_t device_map_descriptors[DEVICE_MAP_PARAMS] = {\n')
+    for param in params:
+        mb_type, struct_type, _, _ = AREAS[param['area']]
+        t = TYPES[fields[(param['area'], param['field'])]]
+        opts = param.get('opts', [0, 0, 0])
+        out.write('    {{ {}, STR({}), STR({}), {}, {}, {}, {}, (uint16_t)(offsetof({}, {}) + 1), {}, {}, '
+                  'OPTS({}, {}, {}), {} }},\n'.format(
+                      param['cid'], c_string(param['key']), c_string(param.get('units', '')), param['slave'],
+                      mb_type, param['reg'], param['regs'], struct_type, param['field'], t[2], t[3],
+                      opts[0], opts[1], opts[2], ACCESS[param.get('access', 'read_write_trigger')]))
+    out.write('};\n\nvoid *const device_map_param_data[DEVICE_MAP_PARAMS] = {\n')
+    for param in params:
+        out.write('    &{}.{},\n'.format(AREAS[param['area']][2], param['field']))
+    out.write('};\n\n')
+    # Buffer of a block gathered from several reads
+    out.write('#define DEVICE_MAP_BLOCK_REGS_MAX   ({})\n\n'.format(
+        max([block['end'] - block['start'] for block in blocks], default=1)))
+    for index, block in enumerate(blocks):
+        instance = AREAS[block['area']][2]
+        out.write('static void device_map_decode_block{}(const uint8_t *data)\n{{\n'.format(index))
+        for (field, offset), t in block['decodes']:
+            out.write('    {}.{} = {}(data + {});\n'.format(instance, field, TYPES[t][5], offset * 2))
+        out.write('}\n\n')
+    out.write('const device_map_block_t device_map_blocks[DEVICE_MAP_BLOCKS] = {\n')
+    for index, block in enumerate(blocks):
+        out.write('    {{ {}, {}, {}, {}, device_map_decode_block{} }},\n'.format(
+            block['slave'], AREAS[block['area']][0], block['start'], block['end'] - block['start'], index))
+    out.write('};\n\nconst device_map_field_t device_map_fields[DEVICE_MAP_FIELDS] = {\n')
+    for (area, name), t in fields.items():
+        out.write('    {{ {}, {}, {}, &{}.{} }},\n'.format(
+            c_string(name), AREAS[area][0], TYPES[t][4], AREAS[area][2], name))
+    out.write('''};
+
+esp_err_t device_map_read_block(const device_map_block_t *block)
+{
+    // Read input registers (4) or holding registers (3)
+    uint8_t command = (block->area == MB_PARAM_INPUT) ? 4 : 3;
+    uint32_t end = (uint32_t)block->reg_start + block->reg_count;
+    uint16_t reg = block->reg_start;
+    uint16_t count = 0;
+    if (!mb_caps_next_read(block->slave_addr, command, &reg, end, &count)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    mb_param_request_t request = { block->slave_addr, command, reg, count };
+    mb_response_view_t view;
+    esp_err_t err;
+    if ((reg == block->reg_start) && (count == block->reg_count)) {
+        err = mbc_master_read_view(&request, &view);
+        if (err != ESP_OK) {
+            return err;
+        }
+        // Decode straight from the receive frame, the view holds the master until it is released
+        if (view.reg_count == block->reg_count) {
+            block->decode(view.data);
+        } else {
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+        mbc_master_release_view(&view);
+        return err;
+    }
+    // Gather the reads the slave accepts
+    uint8_t data[DEVICE_MAP_BLOCK_REGS_MAX * 2] = { 0 };
+    do {
+        request.reg_start = reg;
+        request.reg_size = count;
+        err = mbc_master_read_view(&request, &view);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (view.reg_count == count) {
+            memcpy(&data[(reg - block->reg_start) * 2], view.data, count * 2);
+        } else {
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+        mbc_master_release_view(&view);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if ((uint32_t)reg + count >= end) {
+            break;
+        }
+        reg += count;
+    } while (mb_caps_next_read(block->slave_addr, command, &reg, end, &count));
+    block->decode(data);
+    return ESP_OK;
+}
+''')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate the device map sources from a device schema')
+    parser.add_argument('schema', help='device schema (JSON)')
+    parser.add_argument('output_dir', help='directory of device_map.h and device_map.c')
+    args = parser.parse_args()
+
+    schema, fields, params = load_schema(args.schema)
+    blocks = plan_blocks(params, fields, schema.get('maxBlockGap', 0))
+    schema_name = os.path.basename(args.schema)
+    with open(os.path.join(args.output_dir, 'device_map.h'), 'w') as out:
+        write_header(out, schema_name, fields, params, blocks)
+    with open(os.path.join(args.output_dir, 'device_map.c'), 'w') as out:
+        write_source(out, schema_name, fields, params, blocks)
+
+
+if __name__ == '__main__':
+    main()
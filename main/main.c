@@ -17,7 +17,16 @@
 #include "ethernet_init.h"
 #include "sdkconfig.h"
 #include "mbcontroller.h"
-#include "modbus_params.h"
+#include "device_map.h"
+#include "mb_worker.h"
+#include "point_table.h"
+#include "alarm.h"
+#include "concentrator.h"
+#include "mb_route.h"
+#include "discovery.h"
+#include "mb_caps.h"
+#include "bus_model.h"
+#include "nvs_flash.h"
 
 #define MB_PORT_NUM     (CONFIG_MB_UART_PORT_NUM)   // Number of UART port used for Modbus connection
 #define MB_DEV_SPEED    (CONFIG_MB_UART_BAUD_RATE)  // The communication speed of the UART
@@ -30,17 +39,6 @@
 #define POLL_TIMEOUT_MS                 (1)
 #define POLL_TIMEOUT_TICS               (POLL_TIMEOUT_MS / portTICK_PERIOD_MS)
 
-// The macro to get offset for parameter in the appropriate structure
-#define HOLD_OFFSET(field) ((uint16_t)(offsetof(holding_reg_params_t, field) + 1))
-#define INPUT_OFFSET(field) ((uint16_t)(offsetof(input_reg_params_t, field) + 1))
-#define COIL_OFFSET(field) ((uint16_t)(offsetof(coil_reg_params_t, field) + 1))
-// Discrete offset macro
-#define DISCR_OFFSET(field) ((uint16_t)(offsetof(discrete_reg_params_t, field) + 1))
-
-#define STR(fieldname) ((const char*)( fieldname ))
-// Options can be used as bit masks or parameter limits
-#define OPTS(min_val, max_val, step_val) { .opt1 = min_val, .opt2 = max_val, .opt3 = step_val }
-
 static const char *TAG_MB = "MB_MASTER";
 static const char *TAG_ETH = "ETHERNET";
 
@@ -88,13 +86,8 @@ static void got_ip_event_handler(void *arg, esp_event_base_t event_base,
     ESP_LOGI(TAG_ETH, "~~~~~~~~~~~");
 }
 
-mb_parameter_descriptor_t device_parameters[] = {
-        { 0, STR("Holding"), STR("Holding"), 1, MB_PARAM_HOLDING, 0, 1,HOLD_OFFSET(holding_data0), PARAM_TYPE_U16, 2, OPTS(0,65535,1), PAR_PERMS_READ_WRITE_TRIGGER },
-        { 1, STR("Input"), STR("Input"), 1, MB_PARAM_INPUT, 0, 1,INPUT_OFFSET(input_data0), PARAM_TYPE_U16, 2, OPTS(0,65535,1), PAR_PERMS_READ_WRITE_TRIGGER },
-        { 2, STR("Coil"), STR("Coil"), 1, MB_PARAM_COIL, 0, 1,COIL_OFFSET(coils_port0), PARAM_TYPE_U16, 1, OPTS(1,0,0), PAR_PERMS_READ_WRITE_TRIGGER },
-        { 3, STR("Set holding"), STR("Set holding"), 1, MB_PARAM_HOLDING, 0, 1, HOLD_OFFSET(holding_data0), PARAM_TYPE_U16, 2, OPTS(0,65535,1), PAR_PERMS_READ_WRITE_TRIGGER },
-        { 4, STR("Set coil"), STR("Set coil"), 1, MB_PARAM_COIL, 0, 1, COIL_OFFSET(coils_port0), PARAM_TYPE_U16, 1, OPTS(1,0,0), PAR_PERMS_READ_WRITE_TRIGGER }
-};
+// Characteristics of the generated device map, read_mb() and set_mb() retarget them to the requested register
+mb_parameter_descriptor_t device_parameters[DEVICE_MAP_PARAMS];
 
 // Calculate number of parameters in the table
 const uint16_t num_device_parameters = (sizeof(device_parameters)/sizeof(device_parameters[0]));
@@ -104,27 +97,10 @@ static void* master_get_param_data(const mb_parameter_descriptor_t* param_descri
 {
     assert(param_descriptor != NULL);
     void* instance_ptr = NULL;
-    if (param_descriptor->param_offset != 0) {
-        switch(param_descriptor->mb_param_type)
-        {
-            case MB_PARAM_HOLDING:
-                instance_ptr = ((void*)&holding_reg_params + param_descriptor->param_offset - 1);
-                break;
-            case MB_PARAM_INPUT:
-                instance_ptr = ((void*)&input_reg_params + param_descriptor->param_offset - 1);
-                break;
-            case MB_PARAM_COIL:
-                instance_ptr = ((void*)&coil_reg_params + param_descriptor->param_offset - 1);
-                break;
-            case MB_PARAM_DISCRETE:
-                instance_ptr = ((void*)&discrete_reg_params + param_descriptor->param_offset - 1);
-                break;
-            default:
-                instance_ptr = NULL;
-                break;
-        }
+    if (param_descriptor->cid < DEVICE_MAP_PARAMS) {
+        instance_ptr = device_map_param_data[param_descriptor->cid];
     } else {
-        ESP_LOGE(TAG_MB, "Wrong parameter offset for CID #%d", param_descriptor->cid);
+        ESP_LOGE(TAG_MB, "Wrong parameter cid #%d", param_descriptor->cid);
         assert(instance_ptr != NULL);
     }
     return instance_ptr;
@@ -152,6 +128,7 @@ static esp_err_t master_init(void)
     MB_RETURN_ON_FALSE((err == ESP_OK), ESP_ERR_INVALID_STATE, TAG_MB,
                        "mb controller setup fail, returns(0x%x).",
                        (uint32_t)err);
+    bus_model_init(&comm);
 
     // Set UART pin numbers
     err = uart_set_pin(MB_PORT_NUM, CONFIG_MB_UART_TXD, CONFIG_MB_UART_RXD,
@@ -170,6 +147,7 @@ static esp_err_t master_init(void)
                        "mb serial set mode failure, uart_set_mode() returned (0x%x).", (uint32_t)err);
 
     vTaskDelay(5);
+    memcpy(device_parameters, device_map_descriptors, sizeof(device_parameters));
     err = mbc_master_set_descriptor(&device_parameters[0], num_device_parameters);
     MB_RETURN_ON_FALSE((err == ESP_OK), ESP_ERR_INVALID_STATE, TAG_MB,
                        "mb controller set descriptor fail, returns(0x%x).",
@@ -178,11 +156,33 @@ static esp_err_t master_init(void)
     return err;
 }
 
-void init_ethernet()
-{
-    uint8_t eth_port_cnt = 0;
+typedef struct {
+    TaskHandle_t owner;
     esp_eth_handle_t *eth_handles;
-    ESP_ERROR_CHECK(eth_init(&eth_handles, &eth_port_cnt));
+    uint8_t eth_port_cnt;
+    esp_err_t err;
+} eth_install_t;
+
+// The MAC task is pinned to the core installing the driver, so install it from the network core
+static void eth_install_task(void *arg)
+{
+    eth_install_t *install = (eth_install_t *)arg;
+    install->err = eth_init(&install->eth_handles, &install->eth_port_cnt);
+    xTaskNotifyGive(install->owner);
+    vTaskDelete(NULL);
+}
+
+esp_netif_t *init_ethernet()
+{
+    esp_netif_t *first_netif = NULL;
+    eth_install_t install = { .owner = xTaskGetCurrentTaskHandle(), .err = ESP_FAIL };
+    BaseType_t status = xTaskCreatePinnedToCore(eth_install_task, "eth_install", 4096, &install,
+                                                uxTaskPriorityGet(NULL), NULL, CONFIG_GW_NET_CORE);
+    ESP_ERROR_CHECK((status == pdPASS) ? ESP_OK : ESP_ERR_NO_MEM);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    ESP_ERROR_CHECK(install.err);
+    uint8_t eth_port_cnt = install.eth_port_cnt;
+    esp_eth_handle_t *eth_handles = install.eth_handles;
 
     // Initialize TCP/IP network interface aka the esp-netif (should be called only once in application)
     ESP_ERROR_CHECK(esp_netif_init());
@@ -197,6 +197,7 @@ void init_ethernet()
         esp_netif_t *eth_netif = esp_netif_new(&cfg);
         // Attach Ethernet driver to TCP/IP stack
         ESP_ERROR_CHECK(esp_netif_attach(eth_netif, esp_eth_new_netif_glue(eth_handles[0])));
+        first_netif = eth_netif;
     } else {
         // Use ESP_NETIF_INHERENT_DEFAULT_ETH when multiple Ethernet interfaces are used and so you need to modify
         // esp-netif configuration parameters for each interface (name, priority, etc.).
@@ -219,6 +220,9 @@ void init_ethernet()
 
             // Attach Ethernet driver to TCP/IP stack
             ESP_ERROR_CHECK(esp_netif_attach(eth_netif, esp_eth_new_netif_glue(eth_handles[i])));
+            if (!first_netif) {
+                first_netif = eth_netif;
+            }
         }
     }
 
@@ -230,9 +234,11 @@ void init_ethernet()
     for (int i = 0; i < eth_port_cnt; i++) {
         ESP_ERROR_CHECK(esp_eth_start(eth_handles[i]));
     }
+    return first_netif;
 }
 
-int read_mb(uint16_t cid, int slaveId, int registerId)
+// Read one value, logging a successful read at the given level
+static int read_mb_log(uint16_t cid, int slaveId, int registerId, esp_log_level_t level)
 {
     int value = 0;
     esp_err_t err = ESP_OK;
@@ -241,7 +247,12 @@ int read_mb(uint16_t cid, int slaveId, int registerId)
     device_parameters[cid].mb_reg_start = registerId;
 
     const mb_parameter_descriptor_t* param_descriptor = NULL;
-    err = mbc_master_get_cid_info(cid, &param_descriptor);
+    // Hold the table, a reconfiguration must not free it while the request below uses the descriptor
+    uint32_t descr_hold = 0;
+    err = mbc_master_hold_cid_info(cid, &param_descriptor, &descr_hold);
+    if (err != ESP_OK) {
+        return -1;
+    }
 
     void* temp_data_ptr = master_get_param_data(param_descriptor);
     assert(temp_data_ptr);
@@ -254,21 +265,21 @@ int read_mb(uint16_t cid, int slaveId, int registerId)
         *(uint16_t*)temp_data_ptr = value;
         if ((param_descriptor->mb_param_type == MB_PARAM_HOLDING) ||
             (param_descriptor->mb_param_type == MB_PARAM_INPUT)) {
-            ESP_LOGI(TAG_MB, "Characteristic #%d %s (%s) value = %u (0x%x) read successful.",
-                     param_descriptor->cid,
-                     (char*)param_descriptor->param_key,
-                     (char*)param_descriptor->param_units,
-                     value,
-                     *(uint32_t*)temp_data_ptr);
+            ESP_LOG_LEVEL_LOCAL(level, TAG_MB, "Characteristic #%d %s (%s) value = %u (0x%x) read successful.",
+                                param_descriptor->cid,
+                                (char*)param_descriptor->param_key,
+                                (char*)param_descriptor->param_units,
+                                value,
+                                *(uint32_t*)temp_data_ptr);
         } else {
             uint16_t state = *(uint16_t*)temp_data_ptr;
             const char* rw_str = (state & param_descriptor->param_opts.opt1) ? "ON" : "OFF";
-            ESP_LOGI(TAG_MB, "Characteristic #%d %s (%s) value = %s (0x%x) read successful.",
-                     param_descriptor->cid,
-                     (char*)param_descriptor->param_key,
-                     (char*)param_descriptor->param_units,
-                     (const char*)rw_str,
-                     *(uint16_t*)temp_data_ptr);
+            ESP_LOG_LEVEL_LOCAL(level, TAG_MB, "Characteristic #%d %s (%s) value = %s (0x%x) read successful.",
+                                param_descriptor->cid,
+                                (char*)param_descriptor->param_key,
+                                (char*)param_descriptor->param_units,
+                                (const char*)rw_str,
+                                *(uint16_t*)temp_data_ptr);
         }
     } else {
         value = -1;
@@ -279,9 +290,21 @@ int read_mb(uint16_t cid, int slaveId, int registerId)
                  (char*)esp_err_to_name(err));
     }
 
+    mbc_master_release_cid_info(descr_hold);
     return value;
 }
 
+int read_mb(uint16_t cid, int slaveId, int registerId)
+{
+    return read_mb_log(cid, slaveId, registerId, ESP_LOG_INFO);
+}
+
+// Periodic scans read every point each period, logging each of them would flood the console from the bus core
+int read_mb_quiet(uint16_t cid, int slaveId, int registerId)
+{
+    return read_mb_log(cid, slaveId, registerId, ESP_LOG_DEBUG);
+}
+
 int set_mb(uint16_t cid, int slaveId, int registerId, int value)
 {
     esp_err_t err = ESP_OK;
@@ -290,7 +313,12 @@ int set_mb(uint16_t cid, int slaveId, int registerId, int value)
     device_parameters[cid].mb_reg_start = registerId;
 
     const mb_parameter_descriptor_t* param_descriptor = NULL;
-    err = mbc_master_get_cid_info(cid, &param_descriptor);
+    // Hold the table, a reconfiguration must not free it while the request below uses the descriptor
+    uint32_t descr_hold = 0;
+    err = mbc_master_hold_cid_info(cid, &param_descriptor, &descr_hold);
+    if (err != ESP_OK) {
+        return -1;
+    }
 
     void* temp_data_ptr = master_get_param_data(param_descriptor);
     assert(temp_data_ptr);
@@ -338,6 +366,7 @@ int set_mb(uint16_t cid, int slaveId, int registerId, int value)
                  (char*)esp_err_to_name(err));
     }
 
+    mbc_master_release_cid_info(descr_hold);
     return value;
 }
 
@@ -345,9 +374,31 @@ esp_err_t start_rest_server(const char *base_path);
 
 void app_main(void)
 {
+    // The Modbus stack tasks are pinned by CONFIG_FMB_PORT_TASK_AFFINITY, keep them with the bus engine
+    if (CONFIG_FMB_PORT_TASK_AFFINITY != CONFIG_GW_BUS_CORE) {
+        ESP_LOGW(TAG_MB, "Modbus stack tasks are not pinned to the bus core %d (affinity 0x%x).",
+                 CONFIG_GW_BUS_CORE, CONFIG_FMB_PORT_TASK_AFFINITY);
+    }
     ESP_ERROR_CHECK(master_init());
-    // Initialize Ethernet driver
-    init_ethernet();
+    ESP_ERROR_CHECK(point_table_init());
+    ESP_ERROR_CHECK(alarm_init());
+    ESP_ERROR_CHECK(mb_route_init());
+    ESP_ERROR_CHECK(mb_worker_start());
+    ESP_ERROR_CHECK(discovery_init());
+    // The learned slave capabilities are kept in NVS
+    esp_err_t err = nvs_flash_init();
+    if ((err == ESP_ERR_NVS_NO_FREE_PAGES) || (err == ESP_ERR_NVS_NEW_VERSION_FOUND)) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(err);
+    ESP_ERROR_CHECK(mb_caps_init());
+    // Initialize Ethernet driver, its MAC task is pinned to the core running app_main
+    esp_netif_t *eth_netif = init_ethernet();
+#if CONFIG_GW_CONCENTRATOR
+    // Serve the point cache to upstream Modbus TCP masters
+    ESP_ERROR_CHECK(concentrator_start(eth_netif));
+#endif
 
     ESP_ERROR_CHECK(start_rest_server("esp-home"));
 }
@@ -0,0 +1,410 @@
+/* Learned read capabilities of the slaves of the RTU segment
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include "mb_worker.h"
+#include "mb_caps.h"
+
+#define MB_CAPS_DEVICES_MAX         (CONFIG_GW_CAPS_DEVICES_MAX)
+#define MB_CAPS_RANGES_MAX          (CONFIG_GW_CAPS_RANGES_MAX)
+#define MB_CAPS_TASK_STACK_SIZE     (4096)
+#define MB_CAPS_TASK_PRIO           (3)
+#define MB_CAPS_NVS_NAMESPACE       "mb_caps"
+#define MB_CAPS_NVS_KEY             "devices"
+// Exceptions of a slave refusing the request rather than failing
+#define MB_CAPS_EX_ILLEGAL_ADDRESS  (2)
+#define MB_CAPS_EX_ILLEGAL_VALUE    (3)
+
+typedef struct {
+    uint16_t start;
+    uint16_t count;
+} mb_caps_range_t;
+
+// Capabilities of one read function of a slave
+typedef struct {
+    uint8_t slave_id;
+    uint8_t func_id;
+    uint8_t max_regs;               // registers per request the slave accepts
+    uint8_t range_count;
+    uint16_t span_start;            // probed span, nothing is known outside of it
+    uint32_t span_end;
+    mb_caps_range_t ranges[MB_CAPS_RANGES_MAX];     // readable ranges of the span, sorted by address
+} mb_caps_device_t;
+
+// Saved to NVS as one blob, a blob of another size is from another configuration and ignored
+typedef struct {
+    uint32_t count;
+    mb_caps_device_t devices[MB_CAPS_DEVICES_MAX];
+} mb_caps_table_t;
+
+typedef struct {
+    mb_caps_device_t device;        // result being learned
+    uint8_t ok_regs;                // largest read the slave answered
+    uint8_t refused_regs;           // smallest read refused with exception 03, 0 if none
+} mb_caps_probe_t;
+
+static const char *TAG = "MB_CAPS";
+
+static SemaphoreHandle_t caps_lock;
+static TaskHandle_t caps_task_handle;
+static mb_channel_t *caps_channel;
+static mb_caps_table_t table;
+static mb_caps_table_t saved;
+static mb_caps_probe_t probe;
+static bool running;
+static int reads;
+static esp_err_t last_error = ESP_OK;
+
+// Capabilities of a slave function, called with the lock taken
+static const mb_caps_device_t *mb_caps_find(int slave_id, int func_id)
+{
+    for (uint32_t i = 0; i < table.count; i++) {
+        if ((table.devices[i].slave_id == slave_id) && (table.devices[i].func_id == func_id)) {
+            return &table.devices[i];
+        }
+    }
+    return NULL;
+}
+
+// End of the run of readable or illegal registers starting at reg, called with the lock taken
+static uint32_t mb_caps_extent(const mb_caps_device_t *device, uint32_t reg, bool *readable)
+{
+    *readable = true;
+    if (reg < device->span_start) {
+        return device->span_start;
+    }
+    if (reg >= device->span_end) {
+        return 0x10000;
+    }
+    for (int i = 0; i < device->range_count; i++) {
+        const mb_caps_range_t *range = &device->ranges[i];
+        if (reg < range->start) {
+            *readable = false;
+            return range->start;
+        }
+        if (reg < (uint32_t)range->start + range->count) {
+            return (uint32_t)range->start + range->count;
+        }
+    }
+    *readable = false;
+    return device->span_end;
+}
+
+// Read registers of the probed slave, ESP_ERR_NOT_SUPPORTED if the slave refused the request
+static esp_err_t mb_caps_read(uint16_t reg, uint16_t count, uint8_t *exception)
+{
+    mb_job_t job = { .op = MB_JOB_READ_RANGE, .slave_id = probe.device.slave_id, .value = probe.device.func_id,
+                     .register_id = reg, .count = count };
+    esp_err_t err = mb_worker_execute(caps_channel, &job);
+    xSemaphoreTake(caps_lock, portMAX_DELAY);
+    reads++;
+    xSemaphoreGive(caps_lock);
+    *exception = job.exception;
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (job.value == 0) {
+        return ESP_OK;
+    }
+    if ((job.exception == MB_CAPS_EX_ILLEGAL_ADDRESS) || (job.exception == MB_CAPS_EX_ILLEGAL_VALUE)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return job.exception ? ESP_ERR_INVALID_RESPONSE : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t mb_caps_add_range(uint16_t start, uint16_t count)
+{
+    mb_caps_device_t *device = &probe.device;
+    // The span is read in address order, so a range can only extend the last one
+    if (device->range_count) {
+        mb_caps_range_t *last = &device->ranges[device->range_count - 1];
+        if ((uint32_t)last->start + last->count == start) {
+            last->count += count;
+            return ESP_OK;
+        }
+    }
+    if (device->range_count >= MB_CAPS_RANGES_MAX) {
+        ESP_LOGW(TAG, "Slave %u has more than %d readable ranges.", (unsigned)device->slave_id, MB_CAPS_RANGES_MAX);
+        return ESP_ERR_NO_MEM;
+    }
+    device->ranges[device->range_count].start = start;
+    device->ranges[device->range_count].count = count;
+    device->range_count++;
+    return ESP_OK;
+}
+
+// Find the readable ranges of a read, splitting it while the slave refuses it
+static esp_err_t mb_caps_map(uint16_t reg, uint16_t count)
+{
+    uint8_t exception = 0;
+    esp_err_t err = mb_caps_read(reg, count, &exception);
+    if (err == ESP_OK) {
+        if (count > probe.ok_regs) {
+            probe.ok_regs = (uint8_t)count;
+        }
+        return mb_caps_add_range(reg, count);
+    }
+    if (err != ESP_ERR_NOT_SUPPORTED) {
+        return err;
+    }
+    if ((exception == MB_CAPS_EX_ILLEGAL_VALUE) && (count > 1)
+            && (!probe.refused_regs || (count < probe.refused_regs))) {
+        // Too many registers for one request
+        probe.refused_regs = (uint8_t)count;
+    }
+    if (count == 1) {
+        // Illegal address
+        return ESP_OK;
+    }
+    uint16_t half = count / 2;
+    err = mb_caps_map(reg, half);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return mb_caps_map(reg + half, count - half);
+}
+
+// Find the registers per request in the longest readable run, some slaves refuse long reads with exception 02
+static esp_err_t mb_caps_limit(void)
+{
+    mb_caps_device_t *device = &probe.device;
+    uint16_t run_start = 0;
+    uint32_t high = 0;
+    for (int i = 0; i < device->range_count; i++) {
+        if (device->ranges[i].count > high) {
+            run_start = device->ranges[i].start;
+            high = device->ranges[i].count;
+        }
+    }
+    uint32_t limit = probe.refused_regs ? probe.refused_regs - 1 : MB_CAPS_REGS_MAX;
+    high = (high < limit) ? high : limit;
+    uint32_t low = probe.ok_regs;
+    while (low < high) {
+        uint16_t count = (uint16_t)((low + high + 1) / 2);
+        uint8_t exception = 0;
+        esp_err_t err = mb_caps_read(run_start, count, &exception);
+        if (err == ESP_OK) {
+            low = count;
+        } else if (err == ESP_ERR_NOT_SUPPORTED) {
+            high = count - 1;
+        } else {
+            return err;
+        }
+    }
+    device->max_regs = (uint8_t)(low ? low : 1);
+    return ESP_OK;
+}
+
+static esp_err_t mb_caps_run_probe(void)
+{
+    mb_caps_device_t *device = &probe.device;
+    for (uint32_t reg = device->span_start; reg < device->span_end; ) {
+        // Later blocks use the limit learned from the exceptions of the first ones
+        uint32_t count = device->span_end - reg;
+        uint32_t limit = probe.refused_regs ? probe.refused_regs - 1 : MB_CAPS_REGS_MAX;
+        count = (count < limit) ? count : limit;
+        esp_err_t err = mb_caps_map((uint16_t)reg, (uint16_t)count);
+        if (err != ESP_OK) {
+            return err;
+        }
+        reg += count;
+    }
+    return mb_caps_limit();
+}
+
+static void mb_caps_save(void)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(MB_CAPS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, MB_CAPS_NVS_KEY, &saved, sizeof(saved));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Capabilities are not saved (%s).", esp_err_to_name(err));
+    }
+}
+
+// Replace the capabilities of the probed slave function and save the table
+static void mb_caps_commit(void)
+{
+    xSemaphoreTake(caps_lock, portMAX_DELAY);
+    mb_caps_device_t *device = (mb_caps_device_t *)mb_caps_find(probe.device.slave_id, probe.device.func_id);
+    if (!device && (table.count < MB_CAPS_DEVICES_MAX)) {
+        device = &table.devices[table.count++];
+    }
+    if (device) {
+        memcpy(device, &probe.device, sizeof(*device));
+    }
+    // Flash writes can take long, the bus engine must not wait for them
+    memcpy(&saved, &table, sizeof(saved));
+    xSemaphoreGive(caps_lock);
+    if (device) {
+        mb_caps_save();
+    } else {
+        ESP_LOGW(TAG, "Capability table full, slave %u is not stored.", (unsigned)probe.device.slave_id);
+    }
+}
+
+static void mb_caps_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t started = esp_timer_get_time();
+        esp_err_t err = mb_caps_run_probe();
+        if (err == ESP_OK) {
+            mb_caps_commit();
+            ESP_LOGI(TAG, "Slave %u function %u: %u registers per read, %u readable ranges, %d reads in %lld ms.",
+                     (unsigned)probe.device.slave_id, (unsigned)probe.device.func_id, (unsigned)probe.device.max_regs,
+                     (unsigned)probe.device.range_count, reads, (long long)((esp_timer_get_time() - started) / 1000));
+        } else {
+            ESP_LOGW(TAG, "Probe of slave %u failed (%s).", (unsigned)probe.device.slave_id, esp_err_to_name(err));
+        }
+        xSemaphoreTake(caps_lock, portMAX_DELAY);
+        running = false;
+        last_error = err;
+        xSemaphoreGive(caps_lock);
+    }
+}
+
+esp_err_t mb_caps_init(void)
+{
+    caps_lock = xSemaphoreCreateMutex();
+    caps_channel = mb_worker_channel_open();
+    if (!caps_lock || !caps_channel) {
+        ESP_LOGE(TAG, "no memory for capability prober.");
+        return ESP_ERR_NO_MEM;
+    }
+    nvs_handle_t handle;
+    if (nvs_open(MB_CAPS_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        size_t size = sizeof(table);
+        if ((nvs_get_blob(handle, MB_CAPS_NVS_KEY, &table, &size) != ESP_OK) || (size != sizeof(table))
+                || (table.count > MB_CAPS_DEVICES_MAX)) {
+            memset(&table, 0, sizeof(table));
+        }
+        nvs_close(handle);
+    }
+    ESP_LOGI(TAG, "%u slave functions with learned capabilities.", (unsigned)table.count);
+    BaseType_t status = xTaskCreatePinnedToCore(mb_caps_task, "mb_caps",
+                                                MB_CAPS_TASK_STACK_SIZE, NULL,
+                                                MB_CAPS_TASK_PRIO, &caps_task_handle,
+                                                CONFIG_GW_NET_CORE);
+    if (status != pdPASS) {
+        ESP_LOGE(TAG, "capability prober task creation error.");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mb_caps_probe(int slave_id, int func_id, uint16_t reg_start, uint32_t reg_count)
+{
+    if ((slave_id < 1) || (slave_id > 247) || ((func_id != 3) && (func_id != 4))
+            || !reg_count || (reg_count > UINT16_MAX) || ((uint32_t)reg_start + reg_count > 0x10000)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!caps_task_handle) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(caps_lock, portMAX_DELAY);
+    if (running) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        // The task only uses the probe while running is set
+        memset(&probe, 0, sizeof(probe));
+        probe.device.slave_id = (uint8_t)slave_id;
+        probe.device.func_id = (uint8_t)func_id;
+        probe.device.span_start = reg_start;
+        probe.device.span_end = (uint32_t)reg_start + reg_count;
+        running = true;
+        reads = 0;
+    }
+    xSemaphoreGive(caps_lock);
+    if (err == ESP_OK) {
+        xTaskNotifyGive(caps_task_handle);
+    }
+    return err;
+}
+
+bool mb_caps_next_read(int slave_id, int func_id, uint16_t *reg, uint32_t end, uint16_t *count)
+{
+    uint32_t next = *reg;
+    uint32_t run_end = end;
+    uint32_t limit = MB_CAPS_REGS_MAX;
+    if (caps_lock) {
+        xSemaphoreTake(caps_lock, portMAX_DELAY);
+        const mb_caps_device_t *device = mb_caps_find(slave_id, func_id);
+        if (device) {
+            limit = device->max_regs;
+            bool readable = false;
+            // Skip the illegal addresses
+            while (next < end) {
+                run_end = mb_caps_extent(device, next, &readable);
+                if (readable) {
+                    break;
+                }
+                next = run_end;
+            }
+        }
+        xSemaphoreGive(caps_lock);
+    }
+    if (next >= end) {
+        return false;
+    }
+    run_end = ((run_end < end) ? run_end : end) - next;
+    *reg = (uint16_t)next;
+    *count = (uint16_t)((run_end < limit) ? run_end : limit);
+    return true;
+}
+
+bool mb_caps_readable(int slave_id, int func_id, uint16_t reg)
+{
+    uint16_t next = reg;
+    uint16_t count = 0;
+    return mb_caps_next_read(slave_id, func_id, &next, (uint32_t)reg + 1, &count);
+}
+
+void mb_caps_report(cJSON *root)
+{
+    if (!caps_lock) {
+        return;
+    }
+    xSemaphoreTake(caps_lock, portMAX_DELAY);
+    cJSON_AddBoolToObject(root, "running", running);
+    cJSON_AddNumberToObject(root, "reads", reads);
+    cJSON_AddStringToObject(root, "error", esp_err_to_name(last_error));
+    cJSON *array = cJSON_AddArrayToObject(root, "devices");
+    for (uint32_t i = 0; i < table.count; i++) {
+        const mb_caps_device_t *device = &table.devices[i];
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "slaveId", device->slave_id);
+        cJSON_AddNumberToObject(item, "funcId", device->func_id);
+        cJSON_AddNumberToObject(item, "maxRegs", device->max_regs);
+        cJSON_AddNumberToObject(item, "registerId", device->span_start);
+        cJSON_AddNumberToObject(item, "count", device->span_end - device->span_start);
+        cJSON *ranges = cJSON_AddArrayToObject(item, "readable");
+        for (int j = 0; j < device->range_count; j++) {
+            cJSON *range = cJSON_CreateObject();
+            cJSON_AddNumberToObject(range, "registerId", device->ranges[j].start);
+            cJSON_AddNumberToObject(range, "count", device->ranges[j].count);
+            cJSON_AddItemToArray(ranges, range);
+        }
+        cJSON_AddItemToArray(array, item);
+    }
+    xSemaphoreGive(caps_lock);
+}
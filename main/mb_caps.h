@@ -0,0 +1,88 @@
+/* Learned read capabilities of the slaves of the RTU segment
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "cJSON.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Registers of one FC3/FC4 response
+#define MB_CAPS_REGS_MAX            (125)
+
+/**
+ * @brief Start the capability prober task and load the capabilities learned before from NVS
+ *
+ * NVS must be initialized with nvs_flash_init() first.
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NO_MEM if the task could not be created
+ */
+esp_err_t mb_caps_init(void);
+
+/**
+ * @brief Start probing the read capabilities of a slave in the background
+ *
+ * The span is read in blocks through the bus engine, between the jobs of the other clients.
+ * A read answered with exception 02 (illegal data address) is split until the illegal addresses
+ * are found, a read answered with exception 03 (illegal data value) lowers the registers per
+ * request. The largest readable run then gives the registers per request the slave accepts.
+ * The result replaces the capabilities of the slave for this function and is saved to NVS.
+ *
+ * @param slave_id address of the slave on the RTU segment, 1..247
+ * @param func_id read function: 3 (holding) or 4 (input)
+ * @param reg_start first register of the span
+ * @param reg_count registers of the span
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG on wrong arguments
+ *     - ESP_ERR_INVALID_STATE if a probe is running
+ */
+esp_err_t mb_caps_probe(int slave_id, int func_id, uint16_t reg_start, uint32_t reg_count);
+
+/**
+ * @brief Plan the next read of a register span with the learned capabilities of the slave
+ *
+ * Addresses outside of the probed span are assumed readable, reads of slaves that were not
+ * probed are only bounded by MB_CAPS_REGS_MAX.
+ *
+ * @param slave_id slave address
+ * @param func_id read function: 3 (holding) or 4 (input)
+ * @param[inout] reg first register not read yet, moved past the illegal addresses
+ * @param end register after the span
+ * @param[out] count registers of the next read starting at *reg
+ * @return true if there is a read, false if the rest of the span is illegal
+ */
+bool mb_caps_next_read(int slave_id, int func_id, uint16_t *reg, uint32_t end, uint16_t *count);
+
+/**
+ * @brief Check if a register is outside of the illegal addresses of a slave
+ *
+ * @param slave_id slave address
+ * @param func_id read function, other functions than 3 and 4 are always readable
+ * @param reg register address
+ * @return false if the register answered exception 02 when the slave was probed
+ */
+bool mb_caps_readable(int slave_id, int func_id, uint16_t reg);
+
+/**
+ * @brief Add the prober state and the learned capabilities to a JSON object
+ *
+ * @param root object to add "running", "error" and "devices" to
+ */
+void mb_caps_report(cJSON *root);
+
+#ifdef __cplusplus
+}
+#endif
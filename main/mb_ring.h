@@ -0,0 +1,68 @@
+/* Lock-free single-producer/single-consumer ring
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of slots in the ring, must be a power of two
+#define MB_RING_SIZE    (8)
+
+/**
+ * @brief Ring of pointers handed from exactly one producer task to exactly one consumer task.
+ *
+ * The producer only writes head and the consumer only writes tail, so the two sides
+ * can run on different cores without taking a lock or entering a critical section.
+ */
+typedef struct {
+    void *slots[MB_RING_SIZE];
+    atomic_uint head;               /*!< Next slot to write, owned by the producer */
+    atomic_uint tail;               /*!< Next slot to read, owned by the consumer */
+} mb_ring_t;
+
+static inline void mb_ring_init(mb_ring_t *ring)
+{
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+// Producer side: returns false if the ring is full
+static inline bool mb_ring_push(mb_ring_t *ring, void *item)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if ((head - tail) == MB_RING_SIZE) {
+        return false;
+    }
+    ring->slots[head & (MB_RING_SIZE - 1)] = item;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Consumer side: returns NULL if the ring is empty
+static inline void *mb_ring_pop(mb_ring_t *ring)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail) {
+        return NULL;
+    }
+    void *item = ring->slots[tail & (MB_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return item;
+}
+
+#ifdef __cplusplus
+}
+#endif
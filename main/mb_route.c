@@ -0,0 +1,567 @@
+/* Unit ID routing to downstream transports
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "device_map.h"
+#include "mb_route.h"
+
+#define MB_ROUTE_NAME_LEN           (16)
+#define MB_ROUTE_HOST_LEN           (16)
+#define MB_ROUTE_TASK_STACK_SIZE    (3072)
+#define MB_ROUTE_TASK_PRIO          (5)
+#define MB_ROUTE_QUEUE_SIZE         (CONFIG_GW_ROUTE_QUEUE_SIZE)
+#define MB_ROUTE_TIMEOUT_MS         (CONFIG_GW_ROUTE_TIMEOUT_MS)
+// Largest PDU exchanged: read of one item or echo of a single write
+#define MB_ROUTE_PDU_MAX            (8)
+#define MB_ROUTE_MBAP_LEN           (7)
+
+typedef struct {
+    mb_job_t job;
+    mb_route_done_t done;
+    void *arg;
+} mb_route_request_t;
+
+typedef struct {
+    char name[MB_ROUTE_NAME_LEN];
+    mb_transport_type_t type;
+    char host[MB_ROUTE_HOST_LEN];
+    uint16_t port;
+    QueueHandle_t queue;            // the bus engine and the httpd task both submit, so not a ring
+    int sock;                       // connection of the transport task, -1 when closed
+    uint16_t transaction_id;
+    uint32_t requests;
+    uint32_t errors;
+    uint32_t expired;               // requests dropped because the client deadline passed
+    uint8_t no_mask_write[256 / 8];     // addresses that refused function 22, TCP units use all of 0..255
+} mb_transport_t;
+
+static const char *TAG = "MB_ROUTE";
+
+static const char *transport_type_names[] = { "rtu", "tcp", "rtu-over-tcp" };
+
+// Transports are only added by the httpd task and published by the count
+static mb_transport_t transports[MB_ROUTE_TRANSPORTS_MAX];
+static atomic_uint transport_count;
+// Route of each unit ID: transport + 1 in the high byte and address in the low byte, 0 if not routed.
+// A route is updated by one 16 bit store, so the readers need no lock
+static volatile uint16_t routes[MB_ROUTE_UNIT_MAX + 1];
+
+static uint16_t mb_route_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+// Build the request PDU of a job, returns 0 if the job has no single item equivalent
+static size_t mb_route_build_pdu(const mb_job_t *job, uint8_t *pdu)
+{
+    if (job->cid >= DEVICE_MAP_PARAMS) {
+        return 0;
+    }
+    mb_param_type_t area = device_map_descriptors[job->cid].mb_param_type;
+    uint16_t arg = 1;
+    if (job->op == MB_JOB_READ) {
+        switch (area) {
+            case MB_PARAM_HOLDING:
+                pdu[0] = 3;
+                break;
+            case MB_PARAM_INPUT:
+                pdu[0] = 4;
+                break;
+            case MB_PARAM_COIL:
+                pdu[0] = 1;
+                break;
+            case MB_PARAM_DISCRETE:
+                pdu[0] = 2;
+                break;
+            default:
+                return 0;
+        }
+    } else if ((job->op == MB_JOB_WRITE) && (area == MB_PARAM_HOLDING)) {
+        pdu[0] = 6;
+        arg = (uint16_t)job->value;
+    } else if ((job->op == MB_JOB_WRITE) && (area == MB_PARAM_COIL)) {
+        pdu[0] = 5;
+        arg = job->value ? 0xFF00 : 0x0000;
+    } else {
+        return 0;
+    }
+    pdu[1] = (uint8_t)(job->register_id >> 8);
+    pdu[2] = (uint8_t)job->register_id;
+    pdu[3] = (uint8_t)(arg >> 8);
+    pdu[4] = (uint8_t)arg;
+    return 5;
+}
+
+// Get the value of a response PDU, false on exception or malformed response
+static bool mb_route_parse_pdu(const uint8_t *request, const uint8_t *pdu, size_t len, int *value)
+{
+    if ((len < 2) || (pdu[0] != request[0])) {
+        return false;
+    }
+    switch (pdu[0]) {
+        case 3:
+        case 4:
+            if ((len < 4) || (pdu[1] != 2)) {
+                return false;
+            }
+            *value = (pdu[2] << 8) | pdu[3];
+            return true;
+        case 1:
+        case 2:
+            if ((len < 3) || (pdu[1] != 1)) {
+                return false;
+            }
+            *value = pdu[2] & 1;
+            return true;
+        case 5:
+        case 6:
+            // Single writes answer with an echo of the request
+            if ((len < 5) || memcmp(pdu, request, 5)) {
+                return false;
+            }
+            *value = (pdu[0] == 5) ? (pdu[3] != 0) : ((pdu[3] << 8) | pdu[4]);
+            return true;
+        case 22:
+            if ((len < 7) || memcmp(pdu, request, 7)) {
+                return false;
+            }
+            *value = 0;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void mb_route_disconnect(mb_transport_t *transport)
+{
+    if (transport->sock >= 0) {
+        close(transport->sock);
+        transport->sock = -1;
+    }
+}
+
+static struct timeval mb_route_timeval(uint32_t timeout_ms)
+{
+    struct timeval timeout = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    return timeout;
+}
+
+static bool mb_route_connect(mb_transport_t *transport, uint32_t timeout_ms)
+{
+    if (transport->sock >= 0) {
+        return true;
+    }
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(transport->port);
+    inet_pton(AF_INET, transport->host, &addr.sin_addr);
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return false;
+    }
+    struct timeval timeout = mb_route_timeval(timeout_ms);
+    // Connect without blocking, so an unreachable host costs one timeout and not the TCP retry schedule
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    int res = connect(sock, (struct sockaddr *)&addr, sizeof(addr));
+    if ((res < 0) && (errno == EINPROGRESS)) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if ((select(sock + 1, NULL, &fds, NULL, &timeout) == 1)
+                && !getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) && !error) {
+            res = 0;
+        }
+    }
+    if (res < 0) {
+        ESP_LOGW(TAG, "%s: connection to %s:%u failed.", transport->name, transport->host, (unsigned)transport->port);
+        close(sock);
+        return false;
+    }
+    fcntl(sock, F_SETFL, 0);
+    timeout = mb_route_timeval(MB_ROUTE_TIMEOUT_MS);
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    transport->sock = sock;
+    ESP_LOGI(TAG, "%s: connected to %s:%u.", transport->name, transport->host, (unsigned)transport->port);
+    return true;
+}
+
+static bool mb_route_send(int sock, const uint8_t *data, size_t len)
+{
+    return send(sock, data, len, 0) == (ssize_t)len;
+}
+
+static bool mb_route_recv(int sock, uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t res = recv(sock, data, len, 0);
+        if (res <= 0) {
+            return false;
+        }
+        data += res;
+        len -= res;
+    }
+    return true;
+}
+
+// Exchange a PDU in a Modbus TCP frame, skipping late responses to requests that timed out
+static bool mb_route_exchange_tcp(mb_transport_t *transport, uint8_t unit, const uint8_t *pdu, size_t len,
+                                  uint8_t *response, size_t *response_len)
+{
+    uint8_t frame[MB_ROUTE_MBAP_LEN + MB_ROUTE_PDU_MAX];
+    uint16_t tid = ++transport->transaction_id;
+    frame[0] = (uint8_t)(tid >> 8);
+    frame[1] = (uint8_t)tid;
+    frame[2] = 0;
+    frame[3] = 0;
+    frame[4] = 0;
+    frame[5] = (uint8_t)(len + 1);
+    frame[6] = unit;
+    memcpy(&frame[MB_ROUTE_MBAP_LEN], pdu, len);
+    if (!mb_route_send(transport->sock, frame, MB_ROUTE_MBAP_LEN + len)) {
+        return false;
+    }
+    for (;;) {
+        if (!mb_route_recv(transport->sock, frame, MB_ROUTE_MBAP_LEN)) {
+            return false;
+        }
+        size_t pdu_len = ((frame[4] << 8) | frame[5]) - 1;
+        if ((frame[2] | frame[3]) || (pdu_len < 2) || (pdu_len > MB_ROUTE_PDU_MAX)
+                || !mb_route_recv(transport->sock, response, pdu_len)) {
+            return false;
+        }
+        if (((frame[0] << 8) | frame[1]) == tid) {
+            *response_len = pdu_len;
+            return frame[6] == unit;
+        }
+    }
+}
+
+// Exchange a PDU in an RTU frame tunneled through TCP
+static bool mb_route_exchange_rtu(mb_transport_t *transport, uint8_t unit, const uint8_t *pdu, size_t len,
+                                  uint8_t *response, size_t *response_len)
+{
+    uint8_t frame[MB_ROUTE_PDU_MAX + 3];
+    frame[0] = unit;
+    memcpy(&frame[1], pdu, len);
+    uint16_t crc = mb_route_crc16(frame, len + 1);
+    frame[len + 1] = (uint8_t)crc;
+    frame[len + 2] = (uint8_t)(crc >> 8);
+    if (!mb_route_send(transport->sock, frame, len + 3)) {
+        return false;
+    }
+    // Address, function and the byte count, exception code or first echo byte tell the frame length
+    if (!mb_route_recv(transport->sock, frame, 3)) {
+        return false;
+    }
+    size_t frame_len;
+    if (frame[1] & 0x80) {
+        frame_len = 5;
+    } else if (frame[1] <= 4) {
+        frame_len = 5 + frame[2];
+    } else if (frame[1] == 22) {
+        frame_len = 10;
+    } else {
+        frame_len = 8;
+    }
+    if ((frame_len > sizeof(frame)) || !mb_route_recv(transport->sock, &frame[3], frame_len - 3)) {
+        return false;
+    }
+    // The CRC over a frame including its CRC is 0
+    if ((frame[0] != unit) || mb_route_crc16(frame, frame_len)) {
+        return false;
+    }
+    *response_len = frame_len - 3;
+    memcpy(response, &frame[1], *response_len);
+    return true;
+}
+
+// Exchange a PDU on the connected transport, false if no response came back
+static bool mb_route_transact(mb_transport_t *transport, uint8_t unit, const uint8_t *pdu, size_t len,
+                              uint8_t *response, size_t *response_len)
+{
+    bool exchanged = (transport->type == MB_TRANSPORT_TCP)
+                        ? mb_route_exchange_tcp(transport, unit, pdu, len, response, response_len)
+                        : mb_route_exchange_rtu(transport, unit, pdu, len, response, response_len);
+    if (!exchanged) {
+        // Start again from a clean stream, a late response must not be taken for the next one
+        mb_route_disconnect(transport);
+    }
+    return exchanged;
+}
+
+// Mask write with function 22, or read-modify-write for addresses that refused it
+static bool mb_route_mask_write(mb_transport_t *transport, const mb_job_t *job)
+{
+    uint8_t unit = (uint8_t)job->slave_id;
+    uint8_t pdu[7];
+    uint8_t response[MB_ROUTE_PDU_MAX];
+    size_t response_len = 0;
+    int value = 0;
+    pdu[1] = (uint8_t)(job->register_id >> 8);
+    pdu[2] = (uint8_t)job->register_id;
+    if (!job->xor_mask && !(transport->no_mask_write[unit >> 3] & (1 << (unit & 7)))) {
+        pdu[0] = 22;
+        pdu[3] = (uint8_t)(job->and_mask >> 8);
+        pdu[4] = (uint8_t)job->and_mask;
+        pdu[5] = (uint8_t)(job->or_mask >> 8);
+        pdu[6] = (uint8_t)job->or_mask;
+        if (!mb_route_transact(transport, unit, pdu, 7, response, &response_len)) {
+            return false;
+        }
+        if (mb_route_parse_pdu(pdu, response, response_len, &value)) {
+            return true;
+        }
+        // Only an illegal function exception means the device lacks function 22
+        if ((response_len < 2) || (response[0] != (22 | 0x80)) || (response[1] != 1)) {
+            return false;
+        }
+        transport->no_mask_write[unit >> 3] |= (uint8_t)(1 << (unit & 7));
+        ESP_LOGW(TAG, "%s: unit %u has no mask write, using read-modify-write.", transport->name, (unsigned)unit);
+    }
+    pdu[0] = 3;
+    pdu[3] = 0;
+    pdu[4] = 1;
+    if (!mb_route_transact(transport, unit, pdu, 5, response, &response_len)
+            || !mb_route_parse_pdu(pdu, response, response_len, &value)) {
+        return false;
+    }
+    uint16_t reg = mb_worker_mask_apply(job, (uint16_t)value);
+    pdu[0] = 6;
+    pdu[3] = (uint8_t)(reg >> 8);
+    pdu[4] = (uint8_t)reg;
+    return mb_route_transact(transport, unit, pdu, 5, response, &response_len)
+            && mb_route_parse_pdu(pdu, response, response_len, &value);
+}
+
+static void mb_route_run_job(mb_transport_t *transport, mb_job_t *job)
+{
+    uint8_t pdu[MB_ROUTE_PDU_MAX];
+    uint8_t response[MB_ROUTE_PDU_MAX];
+    size_t response_len = 0;
+    int value = -1;
+    bool ok = false;
+    uint32_t timeout_ms = MB_ROUTE_TIMEOUT_MS;
+    if (job->deadline) {
+        int64_t left_us = job->deadline - esp_timer_get_time();
+        if (left_us <= 0) {
+            // The client gave up while the job was queued, do not spend the link on it
+            transport->expired++;
+            job->value = -1;
+            job->timestamp = 0;
+            job->expired = true;
+            return;
+        }
+        if (left_us < (int64_t)MB_ROUTE_TIMEOUT_MS * 1000) {
+            timeout_ms = (uint32_t)((left_us + 999) / 1000);
+        }
+    }
+    size_t len = (job->op == MB_JOB_MASK_WRITE) ? 0 : mb_route_build_pdu(job, pdu);
+    transport->requests++;
+    if ((len || (job->op == MB_JOB_MASK_WRITE)) && mb_route_connect(transport, timeout_ms)) {
+        struct timeval timeout = mb_route_timeval(timeout_ms);
+        setsockopt(transport->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (job->op == MB_JOB_MASK_WRITE) {
+            ok = mb_route_mask_write(transport, job);
+            value = 0;
+        } else {
+            ok = mb_route_transact(transport, (uint8_t)job->slave_id, pdu, len, response, &response_len)
+                    && mb_route_parse_pdu(pdu, response, response_len, &value);
+        }
+    }
+    if (!ok) {
+        transport->errors++;
+        ESP_LOGE(TAG, "%s: request to unit %d register %d failed.", transport->name, job->slave_id, job->register_id);
+    }
+    job->value = ok ? value : -1;
+    job->timestamp = ok ? (uint64_t)esp_timer_get_time() : 0;
+    job->expired = !ok && job->deadline && (esp_timer_get_time() >= job->deadline);
+}
+
+static void mb_route_task(void *arg)
+{
+    mb_transport_t *transport = (mb_transport_t *)arg;
+    mb_route_request_t request;
+    for (;;) {
+        if (xQueueReceive(transport->queue, &request, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        mb_route_run_job(transport, &request.job);
+        request.done(&request.job, request.arg);
+    }
+}
+
+static int mb_route_find_transport(const char *name)
+{
+    unsigned count = atomic_load_explicit(&transport_count, memory_order_acquire);
+    for (unsigned i = 0; name && (i < count); i++) {
+        if (!strcmp(transports[i].name, name)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+esp_err_t mb_route_init(void)
+{
+    mb_transport_t *local = &transports[MB_ROUTE_LOCAL];
+    strlcpy(local->name, "rtu", MB_ROUTE_NAME_LEN);
+    local->type = MB_TRANSPORT_RTU;
+    local->sock = -1;
+    atomic_store_explicit(&transport_count, 1, memory_order_release);
+    return ESP_OK;
+}
+
+esp_err_t mb_transport_type_from_name(const char *name, mb_transport_type_t *type)
+{
+    for (int i = 0; name && (i < sizeof(transport_type_names) / sizeof(transport_type_names[0])); i++) {
+        if (!strcmp(name, transport_type_names[i])) {
+            *type = (mb_transport_type_t)i;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t mb_route_add_transport(const char *name, mb_transport_type_t type, const char *host, uint16_t port, int *id)
+{
+    struct in_addr addr;
+    if (!name || !name[0] || (strlen(name) >= MB_ROUTE_NAME_LEN) || !host || (strlen(host) >= MB_ROUTE_HOST_LEN)
+            || (inet_pton(AF_INET, host, &addr) != 1) || !port
+            || ((type != MB_TRANSPORT_TCP) && (type != MB_TRANSPORT_RTU_OVER_TCP))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (mb_route_find_transport(name) >= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    unsigned index = atomic_load(&transport_count);
+    if (index >= MB_ROUTE_TRANSPORTS_MAX) {
+        return ESP_ERR_NO_MEM;
+    }
+    mb_transport_t *transport = &transports[index];
+    memset(transport, 0, sizeof(mb_transport_t));
+    strlcpy(transport->name, name, MB_ROUTE_NAME_LEN);
+    strlcpy(transport->host, host, MB_ROUTE_HOST_LEN);
+    transport->type = type;
+    transport->port = port;
+    transport->sock = -1;
+    transport->queue = xQueueCreate(MB_ROUTE_QUEUE_SIZE, sizeof(mb_route_request_t));
+    if (!transport->queue) {
+        return ESP_ERR_NO_MEM;
+    }
+    // Socket I/O runs next to the TCP/IP stack, the bus core keeps the serial timing
+    BaseType_t status = xTaskCreatePinnedToCore(mb_route_task, "mb_route", MB_ROUTE_TASK_STACK_SIZE, transport,
+                                                MB_ROUTE_TASK_PRIO, NULL, CONFIG_GW_NET_CORE);
+    if (status != pdPASS) {
+        vQueueDelete(transport->queue);
+        ESP_LOGE(TAG, "transport task creation error.");
+        return ESP_ERR_NO_MEM;
+    }
+    // Publish the transport only after it is initialized
+    atomic_store_explicit(&transport_count, index + 1, memory_order_release);
+    ESP_LOGI(TAG, "Transport #%u %s: %s %s:%u.", index, name, transport_type_names[type], host, (unsigned)port);
+    if (id) {
+        *id = (int)index;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mb_route_add(int unit_id, const char *transport, int address)
+{
+    if ((unit_id < 1) || (unit_id > MB_ROUTE_UNIT_MAX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int index = mb_route_find_transport(transport);
+    if (index < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    // Unit ID 0 and 248..255 are valid behind TCP gateways, but not on a serial segment
+    bool serial = (transports[index].type == MB_TRANSPORT_RTU);
+    if ((address < (serial ? 1 : 0)) || (address > (serial ? MB_ROUTE_UNIT_MAX : 255))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    routes[unit_id] = (uint16_t)(((index + 1) << 8) | address);
+    return ESP_OK;
+}
+
+int mb_route_resolve(int unit_id, int *address)
+{
+    uint16_t route = ((unit_id >= 1) && (unit_id <= MB_ROUTE_UNIT_MAX)) ? routes[unit_id] : 0;
+    if (!route) {
+        *address = unit_id;
+        return MB_ROUTE_LOCAL;
+    }
+    *address = route & 0xFF;
+    return (route >> 8) - 1;
+}
+
+esp_err_t mb_route_submit(int transport, const mb_job_t *job, mb_route_done_t done, void *arg)
+{
+    unsigned count = atomic_load_explicit(&transport_count, memory_order_acquire);
+    if ((transport <= MB_ROUTE_LOCAL) || (transport >= (int)count) || !job || !done) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    mb_route_request_t request = { .job = *job, .done = done, .arg = arg };
+    if (xQueueSend(transports[transport].queue, &request, 0) != pdTRUE) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void mb_route_report(cJSON *root)
+{
+    unsigned count = atomic_load_explicit(&transport_count, memory_order_acquire);
+    cJSON *array = cJSON_AddArrayToObject(root, "transports");
+    for (unsigned i = 0; i < count; i++) {
+        const mb_transport_t *transport = &transports[i];
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", transport->name);
+        cJSON_AddStringToObject(item, "type", transport_type_names[transport->type]);
+        if (transport->type != MB_TRANSPORT_RTU) {
+            cJSON_AddStringToObject(item, "host", transport->host);
+            cJSON_AddNumberToObject(item, "port", transport->port);
+            cJSON_AddBoolToObject(item, "connected", transport->sock >= 0);
+            cJSON_AddNumberToObject(item, "queued", uxQueueMessagesWaiting(transport->queue));
+            cJSON_AddNumberToObject(item, "requests", transport->requests);
+            cJSON_AddNumberToObject(item, "errors", transport->errors);
+            cJSON_AddNumberToObject(item, "expired", transport->expired);
+        }
+        cJSON_AddItemToArray(array, item);
+    }
+    array = cJSON_AddArrayToObject(root, "routes");
+    for (int unit = 1; unit <= MB_ROUTE_UNIT_MAX; unit++) {
+        uint16_t route = routes[unit];
+        if (!route) {
+            continue;
+        }
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "unitId", unit);
+        cJSON_AddStringToObject(item, "transport", transports[(route >> 8) - 1].name);
+        cJSON_AddNumberToObject(item, "address", route & 0xFF);
+        cJSON_AddItemToArray(array, item);
+    }
+}
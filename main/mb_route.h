@@ -0,0 +1,120 @@
+/* Unit ID routing to downstream transports
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "cJSON.h"
+#include "sdkconfig.h"
+#include "mb_worker.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MB_ROUTE_TRANSPORTS_MAX     (CONFIG_GW_ROUTE_TRANSPORTS_MAX)
+// Transport of the local RTU segment, served by the bus engine
+#define MB_ROUTE_LOCAL              (0)
+#define MB_ROUTE_UNIT_MAX           (247)
+
+typedef enum {
+    MB_TRANSPORT_RTU,               /*!< Local RTU segment of the Modbus master */
+    MB_TRANSPORT_TCP,               /*!< Modbus TCP device or gateway */
+    MB_TRANSPORT_RTU_OVER_TCP       /*!< RTU frames tunneled through a TCP connection (serial device server) */
+} mb_transport_type_t;
+
+/**
+ * @brief Completion callback of a routed job, called from the transport task
+ *
+ * @param job completed job, only valid during the call
+ * @param arg argument given at submission
+ */
+typedef void (*mb_route_done_t)(const mb_job_t *job, void *arg);
+
+/**
+ * @brief Create the local RTU transport, all unit IDs are routed to it until routes are added
+ *
+ * @return
+ *     - ESP_OK on success
+ */
+esp_err_t mb_route_init(void);
+
+/**
+ * @brief Add a TCP transport with its own queue and task, so it does not wait for the other transports
+ *
+ * @param name transport name used by the routes
+ * @param type MB_TRANSPORT_TCP or MB_TRANSPORT_RTU_OVER_TCP
+ * @param host IPv4 address of the device or device server
+ * @param port TCP port
+ * @param[out] id transport identifier, can be NULL
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG on wrong arguments
+ *     - ESP_ERR_INVALID_STATE if the name is already used
+ *     - ESP_ERR_NO_MEM if all transports are in use or the task could not be created
+ */
+esp_err_t mb_route_add_transport(const char *name, mb_transport_type_t type, const char *host, uint16_t port, int *id);
+
+/**
+ * @brief Get the transport type from its name ("rtu", "tcp" or "rtu-over-tcp")
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG if the name is unknown
+ */
+esp_err_t mb_transport_type_from_name(const char *name, mb_transport_type_t *type);
+
+/**
+ * @brief Route a unit ID to a downstream address on a transport
+ *
+ * @param unit_id global unit ID used by the clients, 1..247
+ * @param transport transport name
+ * @param address downstream slave address, 1..247 (0..255 on TCP)
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG on wrong arguments
+ *     - ESP_ERR_NOT_FOUND if the transport does not exist
+ */
+esp_err_t mb_route_add(int unit_id, const char *transport, int address);
+
+/**
+ * @brief Get the transport and downstream address of a unit ID
+ *
+ * Unit IDs without a route go to the local RTU segment with the same address.
+ *
+ * @param unit_id global unit ID
+ * @param[out] address downstream address
+ * @return transport identifier
+ */
+int mb_route_resolve(int unit_id, int *address);
+
+/**
+ * @brief Queue a job on a TCP transport, the job is copied
+ *
+ * @param transport transport identifier, not MB_ROUTE_LOCAL
+ * @param job job with the downstream address in slave_id
+ * @param done completion callback
+ * @param arg argument of the callback
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG on wrong arguments
+ *     - ESP_ERR_NO_MEM if the transport queue is full
+ */
+esp_err_t mb_route_submit(int transport, const mb_job_t *job, mb_route_done_t done, void *arg);
+
+/**
+ * @brief Add the transports and the routes to a JSON object
+ *
+ * @param root object to add "transports" and "routes" to
+ */
+void mb_route_report(cJSON *root);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,553 @@
+/* Modbus bus engine
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "mbcontroller.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "mb_ring.h"
+#include "mb_worker.h"
+#include "point_table.h"
+#include "device_map.h"
+#include "mb_route.h"
+#include "mb_caps.h"
+#include "bus_model.h"
+
+#define MB_WORKER_MAX_CHANNELS  (4)
+// Due points that can wait for the silence of their slave while other slaves are polled
+#define MB_WORKER_PARKED_SCANS  (4)
+// Longest rest of a silence spun on the bus core, longer ones let the bus serve other slaves
+#define MB_WORKER_SPIN_MAX_US   (500)
+// Exception code of a slave without the requested function
+#define MB_WORKER_EX_ILLEGAL_FUNCTION   (1)
+
+int read_mb(uint16_t cid, int slaveId, int registerId);
+int read_mb_quiet(uint16_t cid, int slaveId, int registerId);
+int set_mb(uint16_t cid, int slaveId, int registerId, int value);
+
+// Wait of a producer for a job executed by a TCP transport
+typedef struct {
+    mb_job_t *job;
+    TaskHandle_t owner;
+    atomic_bool done;
+} mb_worker_wait_t;
+
+struct mb_channel {
+    mb_ring_t submit;               // producer task -> bus engine
+    mb_ring_t done;                 // bus engine -> producer task
+    TaskHandle_t owner;             // task to notify on completion
+    mb_job_t *parked;               // job taken from the submit ring, waiting for the silence of its slave
+};
+
+// Last transaction with a slave of the RTU segment, for the silence the slave needs after it
+typedef struct {
+    int64_t end;
+    bool answered;
+} mb_worker_slave_t;
+
+static const char *TAG = "MB_WORKER";
+
+static mb_channel_t channels[MB_WORKER_MAX_CHANNELS];
+static atomic_uint channel_count;
+static TaskHandle_t worker_task_handle;
+static esp_timer_handle_t scan_timer;
+static mb_worker_slave_t slaves[MB_ROUTE_UNIT_MAX + 1];
+static atomic_uint expired_count;
+// Slaves of the RTU segment that answered a mask write with an illegal function exception
+static uint8_t mask_write_unsupported[(MB_ROUTE_UNIT_MAX + 1 + 7) / 8];
+
+// Bound the response timeout of the next transaction by what is left of the deadline, false if it passed
+static bool mb_worker_bound_timeout(const mb_job_t *job)
+{
+    if (!job->deadline) {
+        return true;
+    }
+    int64_t left_us = job->deadline - esp_timer_get_time();
+    if (left_us <= 0) {
+        return false;
+    }
+    uint32_t left_ms = (uint32_t)((left_us + 999) / 1000);
+    if (left_ms < CONFIG_FMB_MASTER_TIMEOUT_MS_RESPOND) {
+        mbc_master_set_response_timeout(left_ms);
+    }
+    return true;
+}
+
+// Bound the response timeout by the deadline, false if the deadline already passed
+static bool mb_worker_apply_deadline(mb_job_t *job)
+{
+    if (!mb_worker_bound_timeout(job)) {
+        // Nobody waits for the result anymore, leave the bus to the jobs that still matter
+        job->value = -1;
+        job->timestamp = 0;
+        job->expired = true;
+        atomic_fetch_add_explicit(&expired_count, 1, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+uint16_t mb_worker_mask_apply(const mb_job_t *job, uint16_t value)
+{
+    return (uint16_t)(((value & job->and_mask) | (job->or_mask & ~job->and_mask)) ^ job->xor_mask);
+}
+
+// One Mask Write Register transaction, or a read-modify-write on slaves without it
+static int mb_worker_mask_write(const mb_job_t *job)
+{
+    uint8_t slave = (uint8_t)job->slave_id;
+    uint16_t reg = (uint16_t)job->register_id;
+    if (!job->xor_mask && !(mask_write_unsupported[slave >> 3] & (1 << (slave & 7)))) {
+        esp_err_t err = mbc_master_mask_write(slave, reg, job->and_mask, job->or_mask);
+        if (err == ESP_OK) {
+            return 0;
+        }
+        // Only an illegal function exception means the slave lacks function 22, as for the TCP transports.
+        // Other exceptions and corrupted responses fail this write only.
+        uint8_t exception = 0;
+        if ((err != ESP_ERR_INVALID_RESPONSE) || (mbc_master_get_exception(&exception) != ESP_OK)
+                || (exception != MB_WORKER_EX_ILLEGAL_FUNCTION)) {
+            return -1;
+        }
+        mask_write_unsupported[slave >> 3] |= (uint8_t)(1 << (slave & 7));
+        ESP_LOGW(TAG, "Slave %u refused mask write, using read-modify-write.", (unsigned)slave);
+        // Each transaction gets what the previous ones left of the deadline, not all of it
+        if (!mb_worker_bound_timeout(job)) {
+            return -1;
+        }
+    }
+    uint16_t value = 0;
+    mb_param_request_t request = { .slave_addr = slave, .command = 3, .reg_start = reg, .reg_size = 1 };
+    if (mbc_master_send_request(&request, &value) != ESP_OK) {
+        return -1;
+    }
+    value = mb_worker_mask_apply(job, value);
+    request.command = 6;
+    if (!mb_worker_bound_timeout(job)) {
+        return -1;
+    }
+    return (mbc_master_send_request(&request, &value) == ESP_OK) ? 0 : -1;
+}
+
+// Probe an address with a short response timeout, value is -1 if nothing answered
+static int mb_worker_probe(mb_job_t *job)
+{
+    // Most addresses of a segment are empty and each of them costs a full response timeout
+    mbc_master_set_response_timeout(CONFIG_GW_DISCOVERY_TIMEOUT_MS);
+    esp_err_t err;
+    if (job->value == 17) {
+        err = mbc_master_report_slave_id((uint8_t)job->slave_id, job->data, &job->data_size);
+    } else {
+        uint16_t value = 0;
+        mb_param_request_t request = { .slave_addr = (uint8_t)job->slave_id, .command = 3, .reg_start = 0, .reg_size = 1 };
+        err = mbc_master_send_request(&request, &value);
+        job->data_size = 0;
+    }
+    mbc_master_set_response_timeout(0);
+    if (err == ESP_ERR_INVALID_RESPONSE) {
+        // An exception also tells that a device is there
+        job->data_size = 0;
+        return 0;
+    }
+    return (err == ESP_OK) ? 0 : -1;
+}
+
+// Read a register range, keeping the exception code of the slave for the capability prober
+static int mb_worker_read_range(mb_job_t *job)
+{
+    mb_param_request_t request = { .slave_addr = (uint8_t)job->slave_id, .command = (uint8_t)job->value,
+                                   .reg_start = (uint16_t)job->register_id, .reg_size = job->count };
+    mb_response_view_t view;
+    job->exception = 0;
+    esp_err_t err = mbc_master_read_view(&request, &view);
+    if (err == ESP_OK) {
+        bool complete = (view.reg_count == job->count);
+        if (job->data) {
+            // Big-endian registers as received, the prober only needs the answer and has no buffer
+            if (!complete) {
+                job->data_size = 0;
+            } else if (job->data_size > job->count * 2) {
+                job->data_size = job->count * 2;
+            }
+            memcpy(job->data, view.data, job->data_size);
+        }
+        mbc_master_release_view(&view);
+        return complete ? 0 : -1;
+    }
+    if (err == ESP_ERR_INVALID_RESPONSE) {
+        mbc_master_get_exception(&job->exception);
+    }
+    return -1;
+}
+
+// Teach the cost model the response time of the slave from a completed read
+static void mb_worker_learn(const mb_job_t *job, int range_func_id)
+{
+    if (job->op == MB_JOB_READ) {
+        int func_id = (job->cid == mb_worker_read_cid(4)) ? 4 : ((job->cid == mb_worker_read_cid(1)) ? 1 : 3);
+        bus_model_learn(job->slave_id, func_id, 1, job->bus_us);
+    } else if (job->op == MB_JOB_READ_RANGE) {
+        bus_model_learn(job->slave_id, range_func_id, job->count, job->bus_us);
+    }
+}
+
+// Jobs of one slave whose results tell if it needs more silence, probes mostly ask empty addresses
+static bool mb_worker_gap_tuned(const mb_job_t *job)
+{
+    return (job->op != MB_JOB_PROBE) && (job->op != MB_JOB_READ_BLOCK)
+           && (job->slave_id > 0) && (job->slave_id <= MB_ROUTE_UNIT_MAX);
+}
+
+// End of the silence the slave of a job needs after its last response, 0 if it needs none
+static int64_t mb_worker_quiet_until(const mb_job_t *job)
+{
+    if (!mb_worker_gap_tuned(job) || !slaves[job->slave_id].answered) {
+        return 0;
+    }
+    return slaves[job->slave_id].end + bus_model_gap_us(job->slave_id);
+}
+
+// Leave a job for later if the silence of its slave has more than MB_WORKER_SPIN_MAX_US to run
+static bool mb_worker_defer(const mb_job_t *job, int64_t *wake)
+{
+    int64_t until = mb_worker_quiet_until(job);
+    if (until - esp_timer_get_time() <= MB_WORKER_SPIN_MAX_US) {
+        return false;
+    }
+    if (until < *wake) {
+        *wake = until;
+    }
+    return true;
+}
+
+static void mb_worker_run_job(mb_job_t *job)
+{
+    job->bus_us = 0;
+    if (job->deadline && !mb_worker_apply_deadline(job)) {
+        return;
+    }
+    bool tuned = mb_worker_gap_tuned(job);
+    bool back_to_back = false;
+    int64_t until = mb_worker_quiet_until(job);
+    if (until) {
+        // Slaves that drop a request coming too soon after their response get the silence they need,
+        // the bus engine deferred the job until at most MB_WORKER_SPIN_MAX_US of it are left
+        int64_t left_us = until - esp_timer_get_time();
+        back_to_back = (left_us > -1000);
+        if (left_us > 0) {
+            esp_rom_delay_us((uint32_t)left_us);
+        }
+    }
+    int64_t start = esp_timer_get_time();
+    int range_func_id = job->value;
+    switch (job->op) {
+        case MB_JOB_READ:
+            job->value = (job->quiet ? read_mb_quiet : read_mb)(job->cid, job->slave_id, job->register_id);
+            break;
+        case MB_JOB_WRITE:
+            job->value = set_mb(job->cid, job->slave_id, job->register_id, job->value);
+            break;
+        case MB_JOB_READ_BLOCK:
+            job->value = ((job->register_id >= 0) && (job->register_id < DEVICE_MAP_BLOCKS)
+                            && (device_map_read_block(&device_map_blocks[job->register_id]) == ESP_OK)) ? 0 : -1;
+            break;
+        case MB_JOB_MASK_WRITE:
+            job->value = mb_worker_mask_write(job);
+            break;
+        case MB_JOB_PROBE:
+            job->value = mb_worker_probe(job);
+            break;
+        case MB_JOB_READ_RANGE:
+            job->value = mb_worker_read_range(job);
+            break;
+        default:
+            job->value = -1;
+            break;
+    }
+    // The stack stamps the response when its end is detected on the bus
+    job->timestamp = 0;
+    if (job->value != -1) {
+        mbc_master_get_rx_timestamp(&job->timestamp);
+    }
+    if (job->timestamp > (uint64_t)start) {
+        job->bus_us = (uint32_t)(job->timestamp - (uint64_t)start);
+        mb_worker_learn(job, range_func_id);
+    }
+    if (tuned) {
+        mb_worker_slave_t *slave = &slaves[job->slave_id];
+        // An exception is an answer, only a missing or corrupted response can be a dropped request
+        uint8_t exception = 0;
+        if (job->value == -1) {
+            mbc_master_get_exception(&exception);
+        }
+        slave->answered = (job->value != -1) || (exception != 0);
+        slave->end = esp_timer_get_time();
+        if (!(job->deadline && (slave->end >= job->deadline))) {
+            bus_model_learn_gap(job->slave_id, back_to_back, !slave->answered);
+        }
+    }
+    if (job->deadline) {
+        mbc_master_set_response_timeout(0);
+        job->expired = (job->value == -1) && (esp_timer_get_time() >= job->deadline);
+    }
+}
+
+static void mb_worker_routed_done(const mb_job_t *job, void *arg)
+{
+    mb_worker_wait_t *wait = (mb_worker_wait_t *)arg;
+    wait->job->value = job->value;
+    wait->job->timestamp = job->timestamp;
+    wait->job->expired = job->expired;
+    // The wait lives on the stack of the producer, which may return as soon as done is set
+    TaskHandle_t owner = wait->owner;
+    atomic_store_explicit(&wait->done, true, memory_order_release);
+    xTaskNotifyGive(owner);
+}
+
+static void mb_worker_point_done(const mb_job_t *job, void *arg)
+{
+    point_table_store((int)(intptr_t)arg, job);
+    // Let the bus engine commit the calculated points depending on it
+    mb_worker_wake();
+}
+
+// Route a due point to its transport, true if it is polled on the RTU segment by mb_worker_scan_run()
+static bool mb_worker_scan_route(int index, mb_job_t *job)
+{
+    int address;
+    int transport = mb_route_resolve(job->slave_id, &address);
+    job->slave_id = address;
+    if (transport == MB_ROUTE_LOCAL) {
+        // Registers the slave answered with an illegal address when probed are not worth the bus time
+        int func_id = (job->cid == mb_worker_read_cid(4)) ? 4 : 3;
+        if ((job->cid == mb_worker_read_cid(1)) || mb_caps_readable(job->slave_id, func_id, (uint16_t)job->register_id)) {
+            return true;
+        }
+        job->value = -1;
+        job->timestamp = 0;
+        point_table_store(index, job);
+    } else if (mb_route_submit(transport, job, mb_worker_point_done, (void *)(intptr_t)index) != ESP_OK) {
+        // Points behind TCP transports complete asynchronously
+        job->value = -1;
+        job->timestamp = 0;
+        point_table_store(index, job);
+    }
+    return false;
+}
+
+static void mb_worker_scan_run(int index, mb_job_t *job)
+{
+    mb_worker_run_job(job);
+    point_table_store(index, job);
+}
+
+static void mb_worker_scan_timer_cb(void *arg)
+{
+    xTaskNotifyGive(worker_task_handle);
+}
+
+// Wake the bus engine when the next point is due or a deferred job can go,
+// a tick timeout would round the wait to 1 / CONFIG_FREERTOS_HZ
+static void mb_worker_scan_arm(int64_t wake, bool scan_full)
+{
+    esp_timer_stop(scan_timer);
+    // With no room to defer another point, due points wait for a deferred one to go first
+    int64_t next_due = scan_full ? INT64_MAX : point_table_next_due();
+    if (wake < next_due) {
+        next_due = wake;
+    }
+    if (next_due == INT64_MAX) {
+        return;
+    }
+    int64_t wait_us = next_due - esp_timer_get_time();
+    if (wait_us <= 0) {
+        xTaskNotifyGive(worker_task_handle);
+    } else {
+        esp_timer_start_once(scan_timer, (uint64_t)wait_us);
+    }
+}
+
+static void mb_worker_task(void *arg)
+{
+    // Due points waiting for the silence of their slave
+    mb_job_t parked_jobs[MB_WORKER_PARKED_SCANS];
+    int parked_index[MB_WORKER_PARKED_SCANS];
+    for (int i = 0; i < MB_WORKER_PARKED_SCANS; i++) {
+        parked_index[i] = -1;
+    }
+    int64_t wake = INT64_MAX;
+    int free_slot = 0;
+    for (;;) {
+        mb_worker_scan_arm(wake, free_slot < 0);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        unsigned count = atomic_load_explicit(&channel_count, memory_order_acquire);
+        bool pending = true;
+        // Round robin between producers so one busy channel can not starve the others
+        while (pending) {
+            pending = false;
+            // Jobs whose slave needs more silence stay aside, the bus serves the other slaves meanwhile
+            wake = INT64_MAX;
+            for (unsigned i = 0; i < count; i++) {
+                mb_channel_t *channel = &channels[i];
+                mb_job_t *job = channel->parked ? channel->parked : mb_ring_pop(&channel->submit);
+                if (!job) {
+                    continue;
+                }
+                if (mb_worker_defer(job, &wake)) {
+                    channel->parked = job;
+                    continue;
+                }
+                channel->parked = NULL;
+                pending = true;
+                mb_worker_run_job(job);
+                // The done ring has the same size as the submit ring, so it can not overflow
+                mb_ring_push(&channel->done, job);
+                xTaskNotifyGive(channel->owner);
+            }
+            free_slot = -1;
+            for (int i = 0; i < MB_WORKER_PARKED_SCANS; i++) {
+                if ((parked_index[i] >= 0) && !mb_worker_defer(&parked_jobs[i], &wake)) {
+                    pending = true;
+                    mb_worker_scan_run(parked_index[i], &parked_jobs[i]);
+                    parked_index[i] = -1;
+                }
+                if ((parked_index[i] < 0) && (free_slot < 0)) {
+                    free_slot = i;
+                }
+            }
+            if (free_slot < 0) {
+                continue;
+            }
+            // Poll one due point between the rounds of client jobs
+            mb_job_t *scan_job = &parked_jobs[free_slot];
+            int index = point_table_take_due(esp_timer_get_time(), scan_job);
+            if (index >= 0) {
+                pending = true;
+                if (!mb_worker_scan_route(index, scan_job)) {
+                    continue;
+                }
+                if (mb_worker_defer(scan_job, &wake)) {
+                    parked_index[free_slot] = index;
+                    free_slot = -1;
+                } else {
+                    mb_worker_scan_run(index, scan_job);
+                }
+            }
+        }
+        // Calculated points are evaluated once per scan pass, not once per changed input
+        point_table_commit();
+    }
+}
+
+esp_err_t mb_worker_start(void)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = mb_worker_scan_timer_cb,
+        .name = "mb_scan"
+    };
+    if (esp_timer_create(&timer_args, &scan_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "scan timer creation error.");
+        return ESP_ERR_NO_MEM;
+    }
+    BaseType_t status = xTaskCreatePinnedToCore(mb_worker_task, "mb_worker",
+                                                CONFIG_GW_BUS_TASK_STACK_SIZE, NULL,
+                                                CONFIG_GW_BUS_TASK_PRIO, &worker_task_handle,
+                                                CONFIG_GW_BUS_CORE);
+    if (status != pdPASS) {
+        ESP_LOGE(TAG, "bus engine task creation error.");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Bus engine started on core %d", CONFIG_GW_BUS_CORE);
+    return ESP_OK;
+}
+
+mb_channel_t *mb_worker_channel_open(void)
+{
+    unsigned index = atomic_load(&channel_count);
+    if (index >= MB_WORKER_MAX_CHANNELS) {
+        ESP_LOGE(TAG, "no free channel.");
+        return NULL;
+    }
+    mb_channel_t *channel = &channels[index];
+    mb_ring_init(&channel->submit);
+    mb_ring_init(&channel->done);
+    channel->owner = NULL;
+    channel->parked = NULL;
+    // Publish the channel only after it is initialized
+    atomic_store_explicit(&channel_count, index + 1, memory_order_release);
+    return channel;
+}
+
+esp_err_t mb_worker_execute(mb_channel_t *channel, mb_job_t *job)
+{
+    if (!channel || !job || !worker_task_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int address = job->slave_id;
+    int transport = ((job->op == MB_JOB_PROBE) || (job->op == MB_JOB_READ_RANGE))
+                        ? MB_ROUTE_LOCAL : mb_route_resolve(job->slave_id, &address);
+    job->slave_id = address;
+    if (transport != MB_ROUTE_LOCAL) {
+        // Jobs for other transports bypass the bus engine, so the serial segment keeps polling meanwhile
+        mb_worker_wait_t wait = { .job = job, .owner = xTaskGetCurrentTaskHandle() };
+        atomic_init(&wait.done, false);
+        esp_err_t err = mb_route_submit(transport, job, mb_worker_routed_done, &wait);
+        if (err != ESP_OK) {
+            job->value = -1;
+            job->timestamp = 0;
+        }
+        while ((err == ESP_OK) && !atomic_load_explicit(&wait.done, memory_order_acquire)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+        return err;
+    }
+    channel->owner = xTaskGetCurrentTaskHandle();
+    if (!mb_ring_push(&channel->submit, job)) {
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskNotifyGive(worker_task_handle);
+    for (;;) {
+        mb_job_t *done = NULL;
+        while ((done = mb_ring_pop(&channel->done)) != NULL) {
+            if (done == job) {
+                return ESP_OK;
+            }
+        }
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+uint32_t mb_worker_expired_count(void)
+{
+    return atomic_load_explicit(&expired_count, memory_order_relaxed);
+}
+
+void mb_worker_wake(void)
+{
+    if (worker_task_handle) {
+        xTaskNotifyGive(worker_task_handle);
+    }
+}
+
+int mb_worker_read_cid(int func_id)
+{
+    switch (func_id) {
+        case 3:
+            return 0;   // Holding
+        case 4:
+            return 1;   // Input
+        case 1:
+            return 2;   // Coil
+        default:
+            return -1;
+    }
+}
@@ -0,0 +1,125 @@
+/* Modbus bus engine
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    MB_JOB_READ,                    /*!< Read one value through read_mb(), or read_mb_quiet() for quiet jobs */
+    MB_JOB_WRITE,                   /*!< Write one value through set_mb() */
+    MB_JOB_READ_BLOCK,              /*!< Read the device map block register_id into the register structs */
+    MB_JOB_MASK_WRITE,              /*!< Modify bits of the holding register register_id, see mb_worker_mask_apply() */
+    MB_JOB_PROBE,                   /*!< Probe slave_id on the RTU segment with function value (3 or 17), see discovery.h */
+    MB_JOB_READ_RANGE               /*!< Read count registers from register_id with function value (3 or 4) on the RTU segment, see mb_caps.h */
+} mb_job_op_t;
+
+/**
+ * @brief One Modbus transaction handed to the bus engine
+ */
+typedef struct {
+    mb_job_op_t op;                 /*!< Operation to execute */
+    uint16_t cid;                   /*!< Characteristic used for the request */
+    int slave_id;                   /*!< Slave address */
+    int register_id;                /*!< Register address */
+    int value;                      /*!< Value to write / value read, -1 on failure (0 on success for blocks and mask writes) */
+    uint16_t and_mask;              /*!< Mask write: bits kept from the current value */
+    uint16_t or_mask;               /*!< Mask write: value of the bits cleared in and_mask */
+    uint16_t xor_mask;              /*!< Mask write: bits toggled afterwards, forces read-modify-write */
+    uint8_t *data;                  /*!< Probe: buffer for the Report Slave ID data, range read: registers (big-endian), can be NULL */
+    uint16_t data_size;             /*!< Probe and range read: size of the buffer, then number of bytes stored */
+    uint16_t count;                 /*!< Range read: number of registers */
+    uint8_t exception;              /*!< Range read: exception code of the slave, 0 if it did not answer with an exception */
+    uint64_t timestamp;             /*!< Receive time of the response in us since boot, 0 on failure */
+    uint32_t bus_us;                /*!< Time from the start of the request to the end of the response, 0 on failure */
+    int64_t deadline;               /*!< Time in us since boot after which nobody waits for the result, 0 for none */
+    bool expired;                   /*!< Dropped or cut short because the deadline passed */
+    bool quiet;                     /*!< Read: log a successful read at debug level only, for periodic scans */
+} mb_job_t;
+
+/**
+ * @brief Submission channel of one producer task
+ */
+typedef struct mb_channel mb_channel_t;
+
+/**
+ * @brief Start the bus engine task pinned to CONFIG_GW_BUS_CORE
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NO_MEM if the task could not be created
+ */
+esp_err_t mb_worker_start(void);
+
+/**
+ * @brief Open a channel for one producer task
+ *
+ * Each channel is a pair of single-producer/single-consumer rings, so it must only
+ * ever be used from one task at a time (for example the httpd task).
+ *
+ * @return channel handle or NULL if all channels are in use
+ */
+mb_channel_t *mb_worker_channel_open(void);
+
+/**
+ * @brief Execute a job on the bus engine and wait for its completion
+ *
+ * The calling task is woken by a task notification once the job is done.
+ * The bus engine always completes a job, Modbus timeouts are reported through job->value.
+ * The slave_id of the job is a unit ID, routed by mb_route_resolve(): jobs for a TCP transport
+ * go to its queue instead of the bus engine, and slave_id is replaced by the downstream address.
+ * Probe and range read jobs are not routed, their slave_id is an address of the RTU segment.
+ * A job with a deadline is dropped if it is still queued when the deadline passes, otherwise
+ * its response timeout is shortened to the time left; both cases set job->expired.
+ *
+ * @param channel channel opened by the calling task
+ * @param job job to execute, updated in place
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG on wrong arguments
+ *     - ESP_ERR_NO_MEM if the channel ring or the transport queue is full
+ */
+esp_err_t mb_worker_execute(mb_channel_t *channel, mb_job_t *job);
+
+/**
+ * @brief Apply the masks of a mask write job to a register value
+ *
+ * The result is ((value AND and_mask) OR (or_mask AND NOT and_mask)) XOR xor_mask, the first
+ * part is what a slave computes for Mask Write Register (function 22). Slaves without function 22
+ * and jobs with a xor_mask are served by a read-modify-write in the same job, so no other job of
+ * the transport comes in between.
+ */
+uint16_t mb_worker_mask_apply(const mb_job_t *job, uint16_t value);
+
+/**
+ * @brief Get the number of jobs dropped by the bus engine because their deadline passed
+ */
+uint32_t mb_worker_expired_count(void);
+
+/**
+ * @brief Wake the bus engine to look at the point scan schedule again
+ */
+void mb_worker_wake(void);
+
+/**
+ * @brief Get the characteristic used to read with a Modbus function
+ *
+ * @param func_id read function: 3 (holding), 4 (input) or 1 (coil)
+ * @return characteristic index or -1 if the function is not supported
+ */
+int mb_worker_read_cid(int func_id);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,598 @@
+/* Polled point cache and calculated points
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "calc_expr.h"
+#include "alarm.h"
+#include "concentrator.h"
+#include "mb_route.h"
+#include "bus_model.h"
+#include "point_table.h"
+
+// Shortest poll period accepted for a register point
+#define POINT_MIN_PERIOD_MS     (10)
+// Polls without activity before an adaptive point backs off to twice its period
+#define POINT_QUIET_POLLS       (4)
+// Wall clock times before 2020 are the clock counting from boot, not set yet
+#define POINT_WALL_CLOCK_SET    (1577836800LL)
+
+typedef struct {
+    char name[POINT_NAME_LEN];
+    point_kind_t kind;
+    int slave_id;
+    int func_id;
+    int register_id;
+    uint16_t cid;
+    uint32_t period_ms;             // configured period, the shortest one of an adaptive point
+    uint32_t poll_ms;               // current period, between period_ms and max_period_ms
+    uint32_t max_period_ms;         // longest period of an adaptive point, period_ms for fixed points
+    double deadband;                // change of value an adaptive point counts as activity
+    double reference;               // value at the last activity
+    uint8_t quiet_polls;            // polls without activity since the period last changed
+    int64_t next_due;
+    int64_t last_poll;              // time the point was last taken for a poll
+    uint32_t jitter_us;             // start of the polls after their due time, moving average
+    uint32_t max_jitter_us;
+    uint32_t missed;                // cycles skipped because the bus was busy past the next due time
+    uint32_t interval_us;           // measured time between polls, moving average
+    uint32_t bus_us;                // measured bus time of a poll, moving average
+    calc_expr_t *expr;              // compiled expression of a calculated point
+    char *expr_text;
+    bool valid;
+    uint64_t timestamp;
+    uint32_t seq;
+} point_t;
+
+static const char *TAG = "POINT_TABLE";
+
+static point_t points[POINT_TABLE_MAX];
+static double point_values[POINT_TABLE_MAX];    // separate array, indexed directly by the bytecode
+static int point_count;
+static uint64_t valid_mask;
+static uint64_t changed_mask;                   // points changed since the last commit
+static uint32_t cache_seq;
+static SemaphoreHandle_t point_lock;
+static TaskHandle_t notify_task;
+
+_Static_assert(POINT_TABLE_MAX <= 64, "point masks are 64 bit wide");
+
+static int point_find(const char *name, size_t len)
+{
+    for (int i = 0; i < point_count; i++) {
+        if ((strlen(points[i].name) == len) && !strncmp(points[i].name, name, len)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int point_resolve(const char *name, size_t len, void *ctx)
+{
+    return point_find(name, len);
+}
+
+// Validate the name and get a free slot, called with the lock taken
+static esp_err_t point_alloc(const char *name, point_t **point)
+{
+    if (!name || !name[0] || (strlen(name) >= POINT_NAME_LEN)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (const char *c = name; *c; c++) {
+        if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c == '_')
+                || ((c != name) && (*c >= '0' && *c <= '9')))) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    if (point_find(name, strlen(name)) >= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (point_count >= POINT_TABLE_MAX) {
+        return ESP_ERR_NO_MEM;
+    }
+    *point = &points[point_count];
+    memset(*point, 0, sizeof(point_t));
+    strlcpy((*point)->name, name, POINT_NAME_LEN);
+    point_values[point_count] = 0;
+    return ESP_OK;
+}
+
+// Record a change of the point, called with the lock taken
+static void point_set(int index, double value, bool valid, uint64_t timestamp)
+{
+    point_t *point = &points[index];
+    bool was_valid = (valid_mask >> index) & 1;
+    point->timestamp = timestamp;
+    if ((valid == was_valid) && (!valid || (point_values[index] == value))) {
+        return;
+    }
+    if (valid) {
+        point_values[index] = value;
+        valid_mask |= (1ULL << index);
+    } else {
+        valid_mask &= ~(1ULL << index);
+    }
+    point->valid = valid;
+    point->seq = ++cache_seq;
+    changed_mask |= (1ULL << index);
+    concentrator_update(index, point_values[index], valid);
+    if (notify_task) {
+        xTaskNotifyGive(notify_task);
+    }
+}
+
+// Moving average over about 8 samples, starting at the first one
+static uint32_t point_average(uint32_t average, uint32_t sample)
+{
+    return average ? (uint32_t)(average + ((int32_t)sample - (int32_t)average) / 8) : sample;
+}
+
+// Predicted bus time of one poll on the RTU segment, 0 for slaves behind a TCP transport
+static uint32_t point_bus_us(int slave_id, int func_id)
+{
+    int address;
+    if (mb_route_resolve(slave_id, &address) != MB_ROUTE_LOCAL) {
+        return 0;
+    }
+    return bus_model_transaction_us(address, func_id, 1);
+}
+
+// Predicted share of the bus time taken by the register points, called with the lock taken.
+// The peak has the adaptive points at their shortest period, as they get when their values move.
+static double point_utilisation(bool peak)
+{
+    double utilisation = 0;
+    for (int i = 0; i < point_count; i++) {
+        const point_t *point = &points[i];
+        if (point->kind == POINT_KIND_REGISTER) {
+            uint32_t period_ms = peak ? point->period_ms : point->poll_ms;
+            utilisation += (double)point_bus_us(point->slave_id, point->func_id) / (period_ms * 1000.0);
+        }
+    }
+    return utilisation;
+}
+
+// Next multiple of the period after now, on the wall clock once it is set so the gateways sample together
+static int64_t point_align(int64_t now, uint32_t period_ms)
+{
+    int64_t period_us = (int64_t)period_ms * 1000;
+    int64_t epoch = 0;
+    struct timeval tv;
+    if ((gettimeofday(&tv, NULL) == 0) && (tv.tv_sec >= POINT_WALL_CLOCK_SET)) {
+        epoch = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - now;
+    }
+    return now + period_us - (now + epoch) % period_us;
+}
+
+// Move the period of an adaptive point with the activity of its value, called with the lock taken
+static void point_adapt(point_t *point, double value, bool was_valid)
+{
+    if (point->max_period_ms == point->period_ms) {
+        return;
+    }
+    if (!was_valid) {
+        point->reference = value;
+    } else if (fabs(value - point->reference) > point->deadband) {
+        point->reference = value;
+        point->quiet_polls = 0;
+        if (point->poll_ms > point->period_ms) {
+            point->poll_ms = (point->poll_ms / 2 > point->period_ms) ? point->poll_ms / 2 : point->period_ms;
+            // The due time was taken with the slower period
+            point->next_due = point_align(esp_timer_get_time(), point->poll_ms);
+        }
+    } else if (++point->quiet_polls >= POINT_QUIET_POLLS) {
+        // The bus time given up is taken by the other points, the scheduler polls whatever is due
+        point->quiet_polls = 0;
+        if (point->poll_ms < point->max_period_ms) {
+            point->poll_ms = (point->poll_ms > point->max_period_ms / 2) ? point->max_period_ms : point->poll_ms * 2;
+            point->next_due = point_align(esp_timer_get_time(), point->poll_ms);
+        }
+    }
+}
+
+esp_err_t point_table_init(void)
+{
+    point_lock = xSemaphoreCreateMutex();
+    if (!point_lock) {
+        ESP_LOGE(TAG, "no memory for point lock.");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t point_table_add_register(const char *name, int slave_id, int func_id, int register_id, uint32_t period_ms)
+{
+    return point_table_add_adaptive(name, slave_id, func_id, register_id, period_ms, period_ms, 0);
+}
+
+esp_err_t point_table_add_adaptive(const char *name, int slave_id, int func_id, int register_id,
+                                   uint32_t period_ms, uint32_t max_period_ms, double deadband)
+{
+    int cid = mb_worker_read_cid(func_id);
+    if ((cid < 0) || (slave_id < 1) || (slave_id > 247) || (register_id < 0) || (register_id > 0xFFFF)
+            || (period_ms < POINT_MIN_PERIOD_MS) || (max_period_ms < period_ms) || !(deadband >= 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    point_t *point = NULL;
+    double utilisation = point_utilisation(true) + (double)point_bus_us(slave_id, func_id) / (period_ms * 1000.0);
+    // A plan over the bus capacity can never keep its periods, one over the limit leaves no room for clients.
+    // Quiet adaptive points speed up again at any time, so the plan must carry them at their shortest period.
+    esp_err_t err = (utilisation > 1.0) ? ESP_ERR_INVALID_SIZE : point_alloc(name, &point);
+    if ((err == ESP_OK) && (utilisation > BUS_MODEL_LIMIT)) {
+        ESP_LOGW(TAG, "Point %s takes the scan plan to %.0f%% of the bus time.", name, utilisation * 100);
+    }
+    if (err == ESP_OK) {
+        point->kind = POINT_KIND_REGISTER;
+        point->slave_id = slave_id;
+        point->func_id = func_id;
+        point->register_id = register_id;
+        point->cid = (uint16_t)cid;
+        point->period_ms = period_ms;
+        // Adaptive points start fast and back off once their value proves quiet
+        point->poll_ms = period_ms;
+        point->max_period_ms = max_period_ms;
+        point->deadband = deadband;
+        point->next_due = 0;
+        // New points are a change for the clients reading deltas
+        point->seq = ++cache_seq;
+        point_count++;
+    }
+    xSemaphoreGive(point_lock);
+    if (err == ESP_OK) {
+        // Poll the new point now instead of at the end of the current scan wait
+        mb_worker_wake();
+    }
+    return err;
+}
+
+esp_err_t point_table_add_calc(const char *name, const char *expr, const char **error)
+{
+    if (!expr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strnlen(expr, CALC_EXPR_TEXT_MAX + 1) > CALC_EXPR_TEXT_MAX) {
+        if (error) {
+            *error = "expression too long";
+        }
+        return ESP_ERR_INVALID_SIZE;
+    }
+    calc_expr_t *code = calloc(1, sizeof(calc_expr_t));
+    char *text = strdup(expr);
+    if (!code || !text) {
+        free(code);
+        free(text);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    point_t *point = NULL;
+    esp_err_t err = point_alloc(name, &point);
+    if (err == ESP_OK) {
+        // Only the points added before can be resolved, so the table order is the evaluation order
+        err = calc_expr_compile(expr, point_resolve, NULL, code, error);
+    }
+    if (err == ESP_OK) {
+        int index = point_count++;
+        point->kind = POINT_KIND_CALC;
+        point->expr = code;
+        point->expr_text = text;
+        point->seq = ++cache_seq;
+        // Evaluate on the next commit even if the inputs do not change anymore
+        changed_mask |= code->inputs;
+        ESP_LOGI(TAG, "Point #%d %s = %s, %u bytes of code.", index, name, expr, (unsigned)code->code_len);
+    }
+    xSemaphoreGive(point_lock);
+    if (err != ESP_OK) {
+        free(code);
+        free(text);
+    }
+    return err;
+}
+
+esp_err_t point_table_get(const char *name, point_value_t *value)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    int index = name ? point_find(name, strlen(name)) : -1;
+    if (index >= 0) {
+        const point_t *point = &points[index];
+        strlcpy(value->name, point->name, POINT_NAME_LEN);
+        value->kind = point->kind;
+        value->value = point_values[index];
+        value->valid = point->valid;
+        value->timestamp = point->timestamp;
+        value->seq = point->seq;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(point_lock);
+    return err;
+}
+
+int point_table_index(const char *name)
+{
+    if (!name) {
+        return -1;
+    }
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    int index = point_find(name, strlen(name));
+    xSemaphoreGive(point_lock);
+    return index;
+}
+
+void point_table_refresh(int index)
+{
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    if ((index >= 0) && (index < point_count)) {
+        concentrator_update(index, point_values[index], points[index].valid);
+    }
+    xSemaphoreGive(point_lock);
+}
+
+void point_table_report(cJSON *root, uint32_t since)
+{
+    point_table_report_mask(root, UINT64_MAX, since);
+}
+
+void point_table_report_mask(cJSON *root, uint64_t mask, uint32_t since)
+{
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    if (since > cache_seq) {
+        // The client saw a cache from before a restart
+        since = 0;
+    }
+    cJSON_AddNumberToObject(root, "seq", cache_seq);
+    cJSON_AddBoolToObject(root, "full", since == 0);
+    cJSON *array = cJSON_AddArrayToObject(root, "points");
+    for (int i = 0; i < point_count; i++) {
+        const point_t *point = &points[i];
+        if (!((mask >> i) & 1) || (point->seq <= since)) {
+            continue;
+        }
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", point->name);
+        // Deltas only carry the values, the configuration is in the full report
+        if (!since && (point->kind == POINT_KIND_REGISTER)) {
+            cJSON_AddNumberToObject(item, "slaveId", point->slave_id);
+            cJSON_AddNumberToObject(item, "registerId", point->register_id);
+            cJSON_AddNumberToObject(item, "funcId", point->func_id);
+            cJSON_AddNumberToObject(item, "periodMs", point->period_ms);
+            if (point->max_period_ms != point->period_ms) {
+                cJSON_AddNumberToObject(item, "maxPeriodMs", point->max_period_ms);
+                cJSON_AddNumberToObject(item, "deadband", point->deadband);
+            }
+        } else if (!since) {
+            cJSON_AddStringToObject(item, "expr", point->expr_text);
+        }
+        if (point->max_period_ms != point->period_ms) {
+            cJSON_AddNumberToObject(item, "pollMs", point->poll_ms);
+        }
+        if (point->valid) {
+            cJSON_AddNumberToObject(item, "value", point_values[i]);
+        } else {
+            cJSON_AddNullToObject(item, "value");
+        }
+        cJSON_AddNumberToObject(item, "timestampUs", (double)point->timestamp);
+        cJSON_AddNumberToObject(item, "seq", point->seq);
+        cJSON_AddItemToArray(array, item);
+    }
+    xSemaphoreGive(point_lock);
+}
+
+bool point_table_changed(uint64_t mask, uint32_t since)
+{
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    // A since newer than the cache is from before a restart, the full report is due
+    bool changed = (since > cache_seq);
+    for (int i = 0; (i < point_count) && !changed; i++) {
+        changed = ((mask >> i) & 1) && (points[i].seq > since);
+    }
+    xSemaphoreGive(point_lock);
+    return changed;
+}
+
+void point_table_set_notify(TaskHandle_t task)
+{
+    notify_task = task;
+}
+
+double point_table_utilisation(void)
+{
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    double utilisation = point_utilisation(true);
+    xSemaphoreGive(point_lock);
+    return utilisation;
+}
+
+void point_table_report_plan(cJSON *root)
+{
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    double measured_utilisation = 0, peak_utilisation = 0;
+    cJSON *array = cJSON_AddArrayToObject(root, "groups");
+    // Points polled with the same period form a scan group
+    for (int i = 0; i < point_count; i++) {
+        const point_t *first = &points[i];
+        bool seen = (first->kind != POINT_KIND_REGISTER);
+        for (int j = 0; (j < i) && !seen; j++) {
+            seen = (points[j].kind == POINT_KIND_REGISTER) && (points[j].period_ms == first->period_ms);
+        }
+        if (seen) {
+            continue;
+        }
+        int count = 0, remote = 0, adaptive = 0, measured = 0;
+        uint32_t predicted_us = 0, measured_us = 0, max_jitter_us = 0, missed = 0;
+        uint64_t jitter_us = 0;
+        double share = 0, peak_share = 0;
+        uint64_t interval_us = 0;
+        for (int j = i; j < point_count; j++) {
+            const point_t *point = &points[j];
+            if ((point->kind != POINT_KIND_REGISTER) || (point->period_ms != first->period_ms)) {
+                continue;
+            }
+            uint32_t bus_us = point_bus_us(point->slave_id, point->func_id);
+            count++;
+            remote += !bus_us;
+            adaptive += (point->max_period_ms != point->period_ms);
+            predicted_us += bus_us;
+            share += (double)bus_us / (point->poll_ms * 1000.0);
+            jitter_us += point->jitter_us;
+            if (point->max_jitter_us > max_jitter_us) {
+                max_jitter_us = point->max_jitter_us;
+            }
+            missed += point->missed;
+            peak_share += (double)bus_us / (point->period_ms * 1000.0);
+            if (bus_us && point->bus_us && point->interval_us) {
+                measured++;
+                measured_us += point->bus_us;
+                interval_us += point->interval_us;
+                measured_utilisation += (double)point->bus_us / point->interval_us;
+            }
+        }
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "periodMs", first->period_ms);
+        cJSON_AddNumberToObject(item, "points", count);
+        cJSON_AddNumberToObject(item, "remotePoints", remote);
+        cJSON_AddNumberToObject(item, "adaptivePoints", adaptive);
+        cJSON_AddNumberToObject(item, "predictedUs", predicted_us);
+        // At the current periods of the adaptive points, and with all of them at their shortest period
+        cJSON_AddNumberToObject(item, "utilisationPct", share * 100);
+        cJSON_AddNumberToObject(item, "peakUtilisationPct", peak_share * 100);
+        peak_utilisation += peak_share;
+        // Measured over the points of the RTU segment polled at least twice
+        cJSON_AddNumberToObject(item, "measuredPoints", measured);
+        cJSON_AddNumberToObject(item, "measuredUs", measured_us);
+        if (measured) {
+            cJSON_AddNumberToObject(item, "measuredPeriodMs", (double)interval_us / measured / 1000.0);
+        } else {
+            cJSON_AddNullToObject(item, "measuredPeriodMs");
+        }
+        // Start of the polls after their due time
+        cJSON_AddNumberToObject(item, "jitterUs", (double)jitter_us / count);
+        cJSON_AddNumberToObject(item, "maxJitterUs", max_jitter_us);
+        cJSON_AddNumberToObject(item, "missedCycles", missed);
+        cJSON_AddItemToArray(array, item);
+    }
+    double utilisation = point_utilisation(false);
+    xSemaphoreGive(point_lock);
+    cJSON_AddNumberToObject(root, "utilisationPct", utilisation * 100);
+    cJSON_AddNumberToObject(root, "peakUtilisationPct", peak_utilisation * 100);
+    cJSON_AddNumberToObject(root, "measuredUtilisationPct", measured_utilisation * 100);
+    // Judged at the peak, like the points when they are added
+    cJSON_AddBoolToObject(root, "feasible", peak_utilisation <= 1.0);
+    cJSON_AddBoolToObject(root, "withinLimit", peak_utilisation <= BUS_MODEL_LIMIT);
+}
+
+int point_table_take_due(int64_t now, mb_job_t *job)
+{
+    int due = -1;
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    for (int i = 0; i < point_count; i++) {
+        const point_t *point = &points[i];
+        if ((point->kind == POINT_KIND_REGISTER) && (point->next_due <= now)
+                && ((due < 0) || (point->next_due < points[due].next_due))) {
+            due = i;
+        }
+    }
+    if (due >= 0) {
+        point_t *point = &points[due];
+        if (point->last_poll) {
+            point->interval_us = point_average(point->interval_us, (uint32_t)(now - point->last_poll));
+        }
+        point->last_poll = now;
+        if (!point->next_due) {
+            // New points are polled at once, then on the grid of their period
+            point->next_due = point_align(now, point->poll_ms);
+        } else {
+            uint32_t jitter_us = (uint32_t)(now - point->next_due);
+            point->jitter_us = point_average(point->jitter_us, jitter_us);
+            if (jitter_us > point->max_jitter_us) {
+                point->max_jitter_us = jitter_us;
+            }
+            // Due times follow each other by the period, so late polls do not push the next ones
+            int64_t period_us = (int64_t)point->poll_ms * 1000;
+            point->next_due += period_us;
+            if (point->next_due <= now) {
+                // Overrun: skip the cycles already missed and stay on the grid
+                point->missed += (uint32_t)((now - point->next_due) / period_us) + 1;
+                point->next_due = point_align(now, point->poll_ms);
+            }
+        }
+        memset(job, 0, sizeof(mb_job_t));
+        job->op = MB_JOB_READ;
+        job->cid = point->cid;
+        job->slave_id = point->slave_id;
+        job->register_id = point->register_id;
+        job->quiet = true;
+    }
+    xSemaphoreGive(point_lock);
+    return due;
+}
+
+void point_table_store(int index, const mb_job_t *job)
+{
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    if ((index >= 0) && (index < point_count)) {
+        bool valid = (job->value != -1);
+        if (job->bus_us) {
+            points[index].bus_us = point_average(points[index].bus_us, job->bus_us);
+        }
+        if (valid) {
+            point_adapt(&points[index], job->value, points[index].valid);
+        }
+        point_set(index, job->value, valid, valid ? job->timestamp : points[index].timestamp);
+        // Alarms see every poll result, not only the changes, so their delays advance
+        alarm_evaluate(index, job->value, valid, job->timestamp);
+    }
+    xSemaphoreGive(point_lock);
+}
+
+void point_table_commit(void)
+{
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    // Points are in dependency order, so one pass propagates the changes through chains
+    for (int i = 0; (i < point_count) && changed_mask; i++) {
+        point_t *point = &points[i];
+        if ((point->kind != POINT_KIND_CALC) || !(point->expr->inputs & changed_mask)) {
+            continue;
+        }
+        uint64_t timestamp = 0;
+        for (int input = 0; input < point_count; input++) {
+            if (((point->expr->inputs >> input) & 1) && (points[input].timestamp > timestamp)) {
+                timestamp = points[input].timestamp;
+            }
+        }
+        double value = 0;
+        bool valid = ((point->expr->inputs & valid_mask) == point->expr->inputs)
+                        && calc_expr_eval(point->expr, point_values, &value);
+        point_set(i, value, valid, timestamp);
+        alarm_evaluate(i, value, valid, timestamp);
+    }
+    changed_mask = 0;
+    xSemaphoreGive(point_lock);
+    // Apply the alarm delays that expired while the values did not change
+    alarm_tick(esp_timer_get_time());
+}
+
+int64_t point_table_next_due(void)
+{
+    int64_t next_due = INT64_MAX;
+    xSemaphoreTake(point_lock, portMAX_DELAY);
+    for (int i = 0; i < point_count; i++) {
+        if ((points[i].kind == POINT_KIND_REGISTER) && (points[i].next_due < next_due)) {
+            next_due = points[i].next_due;
+        }
+    }
+    xSemaphoreGive(point_lock);
+    return next_due;
+}
@@ -0,0 +1,233 @@
+/* Polled point cache and calculated points
+
+   This code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "cJSON.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "mb_worker.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POINT_NAME_LEN          (16)
+#define POINT_TABLE_MAX         (CONFIG_GW_POINTS_MAX)
+
+typedef enum {
+    POINT_KIND_REGISTER,            /*!< Register polled from a slave by the bus engine */
+    POINT_KIND_CALC                 /*!< Value calculated from other points */
+} point_kind_t;
+
+/**
+ * @brief Snapshot of one cached point
+ */
+typedef struct {
+    char name[POINT_NAME_LEN];
+    point_kind_t kind;
+    double value;                   /*!< Last value, kept when the point becomes invalid */
+    bool valid;                     /*!< false before the first read and after a failed read */
+    uint64_t timestamp;             /*!< Receive time of the response in us since boot (newest input for calculated points) */
+    uint32_t seq;                   /*!< Cache sequence number of the last change of value or validity */
+} point_value_t;
+
+/**
+ * @brief Create the point cache
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NO_MEM if the lock could not be created
+ */
+esp_err_t point_table_init(void);
+
+/**
+ * @brief Add a register point polled by the bus engine
+ *
+ * @param name unique point name, also used in expressions
+ * @param slave_id slave address
+ * @param func_id read function: 3 (holding), 4 (input) or 1 (coil)
+ * @param register_id register address
+ * @param period_ms poll period
+ * The bus time of the scan plan is predicted with the cost model of bus_model.h. A point that
+ * takes the plan over BUS_MODEL_LIMIT is added with a warning, one that takes it over the
+ * bus capacity is rejected.
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG on wrong name, function or period
+ *     - ESP_ERR_INVALID_STATE if the name is already used
+ *     - ESP_ERR_INVALID_SIZE if the scan plan would need more than the bus time
+ *     - ESP_ERR_NO_MEM if the table is full
+ */
+esp_err_t point_table_add_register(const char *name, int slave_id, int func_id, int register_id, uint32_t period_ms);
+
+/**
+ * @brief Add a register point polled faster while its value moves and slower while it is quiet
+ *
+ * The point starts at period_ms. A change of the value by more than the deadband since the
+ * last change halves the period down to period_ms, four polls in a row without such
+ * a change double it up to max_period_ms. The bus time a quiet point gives up goes to the
+ * other points. The scan plan is checked like for point_table_add_register(), with every
+ * adaptive point at its shortest period since quiet points can speed up again at any time.
+ *
+ * @param name unique point name, also used in expressions
+ * @param slave_id slave address
+ * @param func_id read function: 3 (holding), 4 (input) or 1 (coil)
+ * @param register_id register address
+ * @param period_ms shortest poll period
+ * @param max_period_ms longest poll period, period_ms for a fixed period
+ * @param deadband change of value that counts as activity, 0 for any change
+ * @return see point_table_add_register()
+ */
+esp_err_t point_table_add_adaptive(const char *name, int slave_id, int func_id, int register_id,
+                                   uint32_t period_ms, uint32_t max_period_ms, double deadband);
+
+/**
+ * @brief Add a point calculated from other points
+ *
+ * The expression is compiled once and evaluated again only when one of its inputs
+ * changes. It can use the points added before it.
+ *
+ * @param name unique point name
+ * @param expr expression text, see calc_expr_compile()
+ * @param[out] error static error description on failure, can be NULL
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG on wrong name or expression
+ *     - ESP_ERR_INVALID_STATE if the name is already used
+ *     - ESP_ERR_NO_MEM if the table is full
+ */
+esp_err_t point_table_add_calc(const char *name, const char *expr, const char **error);
+
+/**
+ * @brief Get a snapshot of one point
+ *
+ * @param name point name
+ * @param[out] value snapshot
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NOT_FOUND if there is no such point
+ */
+esp_err_t point_table_get(const char *name, point_value_t *value);
+
+/**
+ * @brief Get the index of a point, points are never removed so it does not change
+ *
+ * @param name point name
+ * @return point index or -1 if there is no such point
+ */
+int point_table_index(const char *name);
+
+/**
+ * @brief Hand the current value of a point to the concentrator again
+ *
+ * @param index point index
+ */
+void point_table_refresh(int index);
+
+/**
+ * @brief Add the points changed after a cache sequence number to a JSON object
+ *
+ * A point changes when its value or validity changes and when it is added. The full report
+ * (since 0, or a since newer than the cache after a restart) also has the configuration of the points.
+ *
+ * @param root object to add "seq" (newest change), "full" and "points" to
+ * @param since cache sequence number already known by the client, 0 for every point
+ */
+void point_table_report(cJSON *root, uint32_t since);
+
+/**
+ * @brief Add the points of a mask changed after a cache sequence number to a JSON object
+ *
+ * @param root object to add "seq", "full" and "points" to, see point_table_report()
+ * @param mask bit i selects the point of index i
+ * @param since cache sequence number already known by the client, 0 for every point of the mask
+ */
+void point_table_report_mask(cJSON *root, uint64_t mask, uint32_t since);
+
+/**
+ * @brief Check if one of the points of a mask changed after a cache sequence number
+ *
+ * @param mask bit i selects the point of index i
+ * @param since cache sequence number already known by the client
+ * @return true if a point changed or since is newer than the cache (restart)
+ */
+bool point_table_changed(uint64_t mask, uint32_t since);
+
+/**
+ * @brief Set the task notified on every change of a point
+ *
+ * @param task task to notify with xTaskNotifyGive(), NULL for none
+ */
+void point_table_set_notify(TaskHandle_t task);
+
+/**
+ * @brief Predict the share of the bus time the register points take
+ *
+ * Adaptive points count at their shortest period, as for the check of the points added.
+ *
+ * @return sum over the points of the RTU segment of their predicted bus time divided by their shortest period
+ */
+double point_table_utilisation(void);
+
+/**
+ * @brief Add the scan plan to a JSON object, predicted against measured
+ *
+ * The register points polled with the same period form a scan group. Each group has its
+ * predicted bus time per cycle and utilisation, the measured bus time and poll period
+ * of its points, and the start jitter and missed cycles of its polls.
+ *
+ * The utilisation of adaptive points is predicted at their current period, the peak
+ * utilisation at their shortest one. The plan is feasible and within the limit by its peak.
+ *
+ * @param root object to add "groups", "utilisationPct", "peakUtilisationPct",
+ *             "measuredUtilisationPct", "feasible" and "withinLimit" to
+ */
+void point_table_report_plan(cJSON *root);
+
+/**
+ * @brief Take the register point that is due first, bus engine side
+ *
+ * Polls are due on a grid of their period, aligned to the wall clock once it is set and
+ * to the boot otherwise. A late poll does not move the next due time, a poll later than
+ * a whole period skips the missed cycles.
+ *
+ * @param now current time in us since boot
+ * @param[out] job read job for the point
+ * @return point index or -1 if no point is due
+ */
+int point_table_take_due(int64_t now, mb_job_t *job);
+
+/**
+ * @brief Store the result of a job taken by point_table_take_due(), bus engine side
+ *
+ * @param index point index
+ * @param job completed job
+ */
+void point_table_store(int index, const mb_job_t *job);
+
+/**
+ * @brief Evaluate the calculated points whose inputs changed since the previous call, bus engine side
+ */
+void point_table_commit(void);
+
+/**
+ * @brief Time the next register point is due
+ *
+ * @return time in us since boot or INT64_MAX if there are no register points
+ */
+int64_t point_table_next_due(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,17 +6,32 @@
    software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
    CONDITIONS OF ANY KIND, either express or implied.
 */
+#include <math.h>
 #include <string.h>
 #include <fcntl.h>
 #include "esp_http_server.h"
 #include "esp_chip_info.h"
 #include "esp_random.h"
+#include "esp_timer.h"
 #include "esp_log.h"
 #include "esp_vfs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
 #include "cJSON.h"
-
-int read_mb(uint16_t cid, int slaveId, int registerId);
-int set_mb(uint16_t cid, int slaveId, int registerId, int value);
+#include "sdkconfig.h"
+#include "mb_worker.h"
+#include "core_load.h"
+#include "point_table.h"
+#include "alarm.h"
+#include "concentrator.h"
+#include "device_map.h"
+#include "mb_route.h"
+#include "discovery.h"
+#include "mb_caps.h"
+#include "cbor_writer.h"
+#include "bus_model.h"
 
 static const char *REST_TAG = "esp-rest";
 #define REST_CHECK(a, str, goto_tag, ...)                                              \
@@ -31,12 +46,31 @@ static const char *REST_TAG = "esp-rest";
 
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + 128)
 #define SCRATCH_BUFSIZE (10240)
+#define REST_MAX_URI_HANDLERS (24)
+#define LONG_POLL_MAX (CONFIG_GW_LONG_POLL_MAX)
+#define LONG_POLL_TASK_STACK_SIZE (4096)
+#define LONG_POLL_TASK_PRIO (5)
 
 typedef struct rest_server_context {
     char base_path[ESP_VFS_PATH_MAX + 1];
     char scratch[SCRATCH_BUFSIZE];
+    mb_channel_t *mb_channel;
 } rest_server_context_t;
 
+// Request parked by /points/wait until a point changes
+typedef struct {
+    httpd_req_t *req;               // copy from httpd_req_async_handler_begin(), owned by the long poll task
+    uint64_t mask;                  // points waited for
+    uint32_t since;
+    int64_t deadline;
+    bool cbor;                      // encoding negotiated when the request was parked
+} long_poll_t;
+
+static long_poll_t long_polls[LONG_POLL_MAX];
+static int long_poll_count;
+static SemaphoreHandle_t long_poll_lock;
+static TaskHandle_t long_poll_task_handle;
+
 #define CHECK_FILE_EXTENSION(filename, ext) (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
 
 /* Set HTTP response content type according to file extension */
@@ -59,7 +93,8 @@ static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepa
     return httpd_resp_set_type(req, type);
 }
 
-static esp_err_t set_mb_handler(httpd_req_t *req)
+/* Receive the request body and parse it, responds with an error on failure */
+static cJSON *recv_json(httpd_req_t *req)
 {
     int total_len = req->content_len;
     int cur_len = 0;
@@ -68,45 +103,161 @@ static esp_err_t set_mb_handler(httpd_req_t *req)
     if (total_len >= SCRATCH_BUFSIZE) {
         /* Respond with 500 Internal Server Error */
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "content too long");
-        return ESP_FAIL;
+        return NULL;
     }
     while (cur_len < total_len) {
-        received = httpd_req_recv(req, buf + cur_len, total_len);
+        received = httpd_req_recv(req, buf + cur_len, total_len - cur_len);
         if (received <= 0) {
             /* Respond with 500 Internal Server Error */
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post control value");
-            return ESP_FAIL;
+            return NULL;
         }
         cur_len += received;
     }
     buf[total_len] = '\0';
     cJSON *root = cJSON_Parse(buf);
+    if (!root) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+    }
+    return root;
+}
+
+/* Check the Accept header for CBOR, JSON stays the default */
+static bool accepts_cbor(httpd_req_t *req)
+{
+    char accept[128];
+    // A truncated header still has the types the client prefers first
+    esp_err_t err = httpd_req_get_hdr_value_str(req, "Accept", accept, sizeof(accept));
+    return ((err == ESP_OK) || (err == ESP_ERR_HTTPD_RESULT_TRUNC)) && strstr(accept, "application/cbor");
+}
+
+/* Encode the root object, with the registers as a typed array of big-endian uint16 under "values" */
+static void cbor_put_reply(cbor_writer_t *writer, const cJSON *root, const uint8_t *regs, size_t regs_len)
+{
+    if (!regs) {
+        cbor_put_json(writer, root);
+        return;
+    }
+    cbor_put_map(writer, cJSON_GetArraySize(root) + 1);
+    const cJSON *child;
+    cJSON_ArrayForEach(child, root) {
+        cbor_put_text(writer, child->string);
+        cbor_put_json(writer, child);
+    }
+    cbor_put_text(writer, "values");
+    cbor_put_tag(writer, CBOR_TAG_UINT16_BE_ARRAY);
+    cbor_put_bytes(writer, regs, regs_len);
+}
+
+/* Respond with the root object and free it, in CBOR or JSON; registers are added as "values" */
+static esp_err_t send_reply(httpd_req_t *req, cJSON *root, bool cbor, const uint8_t *regs, size_t regs_len)
+{
+    httpd_resp_set_hdr(req, "Vary", "Accept");
+    if (!cbor) {
+        if (regs) {
+            cJSON *values = cJSON_AddArrayToObject(root, "values");
+            for (size_t i = 0; i + 1 < regs_len; i += 2) {
+                cJSON_AddItemToArray(values, cJSON_CreateNumber((regs[i] << 8) | regs[i + 1]));
+            }
+        }
+        httpd_resp_set_type(req, "application/json");
+        const char *sys_info = cJSON_Print(root);
+        httpd_resp_sendstr(req, sys_info);
+        free((void *)sys_info);
+        cJSON_Delete(root);
+        return ESP_OK;
+    }
+    // Count the bytes first, then encode straight into a buffer of that size
+    cbor_writer_t writer;
+    cbor_writer_init(&writer, NULL, 0);
+    cbor_put_reply(&writer, root, regs, regs_len);
+    size_t len = writer.len;
+    uint8_t *buf = malloc(len);
+    if (!buf) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory for the response");
+        return ESP_FAIL;
+    }
+    cbor_writer_init(&writer, buf, len);
+    cbor_put_reply(&writer, root, regs, regs_len);
+    cJSON_Delete(root);
+    httpd_resp_set_type(req, "application/cbor");
+    httpd_resp_send(req, (const char *)buf, writer.len);
+    free(buf);
+    return ESP_OK;
+}
+
+/* Respond with the root object and free it, in the encoding the client accepts */
+static esp_err_t send_json(httpd_req_t *req, cJSON *root)
+{
+    return send_reply(req, root, accepts_cbor(req), NULL, 0);
+}
+
+/* Take the optional client timeout as the deadline of the job, so the bus does not serve a client that left.
+   False if the timeout is not in 1..CONFIG_GW_JOB_TIMEOUT_MAX_MS */
+static bool set_job_deadline(cJSON *root, mb_job_t *job)
+{
+    cJSON *timeout = cJSON_GetObjectItem(root, "timeoutMs");
+    if (!timeout) {
+        return true;
+    }
+    // Bound before converting, a large double does not fit the deadline
+    if (!cJSON_IsNumber(timeout) || !(timeout->valuedouble > 0) || (timeout->valuedouble > CONFIG_GW_JOB_TIMEOUT_MAX_MS)) {
+        return false;
+    }
+    job->deadline = esp_timer_get_time() + (int64_t)(timeout->valuedouble * 1000);
+    return true;
+}
+
+static esp_err_t set_mb_handler(httpd_req_t *req)
+{
+    cJSON *root = recv_json(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
     int slaveId = cJSON_GetObjectItem(root, "slaveId")->valueint;
     int registerId = cJSON_GetObjectItem(root, "registerId")->valueint;
     int funcId = cJSON_GetObjectItem(root, "funcId")->valueint;
     int value = cJSON_GetObjectItem(root, "value")->valueint;
 
+    mb_job_t job = { .op = MB_JOB_WRITE, .slave_id = slaveId, .register_id = registerId, .value = value };
     switch (funcId) {
         case 16:
-            value = set_mb(3,slaveId,registerId,value);
+            job.cid = 3;
             break;
             //Holding
         case 15:
-            value = set_mb(4,slaveId,registerId,value);
+            job.cid = 4;
             break;
             //Coil
         case 10:
-            value = set_mb(3,slaveId,registerId,value);
+            job.cid = 3;
             break;
             //Holding multi
         default:
+            cJSON_Delete(root);
             return ESP_ERR_INVALID_ARG;
     }
+    if (!set_job_deadline(root, &job)) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "timeoutMs out of range");
+        return ESP_FAIL;
+    }
+    mb_worker_execute(((rest_server_context_t *)(req->user_ctx))->mb_channel, &job);
+    value = job.value;
 
     ESP_LOGI(REST_TAG, "set: slaveId = %d, registerId = %d, funcId = %d, value = %d", slaveId, registerId, funcId, value);
 
     httpd_resp_set_type(req, "application/json");
+    if (job.expired) {
+        httpd_resp_set_status(req, "504 Gateway Timeout");
+    }
     cJSON_AddNumberToObject(root, "currentValue",value);
+    if (job.timestamp) {
+        // Receive time on the gateway clock and its age when the reply is built
+        cJSON_AddNumberToObject(root, "timestampUs", (double)job.timestamp);
+        cJSON_AddNumberToObject(root, "ageUs", (double)(esp_timer_get_time() - (int64_t)job.timestamp));
+    }
     const char *sys_info = cJSON_Print(root);
     httpd_resp_sendstr(req, sys_info);
 
@@ -115,60 +266,665 @@ static esp_err_t set_mb_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/* Handler setting, clearing or toggling bits of a holding register in one bus job */
+static esp_err_t mask_mb_handler(httpd_req_t *req)
+{
+    cJSON *root = recv_json(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+    cJSON *slave = cJSON_GetObjectItem(root, "slaveId");
+    cJSON *reg = cJSON_GetObjectItem(root, "registerId");
+    const char *op = cJSON_GetStringValue(cJSON_GetObjectItem(root, "op"));
+    cJSON *bits = cJSON_GetObjectItem(root, "bits");
+    if (!cJSON_IsNumber(slave) || !cJSON_IsNumber(reg) || !op || !cJSON_IsNumber(bits)) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "slaveId, registerId, op and bits are required");
+        return ESP_FAIL;
+    }
+    uint16_t mask = (uint16_t)bits->valueint;
+    mb_job_t job = { .op = MB_JOB_MASK_WRITE, .slave_id = slave->valueint, .register_id = reg->valueint,
+                     .and_mask = 0xFFFF };
+    if (!strcmp(op, "set")) {
+        job.and_mask = (uint16_t)~mask;
+        job.or_mask = mask;
+    } else if (!strcmp(op, "clear")) {
+        job.and_mask = (uint16_t)~mask;
+    } else if (!strcmp(op, "toggle")) {
+        // Function 22 can not toggle, the bus engine reads and writes back in the same job
+        job.xor_mask = mask;
+    } else {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "op is set, clear or toggle");
+        return ESP_FAIL;
+    }
+    if (!set_job_deadline(root, &job)) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "timeoutMs out of range");
+        return ESP_FAIL;
+    }
+    mb_worker_execute(((rest_server_context_t *)(req->user_ctx))->mb_channel, &job);
+
+    ESP_LOGI(REST_TAG, "mask: slaveId = %d, registerId = %d, op = %s, bits = 0x%04x",
+             slave->valueint, reg->valueint, op, (unsigned)mask);
+    if (job.expired) {
+        httpd_resp_set_status(req, "504 Gateway Timeout");
+    }
+    cJSON_AddBoolToObject(root, "ok", job.value == 0);
+    return send_json(req, root);
+}
+
+/* Answer a read of a cached point the same way as a read of a register */
+static esp_err_t get_point(httpd_req_t *req, cJSON *root, const char *name)
+{
+    point_value_t point;
+    if (point_table_get(name, &point) != ESP_OK) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown point");
+        return ESP_FAIL;
+    }
+    if (point.valid) {
+        cJSON_AddNumberToObject(root, "currentValue", point.value);
+    } else {
+        cJSON_AddNullToObject(root, "currentValue");
+    }
+    if (point.timestamp) {
+        cJSON_AddNumberToObject(root, "timestampUs", (double)point.timestamp);
+        cJSON_AddNumberToObject(root, "ageUs", (double)(esp_timer_get_time() - (int64_t)point.timestamp));
+    }
+    cJSON_AddNumberToObject(root, "seq", point.seq);
+    return send_json(req, root);
+}
+
+/* Answer a read of count registers in one request, the registers are a typed array in CBOR */
+static esp_err_t get_block(httpd_req_t *req, cJSON *root, int slave_id, int register_id, int func_id, int count)
+{
+    uint8_t regs[MB_CAPS_REGS_MAX * 2];
+    int address = slave_id;
+    if (((func_id != 3) && (func_id != 4)) || (count < 1) || (count > MB_CAPS_REGS_MAX)
+            || (register_id < 0) || (register_id + count > 0x10000)) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Block reads are 1 to 125 registers of function 3 or 4");
+        return ESP_FAIL;
+    }
+    if (mb_route_resolve(slave_id, &address) != MB_ROUTE_LOCAL) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Block reads are served on the RTU segment only");
+        return ESP_FAIL;
+    }
+    mb_job_t job = { .op = MB_JOB_READ_RANGE, .slave_id = address, .value = func_id, .register_id = register_id,
+                     .count = (uint16_t)count, .data = regs, .data_size = sizeof(regs) };
+    if (!set_job_deadline(root, &job)) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "timeoutMs out of range");
+        return ESP_FAIL;
+    }
+    mb_worker_execute(((rest_server_context_t *)(req->user_ctx))->mb_channel, &job);
+
+    ESP_LOGI(REST_TAG, "get: slaveId = %d, registerId = %d, funcId = %d, count = %d", slave_id, register_id, func_id, count);
+    if (job.expired) {
+        httpd_resp_set_status(req, "504 Gateway Timeout");
+    }
+    cJSON_AddBoolToObject(root, "ok", job.value == 0);
+    if (job.exception) {
+        cJSON_AddNumberToObject(root, "exception", job.exception);
+    }
+    if (job.timestamp) {
+        cJSON_AddNumberToObject(root, "timestampUs", (double)job.timestamp);
+        cJSON_AddNumberToObject(root, "ageUs", (double)(esp_timer_get_time() - (int64_t)job.timestamp));
+    }
+    return send_reply(req, root, accepts_cbor(req), regs, (job.value == 0) ? job.data_size : 0);
+}
+
 static esp_err_t get_mb_handler(httpd_req_t *req)
 {
-    int total_len = req->content_len;
-    int cur_len = 0;
-    char *buf = ((rest_server_context_t *)(req->user_ctx))->scratch;
-    int received = 0;
-    if (total_len >= SCRATCH_BUFSIZE) {
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "content too long");
+    cJSON *root = recv_json(req);
+    if (!root) {
         return ESP_FAIL;
     }
-    while (cur_len < total_len) {
-        received = httpd_req_recv(req, buf + cur_len, total_len);
-        if (received <= 0) {
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post control value");
-            return ESP_FAIL;
-        }
-        cur_len += received;
+    const char *point = cJSON_GetStringValue(cJSON_GetObjectItem(root, "point"));
+    if (point) {
+        return get_point(req, root, point);
     }
-    buf[total_len] = '\0';
-    cJSON *root = cJSON_Parse(buf);
     int slaveId = cJSON_GetObjectItem(root, "slaveId")->valueint;
     int registerId = cJSON_GetObjectItem(root, "registerId")->valueint;
     int funcId = cJSON_GetObjectItem(root, "funcId")->valueint;
+    cJSON *count = cJSON_GetObjectItem(root, "count");
+    if (cJSON_IsNumber(count)) {
+        return get_block(req, root, slaveId, registerId, funcId, count->valueint);
+    }
 
-    int value = 0;
-    switch (funcId) {
-        case 3:
-            value = read_mb(0,slaveId,registerId);
-            break;
-            //Holding
-        case 4:
-            value = read_mb(1,slaveId,registerId);
-            break;
-            //Input
-        case 1:
-            value = read_mb(2,slaveId,registerId);
-            break;
-            //Coil
-        default:
-            return ESP_ERR_INVALID_ARG;
+    mb_job_t job = { .op = MB_JOB_READ, .slave_id = slaveId, .register_id = registerId };
+    int cid = mb_worker_read_cid(funcId);
+    if (cid < 0) {
+        cJSON_Delete(root);
+        return ESP_ERR_INVALID_ARG;
     }
+    job.cid = (uint16_t)cid;
+    if (!set_job_deadline(root, &job)) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "timeoutMs out of range");
+        return ESP_FAIL;
+    }
+    mb_worker_execute(((rest_server_context_t *)(req->user_ctx))->mb_channel, &job);
+    int value = job.value;
 
     ESP_LOGI(REST_TAG, "get: slaveId = %d, registerId = %d, funcId = %d", slaveId, registerId, funcId);
-    httpd_resp_set_type(req, "application/json");
+    if (job.expired) {
+        httpd_resp_set_status(req, "504 Gateway Timeout");
+    }
     cJSON_AddNumberToObject(root, "currentValue",value);
-    const char *sys_info = cJSON_Print(root);
-    httpd_resp_sendstr(req, sys_info);
-    free((void *)sys_info);
-    cJSON_Delete(root);
+    if (job.timestamp) {
+        // Receive time on the gateway clock and its age when the reply is built
+        cJSON_AddNumberToObject(root, "timestampUs", (double)job.timestamp);
+        cJSON_AddNumberToObject(root, "ageUs", (double)(esp_timer_get_time() - (int64_t)job.timestamp));
+    }
+    return send_json(req, root);
+}
+
+/* Handler for defining a polled register point or a calculated point */
+static esp_err_t points_post_handler(httpd_req_t *req)
+{
+    cJSON *root = recv_json(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+    const char *name = cJSON_GetStringValue(cJSON_GetObjectItem(root, "name"));
+    const char *expr = cJSON_GetStringValue(cJSON_GetObjectItem(root, "expr"));
+    const char *error = NULL;
+    esp_err_t err;
+    if (expr) {
+        err = point_table_add_calc(name, expr, &error);
+    } else {
+        cJSON *slave = cJSON_GetObjectItem(root, "slaveId");
+        cJSON *reg = cJSON_GetObjectItem(root, "registerId");
+        cJSON *func = cJSON_GetObjectItem(root, "funcId");
+        cJSON *period = cJSON_GetObjectItem(root, "periodMs");
+        cJSON *max_period = cJSON_GetObjectItem(root, "maxPeriodMs");
+        cJSON *deadband = cJSON_GetObjectItem(root, "deadband");
+        if (cJSON_IsNumber(slave) && cJSON_IsNumber(reg) && cJSON_IsNumber(func) && cJSON_IsNumber(period)) {
+            // With maxPeriodMs the period adapts to the activity of the value, periodMs is the shortest one
+            err = point_table_add_adaptive(name, slave->valueint, func->valueint, reg->valueint, period->valueint,
+                                           cJSON_IsNumber(max_period) ? max_period->valueint : period->valueint,
+                                           cJSON_IsNumber(deadband) ? deadband->valuedouble : 0);
+        } else {
+            err = ESP_ERR_INVALID_ARG;
+            error = "expr or slaveId, registerId, funcId and periodMs expected";
+        }
+    }
+    if (err != ESP_OK) {
+        if (err == ESP_ERR_INVALID_SIZE) {
+            error = "The scan plan would need more than the bus time, see /bus-plan";
+        }
+        ESP_LOGW(REST_TAG, "point %s rejected: %s", name ? name : "?", error ? error : esp_err_to_name(err));
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, error ? error : esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    return send_json(req, root);
+}
+
+/* Handler for listing the points with their cached values, only the changes after ?since=<seq> */
+static esp_err_t points_get_handler(httpd_req_t *req)
+{
+    char query[32];
+    char value[12];
+    uint32_t since = 0;
+    if ((httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+            && (httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK)) {
+        since = strtoul(value, NULL, 10);
+    }
+    cJSON *root = cJSON_CreateObject();
+    point_table_report(root, since);
+    return send_json(req, root);
+}
+
+static esp_err_t send_point_changes(httpd_req_t *req, uint64_t mask, uint32_t since, bool cbor)
+{
+    cJSON *root = cJSON_CreateObject();
+    point_table_report_mask(root, mask, since);
+    return send_reply(req, root, cbor, NULL, 0);
+}
+
+/* Answer the parked requests whose points changed or whose timeout passed */
+static void long_poll_task(void *arg)
+{
+    long_poll_t ready[LONG_POLL_MAX];
+    for (;;) {
+        int64_t now = esp_timer_get_time();
+        int64_t next_deadline = INT64_MAX;
+        int ready_count = 0;
+        xSemaphoreTake(long_poll_lock, portMAX_DELAY);
+        for (int i = 0; i < long_poll_count; ) {
+            long_poll_t *poll = &long_polls[i];
+            if ((now >= poll->deadline) || point_table_changed(poll->mask, poll->since)) {
+                ready[ready_count++] = *poll;
+                *poll = long_polls[--long_poll_count];
+                continue;
+            }
+            next_deadline = (poll->deadline < next_deadline) ? poll->deadline : next_deadline;
+            i++;
+        }
+        xSemaphoreGive(long_poll_lock);
+        // Send outside of the lock, a slow client must not hold up the parking of other requests
+        for (int i = 0; i < ready_count; i++) {
+            send_point_changes(ready[i].req, ready[i].mask, ready[i].since, ready[i].cbor);
+            httpd_req_async_handler_complete(ready[i].req);
+        }
+        TickType_t wait = portMAX_DELAY;
+        if (next_deadline != INT64_MAX) {
+            int64_t wait_us = next_deadline - esp_timer_get_time();
+            wait = (wait_us > 0) ? (TickType_t)((wait_us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000)) : 0;
+        }
+        // Woken by the point table on every change and by newly parked requests
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+/* Handler waiting until one of ?points=a,b,c changed after ?since=<seq>, or ?timeoutMs= passed */
+static esp_err_t points_wait_handler(httpd_req_t *req)
+{
+    size_t len = httpd_req_get_url_query_len(req) + 1;
+    char *query = malloc(len);
+    char *names = malloc(len);
+    if (!query || !names) {
+        free(query);
+        free(names);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory for the query");
+        return ESP_FAIL;
+    }
+    char value[12];
+    uint32_t since = 0;
+    uint32_t timeout_ms = CONFIG_GW_LONG_POLL_TIMEOUT_MS;
+    uint64_t mask = UINT64_MAX;
+    esp_err_t err = ESP_OK;
+    if (httpd_req_get_url_query_str(req, query, len) == ESP_OK) {
+        if (httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK) {
+            since = strtoul(value, NULL, 10);
+        }
+        if (httpd_query_key_value(query, "timeoutMs", value, sizeof(value)) == ESP_OK) {
+            timeout_ms = strtoul(value, NULL, 10);
+            timeout_ms = (timeout_ms < CONFIG_GW_LONG_POLL_TIMEOUT_MS) ? timeout_ms : CONFIG_GW_LONG_POLL_TIMEOUT_MS;
+        }
+        if (httpd_query_key_value(query, "points", names, len) == ESP_OK) {
+            mask = 0;
+            char *save = NULL;
+            for (char *name = strtok_r(names, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+                int index = point_table_index(name);
+                if (index < 0) {
+                    err = ESP_ERR_NOT_FOUND;
+                    break;
+                }
+                mask |= (1ULL << index);
+            }
+        }
+    }
+    free(query);
+    free(names);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown point");
+        return ESP_FAIL;
+    }
+    if (!since || !timeout_ms || point_table_changed(mask, since)) {
+        return send_point_changes(req, mask, since, accepts_cbor(req));
+    }
+    // Park the request, the httpd task goes on serving the other clients meanwhile
+    xSemaphoreTake(long_poll_lock, portMAX_DELAY);
+    if (long_poll_count < LONG_POLL_MAX) {
+        long_poll_t *poll = &long_polls[long_poll_count];
+        err = httpd_req_async_handler_begin(req, &poll->req);
+        if (err == ESP_OK) {
+            poll->mask = mask;
+            poll->since = since;
+            poll->deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+            poll->cbor = accepts_cbor(req);
+            long_poll_count++;
+        }
+    } else {
+        err = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(long_poll_lock);
+    if (err != ESP_OK) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Too many waiting requests");
+        return ESP_FAIL;
+    }
+    xTaskNotifyGive(long_poll_task_handle);
     return ESP_OK;
 }
 
+/* Handler for adding an alarm on a point */
+static esp_err_t alarms_post_handler(httpd_req_t *req)
+{
+    cJSON *root = recv_json(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+    cJSON *limit = cJSON_GetObjectItem(root, "limit");
+    cJSON *hysteresis = cJSON_GetObjectItem(root, "hysteresis");
+    cJSON *on_delay = cJSON_GetObjectItem(root, "onDelayMs");
+    cJSON *off_delay = cJSON_GetObjectItem(root, "offDelayMs");
+    alarm_config_t config = {
+        .point = cJSON_GetStringValue(cJSON_GetObjectItem(root, "point")),
+        .limit = cJSON_IsNumber(limit) ? limit->valuedouble : NAN,
+        .hysteresis = cJSON_IsNumber(hysteresis) ? hysteresis->valuedouble : 0,
+        .on_delay_ms = cJSON_IsNumber(on_delay) ? on_delay->valueint : 0,
+        .off_delay_ms = cJSON_IsNumber(off_delay) ? off_delay->valueint : 0
+    };
+    int id = -1;
+    esp_err_t err = alarm_type_from_name(cJSON_GetStringValue(cJSON_GetObjectItem(root, "type")), &config.type);
+    if (err == ESP_OK) {
+        err = alarm_add(&config, &id);
+    }
+    if (err != ESP_OK) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    cJSON_AddNumberToObject(root, "id", id);
+    return send_json(req, root);
+}
+
+/* Handler for the alarm states and the journal events after ?since=<seq> */
+static esp_err_t alarms_get_handler(httpd_req_t *req)
+{
+    char query[32];
+    char value[12];
+    uint32_t since = 0;
+    if ((httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+            && (httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK)) {
+        since = strtoul(value, NULL, 10);
+    }
+    cJSON *root = cJSON_CreateObject();
+    alarm_report(root, since);
+    return send_json(req, root);
+}
+
+/* Handler for mapping a point into the concentrator register map */
+static esp_err_t concentrator_post_handler(httpd_req_t *req)
+{
+    cJSON *root = recv_json(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+    cJSON *address = cJSON_GetObjectItem(root, "address");
+    concentrator_format_t format = CONCENTRATOR_FORMAT_U16;
+    const char *format_name = cJSON_GetStringValue(cJSON_GetObjectItem(root, "format"));
+    esp_err_t err = ESP_ERR_INVALID_ARG;
+    if (cJSON_IsNumber(address) && (address->valueint >= 0) && (address->valueint <= UINT16_MAX)
+            && (!format_name || (concentrator_format_from_name(format_name, &format) == ESP_OK))) {
+        err = concentrator_map(cJSON_GetStringValue(cJSON_GetObjectItem(root, "point")),
+                               (uint16_t)address->valueint, format);
+    }
+    if (err != ESP_OK) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    return send_json(req, root);
+}
+
+/* Handler for adding a transport ({"name", "type", "host", "port"}) or a route ({"unitId", "transport", "address"}) */
+static esp_err_t routes_post_handler(httpd_req_t *req)
+{
+    cJSON *root = recv_json(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+    cJSON *unit_id = cJSON_GetObjectItem(root, "unitId");
+    esp_err_t err = ESP_ERR_INVALID_ARG;
+    if (unit_id) {
+        cJSON *address = cJSON_GetObjectItem(root, "address");
+        if (cJSON_IsNumber(unit_id) && cJSON_IsNumber(address)) {
+            err = mb_route_add(unit_id->valueint, cJSON_GetStringValue(cJSON_GetObjectItem(root, "transport")),
+                               address->valueint);
+        }
+    } else {
+        mb_transport_type_t type;
+        cJSON *port = cJSON_GetObjectItem(root, "port");
+        if (cJSON_IsNumber(port) && (port->valueint > 0) && (port->valueint <= UINT16_MAX)
+                && (mb_transport_type_from_name(cJSON_GetStringValue(cJSON_GetObjectItem(root, "type")), &type) == ESP_OK)) {
+            int id = 0;
+            err = mb_route_add_transport(cJSON_GetStringValue(cJSON_GetObjectItem(root, "name")), type,
+                                         cJSON_GetStringValue(cJSON_GetObjectItem(root, "host")),
+                                         (uint16_t)port->valueint, &id);
+            if (err == ESP_OK) {
+                cJSON_AddNumberToObject(root, "id", id);
+            }
+        }
+    }
+    if (err != ESP_OK) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    return send_json(req, root);
+}
+
+/* Handler for the transports and the unit ID routes */
+static esp_err_t routes_get_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateObject();
+    mb_route_report(root);
+    return send_json(req, root);
+}
+
+/* Handler starting a discovery scan of RTU addresses and TCP hosts */
+static esp_err_t discovery_post_handler(httpd_req_t *req)
+{
+    cJSON *root = recv_json(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+    discovery_request_t *scan = calloc(1, sizeof(discovery_request_t));
+    if (!scan) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory for the scan");
+        return ESP_FAIL;
+    }
+    cJSON *item = cJSON_GetObjectItem(root, "rtu");
+    scan->rtu = !item || cJSON_IsTrue(item);
+    item = cJSON_GetObjectItem(root, "first");
+    scan->first = cJSON_IsNumber(item) ? (uint8_t)item->valueint : 1;
+    item = cJSON_GetObjectItem(root, "last");
+    scan->last = cJSON_IsNumber(item) ? (uint8_t)item->valueint : 247;
+    item = cJSON_GetObjectItem(root, "funcId");
+    scan->function = cJSON_IsNumber(item) ? (uint8_t)item->valueint : 17;
+    item = cJSON_GetObjectItem(root, "unitId");
+    scan->unit_id = cJSON_IsNumber(item) ? (uint8_t)item->valueint : 255;
+    item = cJSON_GetObjectItem(root, "port");
+    scan->port = cJSON_IsNumber(item) ? (uint16_t)item->valueint : 502;
+    esp_err_t err = ESP_OK;
+    // Hosts are listed, or swept from firstHost over hostCount consecutive addresses
+    cJSON *host;
+    cJSON_ArrayForEach(host, cJSON_GetObjectItem(root, "hosts")) {
+        struct in_addr addr;
+        if ((scan->host_count >= DISCOVERY_HOSTS_MAX) || !cJSON_IsString(host)
+                || (inet_pton(AF_INET, host->valuestring, &addr) != 1)) {
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+        scan->hosts[scan->host_count++] = addr.s_addr;
+    }
+    const char *first_host = cJSON_GetStringValue(cJSON_GetObjectItem(root, "firstHost"));
+    item = cJSON_GetObjectItem(root, "hostCount");
+    if (first_host && (err == ESP_OK)) {
+        struct in_addr addr;
+        int count = cJSON_IsNumber(item) ? item->valueint : 1;
+        // Compared with the room left, the sum could overflow for counts near INT_MAX
+        if ((inet_pton(AF_INET, first_host, &addr) != 1) || (count < 1)
+                || (count > DISCOVERY_HOSTS_MAX - scan->host_count)) {
+            err = ESP_ERR_INVALID_ARG;
+        }
+        for (int i = 0; (err == ESP_OK) && (i < count); i++) {
+            scan->hosts[scan->host_count++] = htonl(ntohl(addr.s_addr) + i);
+        }
+    }
+    if (err == ESP_OK) {
+        err = discovery_start(scan);
+    }
+    free(scan);
+    cJSON_Delete(root);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, (err == ESP_ERR_INVALID_STATE)
+                            ? "A discovery scan is running" : esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    root = cJSON_CreateObject();
+    discovery_report(root);
+    return send_json(req, root);
+}
+
+/* Handler for the discovery progress and the inventory of discovered devices */
+static esp_err_t discovery_get_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateObject();
+    discovery_report(root);
+    return send_json(req, root);
+}
+
+/* Handler starting a probe of the block read limits and illegal addresses of a slave */
+static esp_err_t capabilities_post_handler(httpd_req_t *req)
+{
+    cJSON *root = recv_json(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+    cJSON *item = cJSON_GetObjectItem(root, "slaveId");
+    int slave_id = cJSON_IsNumber(item) ? item->valueint : 0;
+    item = cJSON_GetObjectItem(root, "funcId");
+    int func_id = cJSON_IsNumber(item) ? item->valueint : 3;
+    item = cJSON_GetObjectItem(root, "registerId");
+    int register_id = cJSON_IsNumber(item) ? item->valueint : 0;
+    item = cJSON_GetObjectItem(root, "count");
+    int count = cJSON_IsNumber(item) ? item->valueint : MB_CAPS_REGS_MAX;
+    cJSON_Delete(root);
+    esp_err_t err = ESP_ERR_INVALID_ARG;
+    if ((register_id >= 0) && (register_id <= UINT16_MAX) && (count > 0)) {
+        err = mb_caps_probe(slave_id, func_id, (uint16_t)register_id, (uint32_t)count);
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, (err == ESP_ERR_INVALID_STATE)
+                            ? "A probe is running" : esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    root = cJSON_CreateObject();
+    mb_caps_report(root);
+    return send_json(req, root);
+}
+
+/* Handler for the prober state and the learned capabilities of the slaves */
+static esp_err_t capabilities_get_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateObject();
+    mb_caps_report(root);
+    return send_json(req, root);
+}
+
+/* Handler for checking a scan plan against the bus time before configuring it */
+static esp_err_t bus_plan_post_handler(httpd_req_t *req)
+{
+    cJSON *root = recv_json(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+    cJSON *items = cJSON_GetObjectItem(root, "items");
+    if (!cJSON_IsArray(items)) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "items expected");
+        return ESP_FAIL;
+    }
+    // The configured points are part of the plan, unless the items are a plan of their own
+    cJSON *current = cJSON_GetObjectItem(root, "withCurrent");
+    double utilisation = cJSON_IsFalse(current) ? 0 : point_table_utilisation();
+    cJSON *item;
+    cJSON_ArrayForEach(item, items) {
+        cJSON *slave = cJSON_GetObjectItem(item, "slaveId");
+        cJSON *func = cJSON_GetObjectItem(item, "funcId");
+        cJSON *count = cJSON_GetObjectItem(item, "count");
+        cJSON *period = cJSON_GetObjectItem(item, "periodMs");
+        if (!cJSON_IsNumber(slave) || !cJSON_IsNumber(func) || !cJSON_IsNumber(period) || (period->valueint <= 0)
+                || (cJSON_IsNumber(count) && ((count->valueint < 1) || (count->valueint > 2000)))) {
+            cJSON_Delete(root);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "slaveId, funcId and periodMs expected in the items");
+            return ESP_FAIL;
+        }
+        int address;
+        uint32_t bus_us = 0;
+        // Slaves behind a TCP transport take no time of the RTU segment
+        if (mb_route_resolve(slave->valueint, &address) == MB_ROUTE_LOCAL) {
+            bus_us = bus_model_transaction_us(address, func->valueint,
+                                              cJSON_IsNumber(count) ? (uint16_t)count->valueint : 1);
+        }
+        double share = (double)bus_us / (period->valueint * 1000.0);
+        utilisation += share;
+        cJSON_AddNumberToObject(item, "predictedUs", bus_us);
+        cJSON_AddNumberToObject(item, "utilisationPct", share * 100);
+    }
+    cJSON_AddNumberToObject(root, "utilisationPct", utilisation * 100);
+    cJSON_AddBoolToObject(root, "feasible", utilisation <= 1.0);
+    cJSON_AddBoolToObject(root, "withinLimit", utilisation <= BUS_MODEL_LIMIT);
+    return send_json(req, root);
+}
+
+/* Handler for the cost model and the scan plan, predicted against measured */
+static esp_err_t bus_plan_get_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateObject();
+    bus_model_report(root);
+    point_table_report_plan(root);
+    return send_json(req, root);
+}
+
+/* Handler for the concentrator register map and upstream access counters */
+static esp_err_t concentrator_get_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateObject();
+    concentrator_report(root);
+    return send_json(req, root);
+}
+
+static double device_field_value(const device_map_field_t *field)
+{
+    switch (field->type) {
+        case DEVICE_FIELD_I16:
+            return *(const int16_t *)field->data;
+        case DEVICE_FIELD_U32:
+            return *(const uint32_t *)field->data;
+        case DEVICE_FIELD_I32:
+            return *(const int32_t *)field->data;
+        case DEVICE_FIELD_F32:
+            return *(const float *)field->data;
+        default:
+            return *(const uint16_t *)field->data;
+    }
+}
+
+/* Handler running the block reads of the device map and returning the decoded fields */
+static esp_err_t device_get_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateObject();
+    cJSON *array = cJSON_AddArrayToObject(root, "blocks");
+    for (int i = 0; i < DEVICE_MAP_BLOCKS; i++) {
+        const device_map_block_t *block = &device_map_blocks[i];
+        mb_job_t job = { .op = MB_JOB_READ_BLOCK, .register_id = i };
+        mb_worker_execute(((rest_server_context_t *)(req->user_ctx))->mb_channel, &job);
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "slaveId", block->slave_addr);
+        cJSON_AddNumberToObject(item, "funcId", (block->area == MB_PARAM_INPUT) ? 4 : 3);
+        cJSON_AddNumberToObject(item, "registerId", block->reg_start);
+        cJSON_AddNumberToObject(item, "count", block->reg_count);
+        cJSON_AddBoolToObject(item, "ok", job.value == 0);
+        cJSON_AddItemToArray(array, item);
+    }
+    // The bus engine is done with the structs once the jobs completed
+    cJSON *fields = cJSON_AddObjectToObject(root, "fields");
+    for (int i = 0; i < DEVICE_MAP_FIELDS; i++) {
+        cJSON_AddNumberToObject(fields, device_map_fields[i].name, device_field_value(&device_map_fields[i]));
+    }
+    return send_json(req, root);
+}
+
 /* Simple handler for getting system handler */
 static esp_err_t info_handler(httpd_req_t *req)
 {
@@ -178,6 +934,24 @@ static esp_err_t info_handler(httpd_req_t *req)
     esp_chip_info(&chip_info);
     cJSON_AddStringToObject(root, "version", IDF_VER);
     cJSON_AddNumberToObject(root, "cores", chip_info.cores);
+    cJSON_AddNumberToObject(root, "expiredJobs", mb_worker_expired_count());
+    const char *sys_info = cJSON_Print(root);
+    httpd_resp_sendstr(req, sys_info);
+    free((void *)sys_info);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+/* Handler for getting the load of every core and task since the previous call */
+static esp_err_t core_load_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (core_load_report(root) != ESP_OK) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Run time statistics are not available");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
     const char *sys_info = cJSON_Print(root);
     httpd_resp_sendstr(req, sys_info);
     free((void *)sys_info);
@@ -191,10 +965,23 @@ esp_err_t start_rest_server(const char *base_path)
     rest_server_context_t *rest_context = calloc(1, sizeof(rest_server_context_t));
     REST_CHECK(rest_context, "No memory for rest context", err);
     strlcpy(rest_context->base_path, base_path, sizeof(rest_context->base_path));
+    // All handlers run in the single httpd task, so it is the only producer of this channel
+    rest_context->mb_channel = mb_worker_channel_open();
+    REST_CHECK(rest_context->mb_channel, "No Modbus channel for rest context", err_start);
+
+    // Parked long poll requests are answered by their own task, woken by the point changes
+    long_poll_lock = xSemaphoreCreateMutex();
+    REST_CHECK(long_poll_lock, "No memory for long poll lock", err_start);
+    REST_CHECK(xTaskCreatePinnedToCore(long_poll_task, "long_poll", LONG_POLL_TASK_STACK_SIZE, NULL,
+                                       LONG_POLL_TASK_PRIO, &long_poll_task_handle, CONFIG_GW_NET_CORE) == pdPASS,
+               "Create long poll task failed", err_start);
+    point_table_set_notify(long_poll_task_handle);
 
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
+    config.core_id = CONFIG_GW_NET_CORE;
+    config.max_uri_handlers = REST_MAX_URI_HANDLERS;
 
     ESP_LOGI(REST_TAG, "Starting HTTP Server");
     REST_CHECK(httpd_start(&server, &config) == ESP_OK, "Start server failed", err_start);
@@ -224,6 +1011,150 @@ esp_err_t start_rest_server(const char *base_path)
     };
     httpd_register_uri_handler(server, &set_mb_uri);
 
+    httpd_uri_t mask_mb_uri = {
+        .uri = "/mask-modbus",
+        .method = HTTP_POST,
+        .handler = mask_mb_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &mask_mb_uri);
+
+    httpd_uri_t core_load_uri = {
+        .uri = "/core-load",
+        .method = HTTP_GET,
+        .handler = core_load_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &core_load_uri);
+
+    httpd_uri_t points_post_uri = {
+        .uri = "/points",
+        .method = HTTP_POST,
+        .handler = points_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &points_post_uri);
+
+    httpd_uri_t points_get_uri = {
+        .uri = "/points",
+        .method = HTTP_GET,
+        .handler = points_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &points_get_uri);
+
+    httpd_uri_t points_wait_uri = {
+        .uri = "/points/wait",
+        .method = HTTP_GET,
+        .handler = points_wait_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &points_wait_uri);
+
+    httpd_uri_t alarms_post_uri = {
+        .uri = "/alarms",
+        .method = HTTP_POST,
+        .handler = alarms_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &alarms_post_uri);
+
+    httpd_uri_t alarms_get_uri = {
+        .uri = "/alarms",
+        .method = HTTP_GET,
+        .handler = alarms_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &alarms_get_uri);
+
+    httpd_uri_t concentrator_post_uri = {
+        .uri = "/concentrator",
+        .method = HTTP_POST,
+        .handler = concentrator_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &concentrator_post_uri);
+
+    httpd_uri_t concentrator_get_uri = {
+        .uri = "/concentrator",
+        .method = HTTP_GET,
+        .handler = concentrator_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &concentrator_get_uri);
+
+    httpd_uri_t device_get_uri = {
+        .uri = "/device",
+        .method = HTTP_GET,
+        .handler = device_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &device_get_uri);
+
+    httpd_uri_t routes_post_uri = {
+        .uri = "/routes",
+        .method = HTTP_POST,
+        .handler = routes_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &routes_post_uri);
+
+    httpd_uri_t routes_get_uri = {
+        .uri = "/routes",
+        .method = HTTP_GET,
+        .handler = routes_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &routes_get_uri);
+
+    httpd_uri_t discovery_post_uri = {
+        .uri = "/discovery",
+        .method = HTTP_POST,
+        .handler = discovery_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &discovery_post_uri);
+
+    httpd_uri_t discovery_get_uri = {
+        .uri = "/discovery",
+        .method = HTTP_GET,
+        .handler = discovery_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &discovery_get_uri);
+
+    httpd_uri_t capabilities_post_uri = {
+        .uri = "/capabilities",
+        .method = HTTP_POST,
+        .handler = capabilities_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &capabilities_post_uri);
+
+    httpd_uri_t capabilities_get_uri = {
+        .uri = "/capabilities",
+        .method = HTTP_GET,
+        .handler = capabilities_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &capabilities_get_uri);
+
+    httpd_uri_t bus_plan_post_uri = {
+        .uri = "/bus-plan",
+        .method = HTTP_POST,
+        .handler = bus_plan_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &bus_plan_post_uri);
+
+    httpd_uri_t bus_plan_get_uri = {
+        .uri = "/bus-plan",
+        .method = HTTP_GET,
+        .handler = bus_plan_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &bus_plan_get_uri);
+
     return ESP_OK;
 err_start:
     free(rest_context);
@@ -4,7 +4,12 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <string.h>             // for memcpy
 #include "esp_err.h"            // for esp_err_t
+#include "freertos/FreeRTOS.h"  // for task delay
+#include "freertos/task.h"
+#include "mb_m.h"               // for master run resource of the stack
+#include "port.h"               // for response time define
 #include "mbc_master.h"         // for master interface define
 #include "esp_modbus_master.h"  // for public interface defines
 #include "esp_modbus_callbacks.h"   // for callback functions
@@ -15,11 +20,62 @@ static const char TAG[] __attribute__((unused)) = "MB_CONTROLLER_MASTER";
 // These functions are wrappers for interface functions of the controller
 static mb_master_interface_t* master_interface_ptr = NULL;
 
+// Poll period while waiting for readers of the previous description table
+#define MB_DESCR_GRACE_POLL_TICS   (1)
+
 void mbc_master_init_iface(void* handler)
 {
     master_interface_ptr = (mb_master_interface_t*) handler;
 }
 
+void mbc_master_descr_init(mb_master_options_t* opts)
+{
+    for (int idx = 0; idx < 2; idx++) {
+        opts->mbm_descr[idx].table = NULL;
+        opts->mbm_descr[idx].size = 0;
+        atomic_init(&opts->mbm_descr_readers[idx], 0);
+    }
+    atomic_init(&opts->mbm_descr_active, 0);
+}
+
+unsigned mbc_master_descr_acquire(mb_master_options_t* opts, mb_descr_table_t* descr)
+{
+    unsigned index = 0;
+    for (;;) {
+        index = atomic_load(&opts->mbm_descr_active);
+        atomic_fetch_add(&opts->mbm_descr_readers[index], 1);
+        // Make sure the table was not replaced before the reader was registered
+        if (atomic_load(&opts->mbm_descr_active) == index) {
+            break;
+        }
+        atomic_fetch_sub(&opts->mbm_descr_readers[index], 1);
+    }
+    *descr = opts->mbm_descr[index];
+    return index;
+}
+
+void mbc_master_descr_release(mb_master_options_t* opts, unsigned index)
+{
+    atomic_fetch_sub(&opts->mbm_descr_readers[index & 1], 1);
+}
+
+void mbc_master_descr_publish(mb_master_options_t* opts, const mb_parameter_descriptor_t* descriptor, size_t num_elements)
+{
+    unsigned active = atomic_load(&opts->mbm_descr_active);
+    unsigned next = active ^ 1;
+    // The spare slot can still be used by a reader which registered before the previous swap
+    while (atomic_load(&opts->mbm_descr_readers[next])) {
+        vTaskDelay(MB_DESCR_GRACE_POLL_TICS);
+    }
+    opts->mbm_descr[next].table = descriptor;
+    opts->mbm_descr[next].size = num_elements;
+    atomic_store(&opts->mbm_descr_active, next);
+    // Wait while lookups in the previous table are completed
+    while (atomic_load(&opts->mbm_descr_readers[active])) {
+        vTaskDelay(MB_DESCR_GRACE_POLL_TICS);
+    }
+}
+
 /**
  * Modbus controller destroy function
  */
@@ -49,14 +105,41 @@ esp_err_t mbc_master_get_cid_info(uint16_t cid, const mb_parameter_descriptor_t*
     MB_MASTER_CHECK((master_interface_ptr->get_cid_info != NULL),
                     ESP_ERR_INVALID_STATE,
                     "Master interface is not correctly initialized.");
-    error = master_interface_ptr->get_cid_info(cid, param_info);
+    error = master_interface_ptr->get_cid_info(cid, param_info, NULL);
+    MB_MASTER_CHECK((error == ESP_OK),
+                    error,
+                    "Master get cid info failure, error=(0x%x).",
+                    (int)error);
+    return error;
+}
+
+esp_err_t mbc_master_hold_cid_info(uint16_t cid, const mb_parameter_descriptor_t** param_info, uint32_t* hold)
+{
+    esp_err_t error = ESP_OK;
+    MB_MASTER_CHECK((master_interface_ptr != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    MB_MASTER_CHECK((master_interface_ptr->get_cid_info != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    MB_MASTER_CHECK((hold != NULL), ESP_ERR_INVALID_ARG, "mb incorrect hold pointer.");
+    unsigned index = 0;
+    error = master_interface_ptr->get_cid_info(cid, param_info, &index);
     MB_MASTER_CHECK((error == ESP_OK),
                     error,
                     "Master get cid info failure, error=(0x%x).",
                     (int)error);
+    *hold = index;
     return error;
 }
 
+void mbc_master_release_cid_info(uint32_t hold)
+{
+    if (master_interface_ptr) {
+        mbc_master_descr_release(&master_interface_ptr->opts, hold);
+    }
+}
+
 /**
  * Get parameter data for corresponding characteristic
  */
@@ -97,6 +180,157 @@ esp_err_t mbc_master_send_request(mb_param_request_t* request, void* data_ptr)
     return ESP_OK;
 }
 
+/**
+ * Get receive time stamp of the last successful response
+ */
+esp_err_t mbc_master_get_rx_timestamp(uint64_t* timestamp)
+{
+    MB_MASTER_CHECK((master_interface_ptr != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    MB_MASTER_CHECK((timestamp != NULL),
+                    ESP_ERR_INVALID_ARG,
+                    "Incorrect time stamp pointer.");
+    *timestamp = master_interface_ptr->opts.mbm_rx_timestamp;
+    return ESP_OK;
+}
+
+/**
+ * Get the exception code of the response to the last request
+ */
+esp_err_t mbc_master_get_exception(uint8_t* exception)
+{
+    MB_MASTER_CHECK((master_interface_ptr != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    MB_MASTER_CHECK((exception != NULL),
+                    ESP_ERR_INVALID_ARG,
+                    "Incorrect exception pointer.");
+    *exception = master_interface_ptr->opts.mbm_exception;
+    return ESP_OK;
+}
+
+/**
+ * Set the response timeout of the next requests
+ */
+esp_err_t mbc_master_set_response_timeout(uint32_t timeout_ms)
+{
+    MB_MASTER_CHECK((master_interface_ptr != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    vMBMasterPortTimersRespondTimeoutSet((ULONG)timeout_ms);
+    return ESP_OK;
+}
+
+/**
+ * Send a register read request and borrow the response registers from the receive frame
+ */
+esp_err_t mbc_master_read_view(mb_param_request_t* request, mb_response_view_t* view)
+{
+    MB_MASTER_CHECK((master_interface_ptr != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    MB_MASTER_CHECK((master_interface_ptr->send_request != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    MB_MASTER_CHECK(((request != NULL) && (view != NULL)),
+                    ESP_ERR_INVALID_ARG,
+                    "Incorrect request or view pointer.");
+    MB_MASTER_CHECK(((request->command == MB_FUNC_READ_HOLDING_REGISTER)
+                        || (request->command == MB_FUNC_READ_INPUT_REGISTER)),
+                    ESP_ERR_NOT_SUPPORTED,
+                    "View of command (%u) is not supported.", (unsigned)request->command);
+    mb_master_options_t* mbm_opts = &master_interface_ptr->opts;
+    view->data = NULL;
+    view->reg_count = 0;
+    // The register callbacks fill mbm_view instead of copying when it is the data pointer
+    esp_err_t error = master_interface_ptr->send_request(request, (void*)&mbm_opts->mbm_view);
+    MB_MASTER_CHECK((error == ESP_OK),
+                    error,
+                    "Master read view failure error=(0x%x) (%s).",
+                    (int)error, esp_err_to_name(error));
+    // Hold the master so no other request reuses the receive frame until the view is released
+    MB_MASTER_CHECK(xMBMasterRunResTake(pdMS_TO_TICKS(MB_MAX_RESPONSE_TIME_MS)),
+                    ESP_ERR_TIMEOUT,
+                    "Master is busy.");
+    // The view is ours only if it is from our request and no request was sent after it
+    if ((mbm_opts->mbm_view_owner != xTaskGetCurrentTaskHandle())
+            || (mbm_opts->mbm_view_req != mbm_opts->mbm_req_count)
+            || (mbm_opts->mbm_view.data == NULL)) {
+        vMBMasterRunResRelease();
+        ESP_LOGD(TAG, "Response frame was reused by another request.");
+        return ESP_ERR_INVALID_STATE;
+    }
+    view->reg_count = mbm_opts->mbm_view.reg_count;
+    view->data = mbm_opts->mbm_view.data;
+    view->timestamp = mbm_opts->mbm_rx_timestamp;
+    return ESP_OK;
+}
+
+/**
+ * Release a response view and let the master send other requests
+ */
+esp_err_t mbc_master_release_view(mb_response_view_t* view)
+{
+    MB_MASTER_CHECK((master_interface_ptr != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    MB_MASTER_CHECK(((view != NULL) && (view->data != NULL)),
+                    ESP_ERR_INVALID_ARG,
+                    "View is not held.");
+    view->data = NULL;
+    view->reg_count = 0;
+    vMBMasterRunResRelease();
+    return ESP_OK;
+}
+
+/**
+ * Modify bits of one holding register in a single Mask Write Register transaction
+ */
+esp_err_t mbc_master_mask_write(uint8_t slave_addr, uint16_t reg_addr, uint16_t and_mask, uint16_t or_mask)
+{
+    MB_MASTER_CHECK((master_interface_ptr != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    MB_MASTER_CHECK((master_interface_ptr->send_request != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    mb_param_request_t request = {
+        .slave_addr = slave_addr,
+        .command = MB_FUNC_MASK_WRITE_REGISTER,
+        .reg_start = reg_addr,
+        .reg_size = 1
+    };
+    uint16_t masks[2] = { and_mask, or_mask };
+    return master_interface_ptr->send_request(&request, (void*)masks);
+}
+
+/**
+ * Read the slave ID, run indicator and device specific data of a slave
+ */
+esp_err_t mbc_master_report_slave_id(uint8_t slave_addr, uint8_t* data, uint16_t* length)
+{
+    MB_MASTER_CHECK((master_interface_ptr != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    MB_MASTER_CHECK((master_interface_ptr->send_request != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Master interface is not correctly initialized.");
+    MB_MASTER_CHECK(((data != NULL) && (length != NULL) && (*length > 0)),
+                    ESP_ERR_INVALID_ARG,
+                    "Incorrect data buffer.");
+    mb_param_request_t request = {
+        .slave_addr = slave_addr,
+        .command = MB_FUNC_OTHER_REPORT_SLAVEID,
+        .reg_start = 0,
+        .reg_size = *length
+    };
+    master_interface_ptr->opts.mbm_slave_id_len = 0;
+    esp_err_t error = master_interface_ptr->send_request(&request, (void*)data);
+    *length = (error == ESP_OK) ? master_interface_ptr->opts.mbm_slave_id_len : 0;
+    return error;
+}
+
 /**
  * Set Modbus parameter description table
  */
@@ -222,6 +456,21 @@ eMBErrorCode eMBMasterRegHoldingCB(UCHAR * pucRegBuffer, USHORT usAddress,
     return error;
 }
 
+eMBErrorCode eMBMasterRegSlaveIdCB(UCHAR * pucBuffer, USHORT usNBytes)
+{
+    MB_MASTER_CHECK((master_interface_ptr != NULL),
+                    MB_EILLSTATE,
+                    "Master interface is not correctly initialized.");
+    mb_master_options_t* mbm_opts = &master_interface_ptr->opts;
+    // The data is the same for both ports, so it is copied here and not by the port controllers
+    uint16_t len = (usNBytes < mbm_opts->mbm_reg_buffer_size) ? usNBytes : mbm_opts->mbm_reg_buffer_size;
+    if (mbm_opts->mbm_reg_buffer_ptr && len) {
+        memcpy(mbm_opts->mbm_reg_buffer_ptr, pucBuffer, len);
+    }
+    mbm_opts->mbm_slave_id_len = len;
+    return MB_ENOERR;
+}
+
 eMBErrorCode eMBMasterRegInputCB(UCHAR * pucRegBuffer, USHORT usAddress,
                                 USHORT usNRegs)
 {
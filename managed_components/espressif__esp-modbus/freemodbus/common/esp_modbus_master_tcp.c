@@ -22,3 +22,13 @@ esp_err_t mbc_master_init_tcp(void** handler)
     }
     return  error;
 }
+
+esp_err_t mbc_master_tcp_add_slave(uint8_t slave_addr, const char* ip_addr)
+{
+    return mbc_tcp_master_add_slave_ip(slave_addr, ip_addr);
+}
+
+esp_err_t mbc_master_tcp_remove_slave(uint8_t slave_addr)
+{
+    return mbc_tcp_master_remove_slave_ip(slave_addr);
+}
@@ -187,6 +187,10 @@ esp_err_t mbc_slave_get_param_info(mb_param_info_t* reg_info, uint32_t timeout)
                     ESP_ERR_INVALID_STATE,
                     "Slave interface is not correctly initialized.");
     error = slave_interface_ptr->get_param_info(reg_info, timeout);
+    // An empty queue is the normal result of a poll, return it as documented without logging
+    if (error == ESP_ERR_TIMEOUT) {
+        return error;
+    }
     MB_SLAVE_CHECK((error == ESP_OK),
                     ESP_ERR_INVALID_STATE,
                     "Slave get parameter info failure error=(0x%x).",
@@ -223,6 +227,7 @@ esp_err_t mbc_slave_set_descriptor(mb_register_area_descriptor_t descr_data)
         new_descr->type = descr_data.type;
         new_descr->p_data = descr_data.address;
         new_descr->size = descr_data.size;
+        new_descr->seqlock = NULL;
         LIST_INSERT_HEAD(&mbs_opts->mbs_area_descriptors[descr_data.type], new_descr, entries);
         error = ESP_OK;
     }
@@ -275,6 +280,66 @@ static esp_err_t mbc_slave_send_param_access_notification(mb_event_group_t event
     return err;
 }
 
+void mbc_slave_seqlock_init(mb_seqlock_t* seqlock)
+{
+    seqlock->seq = 0;
+    portMUX_INITIALIZE(&seqlock->writer_lock);
+}
+
+esp_err_t mbc_slave_set_seqlock(mb_param_type_t type, uint16_t start_offset, mb_seqlock_t* seqlock)
+{
+    MB_SLAVE_CHECK((slave_interface_ptr != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Slave interface is not correctly initialized.");
+    MB_SLAVE_CHECK(((type == MB_PARAM_HOLDING) || (type == MB_PARAM_INPUT)),
+                    ESP_ERR_INVALID_ARG, "mb sequence lock is supported for register areas only.");
+    mb_descr_entry_t* it = mbc_slave_find_reg_descriptor(type, start_offset, 1);
+    MB_SLAVE_CHECK(((it != NULL) && (it->start_offset == start_offset)),
+                    ESP_ERR_INVALID_ARG, "mb area descriptor is not defined.");
+    // The stack may already serve the area, it takes the lock or no lock but never a partial one
+    __atomic_store_n(&it->seqlock, seqlock, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+void mbc_slave_area_begin(mb_seqlock_t* seqlock)
+{
+    portENTER_CRITICAL(&seqlock->writer_lock);
+    __atomic_store_n(&seqlock->seq, seqlock->seq + 1, __ATOMIC_RELAXED);
+    // The odd sequence has to be visible before any of the new values
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void mbc_slave_area_commit(mb_seqlock_t* seqlock)
+{
+    __atomic_store_n(&seqlock->seq, seqlock->seq + 1, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&seqlock->writer_lock);
+}
+
+// Copy registers of an area into the response buffer, consistent with the updates of a sequence lock
+static void mbc_slave_read_regs(const mb_descr_entry_t* it, UCHAR* reg_buffer, uint8_t* area, USHORT n_regs)
+{
+    mb_seqlock_t* seqlock = __atomic_load_n(&it->seqlock, __ATOMIC_ACQUIRE);
+    uint32_t seq = 0;
+    do {
+        if (seqlock) {
+            seq = __atomic_load_n(&seqlock->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) {
+                // The writer is inside its critical section on the other core and leaves it shortly
+                continue;
+            }
+        }
+        UCHAR* dst = reg_buffer;
+        uint8_t* src = area;
+        for (USHORT regs = n_regs; regs > 0; regs--) {
+            _XFER_2_RD(dst, src);
+        }
+        if (!seqlock) {
+            break;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || (__atomic_load_n(&seqlock->seq, __ATOMIC_RELAXED) != seq));
+}
+
 /*
  * Below are the common slave read/write register callback functions
  * The concrete slave port can override them using interface function pointers
@@ -293,18 +358,13 @@ eMBErrorCode mbc_reg_input_slave_cb(UCHAR * reg_buffer, USHORT address, USHORT n
     if (it != NULL) {
         uint16_t input_reg_start = (uint16_t)it->start_offset; // Get Modbus start address
         uint8_t* input_buffer = (uint8_t*)it->p_data; // Get instance address
-        uint16_t regs = n_regs;
         uint16_t reg_index;
         // If input or configuration parameters are incorrect then return an error to stack layer
         reg_index = (uint16_t)(address - input_reg_start);
         reg_index <<= 1; // register Address to byte address
         input_buffer += reg_index;
         uint8_t* buffer_start = input_buffer;
-        while (regs > 0) {
-            _XFER_2_RD(reg_buffer, input_buffer);
-            reg_index += 2;
-            regs -= 1;
-        }
+        mbc_slave_read_regs(it, reg_buffer, input_buffer, n_regs);
         // Send access notification
         (void)mbc_slave_send_param_access_notification(MB_EVENT_INPUT_REG_RD);
         // Send parameter info to application task
@@ -326,6 +386,7 @@ eMBErrorCode mbc_reg_holding_slave_cb(UCHAR * reg_buffer, USHORT address, USHORT
                     MB_EINVAL, "Slave stack call failed.");
     eMBErrorCode status = MB_ENOERR;
     uint16_t reg_index;
+    mb_seqlock_t* seqlock = NULL;
     address--; // address of register is already +1
     mb_descr_entry_t* it = mbc_slave_find_reg_descriptor(MB_PARAM_HOLDING, address, n_regs);
     if (it != NULL) {
@@ -338,11 +399,7 @@ eMBErrorCode mbc_reg_holding_slave_cb(UCHAR * reg_buffer, USHORT address, USHORT
         uint8_t* buffer_start = holding_buffer;
         switch (mode) {
             case MB_REG_READ:
-                while (regs > 0) {
-                    _XFER_2_RD(reg_buffer, holding_buffer);
-                    reg_index += 2;
-                    regs -= 1;
-                };
+                mbc_slave_read_regs(it, reg_buffer, holding_buffer, n_regs);
                 // Send access notification
                 (void)mbc_slave_send_param_access_notification(MB_EVENT_HOLDING_REG_RD);
                 // Send parameter info
@@ -350,12 +407,20 @@ eMBErrorCode mbc_reg_holding_slave_cb(UCHAR * reg_buffer, USHORT address, USHORT
                                 (uint8_t*)buffer_start, (uint16_t)n_regs);
                 break;
             case MB_REG_WRITE:
+                // The stack is a second writer of the area, so it takes the same sequence lock
+                seqlock = __atomic_load_n(&it->seqlock, __ATOMIC_ACQUIRE);
+                if (seqlock) {
+                    mbc_slave_area_begin(seqlock);
+                }
                 while (regs > 0) {
                     _XFER_2_WR(holding_buffer, reg_buffer);
                     holding_buffer += 2;
                     reg_index += 2;
                     regs -= 1;
                 };
+                if (seqlock) {
+                    mbc_slave_area_commit(seqlock);
+                }
                 // Send access notification
                 (void)mbc_slave_send_param_access_notification(MB_EVENT_HOLDING_REG_WR);
                 // Send parameter info
@@ -369,6 +434,43 @@ eMBErrorCode mbc_reg_holding_slave_cb(UCHAR * reg_buffer, USHORT address, USHORT
     return status;
 }
 
+// Callback function for the mask write of a MB Holding Register
+// The read, the masks and the write are one update of the sequence lock, so readers never see the register in between
+static eMBErrorCode mbc_reg_holding_mask_slave_cb(USHORT address, USHORT and_mask, USHORT or_mask)
+{
+    MB_SLAVE_CHECK((slave_interface_ptr != NULL),
+                    MB_EILLSTATE, "Slave stack uninitialized.");
+    address--; // address of register is already +1
+    mb_descr_entry_t* it = mbc_slave_find_reg_descriptor(MB_PARAM_HOLDING, address, 1);
+    if (it == NULL) {
+        return MB_ENOREG;
+    }
+    uint8_t* holding_buffer = (uint8_t*)it->p_data + ((uint16_t)(address - it->start_offset) << 1);
+    UCHAR value_buffer[2];
+    UCHAR* dst = value_buffer;
+    uint8_t* src = holding_buffer;
+    mb_seqlock_t* seqlock = __atomic_load_n(&it->seqlock, __ATOMIC_ACQUIRE);
+    if (seqlock) {
+        mbc_slave_area_begin(seqlock);
+    }
+    _XFER_2_RD(dst, src);
+    USHORT value = (USHORT)((value_buffer[0] << 8) | value_buffer[1]);
+    value = (USHORT)((value & and_mask) | (or_mask & (USHORT)~and_mask));
+    value_buffer[0] = (UCHAR)(value >> 8);
+    value_buffer[1] = (UCHAR)(value & 0xFF);
+    src = value_buffer;
+    _XFER_2_WR(holding_buffer, src);
+    if (seqlock) {
+        mbc_slave_area_commit(seqlock);
+    }
+    // Send access notification
+    (void)mbc_slave_send_param_access_notification(MB_EVENT_HOLDING_REG_WR);
+    // Send parameter info
+    (void)mbc_slave_send_param_info(MB_EVENT_HOLDING_REG_WR, (uint16_t)address,
+                    holding_buffer, 1);
+    return MB_ENOERR;
+}
+
 // Callback function for reading of MB Coils Registers
 eMBErrorCode mbc_reg_coils_slave_cb(UCHAR* reg_buffer, USHORT address, USHORT n_coils, eMBRegisterMode mode)
 {
@@ -514,6 +616,30 @@ eMBErrorCode eMBRegHoldingCB(UCHAR * pucRegBuffer, USHORT usAddress,
     return error;
 }
 
+eMBErrorCode eMBRegHoldingMaskCB(USHORT usAddress, USHORT usAndMask, USHORT usOrMask)
+{
+    eMBErrorCode error = MB_ENOERR;
+    MB_SLAVE_CHECK((slave_interface_ptr != NULL),
+                    ESP_ERR_INVALID_STATE,
+                    "Slave interface is not correctly initialized.");
+
+    if (slave_interface_ptr->slave_reg_cb_holding) {
+        // The concrete port owns the registers, read and write them through its callback
+        UCHAR reg_buffer[2];
+        error = slave_interface_ptr->slave_reg_cb_holding(reg_buffer, usAddress, 1, MB_REG_READ);
+        if (error == MB_ENOERR) {
+            USHORT value = (USHORT)((reg_buffer[0] << 8) | reg_buffer[1]);
+            value = (USHORT)((value & usAndMask) | (usOrMask & (USHORT)~usAndMask));
+            reg_buffer[0] = (UCHAR)(value >> 8);
+            reg_buffer[1] = (UCHAR)(value & 0xFF);
+            error = slave_interface_ptr->slave_reg_cb_holding(reg_buffer, usAddress, 1, MB_REG_WRITE);
+        }
+    } else {
+        error = mbc_reg_holding_mask_slave_cb(usAddress, usAndMask, usOrMask);
+    }
+    return error;
+}
+
 eMBErrorCode eMBRegInputCB(UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs)
 {
     eMBErrorCode error = ESP_ERR_INVALID_STATE;
@@ -104,6 +104,15 @@ typedef struct {
     uint16_t reg_size;              /*!< Modbus number of registers */
 } mb_param_request_t;
 
+/**
+ * @brief Borrowed view of the registers of a read response, see mbc_master_read_view()
+ */
+typedef struct {
+    uint16_t reg_count;             /*!< Number of registers in the response */
+    const uint8_t* data;            /*!< Register values in the receive frame, big-endian, 2 * reg_count bytes */
+    uint64_t timestamp;             /*!< Receive time stamp of the response (us since boot) */
+} mb_response_view_t;
+
 /**
  * @brief Initialize Modbus controller and stack for TCP port
  *
@@ -116,6 +125,34 @@ typedef struct {
  */
 esp_err_t mbc_master_init_tcp(void** handler);
 
+/**
+ * @brief Add slave to the Modbus TCP master. When the stack is running the slave
+ *        is connected between transactions and polled as soon as it is connected.
+ *
+ * @param slave_addr slave short address (UID)
+ * @param ip_addr slave IP address string, must be valid until the slave is removed
+ *
+ * @return
+ *     - ESP_OK                 Success
+ *     - ESP_ERR_INVALID_STATE  The slave is already registered or can not be added
+ *     - ESP_ERR_TIMEOUT        The stack is busy
+ */
+esp_err_t mbc_master_tcp_add_slave(uint8_t slave_addr, const char* ip_addr);
+
+/**
+ * @brief Remove slave from the Modbus TCP master and close its connection.
+ *        The slave must not be used in the parameter description table.
+ *
+ * @param slave_addr slave short address (UID)
+ *
+ * @return
+ *     - ESP_OK                 Success
+ *     - ESP_ERR_NOT_FOUND      The slave is not registered
+ *     - ESP_ERR_INVALID_STATE  The slave is used in the table or can not be removed
+ *     - ESP_ERR_TIMEOUT        The stack is busy
+ */
+esp_err_t mbc_master_tcp_remove_slave(uint8_t slave_addr);
+
 /**
  * @brief Initialize Modbus Master controller and stack for Serial port
  *
@@ -157,11 +194,15 @@ esp_err_t mbc_master_start(void);
 /**
  * @brief Set Modbus communication parameters for the controller
  *
+ * @note For the started serial master only the baudrate and parity can be changed,
+ *       the new settings are applied between transactions.
+ *
  * @param comm_info Communication parameters structure.
  *
  * @return
  *     - ESP_OK Success
  *     - ESP_ERR_INVALID_ARG Incorrect parameter data
+ *     - ESP_ERR_INVALID_STATE The parameter can not be changed while started
  */
 esp_err_t mbc_master_setup(void* comm_info);
 
@@ -174,6 +215,10 @@ esp_err_t mbc_master_setup(void* comm_info);
 /**
  * @brief Assign parameter description table for Modbus controller interface.
  *
+ * @note The table can be replaced while the stack is running. The function returns when
+ *       the lookups in the previous table are completed, then the previous table can be freed.
+ *       The slaves of the started TCP master must be added by mbc_master_tcp_add_slave() first.
+ *
  * @param[in] descriptor pointer to parameter description table
  * @param num_elements number of elements in the table
  *
@@ -201,10 +246,124 @@ esp_err_t mbc_master_set_descriptor(const mb_parameter_descriptor_t* descriptor,
  */
 esp_err_t mbc_master_send_request(mb_param_request_t* request, void* data_ptr);
 
+/**
+ * @brief Get the receive time stamp of the response to the last successful request.
+ *        The time stamp is taken by the port when the end of the response frame is detected
+ *        (UART RX idle event corrected by the idle gap or socket readable for TCP).
+ *        For serial ports the error is bounded by the TOUT resolution of the UART (up to one character time)
+ *        plus the wake up latency of the UART event task, which is not delayed by other stack processing.
+ *
+ * @param[out] timestamp time of the response in microseconds since boot (esp_timer_get_time() base)
+ *
+ * @return
+ *     - esp_err_t ESP_OK - the time stamp is returned
+ *     - esp_err_t ESP_ERR_INVALID_ARG - invalid argument of function
+ *     - esp_err_t ESP_ERR_INVALID_STATE - the master interface is not initialized
+ */
+esp_err_t mbc_master_get_rx_timestamp(uint64_t* timestamp);
+
+/**
+ * @brief Get the exception code of the response to the last request.
+ *        Requests answered with an exception fail with ESP_ERR_INVALID_RESPONSE, the code tells for example
+ *        an illegal data address (2) from an illegal data value (3).
+ *
+ * @param[out] exception exception code of the slave, 0 if the last response was not an exception
+ *
+ * @return
+ *     - esp_err_t ESP_OK - the exception code is returned
+ *     - esp_err_t ESP_ERR_INVALID_ARG - invalid argument of function
+ *     - esp_err_t ESP_ERR_INVALID_STATE - the master interface is not initialized
+ */
+esp_err_t mbc_master_get_exception(uint8_t* exception);
+
+/**
+ * @brief Set the response timeout of the next requests, so a request does not wait for a response
+ *        longer than its caller waits for the result. The setting applies to all the following
+ *        requests until it is changed again.
+ *
+ * @param timeout_ms response timeout in milliseconds, 0 to restore CONFIG_FMB_MASTER_TIMEOUT_MS_RESPOND
+ *
+ * @return
+ *     - esp_err_t ESP_OK - the timeout is set
+ *     - esp_err_t ESP_ERR_INVALID_STATE - the master interface is not initialized
+ */
+esp_err_t mbc_master_set_response_timeout(uint32_t timeout_ms);
+
+/**
+ * @brief Send a read request for holding or input registers and borrow the registers of the response
+ *        directly from the receive frame of the stack instead of copying them.
+ *        The view holds the master: other requests wait until it is released with
+ *        mbc_master_release_view(), so release it as soon as the registers are decoded.
+ *
+ * @param request pointer to request structure, the command is 3 (read holding registers) or 4 (read input registers)
+ * @param[out] view view of the response registers, valid until released
+ *
+ * @return
+ *     - esp_err_t ESP_OK - the view is valid and has to be released
+ *     - esp_err_t ESP_ERR_INVALID_ARG - invalid argument of function
+ *     - esp_err_t ESP_ERR_INVALID_STATE - the master interface is not initialized or the frame
+ *                                         was reused by another request before it could be borrowed
+ *     - esp_err_t ESP_ERR_INVALID_RESPONSE - an invalid response from slave
+ *     - esp_err_t ESP_ERR_TIMEOUT - operation timeout or no response from slave
+ *     - esp_err_t ESP_ERR_NOT_SUPPORTED - the command is not a register read or is not supported by slave
+ *     - esp_err_t ESP_FAIL - slave returned an exception or other failure
+ */
+esp_err_t mbc_master_read_view(mb_param_request_t* request, mb_response_view_t* view);
+
+/**
+ * @brief Release a view returned by mbc_master_read_view() and let the master send other requests
+ *
+ * @param view view to release, its data pointer is cleared
+ *
+ * @return
+ *     - esp_err_t ESP_OK - the view is released
+ *     - esp_err_t ESP_ERR_INVALID_ARG - the view is not held
+ *     - esp_err_t ESP_ERR_INVALID_STATE - the master interface is not initialized
+ */
+esp_err_t mbc_master_release_view(mb_response_view_t* view);
+
+/**
+ * @brief Modify bits of one holding register with a Mask Write Register request (function 22).
+ *        The slave writes (current AND and_mask) OR (or_mask AND (NOT and_mask)), so bits are
+ *        set or cleared in one transaction without a read-modify-write by the master.
+ *
+ * @param slave_addr slave address
+ * @param reg_addr register address
+ * @param and_mask bits set to 1 keep their current value
+ * @param or_mask value of the bits cleared in and_mask
+ *
+ * @return
+ *     - esp_err_t ESP_OK - the register is modified
+ *     - esp_err_t ESP_ERR_INVALID_RESPONSE - the slave returned an exception, for example
+ *                                            because it does not support the function
+ *     - esp_err_t ESP_ERR_TIMEOUT - no response from slave
+ *     - esp_err_t ESP_ERR_INVALID_STATE - the master interface is not initialized or busy
+ */
+esp_err_t mbc_master_mask_write(uint8_t slave_addr, uint16_t reg_addr, uint16_t and_mask, uint16_t or_mask);
+
+/**
+ * @brief Read the slave ID, the run indicator and the device specific data of a slave
+ *        with a Report Slave ID request (function 17). Requires CONFIG_FMB_CONTROLLER_SLAVE_ID_SUPPORT.
+ *
+ * @param slave_addr slave address, not the broadcast address
+ * @param[out] data buffer for the response data, longer responses are truncated
+ * @param[in,out] length size of the buffer, then the number of bytes stored
+ *
+ * @return
+ *     - esp_err_t ESP_OK - the response data is stored
+ *     - esp_err_t ESP_ERR_INVALID_RESPONSE - the slave returned an exception, the slave is present
+ *     - esp_err_t ESP_ERR_TIMEOUT - no response from slave
+ *     - esp_err_t ESP_ERR_NOT_SUPPORTED - the function is disabled in the configuration
+ *     - esp_err_t ESP_ERR_INVALID_ARG - invalid buffer
+ */
+esp_err_t mbc_master_report_slave_id(uint8_t slave_addr, uint8_t* data, uint16_t* length);
+
 /**
  * @brief Get information about supported characteristic defined as cid. Uses parameter description table to get
  *        this information. The function will check if characteristic defined as a cid parameter is supported
  *        and returns its description in param_info. Returns ESP_ERR_NOT_FOUND if characteristic is not supported.
+ *        The returned pointer refers to the table and is valid until the table is replaced, use
+ *        mbc_master_hold_cid_info() to keep using it while the application can replace and free the table.
  *
  * @param[in] cid characteristic id
  * @param param_info pointer to pointer of characteristic data.
@@ -217,6 +376,30 @@ esp_err_t mbc_master_send_request(mb_param_request_t* request, void* data_ptr);
 */
 esp_err_t mbc_master_get_cid_info(uint16_t cid, const mb_parameter_descriptor_t** param_info);
 
+/**
+ * @brief Get information about a characteristic like mbc_master_get_cid_info() and hold its description table.
+ *        mbc_master_set_descriptor() does not return, so the application does not free the table, before the
+ *        table is released with mbc_master_release_cid_info(). Requests made in between may use the new table.
+ *        The task holding the table must not call mbc_master_set_descriptor() itself.
+ *
+ * @param[in] cid characteristic id
+ * @param param_info pointer to pointer of characteristic data
+ * @param[out] hold table held, to pass to mbc_master_release_cid_info(), only set on success
+ *
+ * @return
+ *     - esp_err_t ESP_OK - the characteristic is found and its table is held
+ *     - esp_err_t ESP_ERR_INVALID_ARG - invalid argument of function
+ *     - esp_err_t ESP_ERR_NOT_FOUND - the characteristic (cid) not found
+ */
+esp_err_t mbc_master_hold_cid_info(uint16_t cid, const mb_parameter_descriptor_t** param_info, uint32_t* hold);
+
+/**
+ * @brief Release the description table held by mbc_master_hold_cid_info()
+ *
+ * @param hold table held, as returned by mbc_master_hold_cid_info()
+ */
+void mbc_master_release_cid_info(uint32_t hold);
+
 /**
  * @brief Read parameter from modbus slave device whose name is defined by name and has cid.
  *        The additional data for request is taken from parameter description (lookup) table.
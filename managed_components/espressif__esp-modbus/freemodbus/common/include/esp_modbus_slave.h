@@ -36,6 +36,19 @@ typedef struct {
     size_t size;                            /*!< Modbus event register size (number of registers)*/
 } mb_param_info_t;
 
+/**
+ * @brief Sequence lock guarding a register area against torn reads
+ *
+ * The sequence is odd while the area is being updated. The stack copies the registers
+ * of a request and copies them again if the sequence changed meanwhile, so a response
+ * never mixes old and new halves of a multi-register value and the stack never waits
+ * for the application to release a lock.
+ */
+typedef struct {
+    volatile uint32_t seq;                  /*!< Update sequence, odd during an update */
+    portMUX_TYPE writer_lock;               /*!< Serializes the application and stack writers */
+} mb_seqlock_t;
+
 /**
  * @brief Parameter storage area descriptor
  */
@@ -141,6 +154,50 @@ esp_err_t mbc_slave_get_param_info(mb_param_info_t* reg_info, uint32_t timeout);
  */
 esp_err_t mbc_slave_set_descriptor(mb_register_area_descriptor_t descr_data);
 
+/**
+ * @brief Initialize a sequence lock before it is set for an area with mbc_slave_set_seqlock()
+ *
+ * @param seqlock sequence lock of the area
+ */
+void mbc_slave_seqlock_init(mb_seqlock_t* seqlock);
+
+/**
+ * @brief Guard a holding or input area set with mbc_slave_set_descriptor() by a sequence lock
+ *
+ * Areas without a sequence lock are accessed directly, as before. Areas sharing their memory
+ * share the lock.
+ *
+ * @param type MB_PARAM_HOLDING or MB_PARAM_INPUT
+ * @param start_offset Modbus start address of the area
+ * @param seqlock sequence lock initialized with mbc_slave_seqlock_init(), NULL for direct access
+ *
+ * @return
+ *     - ESP_OK: The sequence lock is set
+ *     - ESP_ERR_INVALID_ARG: The area is not a holding or input area set before
+ *     - ESP_ERR_INVALID_STATE: The slave interface is not initialized
+ */
+esp_err_t mbc_slave_set_seqlock(mb_param_type_t type, uint16_t start_offset, mb_seqlock_t* seqlock);
+
+/**
+ * @brief Start an update of an area guarded by a sequence lock
+ *
+ * The update runs in a critical section, so it must only copy a few values and
+ * end with mbc_slave_area_commit().
+ *
+ * @param seqlock sequence lock of the area
+ */
+void mbc_slave_area_begin(mb_seqlock_t* seqlock);
+
+/**
+ * @brief Publish an update started by mbc_slave_area_begin()
+ *
+ * Requests served after this call see all values written during the update,
+ * requests served before see none of them.
+ *
+ * @param seqlock sequence lock of the area
+ */
+void mbc_slave_area_commit(mb_seqlock_t* seqlock);
+
 #ifdef __cplusplus
 }
 #endif
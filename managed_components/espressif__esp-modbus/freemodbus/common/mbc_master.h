@@ -8,6 +8,7 @@
 #define _MB_CONTROLLER_MASTER_H
 
 #include <sys/queue.h>              // for list
+#include <stdatomic.h>              // for descriptor table swap
 #include "freertos/FreeRTOS.h"      // for task creation and queue access
 #include "freertos/task.h"          // for task api access
 #include "freertos/event_groups.h"  // for event groups
@@ -40,6 +41,14 @@ typedef struct {
     uart_parity_t parity;                   /*!< Modbus UART parity settings */
 } mb_master_comm_info_t;
 
+/**
+ * @brief Parameter description table instance
+ */
+typedef struct {
+    const mb_parameter_descriptor_t* table;     /*!< Parameter description table */
+    size_t size;                                /*!< Number of elements in the table */
+} mb_descr_table_t;
+
 #if MB_MASTER_TCP_ENABLED
 /**
  * @brief Modbus slave addr list item for the master
@@ -63,15 +72,26 @@ typedef struct {
     uint16_t mbm_reg_buffer_size;                       /*!< Modbus data buffer size */
     TaskHandle_t mbm_task_handle;                       /*!< Modbus task handle */
     EventGroupHandle_t mbm_event_group;                 /*!< Modbus controller event group */
-    const mb_parameter_descriptor_t* mbm_param_descriptor_table; /*!< Modbus controller parameter description table */
-    size_t mbm_param_descriptor_size;                   /*!< Modbus controller parameter description table size*/
+    mb_descr_table_t mbm_descr[2];                      /*!< Parameter description tables (active and previous one) */
+    atomic_uint mbm_descr_active;                       /*!< Index of active parameter description table */
+    atomic_uint mbm_descr_readers[2];                   /*!< Number of readers of each description table */
+    uint64_t mbm_rx_timestamp;                          /*!< Receive time stamp of the last successful response (us) */
+    uint32_t mbm_req_count;                             /*!< Number of requests sent, counted with the run resource taken */
+    mb_response_view_t mbm_view;                        /*!< Response view filled by the register callbacks */
+    TaskHandle_t mbm_view_owner;                        /*!< Task of the last view request */
+    uint32_t mbm_view_req;                              /*!< Request count of the last view request */
+    uint16_t mbm_slave_id_len;                          /*!< Length of the last Report Slave ID response data */
+    uint8_t mbm_exception;                              /*!< Exception code of the last response, 0 if it was not an exception */
 #if MB_MASTER_TCP_ENABLED
     LIST_HEAD(mbm_slave_addr_info_, mb_slave_addr_entry_s) mbm_slave_list; /*!< Slave address information list */
     uint16_t mbm_slave_list_count;
 #endif
 } mb_master_options_t;
 
-typedef esp_err_t (*iface_get_cid_info)(uint16_t, const mb_parameter_descriptor_t**); /*!< Interface get_cid_info method */
+// Data pointer passed to send_request by mbc_master_read_view(), the register callbacks then fill the view instead of copying
+#define MB_MASTER_IS_VIEW_REQUEST(opts, data_ptr) ((void*)(data_ptr) == (void*)&(opts)->mbm_view)
+
+typedef esp_err_t (*iface_get_cid_info)(uint16_t, const mb_parameter_descriptor_t**, unsigned*); /*!< Interface get_cid_info method */
 typedef esp_err_t (*iface_get_parameter)(uint16_t, char*, uint8_t*, uint8_t*);        /*!< Interface get_parameter method */
 typedef esp_err_t (*iface_send_request)(mb_param_request_t*, void*);                  /*!< Interface send_request method */
 typedef esp_err_t (*iface_set_descriptor)(const mb_parameter_descriptor_t*, const uint16_t); /*!< Interface set_descriptor method */
@@ -101,4 +121,42 @@ typedef struct {
     reg_coils_cb master_reg_cb_coils;       /*!< Stack callback coils rw method */
 } mb_master_interface_t;
 
+/**
+ * @brief Initialize the parameter description table of the options (no table is set)
+ *
+ * @param opts master options
+ */
+void mbc_master_descr_init(mb_master_options_t* opts);
+
+/**
+ * @brief Get the active parameter description table and keep it from being released until
+ *        mbc_master_descr_release() is called. Does not block the table update.
+ *
+ * @param opts master options
+ * @param[out] descr active table
+ *
+ * @return index of the table to pass to mbc_master_descr_release()
+ */
+unsigned mbc_master_descr_acquire(mb_master_options_t* opts, mb_descr_table_t* descr);
+
+/**
+ * @brief Release the parameter description table acquired by mbc_master_descr_acquire()
+ *
+ * @param opts master options
+ * @param index index of the table returned by mbc_master_descr_acquire()
+ */
+void mbc_master_descr_release(mb_master_options_t* opts, unsigned index);
+
+/**
+ * @brief Replace the active parameter description table.
+ *        The lookups which already use the previous table complete on it, the function returns
+ *        when the previous table has no more readers and can be freed by the caller.
+ *        The tables are replaced from one task at a time.
+ *
+ * @param opts master options
+ * @param descriptor new parameter description table
+ * @param num_elements number of elements in the table
+ */
+void mbc_master_descr_publish(mb_master_options_t* opts, const mb_parameter_descriptor_t* descriptor, size_t num_elements);
+
 #endif //_MB_CONTROLLER_MASTER_H
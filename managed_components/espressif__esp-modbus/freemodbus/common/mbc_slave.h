@@ -42,6 +42,7 @@ typedef struct mb_descr_entry_s{
     mb_param_type_t type;                   /*!< Type of storage area descriptor */
     void* p_data;                           /*!< Instance address for storage area descriptor */
     size_t size;                            /*!< Instance size for area descriptor (bytes) */
+    mb_seqlock_t* seqlock;                  /*!< Sequence lock of the area or NULL, set by mbc_slave_set_seqlock() */
     LIST_ENTRY(mb_descr_entry_s) entries;    /*!< The Modbus area descriptor entry */
 } mb_descr_entry_t;
 
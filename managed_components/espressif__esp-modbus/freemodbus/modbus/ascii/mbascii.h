@@ -67,6 +67,7 @@ BOOL            xMBASCIITimerT1SExpired( void );
 #if MB_MASTER_ASCII_ENABLED > 0
 eMBErrorCode    eMBMasterASCIIInit( UCHAR ucPort,
                               ULONG ulBaudRate, eMBParity eParity );
+eMBErrorCode    eMBMasterASCIIReconfigure( ULONG ulBaudRate, eMBParity eParity );
 void            eMBMasterASCIIStart( void );
 void            eMBMasterASCIIStop( void );
 
@@ -52,6 +52,24 @@
 #if MB_MASTER_ASCII_ENABLED > 0
 
 /* ----------------------- Defines ------------------------------------------*/
+/* Characters of an encoded frame: ':', two per byte of the Serial-Line-PDU, CR and LF. */
+#define MB_ASCII_FRAME_CHARS_MAX    ( 1 + 2 * MB_SER_PDU_SIZE_MAX + 2 )
+
+/* Hex character of a nibble and value of a hex character, 0xFF for other characters. */
+#define MB_ASCII_NIBBLE_CHAR( n )   ( ( UCHAR )( ( ( n ) < 0x0A ) ? ( '0' + ( n ) ) : ( 'A' + ( n ) - 0x0A ) ) )
+#define MB_ASCII_CHAR_VALUE( c )    ( ( UCHAR )( ( ( ( c ) >= '0' ) && ( ( c ) <= '9' ) ) ? ( ( c ) - '0' ) : \
+                                      ( ( ( c ) >= 'A' ) && ( ( c ) <= 'F' ) ) ? ( ( c ) - 'A' + 0x0A ) : 0xFF ) )
+
+/* Expand a macro for every value of a byte, to build the lookup tables at compile time. */
+#define MB_ASCII_TABLE4( m, b )     m( b ), m( ( b ) + 1 ), m( ( b ) + 2 ), m( ( b ) + 3 )
+#define MB_ASCII_TABLE16( m, b )    MB_ASCII_TABLE4( m, b ), MB_ASCII_TABLE4( m, ( b ) + 4 ), \
+                                    MB_ASCII_TABLE4( m, ( b ) + 8 ), MB_ASCII_TABLE4( m, ( b ) + 12 )
+#define MB_ASCII_TABLE64( m, b )    MB_ASCII_TABLE16( m, b ), MB_ASCII_TABLE16( m, ( b ) + 16 ), \
+                                    MB_ASCII_TABLE16( m, ( b ) + 32 ), MB_ASCII_TABLE16( m, ( b ) + 48 )
+#define MB_ASCII_TABLE256( m )      MB_ASCII_TABLE64( m, 0 ), MB_ASCII_TABLE64( m, 64 ), \
+                                    MB_ASCII_TABLE64( m, 128 ), MB_ASCII_TABLE64( m, 192 )
+
+#define MB_ASCII_BYTE_CHARS( b )    { MB_ASCII_NIBBLE_CHAR( ( b ) >> 4 ), MB_ASCII_NIBBLE_CHAR( ( b ) & 0x0F ) }
 
 /* ----------------------- Type definitions ---------------------------------*/
 typedef enum
@@ -66,9 +84,7 @@ typedef enum
 typedef enum
 {
     STATE_M_TX_IDLE,            /*!< Transmitter is in idle state. */
-    STATE_M_TX_START,           /*!< Starting transmission (':' sent). */
-    STATE_M_TX_DATA,            /*!< Sending of data (Address, Data, LRC). */
-    STATE_M_TX_END,             /*!< End of transmission. */
+    STATE_M_TX_START,           /*!< Starting transmission of the encoded frame. */
     STATE_M_TX_NOTIFY,          /*!< Notify sender that the frame has been sent. */
     STATE_M_TX_XFWR,            /*!< Transmitter is in transfer finish and wait receive state. */
 } eMBMasterAsciiSndState;
@@ -86,11 +102,14 @@ extern volatile UCHAR   ucMasterSndBuf[];
 extern volatile eMBMasterTimerMode eMasterCurTimerMode;
 
 /* ----------------------- Static functions ---------------------------------*/
-static UCHAR    prvucMBCHAR2BIN( UCHAR ucCharacter );
+static UCHAR    prvucMBLRC( UCHAR * pucFrame, USHORT usLen );
 
-static UCHAR    prvucMBBIN2CHAR( UCHAR ucByte );
+/* ----------------------- Lookup tables ------------------------------------*/
+/* Two hex characters of every byte, high nibble first. */
+static const UCHAR ucMBASCIIBin2Char[256][2] = { MB_ASCII_TABLE256( MB_ASCII_BYTE_CHARS ) };
 
-static UCHAR    prvucMBLRC( UCHAR * pucFrame, USHORT usLen );
+/* Nibble value of every character, 0xFF for the characters that are not hex digits. */
+static const UCHAR ucMBASCIIChar2Bin[256] = { MB_ASCII_TABLE256( MB_ASCII_CHAR_VALUE ) };
 
 /* ----------------------- Static variables ---------------------------------*/
 static volatile eMBMasterAsciiSndState eSndState;
@@ -105,6 +124,11 @@ static volatile eMBBytePos eBytePos;
 static volatile UCHAR *pucMasterSndBufferCur;
 static volatile USHORT usMasterSndBufferCount;
 
+/* The whole frame encoded for the line, written to the port in one call. */
+static UCHAR    ucMasterASCIISndChars[MB_ASCII_FRAME_CHARS_MAX];
+static volatile USHORT usMasterSndCharCount;
+
+/* Sum of the bytes received since the start of the frame, 0 for a frame with a correct LRC. */
 static volatile UCHAR ucLRC;
 static volatile UCHAR ucMBLFCharacter;
 
@@ -131,6 +155,13 @@ eMBMasterASCIIInit( UCHAR ucPort, ULONG ulBaudRate, eMBParity eParity )
     return eStatus;
 }
 
+eMBErrorCode
+eMBMasterASCIIReconfigure( ULONG ulBaudRate, eMBParity eParity )
+{
+    /* The character timeout does not depend on the baudrate. */
+    return ( xMBMasterPortSerialSetConfig( ulBaudRate, eParity ) == TRUE ) ? MB_ENOERR : MB_EPORTERR;
+}
+
 void
 eMBMasterASCIIStart( void )
 {
@@ -156,6 +187,7 @@ eMBMasterASCIIReceive( UCHAR * pucRcvAddress, UCHAR ** pucFrame, USHORT * pusLen
     eMBErrorCode    eStatus = MB_ENOERR;
     UCHAR          *pucMBASCIIFrame = ( UCHAR* ) ucMasterASCIIRcvBuf;
     USHORT          usFrameLength = usMasterRcvBufferPos;
+    UCHAR           ucFrameLRC;
 
     if( xMBMasterPortSerialGetResponse( &pucMBASCIIFrame, &usFrameLength ) == FALSE )
     {
@@ -165,9 +197,18 @@ eMBMasterASCIIReceive( UCHAR * pucRcvAddress, UCHAR ** pucFrame, USHORT * pusLen
     assert( usFrameLength < MB_SER_PDU_SIZE_MAX );
 
     assert( pucMBASCIIFrame );
-    /* Length and CRC check */
-    if( ( usFrameLength >= MB_ASCII_SER_PDU_SIZE_MIN )
-            && ( prvucMBLRC( ( UCHAR * ) pucMBASCIIFrame, usFrameLength ) == 0 ) )
+    /* The receiver summed the bytes while decoding them, the frame is only
+     * read again if the port handed over another buffer. */
+    if( ( pucMBASCIIFrame == ( UCHAR* ) ucMasterASCIIRcvBuf ) && ( usFrameLength == usMasterRcvBufferPos ) )
+    {
+        ucFrameLRC = ucLRC;
+    }
+    else
+    {
+        ucFrameLRC = prvucMBLRC( ( UCHAR * ) pucMBASCIIFrame, usFrameLength );
+    }
+    /* Length and LRC check */
+    if( ( usFrameLength >= MB_ASCII_SER_PDU_SIZE_MIN ) && ( ucFrameLRC == 0 ) )
     {
         /* Save the address field. All frames are passed to the upper layed
         * and the decision if a frame is used is done there.
@@ -192,7 +233,9 @@ eMBErrorCode
 eMBMasterASCIISend( UCHAR ucSlaveAddress, const UCHAR * pucFrame, USHORT usLength )
 {
     eMBErrorCode    eStatus = MB_ENOERR;
-    UCHAR           usLRC;
+    UCHAR           usLRC = 0;
+    UCHAR          *pucChar = ucMasterASCIISndChars;
+    USHORT          usPos;
 
     if ( ucSlaveAddress > MB_MASTER_TOTAL_SLAVE_NUM ) return MB_EINVAL;
 
@@ -211,9 +254,23 @@ eMBMasterASCIISend( UCHAR ucSlaveAddress, const UCHAR * pucFrame, USHORT usLengt
         pucMasterSndBufferCur[MB_SER_PDU_ADDR_OFF] = ucSlaveAddress;
         usMasterSndBufferCount += usLength;
 
-        /* Calculate LRC checksum for Modbus-Serial-Line-PDU. */
-        usLRC = prvucMBLRC( ( UCHAR * ) pucMasterSndBufferCur, usMasterSndBufferCount );
+        /* Encode the whole frame in one pass, the LRC is summed on the way. */
+        *pucChar++ = ':';
+        for( usPos = 0; usPos < usMasterSndBufferCount; usPos++ )
+        {
+            UCHAR ucByte = pucMasterSndBufferCur[usPos];
+            usLRC += ucByte;
+            *pucChar++ = ucMBASCIIBin2Char[ucByte][0];
+            *pucChar++ = ucMBASCIIBin2Char[ucByte][1];
+        }
+        /* LRC is the twos complement of the sum. */
+        usLRC = ( UCHAR )( -( ( CHAR ) usLRC ) );
         pucMasterSndBufferCur[usMasterSndBufferCount++] = usLRC;
+        *pucChar++ = ucMBASCIIBin2Char[usLRC][0];
+        *pucChar++ = ucMBASCIIBin2Char[usLRC][1];
+        *pucChar++ = MB_ASCII_DEFAULT_CR;
+        *pucChar++ = ucMBLFCharacter;
+        usMasterSndCharCount = ( USHORT )( pucChar - ucMasterASCIISndChars );
 
         /* Activate the transmitter. */
         eSndState = STATE_M_TX_START;
@@ -272,6 +329,7 @@ xMBMasterASCIIReceiveFSM( void )
         {
             /* Reset the input buffers to store the frame in receive state. */
             usMasterRcvBufferPos = 0;
+            ucLRC = 0;
             eBytePos = BYTE_HIGH_NIBBLE;
             eRcvState = STATE_M_RX_RCV;
             eSndState = STATE_M_TX_IDLE;
@@ -291,6 +349,7 @@ xMBMasterASCIIReceiveFSM( void )
             /* Empty receive buffer. */
             eBytePos = BYTE_HIGH_NIBBLE;
             usMasterRcvBufferPos = 0;
+            ucLRC = 0;
         }
         else if( ucByte == MB_ASCII_DEFAULT_CR )
         {
@@ -298,7 +357,7 @@ xMBMasterASCIIReceiveFSM( void )
         }
         else
         {
-            ucResult = prvucMBCHAR2BIN( ucByte );
+            ucResult = ucMBASCIIChar2Bin[ucByte];
             switch ( eBytePos )
             {
                 /* High nibble of the byte comes first. We check for
@@ -322,6 +381,7 @@ xMBMasterASCIIReceiveFSM( void )
 
             case BYTE_LOW_NIBBLE:
                 ucMasterASCIIRcvBuf[usMasterRcvBufferPos] |= ucResult;
+                ucLRC += ucMasterASCIIRcvBuf[usMasterRcvBufferPos];
                 usMasterRcvBufferPos++;
                 eBytePos = BYTE_HIGH_NIBBLE;
                 break;
@@ -349,6 +409,7 @@ xMBMasterASCIIReceiveFSM( void )
              * Empty receive buffer and back to receive state. */
             eBytePos = BYTE_HIGH_NIBBLE;
             usMasterRcvBufferPos = 0;
+            ucLRC = 0;
             eRcvState = STATE_M_RX_IDLE;
 
             /* Enable timer for respond timeout and wait for next frame. */
@@ -369,7 +430,6 @@ BOOL
 xMBMasterASCIITransmitFSM( void )
 {
     BOOL            xNeedPoll = TRUE;
-    UCHAR           ucByte;
     BOOL            xFrameIsBroadcast = FALSE;
 
     assert( eRcvState == STATE_M_RX_IDLE );
@@ -386,51 +446,11 @@ xMBMasterASCIITransmitFSM( void )
     case STATE_M_TX_IDLE:
         break;
 
-        /* Start of transmission. The start of a frame is defined by sending
-         * the character ':'. */
+        /* Start of transmission. The frame was encoded as a whole by
+         * eMBMasterASCIISend( ), from the ':' to the LF, so it is handed to the
+         * port in one call instead of one character per call. */
     case STATE_M_TX_START:
-        ucByte = ':';
-        xMBMasterPortSerialPutByte( ( CHAR )ucByte );
-        eSndState = STATE_M_TX_DATA;
-        eBytePos = BYTE_HIGH_NIBBLE;
-        break;
-
-        /* Send the data block. Each data byte is encoded as a character hex
-         * stream with the high nibble sent first and the low nibble sent
-         * last. If all data bytes are exhausted we send a '\r' character
-         * to end the transmission. */
-    case STATE_M_TX_DATA:
-        if( usMasterSndBufferCount > 0 )
-        {
-            switch ( eBytePos )
-            {
-            case BYTE_HIGH_NIBBLE:
-                ucByte = prvucMBBIN2CHAR( ( UCHAR )( *pucMasterSndBufferCur >> 4 ) );
-                xMBMasterPortSerialPutByte( ( CHAR ) ucByte );
-                eBytePos = BYTE_LOW_NIBBLE;
-                break;
-
-            case BYTE_LOW_NIBBLE:
-                ucByte = prvucMBBIN2CHAR( ( UCHAR )( *pucMasterSndBufferCur & 0x0F ) );
-                xMBMasterPortSerialPutByte( ( CHAR )ucByte );
-                pucMasterSndBufferCur++;
-                eBytePos = BYTE_HIGH_NIBBLE;
-                usMasterSndBufferCount--;
-                break;
-            }
-        }
-        else
-        {
-            xMBMasterPortSerialPutByte( MB_ASCII_DEFAULT_CR );
-            eSndState = STATE_M_TX_END;
-        }
-        break;
-
-        /* Finish the frame by sending a LF character. */
-    case STATE_M_TX_END:
-        xMBMasterPortSerialPutByte( ( CHAR )ucMBLFCharacter );
-        /* We need another state to make sure that the CR character has
-         * been sent. */
+        xMBMasterPortSerialPutBuffer( ucMasterASCIISndChars, usMasterSndCharCount );
         eSndState = STATE_M_TX_NOTIFY;
         break;
 
@@ -516,7 +536,6 @@ xMBMasterASCIITimerT1SExpired( void )
         /* Function called in an illegal state. */
     default:
         assert( ( eSndState == STATE_M_TX_START ) || ( eSndState == STATE_M_TX_IDLE )
-                || ( eSndState == STATE_M_TX_DATA ) || ( eSndState == STATE_M_TX_END )
                 || ( eSndState == STATE_M_TX_NOTIFY ) );
         break;
     }
@@ -534,42 +553,6 @@ xMBMasterASCIITimerT1SExpired( void )
     return xNeedPoll;
 }
 
-static  UCHAR
-prvucMBCHAR2BIN( UCHAR ucCharacter )
-{
-    if( ( ucCharacter >= '0' ) && ( ucCharacter <= '9' ) )
-    {
-        return ( UCHAR )( ucCharacter - '0' );
-    }
-    else if( ( ucCharacter >= 'A' ) && ( ucCharacter <= 'F' ) )
-    {
-        return ( UCHAR )( ucCharacter - 'A' + 0x0A );
-    }
-    else
-    {
-        return 0xFF;
-    }
-}
-
-static  UCHAR
-prvucMBBIN2CHAR( UCHAR ucByte )
-{
-    if( ucByte <= 0x09 )
-    {
-        return ( UCHAR )( '0' + ucByte );
-    }
-    else if( ( ucByte >= 0x0A ) && ( ucByte <= 0x0F ) )
-    {
-        return ( UCHAR )( ucByte - 0x0A + 'A' );
-    }
-    else
-    {
-        /* Programming error. */
-        assert( 0 );
-    }
-    return '0';
-}
-
 static  UCHAR
 prvucMBLRC( UCHAR * pucFrame, USHORT usLen )
 {
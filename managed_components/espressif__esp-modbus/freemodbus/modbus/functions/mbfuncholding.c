@@ -73,6 +73,11 @@
 #define MB_PDU_FUNC_READWRITE_WRITE_VALUES_OFF  ( MB_PDU_DATA_OFF + 9 )
 #define MB_PDU_FUNC_READWRITE_SIZE_MIN          ( 9 )
 
+#define MB_PDU_FUNC_MASK_WRITE_ADDR_OFF         ( MB_PDU_DATA_OFF + 0 )
+#define MB_PDU_FUNC_MASK_WRITE_AND_OFF          ( MB_PDU_DATA_OFF + 2 )
+#define MB_PDU_FUNC_MASK_WRITE_OR_OFF           ( MB_PDU_DATA_OFF + 4 )
+#define MB_PDU_FUNC_MASK_WRITE_SIZE             ( 6 )
+
 /* ----------------------- Static functions ---------------------------------*/
 eMBException    prveMBError2Exception( eMBErrorCode eErrorCode );
 
@@ -315,4 +320,47 @@ eMBFuncReadWriteMultipleHoldingRegister( UCHAR * pucFrame, USHORT * usLen )
 
 #endif
 
+#if MB_FUNC_MASK_WRITE_HOLDING_ENABLED > 0
+
+eMBException
+eMBFuncMaskWriteHoldingRegister( UCHAR * pucFrame, USHORT * usLen )
+{
+    USHORT          usRegAddress;
+    USHORT          usAndMask;
+    USHORT          usOrMask;
+
+    eMBException    eStatus = MB_EX_NONE;
+    eMBErrorCode    eRegStatus;
+
+    if( *usLen == ( MB_PDU_FUNC_MASK_WRITE_SIZE + MB_PDU_SIZE_MIN ) )
+    {
+        usRegAddress = ( USHORT )( pucFrame[MB_PDU_FUNC_MASK_WRITE_ADDR_OFF] << 8 );
+        usRegAddress |= ( USHORT )( pucFrame[MB_PDU_FUNC_MASK_WRITE_ADDR_OFF + 1] );
+        usRegAddress++;
+
+        usAndMask = ( USHORT )( pucFrame[MB_PDU_FUNC_MASK_WRITE_AND_OFF] << 8 );
+        usAndMask |= ( USHORT )( pucFrame[MB_PDU_FUNC_MASK_WRITE_AND_OFF + 1] );
+
+        usOrMask = ( USHORT )( pucFrame[MB_PDU_FUNC_MASK_WRITE_OR_OFF] << 8 );
+        usOrMask |= ( USHORT )( pucFrame[MB_PDU_FUNC_MASK_WRITE_OR_OFF + 1] );
+
+        /* The modification is done here and not by the master, as one update of the register. */
+        eRegStatus = eMBRegHoldingMaskCB( usRegAddress, usAndMask, usOrMask );
+
+        /* The response is an echo of the request. If an error occured convert it into a Modbus exception. */
+        if( eRegStatus != MB_ENOERR )
+        {
+            eStatus = prveMBError2Exception( eRegStatus );
+        }
+    }
+    else
+    {
+        /* Can't be a valid request because the length is incorrect. */
+        eStatus = MB_EX_ILLEGAL_DATA_VALUE;
+    }
+    return eStatus;
+}
+
+#endif
+
 #endif
@@ -86,6 +86,12 @@
 #define MB_PDU_FUNC_READWRITE_READ_VALUES_OFF   ( MB_PDU_DATA_OFF + 1 )
 #define MB_PDU_FUNC_READWRITE_SIZE_MIN          ( 1 )
 
+#define MB_PDU_REQ_MASK_WRITE_ADDR_OFF          ( MB_PDU_DATA_OFF + 0 )
+#define MB_PDU_REQ_MASK_WRITE_AND_OFF           ( MB_PDU_DATA_OFF + 2 )
+#define MB_PDU_REQ_MASK_WRITE_OR_OFF            ( MB_PDU_DATA_OFF + 4 )
+#define MB_PDU_REQ_MASK_WRITE_SIZE              ( 6 )
+#define MB_PDU_FUNC_MASK_WRITE_SIZE             ( 6 )
+
 /* ----------------------- Static functions ---------------------------------*/
 eMBException    prveMBError2Exception( eMBErrorCode eErrorCode );
 
@@ -457,5 +463,75 @@ eMBMasterFuncReadWriteMultipleHoldingRegister( UCHAR * pucFrame, USHORT * usLen
     return eStatus;
 }
 
+#endif
+
+#if MB_FUNC_MASK_WRITE_HOLDING_ENABLED > 0
+
+/**
+ * This function will request mask write holding register.
+ * The slave writes (current AND usAndMask) OR (usOrMask AND (NOT usAndMask)).
+ *
+ * @param ucSndAddr salve address
+ * @param usRegAddr register address
+ * @param usAndMask AND mask, bits set to 1 are kept
+ * @param usOrMask OR mask, bits to set among the ones cleared in the AND mask
+ * @param lTimeOut timeout (-1 will waiting forever)
+ *
+ * @return error code
+ */
+eMBMasterReqErrCode
+eMBMasterReqMaskWriteHoldingRegister( UCHAR ucSndAddr, USHORT usRegAddr,
+        USHORT usAndMask, USHORT usOrMask, LONG lTimeOut )
+{
+    UCHAR                 *ucMBFrame;
+    eMBMasterReqErrCode    eErrStatus = MB_MRE_NO_ERR;
+
+    if ( ucSndAddr > MB_MASTER_TOTAL_SLAVE_NUM ) eErrStatus = MB_MRE_ILL_ARG;
+    else if ( xMBMasterRunResTake( lTimeOut ) == FALSE ) eErrStatus = MB_MRE_MASTER_BUSY;
+    else
+    {
+        vMBMasterGetPDUSndBuf(&ucMBFrame);
+        vMBMasterSetDestAddress(ucSndAddr);
+        ucMBFrame[MB_PDU_FUNC_OFF]                    = MB_FUNC_MASK_WRITE_REGISTER;
+        ucMBFrame[MB_PDU_REQ_MASK_WRITE_ADDR_OFF]     = usRegAddr >> 8;
+        ucMBFrame[MB_PDU_REQ_MASK_WRITE_ADDR_OFF + 1] = usRegAddr;
+        ucMBFrame[MB_PDU_REQ_MASK_WRITE_AND_OFF]      = usAndMask >> 8;
+        ucMBFrame[MB_PDU_REQ_MASK_WRITE_AND_OFF + 1]  = usAndMask;
+        ucMBFrame[MB_PDU_REQ_MASK_WRITE_OR_OFF]       = usOrMask >> 8;
+        ucMBFrame[MB_PDU_REQ_MASK_WRITE_OR_OFF + 1]   = usOrMask;
+        vMBMasterSetPDUSndLength( MB_PDU_SIZE_MIN + MB_PDU_REQ_MASK_WRITE_SIZE );
+        ( void ) xMBMasterPortEventPost( EV_MASTER_FRAME_TRANSMIT | EV_MASTER_TRANS_START );
+        eErrStatus = eMBMasterWaitRequestFinish( );
+    }
+    return eErrStatus;
+}
+
+eMBException
+eMBMasterFuncMaskWriteHoldingRegister( UCHAR * pucFrame, USHORT * usLen )
+{
+    UCHAR          *ucMBFrame;
+    eMBException    eStatus = MB_EX_NONE;
+
+    /* The response is an echo of the request, there is nothing to store. */
+    if( xMBMasterRequestIsBroadcast() )
+    {
+        eStatus = MB_EX_NONE;
+    }
+    else if( *usLen == ( MB_PDU_SIZE_MIN + MB_PDU_FUNC_MASK_WRITE_SIZE ) )
+    {
+        vMBMasterGetPDUSndBuf(&ucMBFrame);
+        if( memcmp( &pucFrame[MB_PDU_DATA_OFF], &ucMBFrame[MB_PDU_DATA_OFF], MB_PDU_FUNC_MASK_WRITE_SIZE ) != 0 )
+        {
+            eStatus = MB_EX_ILLEGAL_DATA_VALUE;
+        }
+    }
+    else
+    {
+        /* Can't be a valid response because the length is incorrect. */
+        eStatus = MB_EX_ILLEGAL_DATA_VALUE;
+    }
+    return eStatus;
+}
+
 #endif
 #endif // #if MB_MASTER_RTU_ENABLED || MB_MASTER_ASCII_ENABLED || MB_MASTER_TCP_ENABLED
@@ -0,0 +1,95 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* ----------------------- System includes ----------------------------------*/
+#include "stdlib.h"
+#include "string.h"
+
+/* ----------------------- Platform includes --------------------------------*/
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mb_m.h"
+#include "mbframe.h"
+#include "mbproto.h"
+#include "mbconfig.h"
+
+/* ----------------------- Defines ------------------------------------------*/
+#define MB_PDU_FUNC_REP_SLAVEID_BYTECNT_OFF     ( MB_PDU_DATA_OFF + 0 )
+#define MB_PDU_FUNC_REP_SLAVEID_VALUES_OFF      ( MB_PDU_DATA_OFF + 1 )
+#define MB_PDU_FUNC_REP_SLAVEID_SIZE_MIN        ( 1 )
+
+/* ----------------------- Static functions ---------------------------------*/
+eMBException    prveMBError2Exception( eMBErrorCode eErrorCode );
+
+/* ----------------------- Start implementation -----------------------------*/
+#if MB_MASTER_RTU_ENABLED || MB_MASTER_ASCII_ENABLED || MB_MASTER_TCP_ENABLED
+
+#if MB_FUNC_OTHER_REP_SLAVEID_ENABLED > 0
+
+/**
+ * This function will request the slave ID, run indicator and device specific data of a slave.
+ *
+ * @param ucSndAddr salve address
+ * @param lTimeOut timeout (-1 will waiting forever)
+ *
+ * @return error code
+ */
+eMBMasterReqErrCode
+eMBMasterReqReportSlaveID( UCHAR ucSndAddr, LONG lTimeOut )
+{
+    UCHAR                 *ucMBFrame;
+    eMBMasterReqErrCode    eErrStatus = MB_MRE_NO_ERR;
+
+    /* A broadcast has no response to report. */
+    if ( ( ucSndAddr == MB_ADDRESS_BROADCAST ) || ( ucSndAddr > MB_MASTER_TOTAL_SLAVE_NUM ) ) eErrStatus = MB_MRE_ILL_ARG;
+    else if ( xMBMasterRunResTake( lTimeOut ) == FALSE ) eErrStatus = MB_MRE_MASTER_BUSY;
+    else
+    {
+        vMBMasterGetPDUSndBuf(&ucMBFrame);
+        vMBMasterSetDestAddress(ucSndAddr);
+        ucMBFrame[MB_PDU_FUNC_OFF] = MB_FUNC_OTHER_REPORT_SLAVEID;
+        vMBMasterSetPDUSndLength( MB_PDU_SIZE_MIN );
+        ( void ) xMBMasterPortEventPost( EV_MASTER_FRAME_TRANSMIT | EV_MASTER_TRANS_START );
+        eErrStatus = eMBMasterWaitRequestFinish( );
+    }
+    return eErrStatus;
+}
+
+eMBException
+eMBMasterFuncReportSlaveID( UCHAR * pucFrame, USHORT * usLen )
+{
+    UCHAR           ucByteCount;
+    eMBException    eStatus = MB_EX_NONE;
+    eMBErrorCode    eRegStatus;
+
+    if( *usLen >= MB_PDU_SIZE_MIN + MB_PDU_FUNC_REP_SLAVEID_SIZE_MIN )
+    {
+        ucByteCount = pucFrame[MB_PDU_FUNC_REP_SLAVEID_BYTECNT_OFF];
+        if( *usLen == MB_PDU_FUNC_REP_SLAVEID_VALUES_OFF + ucByteCount )
+        {
+            /* Hand the slave ID and the device specific data over to the application. */
+            eRegStatus = eMBMasterRegSlaveIdCB( &pucFrame[MB_PDU_FUNC_REP_SLAVEID_VALUES_OFF], ucByteCount );
+            if( eRegStatus != MB_ENOERR )
+            {
+                eStatus = prveMBError2Exception( eRegStatus );
+            }
+        }
+        else
+        {
+            eStatus = MB_EX_ILLEGAL_DATA_VALUE;
+        }
+    }
+    else
+    {
+        /* Can't be a valid response because the length is incorrect. */
+        eStatus = MB_EX_ILLEGAL_DATA_VALUE;
+    }
+    return eStatus;
+}
+
+#endif
+#endif // #if MB_MASTER_RTU_ENABLED || MB_MASTER_ASCII_ENABLED || MB_MASTER_TCP_ENABLED
@@ -355,6 +355,21 @@ eMBErrorCode    eMBRegInputCB( UCHAR * pucRegBuffer, USHORT usAddress,
 eMBErrorCode    eMBRegHoldingCB( UCHAR * pucRegBuffer, USHORT usAddress,
                                  USHORT usNRegs, eMBRegisterMode eMode );
 
+/*! \ingroup modbus_registers
+ * \brief Callback function used for a <b>MASK WRITE REGISTER</b> request.
+ *
+ * The application reads the register, applies the masks and writes it back
+ * as one update, so no other writer can interleave and no reader sees the
+ * register between the read and the write.
+ *
+ * \param usAddress The address of the register.
+ * \param usAndMask The AND mask of the request.
+ * \param usOrMask The OR mask of the request.
+ *
+ * \return The error codes of eMBRegHoldingCB( ).
+ */
+eMBErrorCode    eMBRegHoldingMaskCB( USHORT usAddress, USHORT usAndMask, USHORT usOrMask );
+
 /*! \ingroup modbus_registers
  * \brief Callback function used if a <em>Coil Register</em> value is
  *   read or written by the protocol stack. If you are going to use
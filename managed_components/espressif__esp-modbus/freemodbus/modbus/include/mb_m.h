@@ -162,6 +162,26 @@ eMBErrorCode    eMBMasterTCPInit( USHORT usTCPPort );
  */
 eMBErrorCode    eMBMasterClose( void );
 
+/*! \ingroup modbus
+ * \brief Change the serial line parameters of the running Modbus Master stack.
+ *
+ * The function waits the end of the current transaction and applies the
+ * new settings before the next one is started. The mode and the port
+ * can not be changed, use eMBMasterClose( ) and eMBMasterSerialInit( ) for this.
+ *
+ * \param ulBaudRate The new baudrate.
+ * \param eParity The new parity.
+ * \param lTimeOut Time to wait the end of current transaction.
+ *
+ * \return If no error occurs the function returns eMBErrorCode::MB_ENOERR.
+ *   Otherwise one of the following error codes is returned:
+ *    - eMBErrorCode::MB_EILLSTATE If the stack is not initialized in serial mode.
+ *    - eMBErrorCode::MB_ETIMEDOUT If the current transaction is not finished in time.
+ *    - eMBErrorCode::MB_EPORTERR If the porting layer returned an error.
+ */
+eMBErrorCode    eMBMasterSerialReconfigure( ULONG ulBaudRate, eMBParity eParity,
+                                            LONG lTimeOut );
+
 /*! \ingroup modbus
  * \brief Enable the Modbus Master protocol stack.
  *
@@ -344,6 +364,18 @@ eMBErrorCode eMBMasterRegCoilsCB( UCHAR * pucRegBuffer, USHORT usAddress,
 eMBErrorCode eMBMasterRegDiscreteCB( UCHAR * pucRegBuffer, USHORT usAddress,
 		USHORT usNDiscrete );
 
+/*! \ingroup modbus_registers
+ * \brief Callback function used when a <em>Report Slave ID</em> response
+ *   is received by the protocol stack.
+ *
+ * \param pucBuffer The slave ID, the run indicator status and the device
+ *   specific data of the response.
+ * \param usNBytes Number of bytes in the buffer.
+ * \return The function must return one of the following error codes:
+ *   - eMBErrorCode::MB_ENOERR If no error occurred.
+ */
+eMBErrorCode eMBMasterRegSlaveIdCB( UCHAR * pucBuffer, USHORT usNBytes );
+
 /*! \ingroup modbus
  *\brief These Modbus functions are called for user when Modbus run in Master Mode.
  */
@@ -361,6 +393,9 @@ eMBMasterReqReadWriteMultipleHoldingRegister( UCHAR ucSndAddr,
 		USHORT usReadRegAddr, USHORT usNReadRegs, USHORT * pusDataBuffer,
 		USHORT usWriteRegAddr, USHORT usNWriteRegs, LONG lTimeOut );
 eMBMasterReqErrCode
+eMBMasterReqMaskWriteHoldingRegister( UCHAR ucSndAddr, USHORT usRegAddr,
+		USHORT usAndMask, USHORT usOrMask, LONG lTimeOut );
+eMBMasterReqErrCode
 eMBMasterReqReadCoils( UCHAR ucSndAddr, USHORT usCoilAddr, USHORT usNCoils, LONG lTimeOut );
 eMBMasterReqErrCode
 eMBMasterReqWriteCoil( UCHAR ucSndAddr, USHORT usCoilAddr, USHORT usCoilData, LONG lTimeOut );
@@ -369,6 +404,8 @@ eMBMasterReqWriteMultipleCoils( UCHAR ucSndAddr,
 		USHORT usCoilAddr, USHORT usNCoils, UCHAR * pucDataBuffer, LONG lTimeOut );
 eMBMasterReqErrCode
 eMBMasterReqReadDiscreteInputs( UCHAR ucSndAddr, USHORT usDiscreteAddr, USHORT usNDiscreteIn, LONG lTimeOut );
+eMBMasterReqErrCode
+eMBMasterReqReportSlaveID( UCHAR ucSndAddr, LONG lTimeOut );
 
 eMBException
 eMBMasterFuncReportSlaveID( UCHAR * pucFrame, USHORT * usLen );
@@ -390,6 +427,8 @@ eMBException
 eMBMasterFuncReadDiscreteInputs( UCHAR * pucFrame, USHORT * usLen );
 eMBException
 eMBMasterFuncReadWriteMultipleHoldingRegister( UCHAR * pucFrame, USHORT * usLen );
+eMBException
+eMBMasterFuncMaskWriteHoldingRegister( UCHAR * pucFrame, USHORT * usLen );
 
 /* \ingroup modbus
  * \brief These functions are interface for Modbus Master
@@ -408,6 +447,7 @@ BOOL xMBMasterRequestIsBroadcast( void );
 eMBMasterErrorEventType eMBMasterGetErrorType( void );
 void vMBMasterSetErrorType( eMBMasterErrorEventType errorType );
 eMBMasterReqErrCode eMBMasterWaitRequestFinish( void );
+eMBException eMBMasterGetLastException( void );
 eMBMode ucMBMasterGetCommMode( void );
 
 /* ----------------------- Callback -----------------------------------------*/
@@ -110,6 +110,9 @@ typedef eMBErrorCode( *peMBFrameSend ) ( UCHAR slaveAddress,
 
 typedef void( *pvMBFrameClose ) ( void );
 
+typedef eMBErrorCode( *peMBFrameReconfigure ) ( ULONG ulBaudRate,
+                                                eMBParity eParity );
+
 #ifdef __cplusplus
 PR_END_EXTERN_C
 #endif
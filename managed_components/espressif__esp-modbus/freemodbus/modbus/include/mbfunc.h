@@ -81,6 +81,10 @@ eMBException    eMBFuncReadDiscreteInputs( UCHAR * pucFrame, USHORT * usLen );
 eMBException    eMBFuncReadWriteMultipleHoldingRegister( UCHAR * pucFrame, USHORT * usLen );
 #endif
 
+#if MB_FUNC_MASK_WRITE_HOLDING_ENABLED > 0
+eMBException    eMBFuncMaskWriteHoldingRegister( UCHAR * pucFrame, USHORT * usLen );
+#endif
+
 #ifdef __cplusplus
 PR_END_EXTERN_C
 #endif
@@ -139,6 +139,10 @@ void            vMBMasterRunResRelease( void );
 
 uint64_t        xMBMasterPortGetTransactionId( void );
 
+void            vMBMasterPortSetRxTimestamp( uint64_t xTimestamp );
+
+uint64_t        xMBMasterPortGetRxTimestamp( void );
+
 #endif // MB_MASTER_RTU_ENABLED || MB_MASTER_ASCII_ENABLED || MB_MASTER_TCP_ENABLED
 /* ----------------------- Serial port functions ----------------------------*/
 
@@ -163,6 +167,8 @@ BOOL            xMBPortSerialSendResponse( UCHAR *pucMBSerialFrame, USHORT usSer
 BOOL            xMBMasterPortSerialInit( UCHAR ucPort, ULONG ulBaudRate,
                                    UCHAR ucDataBits, eMBParity eParity );
 
+BOOL            xMBMasterPortSerialSetConfig( ULONG ulBaudRate, eMBParity eParity );
+
 void            vMBMasterPortClose( void );
 
 void            xMBMasterPortSerialClose( void );
@@ -173,6 +179,8 @@ BOOL            xMBMasterPortSerialGetByte( CHAR * pucByte );
 
 BOOL            xMBMasterPortSerialPutByte( CHAR ucByte );
 
+BOOL            xMBMasterPortSerialPutBuffer( const UCHAR * pucBuffer, USHORT usLength );
+
 BOOL            xMBMasterPortSerialGetResponse( UCHAR **ppucMBSerialFrame, USHORT * usSerialLength );
 
 BOOL            xMBMasterPortSerialSendRequest( UCHAR *pucMBSerialFrame, USHORT usSerialLength );
@@ -199,10 +207,16 @@ void            xMBMasterPortTimersClose( void );
 
 void            vMBMasterPortTimersT35Enable( void );
 
+void            vMBMasterPortTimersT35Update( USHORT usTimeOut50us );
+
 void            vMBMasterPortTimersConvertDelayEnable( void );
 
 void            vMBMasterPortTimersRespondTimeoutEnable( void );
 
+void            vMBMasterPortTimersRespondTimeoutSet( ULONG ulTimeoutMs );
+
+ULONG           ulMBMasterPortTimersRespondTimeoutGet( void );
+
 void            vMBMasterPortTimersDisable( void );
 
 
@@ -55,6 +55,7 @@ PR_BEGIN_EXTERN_C
 #define MB_FUNC_WRITE_REGISTER                (  6 )
 #define MB_FUNC_WRITE_MULTIPLE_REGISTERS      ( 16 )
 #define MB_FUNC_READWRITE_MULTIPLE_REGISTERS  ( 23 )
+#define MB_FUNC_MASK_WRITE_REGISTER           ( 22 )
 #define MB_FUNC_DIAG_READ_EXCEPTION           (  7 )
 #define MB_FUNC_DIAG_DIAGNOSTIC               (  8 )
 #define MB_FUNC_DIAG_GET_COM_EVENT_CNT        ( 11 )
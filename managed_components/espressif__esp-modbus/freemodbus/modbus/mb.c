@@ -119,6 +119,9 @@ static xMBFunctionHandler xFuncHandlers[MB_FUNC_HANDLERS_MAX] = {
 #if MB_FUNC_READWRITE_HOLDING_ENABLED > 0
     {MB_FUNC_READWRITE_MULTIPLE_REGISTERS, eMBFuncReadWriteMultipleHoldingRegister},
 #endif
+#if MB_FUNC_MASK_WRITE_HOLDING_ENABLED > 0
+    {MB_FUNC_MASK_WRITE_REGISTER, eMBFuncMaskWriteHoldingRegister},
+#endif
 #if MB_FUNC_READ_COILS_ENABLED > 0
     {MB_FUNC_READ_COILS, eMBFuncReadCoils},
 #endif
@@ -76,6 +76,7 @@ static BOOL xMBRunInMasterMode = FALSE;
 static volatile eMBMasterErrorEventType eMBMasterCurErrorType;
 static volatile USHORT usMasterSendPDULength;
 static volatile eMBMode eMBMasterCurrentMode;
+static volatile eMBException eMBMasterLastException;
 
 /*------------------------ Shared variables ---------------------------------*/
 
@@ -100,6 +101,7 @@ static pvMBFrameStart pvMBMasterFrameStartCur;
 static pvMBFrameStop pvMBMasterFrameStopCur;
 static peMBFrameReceive peMBMasterFrameReceiveCur;
 static pvMBFrameClose pvMBMasterFrameCloseCur;
+static peMBFrameReconfigure peMBMasterFrameReconfigureCur;
 
 /* Callback functions required by the porting layer. They are called when
  * an external event has happend which includes a timeout or the reception
@@ -121,7 +123,7 @@ BOOL( *pxMBMasterFrameCBTransmitFSMCur ) ( void );
  */
 static xMBFunctionHandler xMasterFuncHandlers[MB_FUNC_HANDLERS_MAX] = {
 #if MB_FUNC_OTHER_REP_SLAVEID_ENABLED > 0
-    {MB_FUNC_OTHER_REPORT_SLAVEID, eMBFuncReportSlaveID},
+    {MB_FUNC_OTHER_REPORT_SLAVEID, eMBMasterFuncReportSlaveID},
 #endif
 #if MB_FUNC_READ_INPUT_ENABLED > 0
     {MB_FUNC_READ_INPUT_REGISTER, eMBMasterFuncReadInputRegister},
@@ -138,6 +140,9 @@ static xMBFunctionHandler xMasterFuncHandlers[MB_FUNC_HANDLERS_MAX] = {
 #if MB_FUNC_READWRITE_HOLDING_ENABLED > 0
     {MB_FUNC_READWRITE_MULTIPLE_REGISTERS, eMBMasterFuncReadWriteMultipleHoldingRegister},
 #endif
+#if MB_FUNC_MASK_WRITE_HOLDING_ENABLED > 0
+    {MB_FUNC_MASK_WRITE_REGISTER, eMBMasterFuncMaskWriteHoldingRegister},
+#endif
 #if MB_FUNC_READ_COILS_ENABLED > 0
     {MB_FUNC_READ_COILS, eMBMasterFuncReadCoils},
 #endif
@@ -172,6 +177,7 @@ eMBMasterTCPInit( USHORT ucTCPPort )
         peMBMasterFrameSendCur = eMBMasterTCPSend;
         pxMBMasterPortCBTimerExpired = xMBMasterTCPTimerExpired;
         pvMBMasterFrameCloseCur = MB_PORT_HAS_CLOSE ? vMBMasterTCPPortClose : NULL;
+        peMBMasterFrameReconfigureCur = NULL;
         ucMBMasterDestAddress = MB_TCP_PSEUDO_ADDRESS;
         eMBMasterCurrentMode = MB_TCP;
         eMBState = STATE_DISABLED;
@@ -205,6 +211,7 @@ eMBMasterSerialInit( eMBMode eMode, UCHAR ucPort, ULONG ulBaudRate, eMBParity eP
         pxMBMasterFrameCBByteReceived = xMBMasterRTUReceiveFSM;
         pxMBMasterFrameCBTransmitterEmpty = xMBMasterRTUTransmitFSM;
         pxMBMasterPortCBTimerExpired = xMBMasterRTUTimerExpired;
+        peMBMasterFrameReconfigureCur = eMBMasterRTUReconfigure;
         eMBMasterCurrentMode = MB_ASCII;
 
         eStatus = eMBMasterRTUInit(ucPort, ulBaudRate, eParity);
@@ -220,6 +227,7 @@ eMBMasterSerialInit( eMBMode eMode, UCHAR ucPort, ULONG ulBaudRate, eMBParity eP
         pxMBMasterFrameCBByteReceived = xMBMasterASCIIReceiveFSM;
         pxMBMasterFrameCBTransmitterEmpty = xMBMasterASCIITransmitFSM;
         pxMBMasterPortCBTimerExpired = xMBMasterASCIITimerT1SExpired;
+        peMBMasterFrameReconfigureCur = eMBMasterASCIIReconfigure;
         eMBMasterCurrentMode = MB_RTU;
 
         eStatus = eMBMasterASCIIInit(ucPort, ulBaudRate, eParity );
@@ -247,6 +255,26 @@ eMBMasterSerialInit( eMBMode eMode, UCHAR ucPort, ULONG ulBaudRate, eMBParity eP
     return eStatus;
 }
 
+eMBErrorCode
+eMBMasterSerialReconfigure( ULONG ulBaudRate, eMBParity eParity, LONG lTimeOut )
+{
+    eMBErrorCode    eStatus = MB_ENOERR;
+
+    if( ( eMBState == STATE_NOT_INITIALIZED ) || ( peMBMasterFrameReconfigureCur == NULL ) )
+    {
+        return MB_EILLSTATE;
+    }
+    /* Wait the end of current transaction, the next one is blocked
+     * until the line is reconfigured. */
+    if( xMBMasterRunResTake( lTimeOut ) != TRUE )
+    {
+        return MB_ETIMEDOUT;
+    }
+    eStatus = peMBMasterFrameReconfigureCur( ulBaudRate, eParity );
+    vMBMasterRunResRelease( );
+    return eStatus;
+}
+
 eMBErrorCode
 eMBMasterClose( void )
 {
@@ -343,6 +371,7 @@ eMBMasterPoll( void )
             case EV_MASTER_FRAME_TRANSMIT:
                 ESP_LOGD(MB_PORT_TAG, "%" PRIu64 ":EV_MASTER_FRAME_TRANSMIT", xEvent.xTransactionId);
                 /* Master is busy now. */
+                atomic_store(&(eMBMasterLastException), MB_EX_NONE);
                 vMBMasterGetPDUSndBuf( &ucMBSendFrame );
                 ESP_LOG_BUFFER_HEX_LEVEL("POLL transmit buffer", (void*)ucMBSendFrame, usMBMasterGetPDUSndLength(), ESP_LOG_DEBUG);
                 eStatus = peMBMasterFrameSendCur( ucMBMasterGetDestAddress(), ucMBSendFrame, usMBMasterGetPDUSndLength() );
@@ -398,6 +427,8 @@ eMBMasterPoll( void )
                     /* If receive frame has exception. The receive function code highest bit is 1.*/
                     if (ucFunctionCode & MB_FUNC_ERROR) {
                         eException = (eMBException)ucMBRcvFrame[MB_PDU_DATA_OFF];
+                        /* Keep the exception code of the slave for the application. */
+                        atomic_store(&(eMBMasterLastException), eException);
                     } else {
                         for ( i = 0; i < MB_FUNC_HANDLERS_MAX; i++ )
                         {
@@ -523,6 +554,12 @@ void IRAM_ATTR vMBMasterSetErrorType( eMBMasterErrorEventType errorType )
     atomic_store(&(eMBMasterCurErrorType), errorType);
 }
 
+// Get the exception code of the last response, MB_EX_NONE if it was not an exception response.
+eMBException eMBMasterGetLastException( void )
+{
+    return atomic_load(&eMBMasterLastException);
+}
+
 /* Get Modbus Master send PDU's buffer address pointer.*/
 void vMBMasterGetPDUSndBuf( UCHAR ** pucFrame )
 {
@@ -61,6 +61,7 @@ BOOL            xMBRTUTimerT35Expired( void );
 
 #if MB_MASTER_RTU_ENABLED
 eMBErrorCode    eMBMasterRTUInit( UCHAR ucPort, ULONG ulBaudRate,eMBParity eParity );
+eMBErrorCode    eMBMasterRTUReconfigure( ULONG ulBaudRate, eMBParity eParity );
 void            eMBMasterRTUStart( void );
 void            eMBMasterRTUStop( void );
 eMBErrorCode    eMBMasterRTUReceive( UCHAR * pucRcvAddress, UCHAR ** pucFrame, USHORT * pusLength );
@@ -88,11 +88,37 @@ static volatile UCHAR *ucMasterRTURcvBuf = ucMasterRcvBuf;
 static volatile UCHAR *ucMasterRTUSndBuf = ucMasterSndBuf;
 
 /* ----------------------- Start implementation -----------------------------*/
+static USHORT
+usMBMasterRTUGetT35( ULONG ulBaudRate )
+{
+    ULONG           usTimerT35_50us;
+
+    /* If baudrate > 19200 then we should use the fixed timer values
+     * t35 = 1750us. Otherwise t35 must be 3.5 times the character time.
+     */
+    if( ulBaudRate > 19200 )
+    {
+        usTimerT35_50us = 35;       /* 1800us. */
+    }
+    else
+    {
+        /* The timer reload value for a character is given by:
+         *
+         * ChTimeValue = Ticks_per_1s / ( Baudrate / 11 )
+         *             = 11 * Ticks_per_1s / Baudrate
+         *             = 220000 / Baudrate
+         * The reload for t3.5 is 1.5 times this value and similary
+         * for t3.5.
+         */
+        usTimerT35_50us = ( 7UL * 220000UL ) / ( 2UL * ulBaudRate );
+    }
+    return ( USHORT ) usTimerT35_50us;
+}
+
 eMBErrorCode
 eMBMasterRTUInit(UCHAR ucPort, ULONG ulBaudRate, eMBParity eParity )
 {
     eMBErrorCode    eStatus = MB_ENOERR;
-    ULONG           usTimerT35_50us;
 
     ENTER_CRITICAL_SECTION(  );
 
@@ -101,37 +127,32 @@ eMBMasterRTUInit(UCHAR ucPort, ULONG ulBaudRate, eMBParity eParity )
     {
         eStatus = MB_EPORTERR;
     }
-    else
+    else if( xMBMasterPortTimersInit( usMBMasterRTUGetT35( ulBaudRate ) ) != TRUE )
     {
-        /* If baudrate > 19200 then we should use the fixed timer values
-         * t35 = 1750us. Otherwise t35 must be 3.5 times the character time.
-         */
-        if( ulBaudRate > 19200 )
-        {
-            usTimerT35_50us = 35;       /* 1800us. */
-        }
-        else
-        {
-            /* The timer reload value for a character is given by:
-             *
-             * ChTimeValue = Ticks_per_1s / ( Baudrate / 11 )
-             *             = 11 * Ticks_per_1s / Baudrate
-             *             = 220000 / Baudrate
-             * The reload for t3.5 is 1.5 times this value and similary
-             * for t3.5.
-             */
-            usTimerT35_50us = ( 7UL * 220000UL ) / ( 2UL * ulBaudRate );
-        }
-        if( xMBMasterPortTimersInit( ( USHORT ) usTimerT35_50us ) != TRUE )
-        {
-            eStatus = MB_EPORTERR;
-        }
+        eStatus = MB_EPORTERR;
     }
     EXIT_CRITICAL_SECTION(  );
 
     return eStatus;
 }
 
+eMBErrorCode
+eMBMasterRTUReconfigure( ULONG ulBaudRate, eMBParity eParity )
+{
+    eMBErrorCode    eStatus = MB_ENOERR;
+
+    /* Called between transactions, the line and the timer are idle. */
+    if( xMBMasterPortSerialSetConfig( ulBaudRate, eParity ) != TRUE )
+    {
+        eStatus = MB_EPORTERR;
+    }
+    else
+    {
+        vMBMasterPortTimersT35Update( usMBMasterRTUGetT35( ulBaudRate ) );
+    }
+    return eStatus;
+}
+
 void
 eMBMasterRTUStart( void )
 {
@@ -277,9 +298,8 @@ xMBMasterRTUReceiveFSM( void )
         break;
 
         /* In the idle state we wait for a new character. If a character
-         * is received the t1.5 and t3.5 timers are started and the
-         * receiver is in the state STATE_M_RX_RCV and disable early
-         * the timer of respond timeout .
+         * is received the receiver is in the state STATE_M_RX_RCV and
+         * disable early the timer of respond timeout.
          */
     case STATE_M_RX_IDLE:
         /* In time of respond timeout,the receiver receive a frame.
@@ -293,15 +313,11 @@ xMBMasterRTUReceiveFSM( void )
             eRcvState = STATE_M_RX_RCV;
             eSndState = STATE_M_TX_IDLE;
         }
-
-        /* Enable t3.5 timers. */
-#if CONFIG_FMB_TIMER_PORT_ENABLED
-        vMBMasterPortTimersT35Enable( );
-#endif
+        /* The end of frame is signalled by the UART RX idle detection. */
         break;
 
-        /* We are currently receiving a frame. Reset the timer after
-         * every character received. If more than the maximum possible
+        /* We are currently receiving a frame. No timer is touched per
+         * character, the frame ends on UART RX idle. If more than the maximum possible
          * number of bytes in a modbus frame is received the frame is
          * ignored.
          */
@@ -316,9 +332,6 @@ xMBMasterRTUReceiveFSM( void )
         {
             eRcvState = STATE_M_RX_ERROR;
         }
-#if CONFIG_FMB_TIMER_PORT_ENABLED
-        vMBMasterPortTimersT35Enable( );
-#endif
         break;
     }
     return xStatus;
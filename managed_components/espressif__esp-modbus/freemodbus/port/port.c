@@ -82,6 +82,38 @@ BOOL xMBPortSerialWaitEvent(QueueHandle_t xMbUartQueue, uart_event_t* pxEvent, U
     return xResult;
 }
 
+/*
+ * Configures the UART RX idle (TOUT) detection to signal the end of frame.
+ * The gap is defined in bit times and converted into the TOUT threshold
+ * which is measured in characters (start + data + parity + stop bits).
+ */
+BOOL xMBPortSerialSetRxIdleGap(UCHAR ucUartNum, ULONG ulBaudRate, UCHAR ucDataBits, BOOL xParity, ULONG *pulGapUs)
+{
+    ULONG ulGapBits = MB_SERIAL_RX_IDLE_BITS;
+    ULONG ulSymbolBits = 1 + ucDataBits + (xParity ? 1 : 0) + 1;
+    if (ulBaudRate > MB_SERIAL_RX_IDLE_BAUD_FIXED) {
+        ulGapBits = (ULONG)(((uint64_t)MB_SERIAL_RX_IDLE_GAP_US * ulBaudRate + 999999UL) / 1000000UL);
+    }
+    ULONG ulTout = (ulGapBits + ulSymbolBits - 1) / ulSymbolBits;
+    ulTout = (ulTout > 0) ? ulTout : 1;
+    if (ulTout > MB_SERIAL_RX_IDLE_TOUT_MAX) {
+        // The driver rejects longer thresholds, the frame end comes earlier than configured
+        ESP_LOGW(MB_PORT_TAG, "%s: gap of %lu bits limited to %u symbols.", __func__,
+                    (unsigned long)ulGapBits, (unsigned)MB_SERIAL_RX_IDLE_TOUT_MAX);
+        ulTout = MB_SERIAL_RX_IDLE_TOUT_MAX;
+    }
+    esp_err_t xErr = uart_set_rx_timeout(ucUartNum, (uint8_t)ulTout);
+    MB_PORT_CHECK((xErr == ESP_OK), FALSE,
+            "mb serial set rx timeout failure, uart_set_rx_timeout() returned (0x%x).", (int)xErr);
+    if (pulGapUs) {
+        // The actual idle time after the last character before the TOUT event
+        *pulGapUs = (ULONG)(((uint64_t)ulTout * ulSymbolBits * 1000000UL) / ulBaudRate);
+    }
+    ESP_LOGD(MB_PORT_TAG, "%s: gap %lu bits, TOUT = %lu symbols.", __func__,
+                (unsigned long)ulGapBits, (unsigned long)ulTout);
+    return TRUE;
+}
+
 #endif
 
 #if MB_MASTER_RTU_ENABLED || MB_MASTER_ASCII_ENABLED
@@ -63,7 +63,12 @@
 
 #define MB_SERIAL_TASK_PRIO             (CONFIG_FMB_PORT_TASK_PRIO)
 #define MB_SERIAL_TASK_STACK_SIZE       (CONFIG_FMB_PORT_TASK_STACK_SIZE)
-#define MB_SERIAL_TOUT                  (3) // 3.5*8 = 28 ticks, TOUT=3 -> ~24..33 ticks
+
+// Frame gap detected by UART RX idle (TOUT) feature
+#define MB_SERIAL_RX_IDLE_BITS          (CONFIG_FMB_SERIAL_RX_IDLE_BITS) // gap in bit times up to 19200 baud
+#define MB_SERIAL_RX_IDLE_GAP_US        (CONFIG_FMB_SERIAL_RX_IDLE_GAP_US) // fixed gap above 19200 baud
+#define MB_SERIAL_RX_IDLE_BAUD_FIXED    (19200)
+#define MB_SERIAL_RX_IDLE_TOUT_MAX      (126) // longest TOUT threshold of uart_set_rx_timeout() in symbols
 
 // Set buffer size for transmission
 #define MB_SERIAL_BUF_SIZE              (CONFIG_FMB_SERIAL_BUF_SIZE)
@@ -189,6 +194,7 @@ void vMBPortSetMode( UCHAR ucMode );
 UCHAR ucMBPortGetMode( void );
 
 BOOL xMBPortSerialWaitEvent(QueueHandle_t xMbUartQueue, uart_event_t* pxEvent, ULONG xTimeout);
+BOOL xMBPortSerialSetRxIdleGap(UCHAR ucUartNum, ULONG ulBaudRate, UCHAR ucDataBits, BOOL xParity, ULONG *pulGapUs);
 
 #ifdef __cplusplus
 PR_END_EXTERN_C
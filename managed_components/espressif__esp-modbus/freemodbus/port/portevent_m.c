@@ -67,6 +67,7 @@ static EventGroupHandle_t xEventGroupMasterConfirmHdl;
 static QueueHandle_t xQueueMasterHdl;
 
 static uint64_t xTransactionID = 0;
+static uint64_t xRxTimestamp = 0; // time of the last received frame, set by the port as close to the event as possible
 
 /* ----------------------- Start implementation -----------------------------*/
 
@@ -81,6 +82,7 @@ xMBMasterPortEventInit( void )
     MB_PORT_CHECK(xQueueMasterHdl, FALSE, "mb stack event group creation error.");
     vQueueAddToRegistry(xQueueMasterHdl, "MbMasterPortEventQueue");
     xTransactionID = 0;
+    xRxTimestamp = 0;
     return TRUE;
 }
 
@@ -150,6 +152,16 @@ uint64_t xMBMasterPortGetTransactionId( )
     return atomic_load(&xTransactionID);
 }
 
+void vMBMasterPortSetRxTimestamp( uint64_t xTimestamp )
+{
+    atomic_store(&(xRxTimestamp), xTimestamp);
+}
+
+uint64_t xMBMasterPortGetRxTimestamp( void )
+{
+    return atomic_load(&xRxTimestamp);
+}
+
 // This function is initialize the OS resource for modbus master.
 void vMBMasterOsResInit( void )
 {
@@ -238,10 +238,10 @@ BOOL xMBPortSerialInit(UCHAR ucPORT, ULONG ulBaudRate,
     MB_PORT_CHECK((xErr == ESP_OK), FALSE,
             "mb serial driver failure, uart_driver_install() returned (0x%x).", (int)xErr);
 #if !CONFIG_FMB_TIMER_PORT_ENABLED
-    // Set timeout for TOUT interrupt (T3.5 modbus time)
-    xErr = uart_set_rx_timeout(ucUartNumber, MB_SERIAL_TOUT);
-    MB_PORT_CHECK((xErr == ESP_OK), FALSE,
-            "mb serial set rx timeout failure, uart_set_rx_timeout() returned (0x%x).", (int)xErr);
+    // Set timeout for TOUT interrupt (T3.5 modbus time measured in bit times)
+    MB_PORT_CHECK((xMBPortSerialSetRxIdleGap(ucUartNumber, ulBaudRate, ucDataBits,
+                                                (ucParity != UART_PARITY_DISABLE), NULL)), FALSE,
+                        "mb serial set rx idle gap failure.");
 #endif
 
     // Set always timeout flag to trigger timeout interrupt even after rx fifo full
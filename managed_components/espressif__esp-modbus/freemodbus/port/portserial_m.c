@@ -35,6 +35,7 @@
  */
 
 #include <string.h>
+#include <stdatomic.h>
 #include "driver/uart.h"
 #include "soc/dport_access.h"
 #include "freertos/FreeRTOS.h"
@@ -52,8 +53,6 @@
 #include "port_serial_master.h"
 
 /* ----------------------- Defines ------------------------------------------*/
-#define MB_SERIAL_RX_SEMA_TOUT_MS   (1000)
-#define MB_SERIAL_RX_SEMA_TOUT      (pdMS_TO_TICKS(MB_SERIAL_RX_SEMA_TOUT_MS))
 #define MB_SERIAL_RX_FLUSH_RETRY    (2)
 
 /* ----------------------- Static variables ---------------------------------*/
@@ -66,83 +65,53 @@ static TaskHandle_t  xMbTaskHandle;
 // The UART hardware port number
 static UCHAR ucUartNumber = UART_NUM_MAX - 1;
 
-static BOOL bRxStateEnabled = FALSE; // Receiver enabled flag
-static BOOL bTxStateEnabled = FALSE; // Transmitter enabled flag
+// Receive permit: set when the stack is ready for the next response and
+// consumed by the UART task for the first frame received after that.
+// The UART task is never suspended, data received without the permit is discarded.
+static atomic_bool xRxPermit = false;
+static atomic_bool xTxStateEnabled = false; // Transmitter enabled flag
 
-static SemaphoreHandle_t xMasterSemaRxHandle; // Rx blocking semaphore handle
+// Line idle time from the end of the last character to the UART TOUT event
+static ULONG ulRxIdleGapUs = 0;
 
-static BOOL xMBMasterPortRxSemaInit( void )
-{
-    xMasterSemaRxHandle = xSemaphoreCreateBinary();
-    MB_PORT_CHECK((xMasterSemaRxHandle != NULL), FALSE , "%s: RX semaphore create failure.", __func__);
-    return TRUE;
-}
-
-static void vMBMasterPortRxSemaClose( void )
-{
-    if (xMasterSemaRxHandle) {
-        vSemaphoreDelete(xMasterSemaRxHandle);
-        xMasterSemaRxHandle = NULL;
-    }
-}
-
-static BOOL xMBMasterPortRxSemaTake( LONG lTimeOut )
-{
-    BaseType_t xStatus = pdTRUE;
-    xStatus = xSemaphoreTake(xMasterSemaRxHandle, lTimeOut );
-    MB_PORT_CHECK((xStatus == pdTRUE), FALSE , "%s: RX semaphore take failure.", __func__);
-    ESP_LOGV(MB_PORT_TAG,"%s:Take RX semaphore (%" PRIu64 " ticks).", __func__, (uint64_t)lTimeOut);
-    return TRUE;
-}
-
-static void vMBMasterRxSemaRelease( void )
-{
-    BaseType_t xStatus = pdFALSE;
-    xStatus = xSemaphoreGive(xMasterSemaRxHandle);
-    if (xStatus != pdTRUE) {
-        ESP_LOGD(MB_PORT_TAG,"%s:RX semaphore is free.", __func__);
-    }
-}
-
-static BOOL vMBMasterRxSemaIsBusy( void )
-{
-    BaseType_t xStatus = pdFALSE;
-    xStatus = (uxSemaphoreGetCount(xMasterSemaRxHandle) == 0) ? TRUE : FALSE;
-    return xStatus;
-}
+// Data bits of the character, kept for reconfiguration of the line
+static UCHAR ucUartDataBits = 8;
 
 void vMBMasterRxFlush( void )
 {
-    size_t xSize = 1;
-    esp_err_t xErr = ESP_OK;
+    size_t xSize = 0;
+    esp_err_t xErr = uart_get_buffered_data_len(ucUartNumber, &xSize);
+    MB_PORT_CHECK((xErr == ESP_OK), ; , "mb flush serial fail, error = 0x%x.", (int)xErr);
     for (int xCount = 0; (xCount < MB_SERIAL_RX_FLUSH_RETRY) && xSize; xCount++) {
-        xErr = uart_get_buffered_data_len(ucUartNumber, &xSize);
-        MB_PORT_CHECK((xErr == ESP_OK), ; , "mb flush serial fail, error = 0x%x.", (int)xErr);
         BaseType_t xStatus = xQueueReset(xMbUartQueue);
         if (xStatus) {
             xErr = uart_flush_input(ucUartNumber);
             MB_PORT_CHECK((xErr == ESP_OK), ; , "mb flush serial fail, error = 0x%x.", (int)xErr);
         }
+        xErr = uart_get_buffered_data_len(ucUartNumber, &xSize);
+        MB_PORT_CHECK((xErr == ESP_OK), ; , "mb flush serial fail, error = 0x%x.", (int)xErr);
     }
 }
 
 void vMBMasterPortSerialEnable(BOOL bRxEnable, BOOL bTxEnable)
 {
     // This function can be called from xMBRTUTransmitFSM() of different task
+    // and only changes the receive permit, the UART task keeps running.
     if (bTxEnable) {
+        // Drop the data received before the request (flushes only if anything is buffered)
         vMBMasterRxFlush();
-        bTxStateEnabled = TRUE;
-    } else {
-        bTxStateEnabled = FALSE;
-    }
-    if (bRxEnable) {
-        bRxStateEnabled = TRUE;
-        vMBMasterRxSemaRelease();
-        vTaskResume(xMbTaskHandle); // Resume receiver task
+        atomic_store(&xTxStateEnabled, true);
     } else {
-        vTaskSuspend(xMbTaskHandle); // Block receiver task
-        bRxStateEnabled = FALSE;
+        atomic_store(&xTxStateEnabled, false);
     }
+    atomic_store(&xRxPermit, (bRxEnable != FALSE));
+}
+
+// Consume the receive permit, returns TRUE if the stack is waiting for the data
+static BOOL xMBMasterPortRxPermitTake( void )
+{
+    bool xExpected = true;
+    return atomic_compare_exchange_strong(&xRxPermit, &xExpected, false) ? TRUE : FALSE;
 }
 
 static USHORT usMBMasterPortSerialRxPoll(size_t xEventSize)
@@ -150,26 +119,20 @@ static USHORT usMBMasterPortSerialRxPoll(size_t xEventSize)
     BOOL xStatus = TRUE;
     USHORT usCnt = 0;
 
-    xStatus = xMBMasterPortRxSemaTake(MB_SERIAL_RX_SEMA_TOUT);
-    if (xStatus) {
-        while(xStatus && (usCnt++ <= xEventSize)) {
-            // Call the Modbus stack callback function and let it fill the stack buffers.
-            xStatus = pxMBMasterFrameCBByteReceived(); // callback to receive FSM
-        }
-        // The buffer is transferred into Modbus stack and is not needed here any more
-        uart_flush_input(ucUartNumber);
-        ESP_LOGD(TAG, "Received data: %u(bytes in buffer)", (unsigned)usCnt);
-#if !CONFIG_FMB_TIMER_PORT_ENABLED
-        vMBMasterSetCurTimerMode(MB_TMODE_T35);
-        xStatus = pxMBMasterPortCBTimerExpired();
-        if (!xStatus) {
-            xMBMasterPortEventPost(EV_MASTER_FRAME_RECEIVED);
-            ESP_LOGD(TAG, "Send additional RX ready event.");
-        }
-#endif
-    } else {
-        ESP_LOGE(TAG, "%s: bRxState disabled but junk data (%u bytes) received. ", 
-                            __func__, (unsigned)xEventSize);
+    while(xStatus && (usCnt++ <= xEventSize)) {
+        // Call the Modbus stack callback function and let it fill the stack buffers.
+        xStatus = pxMBMasterFrameCBByteReceived(); // callback to receive FSM
+    }
+    // The buffer is transferred into Modbus stack and is not needed here any more
+    uart_flush_input(ucUartNumber);
+    ESP_LOGD(TAG, "Received data: %u(bytes in buffer)", (unsigned)usCnt);
+    // The UART TOUT event already means the line was idle for the frame gap,
+    // so complete the frame here instead of restarting the T3.5 timer per byte.
+    vMBMasterSetCurTimerMode(MB_TMODE_T35);
+    xStatus = pxMBMasterPortCBTimerExpired();
+    if (!xStatus) {
+        xMBMasterPortEventPost(EV_MASTER_FRAME_RECEIVED);
+        ESP_LOGD(TAG, "Send additional RX ready event.");
     }
     return usCnt;
 }
@@ -179,7 +142,7 @@ BOOL xMBMasterPortSerialTxPoll(void)
     USHORT usCount = 0;
     BOOL bNeedPoll = TRUE;
 
-    if( bTxStateEnabled ) {
+    if( atomic_load(&xTxStateEnabled) ) {
         // Continue while all response bytes put in buffer or out of buffer
         while(bNeedPoll && (usCount++ < MB_SERIAL_BUF_SIZE)) {
             // Calls the modbus stack callback function to let it fill the UART transmit buffer.
@@ -202,6 +165,8 @@ static void vUartTask(void* pvParameters)
     USHORT usResult = 0;
     for(;;) {
         if (xMBPortSerialWaitEvent(xMbUartQueue, (void*)&xEvent, portMAX_DELAY)) {
+            // Take the time stamp first to keep the latency of the event minimal
+            uint64_t xEventTimestamp = esp_timer_get_time();
             ESP_LOGD(TAG, "MB_uart[%u] event:", (unsigned)ucUartNumber);
             switch(xEvent.type) {
                 //Event of UART receiving data
@@ -210,12 +175,15 @@ static void vUartTask(void* pvParameters)
                     // This flag set in the event means that no more
                     // data received during configured timeout and UART TOUT feature is triggered
                     if (xEvent.timeout_flag) {
-                        // Response is received but previous packet processing is pending
-                        // Do not wait completion of processing and just discard received data as incorrect
-                        if (vMBMasterRxSemaIsBusy()) {
+                        // The stack does not wait for a response (no request sent or
+                        // previous response is still processed), discard the data as incorrect
+                        if (!xMBMasterPortRxPermitTake()) {
+                            ESP_LOGD(TAG, "Receiver disabled, discard %u bytes.", (unsigned)xEvent.size);
                             vMBMasterRxFlush();
                             break;
                         }
+                        // The frame ended one idle gap before the TOUT event
+                        vMBMasterPortSetRxTimestamp(xEventTimestamp - ulRxIdleGapUs);
                         // Get buffered data length
                         ESP_ERROR_CHECK(uart_get_buffered_data_len(ucUartNumber, &xEvent.size));
                         // Read received data and send it to modbus stack
@@ -265,6 +233,7 @@ BOOL xMBMasterPortSerialInit( UCHAR ucPORT, ULONG ulBaudRate, UCHAR ucDataBits,
     esp_err_t xErr = ESP_OK;
     // Set communication port number
     ucUartNumber = ucPORT;
+    ucUartDataBits = ucDataBits;
     // Configure serial communication parameters
     UCHAR ucParity = UART_PARITY_DISABLE;
     UCHAR ucData = UART_DATA_8_BITS;
@@ -321,15 +290,16 @@ BOOL xMBMasterPortSerialInit( UCHAR ucPORT, ULONG ulBaudRate, UCHAR ucDataBits,
                                     MB_QUEUE_LENGTH, &xMbUartQueue, MB_PORT_SERIAL_ISR_FLAG);
     MB_PORT_CHECK((xErr == ESP_OK), FALSE,
             "mb serial driver failure, uart_driver_install() returned (0x%x).", (int)xErr);
-    // Set timeout for TOUT interrupt (T3.5 modbus time)
-    xErr = uart_set_rx_timeout(ucUartNumber, MB_SERIAL_TOUT);
-    MB_PORT_CHECK((xErr == ESP_OK), FALSE,
-            "mb serial set rx timeout failure, uart_set_rx_timeout() returned (0x%x).", (int)xErr);
+    // Set timeout for TOUT interrupt (T3.5 modbus time measured in bit times)
+    MB_PORT_CHECK((xMBPortSerialSetRxIdleGap(ucUartNumber, ulBaudRate, ucDataBits,
+                                                (ucParity != UART_PARITY_DISABLE), &ulRxIdleGapUs)), FALSE,
+                        "mb serial set rx idle gap failure.");
 
     // Set always timeout flag to trigger timeout interrupt even after rx fifo full
     uart_set_always_rx_timeout(ucUartNumber, true);
-    MB_PORT_CHECK((xMBMasterPortRxSemaInit()), FALSE,
-                        "mb serial RX semaphore create fail.");
+    // Receiver stays disabled until the stack is started
+    atomic_store(&xRxPermit, false);
+    atomic_store(&xTxStateEnabled, false);
     // Create a task to handle UART events
     BaseType_t xStatus = xTaskCreatePinnedToCore(vUartTask, "uart_queue_task",
                                                     MB_SERIAL_TASK_STACK_SIZE,
@@ -340,16 +310,50 @@ BOOL xMBMasterPortSerialInit( UCHAR ucPORT, ULONG ulBaudRate, UCHAR ucDataBits,
         // Force exit from function with failure
         MB_PORT_CHECK(FALSE, FALSE,
                 "mb stack serial task creation error. xTaskCreate() returned (0x%x).", (int)xStatus);
-    } else {
-        vTaskSuspend(xMbTaskHandle); // Suspend serial task while stack is not started
     }
     ESP_LOGD(MB_PORT_TAG,"%s Init serial.", __func__);
     return TRUE;
 }
 
+BOOL xMBMasterPortSerialSetConfig( ULONG ulBaudRate, eMBParity eParity )
+{
+    uart_parity_t xParity = UART_PARITY_DISABLE;
+    switch(eParity){
+        case MB_PAR_NONE:
+            xParity = UART_PARITY_DISABLE;
+            break;
+        case MB_PAR_ODD:
+            xParity = UART_PARITY_ODD;
+            break;
+        case MB_PAR_EVEN:
+            xParity = UART_PARITY_EVEN;
+            break;
+        default:
+            ESP_LOGE(TAG, "Incorrect parity option: %u", (unsigned)eParity);
+            return FALSE;
+    }
+    // The caller owns the bus, wait the last request to leave the line before the change
+    esp_err_t xErr = uart_wait_tx_done(ucUartNumber, MB_SERIAL_TX_TOUT_TICKS);
+    MB_PORT_CHECK((xErr == ESP_OK), FALSE,
+            "mb serial sent buffer failure, uart_wait_tx_done() returned (0x%x).", (int)xErr);
+    xErr = uart_set_baudrate(ucUartNumber, ulBaudRate);
+    MB_PORT_CHECK((xErr == ESP_OK), FALSE,
+            "mb serial set baudrate failure, uart_set_baudrate() returned (0x%x).", (int)xErr);
+    xErr = uart_set_parity(ucUartNumber, xParity);
+    MB_PORT_CHECK((xErr == ESP_OK), FALSE,
+            "mb serial set parity failure, uart_set_parity() returned (0x%x).", (int)xErr);
+    MB_PORT_CHECK((xMBPortSerialSetRxIdleGap(ucUartNumber, ulBaudRate, ucUartDataBits,
+                                                (xParity != UART_PARITY_DISABLE), &ulRxIdleGapUs)), FALSE,
+                        "mb serial set rx idle gap failure.");
+    // Drop the characters received with the previous settings
+    vMBMasterRxFlush();
+    ESP_LOGD(TAG, "Serial reconfigured: %u baud, parity %u.", (unsigned)ulBaudRate, (unsigned)eParity);
+    return TRUE;
+}
+
 void vMBMasterPortSerialClose(void)
 {
-    vMBMasterPortRxSemaClose();
+    atomic_store(&xRxPermit, false);
     (void)vTaskDelete(xMbTaskHandle);
     ESP_ERROR_CHECK(uart_driver_delete(ucUartNumber));
 }
@@ -362,6 +366,14 @@ BOOL xMBMasterPortSerialPutByte(CHAR ucByte)
     return (ucLength == 1);
 }
 
+BOOL xMBMasterPortSerialPutBuffer(const UCHAR *pucBuffer, USHORT usLength)
+{
+    // Send a whole encoded frame to UART transmission buffer in one call
+    // This function is called by Modbus stack
+    int iLength = uart_write_bytes(ucUartNumber, pucBuffer, usLength);
+    return (iLength == (int)usLength);
+}
+
 // Get one byte from intermediate RX buffer
 BOOL xMBMasterPortSerialGetByte(CHAR* pucByte)
 {
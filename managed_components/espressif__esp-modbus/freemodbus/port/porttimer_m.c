@@ -46,6 +46,8 @@ static const char *TAG = "MBM_TIMER";
 
 /* ----------------------- Variables ----------------------------------------*/
 static xTimerContext_t* pxTimerContext = NULL;
+// Response timeout of the next requests in ms, 0 for MB_MASTER_TIMEOUT_MS_RESPOND
+static volatile ULONG ulRespondTimeoutMs = 0;
 
 /* ----------------------- Start implementation -----------------------------*/
 static void IRAM_ATTR vTimerAlarmCBHandler(void *param)
@@ -109,6 +111,14 @@ void vMBMasterPortTimersT35Enable(void)
     (void)xMBMasterPortTimersEnable(xToutUs);
 }
 
+void vMBMasterPortTimersT35Update(USHORT usTimeOut50us)
+{
+    MB_PORT_CHECK(pxTimerContext && (usTimeOut50us > 0), ; ,
+                    "Modbus timer is not initialized or timeout is incorrect.");
+    // Applied on the next start of T35 timer
+    pxTimerContext->usT35Ticks = usTimeOut50us;
+}
+
 void vMBMasterPortTimersConvertDelayEnable(void)
 {
     // Covert time in milliseconds into ticks
@@ -120,9 +130,21 @@ void vMBMasterPortTimersConvertDelayEnable(void)
     (void)xMBMasterPortTimersEnable(xToutUs);
 }
 
+void vMBMasterPortTimersRespondTimeoutSet(ULONG ulTimeoutMs)
+{
+    // Applied on the next start of the response timer
+    ulRespondTimeoutMs = ulTimeoutMs;
+}
+
+ULONG ulMBMasterPortTimersRespondTimeoutGet(void)
+{
+    ULONG ulTimeoutMs = ulRespondTimeoutMs;
+    return ulTimeoutMs ? ulTimeoutMs : MB_MASTER_TIMEOUT_MS_RESPOND;
+}
+
 void vMBMasterPortTimersRespondTimeoutEnable(void)
 {
-    uint64_t xToutUs = (MB_MASTER_TIMEOUT_MS_RESPOND * 1000);
+    uint64_t xToutUs = ((uint64_t)ulMBMasterPortTimersRespondTimeoutGet() * 1000);
 
     vMBMasterSetCurTimerMode(MB_TMODE_RESPOND_TIMEOUT);
     ESP_LOGD(MB_PORT_TAG,"%s Respond enable timeout.", __func__);
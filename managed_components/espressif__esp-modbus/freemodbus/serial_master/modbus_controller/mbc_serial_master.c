@@ -76,6 +76,18 @@ static esp_err_t mbc_serial_master_setup(void* comm_info)
                 "mb wrong port to set = (%u).", (unsigned)comm_info_ptr->port);
     MB_MASTER_CHECK((comm_info_ptr->parity <= UART_PARITY_ODD), ESP_ERR_INVALID_ARG,
                 "mb wrong parity option = (%u).", (unsigned)comm_info_ptr->parity);
+    EventBits_t flag = xEventGroupGetBits(mbm_opts->mbm_event_group);
+    if (flag & MB_EVENT_STACK_STARTED) {
+        // The stack is running, only the line parameters can be changed between transactions
+        MB_MASTER_CHECK(((comm_info_ptr->mode == mbm_opts->mbm_comm.mode)
+                            && (comm_info_ptr->port == mbm_opts->mbm_comm.port)),
+                        ESP_ERR_INVALID_STATE, "mb mode or port can not be changed while started.");
+        eMBErrorCode status = eMBMasterSerialReconfigure((ULONG)comm_info_ptr->baudrate,
+                                                        MB_PORT_PARITY_GET(comm_info_ptr->parity),
+                                                        (LONG)MB_SERIAL_API_RESP_TICS);
+        MB_MASTER_CHECK((status == MB_ENOERR), ESP_ERR_INVALID_STATE,
+                "mb stack reconfiguration failure, returns (0x%x).", (int)status);
+    }
     // Save the communication options
     mbm_opts->mbm_comm = *(mb_communication_info_t*)comm_info_ptr;
     return ESP_OK;
@@ -156,8 +168,8 @@ static esp_err_t mbc_serial_master_set_descriptor(const mb_parameter_descriptor_
         MB_MASTER_CHECK((reg_ptr->mb_size > 0),
                             ESP_ERR_INVALID_ARG, "mb descriptor param size is incorrect.");
     }
-    mbm_opts->mbm_param_descriptor_table = descriptor;
-    mbm_opts->mbm_param_descriptor_size = num_elements;
+    // The lookups in progress complete on the previous table
+    mbc_master_descr_publish(mbm_opts, descriptor, num_elements);
     return ESP_OK;
 }
 
@@ -186,6 +198,14 @@ static esp_err_t mbc_serial_master_send_request(mb_param_request_t* request, voi
         // Set the buffer for callback function processing of received data
         mbm_opts->mbm_reg_buffer_ptr = (uint8_t*)data_ptr;
         mbm_opts->mbm_reg_buffer_size = mb_size;
+        mbm_opts->mbm_req_count++;
+        if (MB_MASTER_IS_VIEW_REQUEST(mbm_opts, data_ptr)) {
+            // Remember whose response the view will hold, see mbc_master_read_view()
+            mbm_opts->mbm_view_owner = xTaskGetCurrentTaskHandle();
+            mbm_opts->mbm_view_req = mbm_opts->mbm_req_count;
+            mbm_opts->mbm_view.data = NULL;
+            mbm_opts->mbm_view.reg_count = 0;
+        }
 
         vMBMasterRunResRelease();
 
@@ -228,6 +248,18 @@ static esp_err_t mbc_serial_master_send_request(mb_param_request_t* request, voi
                                                                         (USHORT)mb_offset, (USHORT)mb_size,
                                                                         (LONG)MB_SERIAL_API_RESP_TICS );
                 break;
+#if MB_FUNC_OTHER_REP_SLAVEID_ENABLED
+            case MB_FUNC_OTHER_REPORT_SLAVEID:
+                // reg_size is the size of the data buffer in bytes
+                mb_error = eMBMasterReqReportSlaveID((UCHAR)mb_slave_addr, (LONG)MB_SERIAL_API_RESP_TICS);
+                break;
+#endif
+            case MB_FUNC_MASK_WRITE_REGISTER:
+                // data_ptr holds the AND mask followed by the OR mask
+                mb_error = eMBMasterReqMaskWriteHoldingRegister((UCHAR)mb_slave_addr, (USHORT)mb_offset,
+                                                                ((USHORT*)data_ptr)[0], ((USHORT*)data_ptr)[1],
+                                                                (LONG)MB_SERIAL_API_RESP_TICS);
+                break;
             case MB_FUNC_READ_INPUT_REGISTER:
                 mb_error = eMBMasterReqReadInputRegister( (UCHAR)mb_slave_addr, (USHORT)mb_offset,
                                                             (USHORT)mb_size, (LONG) MB_SERIAL_API_RESP_TICS );
@@ -239,10 +271,15 @@ static esp_err_t mbc_serial_master_send_request(mb_param_request_t* request, voi
         }
     }
 
+    // Exception code of the slave, so the application can tell an illegal address from other failures
+    mbm_opts->mbm_exception = (mb_error == MB_MRE_EXE_FUN) ? (uint8_t)eMBMasterGetLastException() : 0;
+
     // Propagate the Modbus errors to higher level
     switch(mb_error)
     {
         case MB_MRE_NO_ERR:
+            // Keep the receive time stamp of the response to this request
+            mbm_opts->mbm_rx_timestamp = xMBMasterPortGetRxTimestamp();
             error = ESP_OK;
             break;
 
@@ -272,7 +309,8 @@ static esp_err_t mbc_serial_master_send_request(mb_param_request_t* request, voi
     return error;
 }
 
-static esp_err_t mbc_serial_master_get_cid_info(uint16_t cid, const mb_parameter_descriptor_t** param_buffer)
+// Look up a characteristic, the table stays held for the caller if hold is not NULL
+static esp_err_t mbc_serial_master_get_cid_info(uint16_t cid, const mb_parameter_descriptor_t** param_buffer, unsigned* hold)
 {
     MB_MASTER_CHECK((mbm_interface_ptr != NULL),
                     ESP_ERR_INVALID_STATE,
@@ -281,18 +319,29 @@ static esp_err_t mbc_serial_master_get_cid_info(uint16_t cid, const mb_parameter
 
     MB_MASTER_CHECK((param_buffer != NULL),
                         ESP_ERR_INVALID_ARG, "mb incorrect data buffer pointer.");
-    MB_MASTER_CHECK((mbm_opts->mbm_param_descriptor_table != NULL),
-                        ESP_ERR_INVALID_ARG, "mb incorrect descriptor table or not set.");
-    MB_MASTER_CHECK((cid < mbm_opts->mbm_param_descriptor_size),
-                        ESP_ERR_NOT_FOUND, "mb incorrect cid of characteristic.");
-
-    // It is assumed that characteristics cid increased in the table
-    const mb_parameter_descriptor_t* reg_info = &mbm_opts->mbm_param_descriptor_table[cid];
-
-    MB_MASTER_CHECK((reg_info->param_key != NULL),
-                        ESP_ERR_INVALID_ARG, "mb incorrect characteristic key.");
-    *param_buffer = reg_info;
-    return ESP_OK;
+    mb_descr_table_t descr;
+    unsigned descr_idx = mbc_master_descr_acquire(mbm_opts, &descr);
+    esp_err_t error = ESP_OK;
+    if (descr.table == NULL) {
+        ESP_LOGE(TAG, "mb incorrect descriptor table or not set.");
+        error = ESP_ERR_INVALID_ARG;
+    } else if (cid >= descr.size) {
+        ESP_LOGE(TAG, "mb incorrect cid of characteristic.");
+        error = ESP_ERR_NOT_FOUND;
+    } else if (descr.table[cid].param_key == NULL) {
+        // It is assumed that characteristics cid increased in the table
+        ESP_LOGE(TAG, "mb incorrect characteristic key.");
+        error = ESP_ERR_INVALID_ARG;
+    } else {
+        *param_buffer = &descr.table[cid];
+    }
+    if ((error == ESP_OK) && hold) {
+        // Released by mbc_master_release_cid_info(), a table update waits for it
+        *hold = descr_idx;
+    } else {
+        mbc_master_descr_release(mbm_opts, descr_idx);
+    }
+    return error;
 }
 
 // Helper function to get modbus command for each type of Modbus register area
@@ -345,9 +394,11 @@ static esp_err_t mbc_serial_master_set_request(char* name, mb_param_mode_t mode,
                         ESP_ERR_INVALID_ARG, "mb incorrect request parameter.");
     MB_MASTER_CHECK((mode <= MB_PARAM_WRITE),
                         ESP_ERR_INVALID_ARG, "mb incorrect mode.");
-    MB_MASTER_ASSERT(mbm_opts->mbm_param_descriptor_table != NULL);
-    const mb_parameter_descriptor_t* reg_ptr = mbm_opts->mbm_param_descriptor_table;
-    for (uint16_t counter = 0; counter < (mbm_opts->mbm_param_descriptor_size); counter++, reg_ptr++)
+    mb_descr_table_t descr;
+    unsigned descr_idx = mbc_master_descr_acquire(mbm_opts, &descr);
+    MB_MASTER_ASSERT(descr.table != NULL);
+    const mb_parameter_descriptor_t* reg_ptr = descr.table;
+    for (uint16_t counter = 0; counter < (descr.size); counter++, reg_ptr++)
     {
         // Check the cid of the parameter is equal to record number in the table
         // Check the length of name and parameter key strings from table
@@ -363,8 +414,11 @@ static esp_err_t mbc_serial_master_set_request(char* name, mb_param_mode_t mode,
             request->reg_start = reg_ptr->mb_reg_start;
             request->reg_size = reg_ptr->mb_size;
             request->command = mbc_serial_master_get_command(reg_ptr->mb_param_type, mode);
-            MB_MASTER_CHECK((request->command > 0), ESP_ERR_INVALID_ARG,
-                                "mb incorrect command or parameter type.");
+            if (request->command == 0) {
+                ESP_LOGE(TAG, "mb incorrect command or parameter type.");
+                error = ESP_ERR_INVALID_ARG;
+                break;
+            }
             if (reg_data != NULL) {
                 *reg_data = *reg_ptr; // Set the cid registered parameter data
             }
@@ -372,6 +426,8 @@ static esp_err_t mbc_serial_master_set_request(char* name, mb_param_mode_t mode,
             break;
         }
     }
+    // The request works on its own copy of the descriptor
+    mbc_master_descr_release(mbm_opts, descr_idx);
     return error;
 }
 
@@ -474,6 +530,12 @@ eMBErrorCode eMBRegInputCBSerialMaster(UCHAR * pucRegBuffer, USHORT usAddress,
     if ((pucInputBuffer != NULL)
             && (usNRegs >= 1)
             && (usRegInputNregs == usRegs)) {
+        if (MB_MASTER_IS_VIEW_REQUEST(mbm_opts, pucInputBuffer)) {
+            // Borrow the registers from the receive frame
+            mbm_opts->mbm_view.data = pucRegBuffer;
+            mbm_opts->mbm_view.reg_count = usNRegs;
+            return eStatus;
+        }
         while (usRegs > 0) {
             _XFER_2_RD(pucInputBuffer, pucRegBuffer);
             usRegs -= 1;
@@ -513,6 +575,12 @@ eMBErrorCode eMBRegHoldingCBSerialMaster(UCHAR * pucRegBuffer, USHORT usAddress,
     if ((pucHoldingBuffer != NULL)
             && (usRegHoldingNregs == usNRegs)
             && (usNRegs >= 1)) {
+        if ((eMode == MB_REG_READ) && MB_MASTER_IS_VIEW_REQUEST(mbm_opts, pucHoldingBuffer)) {
+            // Borrow the registers from the receive frame
+            mbm_opts->mbm_view.data = pucRegBuffer;
+            mbm_opts->mbm_view.reg_count = usNRegs;
+            return eStatus;
+        }
         switch (eMode) {
             case MB_REG_WRITE:
                 while (usRegs > 0) {
@@ -649,6 +717,9 @@ esp_err_t mbc_serial_master_create(void** handler)
     // Initialize interface properties
     mb_master_options_t* mbm_opts = &mbm_interface_ptr->opts;
     mbm_opts->port_type = MB_PORT_SERIAL_MASTER;
+    mbm_opts->mbm_rx_timestamp = 0;
+    mbm_opts->mbm_exception = 0;
+    mbc_master_descr_init(mbm_opts);
 
     vMBPortSetMode((UCHAR)MB_PORT_SERIAL_MASTER);
 
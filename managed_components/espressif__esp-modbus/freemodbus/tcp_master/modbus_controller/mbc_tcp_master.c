@@ -36,6 +36,7 @@
 
 static mb_master_interface_t* mbm_interface_ptr = NULL;
 static const char *TAG = "MB_CONTROLLER_MASTER";
+static bool mbm_stack_started = false;
 
 // Searches the slave address in the address info list and returns address info if found, else NULL
 static mb_slave_addr_entry_t* mbc_tcp_master_find_slave_addr(uint8_t slave_addr)
@@ -147,7 +148,9 @@ static esp_err_t mbc_tcp_master_start(void)
     MB_MASTER_CHECK((status == MB_ENOERR), ESP_ERR_INVALID_STATE,
             "mb stack initialization failure, eMBMasterInit() returns (0x%x).", status);
 
-    MB_MASTER_CHECK((mbm_opts->mbm_param_descriptor_size >= 1), ESP_ERR_INVALID_ARG, "mb table size is incorrect.");
+    mb_descr_table_t descr;
+    mbc_master_descr_release(mbm_opts, mbc_master_descr_acquire(mbm_opts, &descr));
+    MB_MASTER_CHECK((descr.size >= 1), ESP_ERR_INVALID_ARG, "mb table size is incorrect.");
 
     bool result = false;
     const char** comm_ip_table = (const char**)comm_info->ip_addr;
@@ -178,6 +181,7 @@ static esp_err_t mbc_tcp_master_start(void)
     MB_MASTER_CHECK((start), ESP_ERR_INVALID_STATE,
                             "mb stack could not connect to slaves for %d seconds.",
                             CONFIG_FMB_TCP_CONNECTION_TOUT_SEC);
+    mbm_stack_started = true;
     return ESP_OK;
 }
 
@@ -203,6 +207,7 @@ static esp_err_t mbc_tcp_master_destroy(void)
     (void)vEventGroupDelete(mbm_opts->mbm_event_group);
     mbm_opts->mbm_event_group = NULL;
     mbc_tcp_master_free_slave_list();
+    mbm_stack_started = false;
     free(mbm_interface_ptr); // free the memory allocated for options
     vMBPortSetMode((UCHAR)MB_PORT_INACTIVE);
     mbm_interface_ptr = NULL;
@@ -235,6 +240,9 @@ static esp_err_t mbc_tcp_master_set_descriptor(const mb_parameter_descriptor_t*
         // Is the slave already in the list?
         p_slave = mbc_tcp_master_find_slave_addr(reg_ptr->mb_slave_addr);
         // Add it to slave list if not there.
+        // The slaves of running stack are added by mbc_tcp_master_add_slave_ip() only.
+        MB_MASTER_CHECK((p_slave || !mbm_stack_started), ESP_ERR_INVALID_STATE,
+                            "mb unknown slave %u for cid #%u.", (unsigned)reg_ptr->mb_slave_addr, (unsigned)reg_ptr->cid);
         if (!p_slave) {
             // Is the IP address correctly defined for the slave?
             MB_MASTER_CHECK((comm_ip_table[slave_cnt]), ESP_ERR_INVALID_STATE, "mb missing IP address for cid #%u.", (unsigned)reg_ptr->cid);
@@ -242,8 +250,8 @@ static esp_err_t mbc_tcp_master_set_descriptor(const mb_parameter_descriptor_t*
             MB_MASTER_ASSERT(mbc_tcp_master_add_slave(idx, reg_ptr->mb_slave_addr, comm_ip_table[slave_cnt++]) == ESP_OK);
         }
     }
-    mbm_opts->mbm_param_descriptor_table = descriptor;
-    mbm_opts->mbm_param_descriptor_size = num_elements;
+    // The lookups in progress complete on the previous table
+    mbc_master_descr_publish(mbm_opts, descriptor, num_elements);
     return ESP_OK;
 }
 
@@ -268,6 +276,14 @@ static esp_err_t mbc_tcp_master_send_request(mb_param_request_t* request, void*
         // Set the buffer for callback function processing of received data
         mbm_opts->mbm_reg_buffer_ptr = (uint8_t*)data_ptr;
         mbm_opts->mbm_reg_buffer_size = mb_size;
+        mbm_opts->mbm_req_count++;
+        if (MB_MASTER_IS_VIEW_REQUEST(mbm_opts, data_ptr)) {
+            // Remember whose response the view will hold, see mbc_master_read_view()
+            mbm_opts->mbm_view_owner = xTaskGetCurrentTaskHandle();
+            mbm_opts->mbm_view_req = mbm_opts->mbm_req_count;
+            mbm_opts->mbm_view.data = NULL;
+            mbm_opts->mbm_view.reg_count = 0;
+        }
 
         vMBMasterRunResRelease();
 
@@ -311,6 +327,18 @@ static esp_err_t mbc_tcp_master_send_request(mb_param_request_t* request, void*
                                                                         (USHORT)mb_offset, (USHORT)mb_size,
                                                                         (LONG)MB_TCP_API_RESP_TICS);
                 break;
+#if MB_FUNC_OTHER_REP_SLAVEID_ENABLED
+            case MB_FUNC_OTHER_REPORT_SLAVEID:
+                // reg_size is the size of the data buffer in bytes
+                mb_error = eMBMasterReqReportSlaveID((UCHAR)mb_slave_addr, (LONG)MB_TCP_API_RESP_TICS);
+                break;
+#endif
+            case MB_FUNC_MASK_WRITE_REGISTER:
+                // data_ptr holds the AND mask followed by the OR mask
+                mb_error = eMBMasterReqMaskWriteHoldingRegister((UCHAR)mb_slave_addr, (USHORT)mb_offset,
+                                                                ((USHORT*)data_ptr)[0], ((USHORT*)data_ptr)[1],
+                                                                (LONG)MB_TCP_API_RESP_TICS);
+                break;
             case MB_FUNC_READ_INPUT_REGISTER:
                 mb_error = eMBMasterReqReadInputRegister((UCHAR)mb_slave_addr, (USHORT)mb_offset,
                                                             (USHORT)mb_size, (LONG)MB_TCP_API_RESP_TICS);
@@ -322,10 +350,15 @@ static esp_err_t mbc_tcp_master_send_request(mb_param_request_t* request, void*
         }
     } 
 
+    // Exception code of the slave, so the application can tell an illegal address from other failures
+    mbm_opts->mbm_exception = (mb_error == MB_MRE_EXE_FUN) ? (uint8_t)eMBMasterGetLastException() : 0;
+
     // Propagate the Modbus errors to higher level
     switch(mb_error)
     {
         case MB_MRE_NO_ERR:
+            // Keep the receive time stamp of the response to this request
+            mbm_opts->mbm_rx_timestamp = xMBMasterPortGetRxTimestamp();
             error = ESP_OK;
             break;
 
@@ -355,21 +388,36 @@ static esp_err_t mbc_tcp_master_send_request(mb_param_request_t* request, void*
     return error;
 }
 
-static esp_err_t mbc_tcp_master_get_cid_info(uint16_t cid, const mb_parameter_descriptor_t** param_buffer)
+// Look up a characteristic, the table stays held for the caller if hold is not NULL
+static esp_err_t mbc_tcp_master_get_cid_info(uint16_t cid, const mb_parameter_descriptor_t** param_buffer, unsigned* hold)
 {
     MB_MASTER_ASSERT(mbm_interface_ptr != NULL);
     mb_master_options_t* mbm_opts = &mbm_interface_ptr->opts;
 
     MB_MASTER_CHECK((param_buffer != NULL), ESP_ERR_INVALID_ARG, "mb incorrect data buffer pointer.");
-    MB_MASTER_CHECK((mbm_opts->mbm_param_descriptor_table != NULL), ESP_ERR_INVALID_ARG, "mb incorrect descriptor table or not set.");
-    MB_MASTER_CHECK((cid < mbm_opts->mbm_param_descriptor_size), ESP_ERR_NOT_FOUND, "mb incorrect cid of characteristic.");
-
-    // It is assumed that characteristics cid increased in the table
-    const mb_parameter_descriptor_t* reg_info = &mbm_opts->mbm_param_descriptor_table[cid];
-
-    MB_MASTER_CHECK((reg_info->param_key != NULL), ESP_ERR_INVALID_ARG, "mb incorrect characteristic key.");
-    *param_buffer = reg_info;
-    return ESP_OK;
+    mb_descr_table_t descr;
+    unsigned descr_idx = mbc_master_descr_acquire(mbm_opts, &descr);
+    esp_err_t error = ESP_OK;
+    if (descr.table == NULL) {
+        ESP_LOGE(TAG, "mb incorrect descriptor table or not set.");
+        error = ESP_ERR_INVALID_ARG;
+    } else if (cid >= descr.size) {
+        ESP_LOGE(TAG, "mb incorrect cid of characteristic.");
+        error = ESP_ERR_NOT_FOUND;
+    } else if (descr.table[cid].param_key == NULL) {
+        // It is assumed that characteristics cid increased in the table
+        ESP_LOGE(TAG, "mb incorrect characteristic key.");
+        error = ESP_ERR_INVALID_ARG;
+    } else {
+        *param_buffer = &descr.table[cid];
+    }
+    if ((error == ESP_OK) && hold) {
+        // Released by mbc_master_release_cid_info(), a table update waits for it
+        *hold = descr_idx;
+    } else {
+        mbc_master_descr_release(mbm_opts, descr_idx);
+    }
+    return error;
 }
 
 // Helper function to get modbus command for each type of Modbus register area
@@ -444,9 +492,11 @@ static esp_err_t mbc_tcp_master_set_request(char* name, mb_param_mode_t mode, mb
     MB_MASTER_CHECK((name != NULL), ESP_ERR_INVALID_ARG, "mb incorrect parameter name.");
     MB_MASTER_CHECK((request != NULL), ESP_ERR_INVALID_ARG, "mb incorrect request parameter.");
     MB_MASTER_CHECK((mode <= MB_PARAM_WRITE), ESP_ERR_INVALID_ARG, "mb incorrect mode.");
-    MB_MASTER_ASSERT(mbm_opts->mbm_param_descriptor_table != NULL);
-    const mb_parameter_descriptor_t* reg_ptr = mbm_opts->mbm_param_descriptor_table;
-    for (uint16_t counter = 0; counter < (mbm_opts->mbm_param_descriptor_size); counter++, reg_ptr++)
+    mb_descr_table_t descr;
+    unsigned descr_idx = mbc_master_descr_acquire(mbm_opts, &descr);
+    MB_MASTER_ASSERT(descr.table != NULL);
+    const mb_parameter_descriptor_t* reg_ptr = descr.table;
+    for (uint16_t counter = 0; counter < (descr.size); counter++, reg_ptr++)
     {
         // Check the cid of the parameter is equal to record number in the table
         // Check the length of name and parameter key strings from table
@@ -462,7 +512,11 @@ static esp_err_t mbc_tcp_master_set_request(char* name, mb_param_mode_t mode, mb
             request->reg_start = reg_ptr->mb_reg_start;
             request->reg_size = reg_ptr->mb_size;
             request->command = mbc_tcp_master_get_command(reg_ptr->mb_param_type, mode);
-            MB_MASTER_CHECK((request->command > 0), ESP_ERR_INVALID_ARG, "mb incorrect command or parameter type.");
+            if (request->command == 0) {
+                ESP_LOGE(TAG, "mb incorrect command or parameter type.");
+                error = ESP_ERR_INVALID_ARG;
+                break;
+            }
             if (reg_data != NULL) {
                 *reg_data = *reg_ptr; // Set the cid registered parameter data
             }
@@ -470,6 +524,8 @@ static esp_err_t mbc_tcp_master_set_request(char* name, mb_param_mode_t mode, mb
             break;
         }
     }
+    // The request works on its own copy of the descriptor
+    mbc_master_descr_release(mbm_opts, descr_idx);
     return error;
 }
 
@@ -591,6 +647,12 @@ eMBErrorCode eMBRegInputCBTcpMaster(UCHAR* pucRegBuffer, USHORT usAddress, USHOR
     if ((pucInputBuffer != NULL)
             && (usNRegs >= 1)
             && (usRegInputNregs == usRegs)) {
+        if (MB_MASTER_IS_VIEW_REQUEST(mbm_opts, pucInputBuffer)) {
+            // Borrow the registers from the receive frame
+            mbm_opts->mbm_view.data = pucRegBuffer;
+            mbm_opts->mbm_view.reg_count = usNRegs;
+            return eStatus;
+        }
         while (usRegs > 0) {
             _XFER_2_RD(pucInputBuffer, pucRegBuffer);
             usRegs -= 1;
@@ -626,6 +688,13 @@ eMBErrorCode eMBRegHoldingCBTcpMaster(UCHAR *pucRegBuffer, USHORT usAddress,
     // Check input and configuration parameters for correctness
     if ((pucHoldingBuffer != NULL) && (usRegHoldingNregs == usNRegs) && (usNRegs >= 1))
     {
+        if ((eMode == MB_REG_READ) && MB_MASTER_IS_VIEW_REQUEST(mbm_opts, pucHoldingBuffer))
+        {
+            // Borrow the registers from the receive frame
+            mbm_opts->mbm_view.data = pucRegBuffer;
+            mbm_opts->mbm_view.reg_count = usNRegs;
+            return eStatus;
+        }
         switch (eMode)
         {
         case MB_REG_WRITE:
@@ -763,6 +832,9 @@ esp_err_t mbc_tcp_master_create(void** handler)
     // Initialize interface properties
     mb_master_options_t* mbm_opts = &mbm_interface_ptr->opts;
     mbm_opts->port_type = MB_PORT_TCP_MASTER;
+    mbm_opts->mbm_rx_timestamp = 0;
+    mbm_opts->mbm_exception = 0;
+    mbc_master_descr_init(mbm_opts);
 
     vMBPortSetMode((UCHAR)MB_PORT_TCP_MASTER);
 
@@ -812,4 +884,55 @@ esp_err_t mbc_tcp_master_create(void** handler)
     return ESP_OK;
 }
 
+// Add slave to the slave list, the slave of running stack is connected between transactions
+esp_err_t mbc_tcp_master_add_slave_ip(uint8_t slave_addr, const char* ip_addr)
+{
+    MB_MASTER_CHECK((mbm_interface_ptr != NULL), ESP_ERR_INVALID_STATE, "Master interface uninitialized.");
+    mb_master_options_t* mbm_opts = &mbm_interface_ptr->opts;
+    MB_MASTER_CHECK((ip_addr != NULL), ESP_ERR_INVALID_ARG, "mb incorrect slave ip address.");
+    MB_MASTER_CHECK((mbc_tcp_master_find_slave_addr(slave_addr) == NULL), ESP_ERR_INVALID_STATE,
+                        "mb slave %u is already registered.", (unsigned)slave_addr);
+    MB_MASTER_CHECK((mbm_opts->mbm_slave_list_count < (MB_TCP_PORT_MAX_CONN - 1)),
+                        ESP_ERR_INVALID_STATE, "mb max number of slaves < %d.", MB_TCP_PORT_MAX_CONN);
+    uint16_t index = mbm_opts->mbm_slave_list_count;
+    if (mbm_stack_started) {
+        // Hold the stack resource, so the port applies the change between transactions
+        MB_MASTER_CHECK((xMBMasterRunResTake(MB_TCP_API_RESP_TICS) == TRUE), ESP_ERR_TIMEOUT, "mb stack is busy.");
+        BOOL result = xMBTCPPortMasterAddSlaveIp(index, ip_addr, slave_addr)
+                        && xMBTCPPortMasterWaitConfig(MB_TCP_CONNECTION_TOUT);
+        vMBMasterRunResRelease();
+        MB_MASTER_CHECK(result, ESP_ERR_INVALID_STATE, "mb stack add slave IP failed: %s.", ip_addr);
+    }
+    return mbc_tcp_master_add_slave(index, slave_addr, ip_addr);
+}
+
+// Remove slave from the slave list and close its connection
+esp_err_t mbc_tcp_master_remove_slave_ip(uint8_t slave_addr)
+{
+    MB_MASTER_CHECK((mbm_interface_ptr != NULL), ESP_ERR_INVALID_STATE, "Master interface uninitialized.");
+    mb_master_options_t* mbm_opts = &mbm_interface_ptr->opts;
+    mb_slave_addr_entry_t* p_slave = mbc_tcp_master_find_slave_addr(slave_addr);
+    MB_MASTER_CHECK((p_slave != NULL), ESP_ERR_NOT_FOUND, "mb slave %u is not registered.", (unsigned)slave_addr);
+    // The slave must be excluded from the description table first
+    mb_descr_table_t descr;
+    unsigned descr_idx = mbc_master_descr_acquire(mbm_opts, &descr);
+    bool used = false;
+    for (size_t idx = 0; descr.table && (idx < descr.size) && !used; idx++) {
+        used = (descr.table[idx].mb_slave_addr == slave_addr);
+    }
+    mbc_master_descr_release(mbm_opts, descr_idx);
+    MB_MASTER_CHECK(!used, ESP_ERR_INVALID_STATE, "mb slave %u is used in the descriptor table.", (unsigned)slave_addr);
+    if (mbm_stack_started) {
+        MB_MASTER_CHECK((xMBMasterRunResTake(MB_TCP_API_RESP_TICS) == TRUE), ESP_ERR_TIMEOUT, "mb stack is busy.");
+        BOOL result = xMBTCPPortMasterRemoveSlave(slave_addr)
+                        && xMBTCPPortMasterWaitConfig(MB_TCP_CONNECTION_TOUT);
+        vMBMasterRunResRelease();
+        MB_MASTER_CHECK(result, ESP_ERR_INVALID_STATE, "mb stack remove slave failed: %u.", (unsigned)slave_addr);
+    }
+    LIST_REMOVE(p_slave, entries);
+    mbm_opts->mbm_slave_list_count--;
+    free(p_slave);
+    return ESP_OK;
+}
+
 #endif //#if MB_MASTER_TCP_ENABLED
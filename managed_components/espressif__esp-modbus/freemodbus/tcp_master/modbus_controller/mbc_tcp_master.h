@@ -30,4 +30,28 @@
  */
 esp_err_t mbc_tcp_master_create(void** handler);
 
+/**
+ * @brief Add slave to the TCP master, the slave of running stack is connected between transactions
+ *
+ * @param slave_addr slave short address (UID)
+ * @param ip_addr slave IP address string, must be valid until the slave is removed
+ * @return
+ *     - ESP_OK   Success
+ *     - ESP_ERR_INVALID_STATE the slave is already registered or the stack failed to add it
+ *     - ESP_ERR_TIMEOUT the stack is busy
+ */
+esp_err_t mbc_tcp_master_add_slave_ip(uint8_t slave_addr, const char* ip_addr);
+
+/**
+ * @brief Remove slave from the TCP master and close its connection
+ *
+ * @param slave_addr slave short address (UID)
+ * @return
+ *     - ESP_OK   Success
+ *     - ESP_ERR_NOT_FOUND the slave is not registered
+ *     - ESP_ERR_INVALID_STATE the slave is used in the descriptor table or the stack failed to remove it
+ *     - ESP_ERR_TIMEOUT the stack is busy
+ */
+esp_err_t mbc_tcp_master_remove_slave_ip(uint8_t slave_addr);
+
 #endif // _MODBUS_TCP_CONTROLLER_SLAVE
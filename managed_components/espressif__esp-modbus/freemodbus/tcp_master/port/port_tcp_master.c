@@ -68,6 +68,8 @@
 #define MB_EVENT_REQ_ERR_MASK           ( EV_MASTER_PROCESS_SUCCESS )
 
 #define MB_EVENT_WAIT_TOUT_MS           ( 3000 )
+#define MB_TCP_IDLE_POLL_MS             ( 100 )     // Period to apply slave list changes while idle
+#define MB_TCP_PENDING_RETRY_TIMEOUT    ( 1000000 ) // Connection retry period for slaves added at runtime in uS
 
 #define MB_TCP_READ_TICK_MS             ( 1 )
 #define MB_TCP_READ_BUF_RETRY_CNT       ( 4 )
@@ -82,6 +84,7 @@ static MbPortConfig_t xMbPortConfig;
 static EventGroupHandle_t xMasterEventHandle = NULL;
 static SemaphoreHandle_t xShutdownSemaphore = NULL;
 static EventBits_t xMasterEvent = 0;
+static int64_t xPendingRetryTime = 0;
 
 /* ----------------------- Static functions ---------------------------------*/
 static void vMBTCPPortMasterTask(void *pvParameters);
@@ -114,6 +117,7 @@ xMBMasterTCPPortInit( USHORT usTCPPort )
     for(int idx = 0; idx < MB_TCP_PORT_MAX_CONN; xMbPortConfig.pxMbSlaveInfo[idx] = NULL, idx++);
 
     xMbPortConfig.xConnectQueue = NULL;
+    xMbPortConfig.xConfigResult = FALSE;
     xMbPortConfig.usPort = usTCPPort;
     xMbPortConfig.usMbSlaveInfoCount = 0;
     xMbPortConfig.ucCurSlaveIndex = 1;
@@ -127,6 +131,13 @@ xMBMasterTCPPortInit( USHORT usTCPPort )
         return FALSE;
     }
 
+    xMbPortConfig.xConfigDoneSema = xSemaphoreCreateBinary();
+    if (xMbPortConfig.xConfigDoneSema == NULL)
+    {
+        ESP_LOGE(TAG, "TCP master config semaphore creation failure.");
+        return FALSE;
+    }
+
     // Create task for packet processing
     BaseType_t xErr = xTaskCreatePinnedToCore(vMBTCPPortMasterTask,
                                               "tcp_master_task",
@@ -152,8 +163,10 @@ static MbSlaveInfo_t *vMBTCPPortMasterFindSlaveInfo(UCHAR ucSlaveAddr)
 {
     int xIndex;
     BOOL xFound = false;
-    for (xIndex = 0; xIndex < xMbPortConfig.usMbSlaveInfoCount; xIndex++) {
-        if (xMbPortConfig.pxMbSlaveInfo[xIndex]->ucSlaveAddr == ucSlaveAddr) {
+    // The slots can be freed at runtime, check all of them
+    for (xIndex = 0; xIndex < MB_TCP_PORT_MAX_CONN; xIndex++) {
+        if (xMbPortConfig.pxMbSlaveInfo[xIndex]
+                && (xMbPortConfig.pxMbSlaveInfo[xIndex]->ucSlaveAddr == ucSlaveAddr)) {
             xMbPortConfig.pxMbSlaveCurrInfo = xMbPortConfig.pxMbSlaveInfo[xIndex];
             xFound = TRUE;
             xMbPortConfig.ucCurSlaveIndex = xIndex;
@@ -257,8 +270,8 @@ static int64_t xMBTCPPortMasterGetRespTimeLeft(MbSlaveInfo_t *pxInfo)
         return 0;
     }
     int64_t xTimeStamp = xMBTCPGetTimeStamp() - pxInfo->xSendTimeStamp;
-    return (xTimeStamp > (1000 * MB_MASTER_TIMEOUT_MS_RESPOND)) ? 0 :
-                    (MB_MASTER_TIMEOUT_MS_RESPOND - (xTimeStamp / 1000) - 1);
+    int64_t xTimeoutMs = (int64_t)ulMBMasterPortTimersRespondTimeoutGet();
+    return (xTimeStamp > (1000 * xTimeoutMs)) ? 0 : (xTimeoutMs - (xTimeStamp / 1000) - 1);
 }
 
 // Wait socket ready to read state
@@ -498,6 +511,8 @@ BOOL xMBTCPPortMasterAddSlaveIp(const USHORT usIndex, const CHAR *pcIpStr, UCHAR
     BOOL xRes = FALSE;
     MbSlaveAddrInfo_t xSlaveAddrInfo = {0};
     MB_PORT_CHECK(xMbPortConfig.xConnectQueue != NULL, FALSE, "Wrong slave IP address to add.");
+    // Drop the result of previous change which was not waited for
+    (void)xSemaphoreTake(xMbPortConfig.xConfigDoneSema, 0);
     if (pcIpStr && (usIndex != 0xFF)) {
         xRes = xMBTCPPortMasterCheckHost(pcIpStr, NULL);
     }
@@ -511,6 +526,28 @@ BOOL xMBTCPPortMasterAddSlaveIp(const USHORT usIndex, const CHAR *pcIpStr, UCHAR
     return xRes;
 }
 
+BOOL xMBTCPPortMasterRemoveSlave(UCHAR ucSlaveAddress)
+{
+    MbSlaveAddrInfo_t xSlaveAddrInfo = {0};
+    MB_PORT_CHECK(xMbPortConfig.xConnectQueue != NULL, FALSE, "Wrong slave to remove.");
+    (void)xSemaphoreTake(xMbPortConfig.xConfigDoneSema, 0);
+    xSlaveAddrInfo.ucSlaveAddr = ucSlaveAddress;
+    xSlaveAddrInfo.xRemove = TRUE;
+    BaseType_t xStatus = xQueueSend(xMbPortConfig.xConnectQueue, (void *)&xSlaveAddrInfo, 100);
+    MB_PORT_CHECK((xStatus == pdTRUE), FALSE, "FAIL to remove slave: %u.", (unsigned)ucSlaveAddress);
+    return TRUE;
+}
+
+BOOL xMBTCPPortMasterWaitConfig(TickType_t xTimeout)
+{
+    MB_PORT_CHECK(xMbPortConfig.xConfigDoneSema != NULL, FALSE, "Port is not initialized.");
+    if (xSemaphoreTake(xMbPortConfig.xConfigDoneSema, xTimeout) != pdTRUE) {
+        ESP_LOGE(TAG, "Slave list change is not applied in time.");
+        return FALSE;
+    }
+    return xMbPortConfig.xConfigResult;
+}
+
 // Unblocking connect function
 static err_t xMBTCPPortMasterConnect(MbSlaveInfo_t *pxInfo)
 {
@@ -662,6 +699,141 @@ static void xMBTCPPortMasterFsmSetError(eMBMasterErrorEventType xErrType, eMBMas
     xMBMasterPortEventPost(xPostEvent);
 }
 
+// Register the slave in the first free slot of connection info structure
+static MbSlaveInfo_t *xMBTCPPortMasterRegisterSlave(const MbSlaveAddrInfo_t *pxAddrInfo)
+{
+    int xSlot = -1;
+    for (int xIndex = 0; xIndex < MB_TCP_PORT_MAX_CONN; xIndex++) {
+        if (!xMbPortConfig.pxMbSlaveInfo[xIndex]) {
+            xSlot = xIndex;
+            break;
+        }
+    }
+    if (xSlot < 0) {
+        ESP_LOGE(TAG, "Exceeds maximum connections limit=%u.", (unsigned)MB_TCP_PORT_MAX_CONN);
+        return NULL;
+    }
+    MbSlaveInfo_t *pxInfo = calloc(1, sizeof(MbSlaveInfo_t));
+    if (!pxInfo) {
+        ESP_LOGE(TAG, "Slave(#%d), info structure allocation fail.", xSlot);
+        return NULL;
+    }
+    pxInfo->pucRcvBuf = calloc(MB_TCP_BUF_SIZE, sizeof(UCHAR));
+    if (!pxInfo->pucRcvBuf) {
+        ESP_LOGE(TAG, "Slave(#%d), receive buffer allocation fail.", xSlot);
+        free(pxInfo);
+        return NULL;
+    }
+    pxInfo->usRcvPos = 0;
+    pxInfo->pcIpAddr = pxAddrInfo->pcIPAddr;
+    pxInfo->xSockId = -1;
+    pxInfo->xError = -1;
+    pxInfo->xRecvTimeStamp = xMBTCPGetTimeStamp();
+    pxInfo->xSendTimeStamp = xMBTCPGetTimeStamp();
+    pxInfo->xMbProto = MB_PROTO_TCP;
+    pxInfo->ucSlaveAddr = pxAddrInfo->ucSlaveAddr;
+    pxInfo->xIndex = pxAddrInfo->usIndex;
+    pxInfo->usTidCnt = (USHORT)(xSlot << 8U);
+    // Register slave
+    xMbPortConfig.pxMbSlaveInfo[xSlot] = pxInfo;
+    xMbPortConfig.usMbSlaveInfoCount++;
+    ESP_LOGI(TAG, "Add slave IP: %s", pxAddrInfo->pcIPAddr);
+    return pxInfo;
+}
+
+// Close the connection of the slave and release its slot
+static void vMBTCPPortMasterUnregisterSlave(MbSlaveInfo_t *pxInfo, fd_set *pxConnSet, USHORT *pusSlaveConnCnt)
+{
+    if ((pxInfo->xSockId >= 0) && FD_ISSET(pxInfo->xSockId, pxConnSet)) {
+        FD_CLR(pxInfo->xSockId, pxConnSet);
+        if (*pusSlaveConnCnt) {
+            (*pusSlaveConnCnt)--;
+        }
+    }
+    xMBTCPPortMasterCloseConnection(pxInfo);
+    for (int xIndex = 0; xIndex < MB_TCP_PORT_MAX_CONN; xIndex++) {
+        if (xMbPortConfig.pxMbSlaveInfo[xIndex] == pxInfo) {
+            xMbPortConfig.pxMbSlaveInfo[xIndex] = NULL;
+            xMbPortConfig.usMbSlaveInfoCount--;
+        }
+    }
+    if (xMbPortConfig.pxMbSlaveCurrInfo == pxInfo) {
+        xMbPortConfig.pxMbSlaveCurrInfo = NULL;
+    }
+    ESP_LOGI(TAG, "Remove slave IP: %s", pxInfo->pcIpAddr);
+    free(pxInfo->pucRcvBuf);
+    free(pxInfo);
+}
+
+// Connect the slave registered at runtime, the slave stays pending until connected
+static void vMBTCPPortMasterConnectSlave(MbSlaveInfo_t *pxInfo, fd_set *pxConnSet, USHORT *pusSlaveConnCnt)
+{
+    err_t xErr = xMBTCPPortMasterConnect(pxInfo);
+    pxInfo->xError = xErr;
+    if ((xErr != ERR_OK) || FD_ISSET(pxInfo->xSockId, pxConnSet)) {
+        ESP_LOGD(TAG, MB_SLAVE_FMT(", connection is pending, error = 0x%x."),
+                    (int)pxInfo->xIndex, (int)pxInfo->xSockId, pxInfo->pcIpAddr, (int)xErr);
+        return;
+    }
+    FD_SET(pxInfo->xSockId, pxConnSet);
+    (*pusSlaveConnCnt)++;
+    pxInfo->xRecvTimeStamp = xMBTCPGetTimeStamp();
+    pxInfo->xSendTimeStamp = xMBTCPGetTimeStamp();
+    ESP_LOGI(TAG, MB_SLAVE_FMT(", connected %u slave(s)."),
+                (int)pxInfo->xIndex, (int)pxInfo->xSockId, pxInfo->pcIpAddr, (unsigned)*pusSlaveConnCnt);
+}
+
+// Apply the slave list changes requested while the stack is running.
+// Called by the port task between transactions only.
+static void vMBTCPPortMasterApplyConfig(fd_set *pxConnSet, USHORT *pusSlaveConnCnt, TickType_t xWaitTicks)
+{
+    MbSlaveAddrInfo_t xSlaveAddrInfo = { 0 };
+    while (xQueueReceive(xMbPortConfig.xConnectQueue, (void*)&xSlaveAddrInfo, xWaitTicks) == pdTRUE) {
+        xWaitTicks = 0;
+        MbSlaveInfo_t *pxInfo = NULL;
+        for (int xIndex = 0; (xIndex < MB_TCP_PORT_MAX_CONN) && !pxInfo; xIndex++) {
+            if (xMbPortConfig.pxMbSlaveInfo[xIndex]
+                    && (xMbPortConfig.pxMbSlaveInfo[xIndex]->ucSlaveAddr == xSlaveAddrInfo.ucSlaveAddr)) {
+                pxInfo = xMbPortConfig.pxMbSlaveInfo[xIndex];
+            }
+        }
+        BOOL xResult = FALSE;
+        if (xSlaveAddrInfo.xRemove) {
+            if (pxInfo) {
+                vMBTCPPortMasterUnregisterSlave(pxInfo, pxConnSet, pusSlaveConnCnt);
+                xResult = TRUE;
+            } else {
+                ESP_LOGE(TAG, "Slave info for short address %u not found.", (unsigned)xSlaveAddrInfo.ucSlaveAddr);
+            }
+        } else if (!xSlaveAddrInfo.pcIPAddr) {
+            // The end of list marker is used on start only
+            xResult = TRUE;
+        } else if (pxInfo) {
+            ESP_LOGE(TAG, "Slave short address %u is already registered.", (unsigned)xSlaveAddrInfo.ucSlaveAddr);
+        } else {
+            pxInfo = xMBTCPPortMasterRegisterSlave(&xSlaveAddrInfo);
+            if (pxInfo) {
+                vMBTCPPortMasterConnectSlave(pxInfo, pxConnSet, pusSlaveConnCnt);
+                xResult = TRUE;
+            }
+        }
+        xMbPortConfig.xConfigResult = xResult;
+        xSemaphoreGive(xMbPortConfig.xConfigDoneSema);
+    }
+    // Retry the connection of pending slaves from time to time
+    int64_t xTime = xMBTCPGetTimeStamp();
+    if ((*pusSlaveConnCnt < xMbPortConfig.usMbSlaveInfoCount)
+            && ((xTime - xPendingRetryTime) > MB_TCP_PENDING_RETRY_TIMEOUT)) {
+        xPendingRetryTime = xTime;
+        for (int xIndex = 0; xIndex < MB_TCP_PORT_MAX_CONN; xIndex++) {
+            MbSlaveInfo_t *pxInfo = xMbPortConfig.pxMbSlaveInfo[xIndex];
+            if (pxInfo && ((pxInfo->xSockId < 0) || !FD_ISSET(pxInfo->xSockId, pxConnSet))) {
+                vMBTCPPortMasterConnectSlave(pxInfo, pxConnSet, pusSlaveConnCnt);
+            }
+        }
+    }
+}
+
 static void vMBTCPPortMasterTask(void *pvParameters)
 {
     MbSlaveInfo_t *pxInfo;
@@ -687,43 +859,22 @@ static void vMBTCPPortMasterTask(void *pvParameters)
                 xMBMasterPortEventPost(EV_MASTER_READY);
                 break;
             }
-            if (xMbPortConfig.usMbSlaveInfoCount > MB_TCP_PORT_MAX_CONN) {
-                ESP_LOGE(TAG, "Exceeds maximum connections limit=%u.", (unsigned)MB_TCP_PORT_MAX_CONN);
-                break;
-            }
-            pxInfo = calloc(1, sizeof(MbSlaveInfo_t));
-            if (!pxInfo) {
-                ESP_LOGE(TAG, "Slave(#%u), info structure allocation fail.",
-                         (unsigned)xMbPortConfig.usMbSlaveInfoCount);
-                free(pxInfo);
+            if (!xMBTCPPortMasterRegisterSlave(&xSlaveAddrInfo)) {
                 break;
             }
-            pxInfo->pucRcvBuf = calloc(MB_TCP_BUF_SIZE, sizeof(UCHAR));
-            if (!pxInfo->pucRcvBuf) {
-                ESP_LOGE(TAG, "Slave(#%u), receive buffer allocation fail.",
-                         (unsigned)xMbPortConfig.usMbSlaveInfoCount);
-                free(pxInfo->pucRcvBuf);
-                break;
-            }
-            pxInfo->usRcvPos = 0;
-            pxInfo->pcIpAddr = xSlaveAddrInfo.pcIPAddr;
-            pxInfo->xSockId = -1;
-            pxInfo->xError = -1;
-            pxInfo->xRecvTimeStamp = xMBTCPGetTimeStamp();
-            pxInfo->xSendTimeStamp = xMBTCPGetTimeStamp();
-            pxInfo->xMbProto = MB_PROTO_TCP;
-            pxInfo->ucSlaveAddr = xSlaveAddrInfo.ucSlaveAddr;
-            pxInfo->xIndex = xSlaveAddrInfo.usIndex;
-            pxInfo->usTidCnt = (USHORT)(xMbPortConfig.usMbSlaveInfoCount << 8U);
-            // Register slave
-            xMbPortConfig.pxMbSlaveInfo[xMbPortConfig.usMbSlaveInfoCount++] = pxInfo;
-            ESP_LOGI(TAG, "Add slave IP: %s", xSlaveAddrInfo.pcIPAddr);
         }
     }
 
     // Main connection cycle
     while (1)
     {
+        FD_ZERO(&xConnSet);
+        usSlaveConnCnt = 0;
+        // All slaves are removed at runtime, wait for new ones
+        while (!xMbPortConfig.usMbSlaveInfoCount) {
+            vMBTCPPortMasterApplyConfig(&xConnSet, &usSlaveConnCnt, pdMS_TO_TICKS(MB_EVENT_WAIT_TOUT_MS));
+            xMBTCPPortMasterCheckShutdown();
+        }
         ESP_LOGI(TAG, "Connecting to slaves...");
         xTime = xMBTCPGetTimeStamp();
         usSlaveConnCnt = 0;
@@ -794,9 +945,18 @@ static void vMBTCPPortMasterTask(void *pvParameters)
 
         // Slave receive data loop
         while(usSlaveConnCnt) {
+            // Apply the slave list changes, they are requested between transactions only
+            vMBTCPPortMasterApplyConfig(&xConnSet, &usSlaveConnCnt, 0);
+            if (!usSlaveConnCnt) {
+                break;
+            }
             xReadSet = xConnSet;
             // Check transmission event to clear appropriate bit.
-            xMBMasterPortFsmWaitConfirmation(EV_MASTER_FRAME_TRANSMIT, pdMS_TO_TICKS(MB_EVENT_WAIT_TOUT_MS));
+            if (!xMBMasterPortFsmWaitConfirmation(EV_MASTER_FRAME_TRANSMIT, pdMS_TO_TICKS(MB_TCP_IDLE_POLL_MS))) {
+                // No transaction is started, nothing to receive
+                xMBTCPPortMasterCheckShutdown();
+                continue;
+            }
             // Synchronize state machine with send packet event
             if (xMBMasterPortFsmWaitConfirmation(EV_MASTER_FRAME_SENT, pdMS_TO_TICKS(MB_EVENT_WAIT_TOUT_MS))) {
                 ESP_LOGD(TAG, "FSM Synchronized with sent event.");
@@ -841,6 +1001,8 @@ static void vMBTCPPortMasterTask(void *pvParameters)
             } else {
                 // Check to make sure that active slave data is ready
                 if (FD_ISSET(pxCurrInfo->xSockId, &xReadSet)) {
+                    // Time stamp of the response is taken as soon as the socket is readable
+                    int64_t xRxTimeStamp = xMBTCPGetTimeStamp();
                     int xRet = ERR_BUF;
                     for (int retry = 0; (xRet == ERR_BUF) && (retry < MB_TCP_READ_BUF_RETRY_CNT); retry++) {
                         xRet = vMBTCPPortMasterReadPacket(pxCurrInfo);
@@ -850,6 +1012,7 @@ static void vMBTCPPortMasterTask(void *pvParameters)
                     }
                     if (xRet > 0) {
                         // Response received correctly, send an event to stack
+                        vMBMasterPortSetRxTimestamp((uint64_t)xRxTimeStamp);
                         xMBTCPPortMasterFsmSetError(EV_ERROR_INIT, EV_MASTER_FRAME_RECEIVED);
                         ESP_LOGD(TAG, MB_SLAVE_FMT(", frame received."),
                                     (int)pxCurrInfo->xIndex, (int)pxCurrInfo->xSockId, pxCurrInfo->pcIpAddr);
@@ -930,6 +1093,8 @@ void vMBMasterTCPPortDisable(void)
 void vMBMasterTCPPortClose(void)
 {
     vQueueDelete(xMbPortConfig.xConnectQueue);
+    vSemaphoreDelete(xMbPortConfig.xConfigDoneSema);
+    xMbPortConfig.xConfigDoneSema = NULL;
     vMBMasterPortTimerClose();
     // Release resources for the event queue.
     vMBMasterPortEventClose();
@@ -43,6 +43,7 @@
 
 #include "lwip/sys.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "port.h"
 
 /* ----------------------- Defines ------------------------------------------*/
@@ -80,6 +81,8 @@ typedef struct {
 typedef struct {
     TaskHandle_t  xMbTcpTaskHandle;     /*!< Master TCP/UDP handling task handle */
     QueueHandle_t xConnectQueue;        /*!< Master connection queue */
+    SemaphoreHandle_t xConfigDoneSema;  /*!< Master slave list change is applied */
+    BOOL xConfigResult;                 /*!< Master result of the last slave list change */
     USHORT usPort;                      /*!< Master TCP/UDP port number */
     USHORT usMbSlaveInfoCount;          /*!< Master count of connected slaves */
     USHORT ucCurSlaveIndex;             /*!< Master current processing slave index */
@@ -94,6 +97,7 @@ typedef struct {
     USHORT usIndex;                     /*!< index of the address info */
     const char* pcIPAddr;               /*!< represents the IP address of the slave */
     UCHAR ucSlaveAddr;                  /*!< slave unit ID (UID) field for MBAP frame  */
+    BOOL xRemove;                       /*!< remove the slave instead of adding */
 } MbSlaveAddrInfo_t;
 
 /* ----------------------- Function prototypes ------------------------------*/
@@ -110,6 +114,26 @@ typedef struct {
  */
 BOOL xMBTCPPortMasterAddSlaveIp(const USHORT usIndex, const CHAR* pcIpStr, UCHAR ucSlaveAddress);
 
+/**
+ * Removes registered slave and closes its connection, used when the stack is running
+ *
+ * @param ucSlaveAddress slave unit ID (UID) to remove
+ *
+ * @return TRUE if the request is queued, else FALSE
+ */
+BOOL xMBTCPPortMasterRemoveSlave(UCHAR ucSlaveAddress);
+
+/**
+ * Waits until the port task applies the slave list change requested by
+ * xMBTCPPortMasterAddSlaveIp() or xMBTCPPortMasterRemoveSlave() while the stack is running.
+ * The change is applied between transactions.
+ *
+ * @param xTimeout - timeout in ticks to wait for the change
+ *
+ * @return TRUE if the change is applied successfully, else FALSE
+ */
+BOOL xMBTCPPortMasterWaitConfig(TickType_t xTimeout);
+
 /**
  * Keeps FSM event handle and mask then wait for Master stack to start
  *
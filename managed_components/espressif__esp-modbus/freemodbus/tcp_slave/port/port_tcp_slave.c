@@ -57,7 +57,7 @@
 #include "port_tcp_slave.h"
 #include "esp_modbus_common.h"      // for common types for network options
 
-#if MB_TCP_ENABLED
+#if MB_TCP_ENABLED && !CONFIG_FMB_TCP_SLAVE_NETCONN
 
 /* ----------------------- Defines  -----------------------------------------*/
 #define MB_TCP_DISCONNECT_TIMEOUT       ( CONFIG_FMB_TCP_CONNECTION_TOUT_SEC * 1000000 ) // disconnect timeout in uS
@@ -746,4 +746,4 @@ xMBTCPPortSendResponse( UCHAR * pucMBTCPFrame, USHORT usTCPLength )
     return bFrameSent;
 }
 
-#endif //#if MB_TCP_ENABLED
+#endif //#if MB_TCP_ENABLED && !CONFIG_FMB_TCP_SLAVE_NETCONN
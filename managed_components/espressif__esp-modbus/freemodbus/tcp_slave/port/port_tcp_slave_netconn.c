@@ -0,0 +1,403 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// port_tcp_slave_netconn.c
+// Modbus TCP slave port built on the lwIP netconn API.
+// The MBAP header is parsed directly from the received pbuf chain and the
+// request is placed into the frame buffer with one copy, without the BSD socket
+// layer (select(), socket mailboxes and recv() staging) in the path.
+
+/* ----------------------- System includes ----------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+/* ----------------------- lwIP includes ------------------------------------*/
+#include "lwip/err.h"
+#include "lwip/api.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mb.h"
+#include "mbport.h"
+#include "port.h"
+#include "mbframe.h"
+#include "port_tcp_slave.h"
+#include "esp_modbus_common.h"      // for common types for network options
+
+#if MB_TCP_ENABLED && CONFIG_FMB_TCP_SLAVE_NETCONN
+
+/* ----------------------- Defines  -----------------------------------------*/
+#define MB_TCP_DISCONNECT_TIMEOUT       ( CONFIG_FMB_TCP_CONNECTION_TOUT_SEC * 1000000 ) // disconnect timeout in uS
+#define MB_TCP_RESP_TIMEOUT_MS          ( MB_MASTER_TIMEOUT_MS_RESPOND - 1 ) // slave response time limit
+#define MB_TCP_IDLE_CHECK_MS            ( 1000 ) // period to check idle connections
+#define MB_TCP_MBAP_SIZE                ( MB_TCP_FUNC ) // MBAP header size including UID
+
+// Notification bits of the server task
+#define MB_TCP_NOTIFY_NET               ( 1UL << 0 ) // connection event from lwIP
+#define MB_TCP_NOTIFY_RESP              ( 1UL << 1 ) // response is sent by the stack
+
+/* ----------------------- Type definitions ---------------------------------*/
+typedef struct {
+    int xIndex;                     /*!< Client index */
+    struct netconn* pxConn;         /*!< Client connection */
+    struct pbuf* pxRxChain;         /*!< Received data not yet consumed as a frame */
+    UCHAR* pucFrame;                /*!< Request buffer, the response is built in place */
+    USHORT usFrameLen;              /*!< Length of the request in the buffer */
+    USHORT usTidCnt;                /*!< TID of the current request */
+    int64_t xRecvTimeStamp;         /*!< Last request timestamp */
+    int64_t xSendTimeStamp;         /*!< Last response timestamp */
+    CHAR cIpAddr[IPADDR_STRLEN_MAX];/*!< Client IP address */
+} MbNetconnClient_t;
+
+/* ----------------------- Prototypes ---------------------------------------*/
+void vMBPortEventClose( void );
+
+/* ----------------------- Static variables ---------------------------------*/
+static const char *TAG = "MB_TCP_SLAVE_NETCONN";
+static struct netconn* pxListenConn = NULL;
+static MbNetconnClient_t* pxClients[MB_TCP_PORT_MAX_CONN] = { 0 };
+static MbNetconnClient_t* pxCurClient = NULL;
+static TaskHandle_t xServerTaskHandle = NULL;
+static SemaphoreHandle_t xShutdownSemaphore = NULL;
+static volatile BOOL xShutdown = FALSE;
+static MbSlavePortConfig_t xConfig = { 0 };
+
+/* ----------------------- Static functions ---------------------------------*/
+// Called from the tcpip thread on every connection event, just wake the server task
+static void vMBTCPPortNetconnEvent(struct netconn* pxConn, enum netconn_evt xEvent, u16_t usLen)
+{
+    if ((xEvent == NETCONN_EVT_RCVPLUS) && xServerTaskHandle) {
+        xTaskNotify(xServerTaskHandle, MB_TCP_NOTIFY_NET, eSetBits);
+    }
+}
+
+static void vMBTCPPortFreeClient(MbNetconnClient_t* pxClient)
+{
+    if (!pxClient) {
+        return;
+    }
+    if (pxClient->pxConn) {
+        netconn_close(pxClient->pxConn);
+        netconn_delete(pxClient->pxConn);
+    }
+    if (pxClient->pxRxChain) {
+        pbuf_free(pxClient->pxRxChain);
+    }
+    free(pxClient->pucFrame);
+    if (pxCurClient == pxClient) {
+        pxCurClient = NULL;
+    }
+    pxClients[pxClient->xIndex] = NULL;
+    if (xConfig.usClientCount) {
+        xConfig.usClientCount--;
+    }
+    free(pxClient);
+}
+
+static struct netconn* pxMBTCPPortListen(void)
+{
+    MB_PORT_CHECK((xConfig.eMbProto == MB_PROTO_TCP), NULL, "Only TCP is supported by netconn port.");
+    enum netconn_type xType = (xConfig.xIpVer == MB_PORT_IPV4) ? NETCONN_TCP : NETCONN_TCP_IPV6;
+    struct netconn* pxConn = netconn_new_with_callback(xType, vMBTCPPortNetconnEvent);
+    MB_PORT_CHECK(pxConn, NULL, "Listen connection allocation failure.");
+
+    ip_addr_t xBindAddr;
+    ip_addr_set_any((xConfig.xIpVer == MB_PORT_IPV6), &xBindAddr);
+    if (xConfig.pcBindAddr && !ipaddr_aton(xConfig.pcBindAddr, &xBindAddr)) {
+        ESP_LOGE(TAG, "Incorrect bind address %s, bind to any.", xConfig.pcBindAddr);
+        ip_addr_set_any((xConfig.xIpVer == MB_PORT_IPV6), &xBindAddr);
+    }
+    err_t xErr = netconn_bind(pxConn, &xBindAddr, xConfig.usPort);
+    if (xErr == ERR_OK) {
+        xErr = netconn_listen(pxConn);
+    }
+    if (xErr != ERR_OK) {
+        ESP_LOGE(TAG, "Listen on port %u failed, err = %d.", (unsigned)xConfig.usPort, (int)xErr);
+        netconn_delete(pxConn);
+        return NULL;
+    }
+    netconn_set_nonblocking(pxConn, 1);
+    ESP_LOGI(TAG, "Listener on port: %u", (unsigned)xConfig.usPort);
+    return pxConn;
+}
+
+static void vMBTCPPortAccept(void)
+{
+    struct netconn* pxConn = NULL;
+    while (netconn_accept(pxListenConn, &pxConn) == ERR_OK) {
+        int i = 0;
+        for (i = 0; (i < MB_TCP_PORT_MAX_CONN) && pxClients[i]; i++);
+        if (i == MB_TCP_PORT_MAX_CONN) {
+            ESP_LOGE(TAG, "Fail to accept connection, only %u connections supported.", (unsigned)MB_TCP_PORT_MAX_CONN);
+            netconn_close(pxConn);
+            netconn_delete(pxConn);
+            continue;
+        }
+        MbNetconnClient_t* pxClient = calloc(1, sizeof(MbNetconnClient_t));
+        UCHAR* pucFrame = calloc(MB_TCP_BUF_SIZE, sizeof(UCHAR));
+        if (!pxClient || !pucFrame) {
+            ESP_LOGE(TAG, "Client info allocation fail.");
+            free(pxClient);
+            free(pucFrame);
+            netconn_close(pxConn);
+            netconn_delete(pxConn);
+            continue;
+        }
+        pxClient->xIndex = i;
+        pxClient->pxConn = pxConn;
+        pxClient->pucFrame = pucFrame;
+        pxClient->xRecvTimeStamp = esp_timer_get_time();
+        netconn_set_nonblocking(pxConn, 1);
+        // Responses are sent as soon as they are ready
+        LOCK_TCPIP_CORE();
+        tcp_nagle_disable(pxConn->pcb.tcp);
+        UNLOCK_TCPIP_CORE();
+        ip_addr_t xAddr;
+        u16_t usPort = 0;
+        if (netconn_peer(pxConn, &xAddr, &usPort) == ERR_OK) {
+            ipaddr_ntoa_r(&xAddr, pxClient->cIpAddr, sizeof(pxClient->cIpAddr));
+        }
+        pxClients[i] = pxClient;
+        xConfig.usClientCount++;
+        ESP_LOGI(TAG, "Client %d, accept connection from address: %s", i, pxClient->cIpAddr);
+    }
+}
+
+// Executes one transaction for the complete frame in the client buffer
+static void vMBTCPPortProcessFrame(MbNetconnClient_t* pxClient)
+{
+    pxClient->usTidCnt = MB_TCP_GET_FIELD(pxClient->pucFrame, MB_TCP_TID);
+    pxClient->xRecvTimeStamp = esp_timer_get_time();
+    pxCurClient = pxClient;
+#if MB_TCP_DEBUG
+    prvvMBTCPLogFrame(TAG, pxClient->pucFrame, pxClient->usFrameLen);
+#endif
+    // Drop any stale completion and let the stack process the frame
+    (void)xTaskNotifyWait(MB_TCP_NOTIFY_RESP, 0, NULL, 0);
+    xMBPortEventPost(EV_FRAME_RECEIVED);
+    // Connection events keep their bit set and are handled by the next server cycle
+    TickType_t xStartTick = xTaskGetTickCount();
+    TickType_t xTimeout = pdMS_TO_TICKS(MB_TCP_RESP_TIMEOUT_MS);
+    uint32_t ulBits = 0;
+    while (!(ulBits & MB_TCP_NOTIFY_RESP)) {
+        TickType_t xElapsed = xTaskGetTickCount() - xStartTick;
+        if ((xElapsed >= xTimeout) || !xTaskNotifyWait(0, MB_TCP_NOTIFY_RESP, &ulBits, xTimeout - xElapsed)) {
+            ESP_LOGD(TAG, "Response is ignored, time exceeds configured %d [ms].",
+                                                    (unsigned)MB_TCP_RESP_TIMEOUT_MS);
+            break;
+        }
+    }
+    pxClient->xSendTimeStamp = esp_timer_get_time();
+    ESP_LOGD(TAG, "Client %d, processing time = %" PRIu64 "(us).", pxClient->xIndex,
+                        (uint64_t)(pxClient->xSendTimeStamp - pxClient->xRecvTimeStamp));
+}
+
+// Consumes complete MBAP frames from the received pbuf chain, returns FALSE if the connection must be dropped
+static BOOL xMBTCPPortConsumeFrames(MbNetconnClient_t* pxClient)
+{
+    while (pxClient->pxRxChain && (pxClient->pxRxChain->tot_len >= MB_TCP_MBAP_SIZE)) {
+        struct pbuf* pxChain = pxClient->pxRxChain;
+        // Read the header fields straight from the pbufs, they may be split between segments
+        USHORT usPID = (USHORT)((pbuf_get_at(pxChain, MB_TCP_PID) << 8U) | pbuf_get_at(pxChain, MB_TCP_PID + 1));
+        USHORT usLen = (USHORT)((pbuf_get_at(pxChain, MB_TCP_LEN) << 8U) | pbuf_get_at(pxChain, MB_TCP_LEN + 1));
+        USHORT usFrameLen = MB_TCP_UID + usLen;
+        if ((usPID != 0) || (usLen < 2) || (usFrameLen > MB_TCP_BUF_SIZE)) {
+            ESP_LOGE(TAG, "Client %d, incorrect MBAP header (pid = %u, len = %u), drop connection.",
+                                pxClient->xIndex, (unsigned)usPID, (unsigned)usLen);
+            return FALSE;
+        }
+        if (pxChain->tot_len < usFrameLen) {
+            break; // wait for the rest of the frame
+        }
+        pxClient->usFrameLen = pbuf_copy_partial(pxChain, pxClient->pucFrame, usFrameLen, 0);
+        pxClient->pxRxChain = pbuf_free_header(pxChain, usFrameLen);
+        vMBTCPPortProcessFrame(pxClient);
+    }
+    return TRUE;
+}
+
+static BOOL xMBTCPPortRxPoll(MbNetconnClient_t* pxClient)
+{
+    struct pbuf* pxBuf = NULL;
+    err_t xErr = ERR_OK;
+    while ((xErr = netconn_recv_tcp_pbuf(pxClient->pxConn, &pxBuf)) == ERR_OK) {
+        if (pxClient->pxRxChain) {
+            pbuf_cat(pxClient->pxRxChain, pxBuf);
+        } else {
+            pxClient->pxRxChain = pxBuf;
+        }
+        if (!xMBTCPPortConsumeFrames(pxClient)) {
+            return FALSE;
+        }
+    }
+    if (xErr != ERR_WOULDBLOCK) {
+        ESP_LOGD(TAG, "Client %d (%s), connection closed, err = %d.", pxClient->xIndex, pxClient->cIpAddr, (int)xErr);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void vMBTCPPortServerTask(void *pvParameters)
+{
+    while (!xShutdown) {
+        if (!pxListenConn) {
+            pxListenConn = pxMBTCPPortListen();
+            if (!pxListenConn) {
+                vTaskDelay(pdMS_TO_TICKS(MB_TCP_IDLE_CHECK_MS));
+                continue;
+            }
+        }
+        (void)xTaskNotifyWait(0, MB_TCP_NOTIFY_NET, NULL, pdMS_TO_TICKS(MB_TCP_IDLE_CHECK_MS));
+        if (xShutdown) {
+            break;
+        }
+        vMBTCPPortAccept();
+        int64_t xTimeStamp = esp_timer_get_time();
+        for (int i = 0; i < MB_TCP_PORT_MAX_CONN; i++) {
+            MbNetconnClient_t* pxClient = pxClients[i];
+            if (!pxClient) {
+                continue;
+            }
+            if (!xMBTCPPortRxPoll(pxClient)) {
+                vMBTCPPortFreeClient(pxClient);
+            } else if ((xTimeStamp - pxClient->xRecvTimeStamp) > MB_TCP_DISCONNECT_TIMEOUT) {
+                ESP_LOGE(TAG, "Client %d do not answer for %" PRIu64 " (us). Drop connection...",
+                                        i, (uint64_t)(xTimeStamp - pxClient->xRecvTimeStamp));
+                vMBTCPPortFreeClient(pxClient);
+            }
+        }
+    }
+    if (xShutdownSemaphore) {
+        xSemaphoreGive(xShutdownSemaphore);
+    }
+    vTaskDelete(NULL);
+}
+
+/* ----------------------- Begin implementation -----------------------------*/
+BOOL
+xMBTCPPortInit( USHORT usTCPPort )
+{
+    xConfig.usPort = usTCPPort;
+    xConfig.eMbProto = MB_PROTO_TCP;
+    xConfig.usClientCount = 0;
+    xConfig.pvNetIface = NULL;
+    xConfig.xIpVer = MB_PORT_IPV4;
+    xConfig.pcBindAddr = NULL;
+    xShutdown = FALSE;
+
+    // Create task for packet processing
+    BaseType_t xErr = xTaskCreatePinnedToCore(vMBTCPPortServerTask,
+                                    "tcp_slave_task",
+                                    MB_TCP_STACK_SIZE,
+                                    NULL,
+                                    MB_TCP_TASK_PRIO,
+                                    &xServerTaskHandle,
+                                    MB_PORT_TASK_AFFINITY);
+    if (xErr != pdTRUE) {
+        ESP_LOGE(TAG, "Server task creation failure.");
+        return FALSE;
+    }
+    vTaskSuspend(xServerTaskHandle);
+    xConfig.xMbTcpTaskHandle = xServerTaskHandle;
+    ESP_LOGI(TAG, "Protocol stack initialized.");
+    return TRUE;
+}
+
+void vMBTCPPortSlaveSetNetOpt(void* pvNetIf, eMBPortIpVer xIpVersion, eMBPortProto xProto, CHAR* pcBindAddrStr)
+{
+    // Set network options
+    xConfig.pvNetIface = pvNetIf;
+    xConfig.eMbProto = xProto;
+    xConfig.xIpVer = xIpVersion;
+    xConfig.pcBindAddr = pcBindAddrStr;
+}
+
+void
+vMBTCPPortClose( )
+{
+    // Let the task leave its cycle so no netconn call is interrupted
+    xShutdownSemaphore = xSemaphoreCreateBinary();
+    xShutdown = TRUE;
+    vTaskResume(xServerTaskHandle);
+    xTaskNotify(xServerTaskHandle, MB_TCP_NOTIFY_NET, eSetBits);
+    if (xShutdownSemaphore == NULL ||
+        xSemaphoreTake(xShutdownSemaphore, 2*pdMS_TO_TICKS(CONFIG_FMB_MASTER_TIMEOUT_MS_RESPOND)) != pdTRUE) {
+        ESP_LOGE(TAG, "Task couldn't exit gracefully within timeout -> abruptly deleting the task");
+        vTaskDelete(xServerTaskHandle);
+    }
+    if (xShutdownSemaphore) {
+        vSemaphoreDelete(xShutdownSemaphore);
+        xShutdownSemaphore = NULL;
+    }
+    xServerTaskHandle = NULL;
+    vMBPortEventClose( );
+}
+
+void vMBTCPPortEnable( void )
+{
+    vTaskResume(xServerTaskHandle);
+}
+
+void
+vMBTCPPortDisable( void )
+{
+    vTaskSuspend(xServerTaskHandle);
+    for (int i = 0; i < MB_TCP_PORT_MAX_CONN; i++) {
+        vMBTCPPortFreeClient(pxClients[i]);
+    }
+    if (pxListenConn) {
+        netconn_close(pxListenConn);
+        netconn_delete(pxListenConn);
+        pxListenConn = NULL;
+    }
+}
+
+BOOL
+xMBTCPPortGetRequest( UCHAR ** ppucMBTCPFrame, USHORT * usTCPLength )
+{
+    BOOL xRet = FALSE;
+    if (pxCurClient) {
+        *ppucMBTCPFrame = &pxCurClient->pucFrame[0];
+        *usTCPLength = pxCurClient->usFrameLen;
+        xRet = TRUE;
+    }
+    return xRet;
+}
+
+BOOL
+xMBTCPPortSendResponse( UCHAR * pucMBTCPFrame, USHORT usTCPLength )
+{
+    BOOL bFrameSent = FALSE;
+    if (pxCurClient) {
+        // Apply TID field from request to the frame before send response
+        pucMBTCPFrame[MB_TCP_TID] = (UCHAR)(pxCurClient->usTidCnt >> 8U);
+        pucMBTCPFrame[MB_TCP_TID + 1] = (UCHAR)(pxCurClient->usTidCnt & 0xFF);
+        // The frame buffer is reused by the next request, so lwIP copies it into the segment
+        size_t xWritten = 0;
+        err_t xErr = netconn_write_partly(pxCurClient->pxConn, pucMBTCPFrame, usTCPLength,
+                                            NETCONN_COPY, &xWritten);
+        if ((xErr != ERR_OK) || (xWritten != usTCPLength)) {
+            ESP_LOGE(TAG, "Client %d, fail to send data, err = %d, sent %u of %u bytes.", pxCurClient->xIndex,
+                                (int)xErr, (unsigned)xWritten, (unsigned)usTCPLength);
+        } else {
+            bFrameSent = TRUE;
+        }
+    } else {
+        ESP_LOGD(TAG, "Port is not active. Release lock.");
+    }
+    // Release the server task waiting for the transaction to complete
+    xTaskNotify(xServerTaskHandle, MB_TCP_NOTIFY_RESP, eSetBits);
+    return bFrameSent;
+}
+
+#endif //#if MB_TCP_ENABLED && CONFIG_FMB_TCP_SLAVE_NETCONN